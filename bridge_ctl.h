@@ -15,6 +15,8 @@
 #include <net/if.h>
 #include <linux/if_ether.h>
 
+#include "epoll_loop.h"
+
 typedef struct
 {
     int if_index;
@@ -22,6 +24,12 @@ typedef struct
     char name[IFNAMSIZ];
 
     bool up;
+    struct hlist_node if_hash; /* anchor in the bridges hash by if_index */
+    /* Drives MSTP_IN_tick() while STP is enabled on the bridge */
+    struct epoll_timer tick_timer;
+    unsigned int tick_interval; /* ms, period the tick_timer is armed with */
+    /* anchor in the list of the bridges the current receive batch reached */
+    struct list_head rx_batch_list;
 } sysdep_br_data_t;
 
 typedef struct
@@ -31,7 +39,9 @@ typedef struct
     char name[IFNAMSIZ];
 
     bool up;
+    struct hlist_node if_hash; /* anchor in the ports hash by if_index */
     int speed, duplex;
+    __u64 rx_hash; /* packet_filter_hash() of the last received BPDU */
 } sysdep_if_data_t;
 
 #define GET_PORT_SPEED(port)    ((port)->sysdeps.speed)
@@ -71,7 +81,17 @@ int init_bridge_ops(void);
 int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags);
 
 void bridge_bpdu_rcv(int ifindex, const unsigned char *data, int len);
+void bridge_bpdu_rcv_batch_begin(void);
+void bridge_bpdu_rcv_batch_end(void);
+void bridge_bpdu_tx_error(int ifindex, int err, int sent, int len);
+
+typedef enum
+{
+    BPDU_TX_DEFERRED,  /* held back until the packet socket drains */
+    BPDU_TX_COALESCED, /* replaced a held back BPDU of the same port */
+    BPDU_TX_DROPPED,   /* backpressure queue full */
+} bpdu_tx_backlog_t;
 
-void bridge_one_second(void);
+void bridge_bpdu_tx_backlog(int ifindex, bpdu_tx_backlog_t ev);
 
 #endif /* BRIDGE_CTL_H */
@@ -24,12 +24,42 @@
 #include "mstp.h"
 #include "driver.h"
 #include "libnetlink.h"
+#include "bridge_track.h"
 
 #ifndef SYSFS_CLASS_NET
 #define SYSFS_CLASS_NET "/sys/class/net"
 #endif
 
 static LIST_HEAD(bridges);
+/* Bridges which received BPDUs of the current receive batch */
+static LIST_HEAD(rx_batch_bridges);
+static bool rx_batch;
+
+bool bridge_rx_fast_path = true;
+bool bridge_lazy_msti_ports = false;
+
+/* Bridges and ports hashed by if_index, so that a received BPDU or a control
+ * request finds its port without walking all the bridges */
+#define IF_HASH_SIZE    1024
+static struct hlist_head br_hash[IF_HASH_SIZE];
+static struct hlist_head if_hash[IF_HASH_SIZE];
+
+static inline struct hlist_head *if_hash_head(struct hlist_head *hash,
+                                              int if_index)
+{
+    return &hash[(unsigned int)if_index & (IF_HASH_SIZE - 1)];
+}
+
+static void bridge_tick(struct epoll_timer *t)
+{
+    bridge_t *br = t->arg;
+    unsigned int elapsed = br->sysdeps.tick_interval;
+
+    /* Changed tick interval takes effect from the next tick */
+    br->sysdeps.tick_interval = MSTP_IN_get_tick_interval(br);
+    epoll_timer_rearm(t, br->sysdeps.tick_interval);
+    MSTP_IN_tick(br, elapsed);
+}
 
 static bridge_t * create_br(int if_index)
 {
@@ -38,6 +68,8 @@ static bridge_t * create_br(int if_index)
 
     /* Init system dependent info */
     br->sysdeps.if_index = if_index;
+    epoll_timer_init(&br->sysdeps.tick_timer, bridge_tick, br);
+    INIT_LIST_HEAD(&br->sysdeps.rx_batch_list);
     if (!index_to_name(if_index, br->sysdeps.name))
         goto err;
     if (get_hwaddr(br->sysdeps.name, br->sysdeps.macaddr))
@@ -49,8 +81,13 @@ static bridge_t * create_br(int if_index)
     INFO("Add bridge %s", br->sysdeps.name);
     if(!MSTP_IN_bridge_create(br, br->sysdeps.macaddr))
         goto err;
+    br->rx_suppress = packet_filter_suppressing();
+    br->rx_fast_path = bridge_rx_fast_path;
+    br->lazy_msti_ports = bridge_lazy_msti_ports;
 
     list_add_tail(&br->list, &bridges);
+    hlist_add_head(&br->sysdeps.if_hash,
+                   if_hash_head(br_hash, br->sysdeps.if_index));
     return br;
 err:
     free(br);
@@ -60,7 +97,9 @@ err:
 static bridge_t * find_br(int if_index)
 {
     bridge_t *br;
-    list_for_each_entry(br, &bridges, list)
+    struct hlist_node *n;
+    hlist_for_each_entry(br, n, if_hash_head(br_hash, if_index),
+                         sysdeps.if_hash)
     {
         if(br->sysdeps.if_index == if_index)
             return br;
@@ -99,6 +138,8 @@ static port_t * create_if(bridge_t * br, int if_index)
         goto err;
     if(!MSTP_IN_port_create_and_add_tail(prt, portno))
         goto err;
+    hlist_add_head(&prt->sysdeps.if_hash, if_hash_head(if_hash, if_index));
+    packet_filter_add_if(if_index);
 
     return prt;
 err:
@@ -106,10 +147,13 @@ err:
     return NULL;
 }
 
-static port_t * find_if(bridge_t * br, int if_index)
+/* Find the port in any bridge */
+static port_t *find_port(int if_index)
 {
     port_t *prt;
-    list_for_each_entry(prt, &br->ports, br_list)
+    struct hlist_node *n;
+    hlist_for_each_entry(prt, n, if_hash_head(if_hash, if_index),
+                         sysdeps.if_hash)
     {
         if(prt->sysdeps.if_index == if_index)
             return prt;
@@ -117,48 +161,44 @@ static port_t * find_if(bridge_t * br, int if_index)
     return NULL;
 }
 
+static port_t * find_if(bridge_t * br, int if_index)
+{
+    port_t *prt = find_port(if_index);
+    return (prt && prt->bridge == br) ? prt : NULL;
+}
+
 static inline void delete_if(port_t *prt)
 {
     INFO("Del iface %s", prt->sysdeps.name);
+    hlist_del(&prt->sysdeps.if_hash);
+    packet_filter_del_if(prt->sysdeps.if_index);
     driver_delete_port(prt);
     MSTP_IN_delete_port(prt);
     free(prt);
 }
 
-static inline bool delete_if_byindex(bridge_t * br, int if_index)
-{
-    port_t *prt;
-    if(!(prt = find_if(br, if_index)))
-        return false;
-    delete_if(prt);
-    return true;
-}
-
 static bool delete_br_byindex(int if_index)
 {
     bridge_t *br;
+    port_t *prt;
     if(!(br = find_br(if_index)))
         return false;
 
     INFO("Delete bridge %s (%d)", br->sysdeps.name, if_index);
 
     list_del(&br->list);
+    hlist_del(&br->sysdeps.if_hash);
+    list_del(&br->sysdeps.rx_batch_list);
+    /* Ports are freed by MSTP_IN_delete_bridge() */
+    list_for_each_entry(prt, &br->ports, br_list)
+        hlist_del(&prt->sysdeps.if_hash);
+    epoll_timer_cancel(&br->sysdeps.tick_timer);
     driver_delete_bridge(br);
     MSTP_IN_delete_bridge(br);
     free(br);
     return true;
 }
 
-void bridge_one_second(void)
-{
-    bridge_t *br;
-    list_for_each_entry(br, &bridges, list)
-    {
-        if(br->stp_enabled)
-            MSTP_IN_one_second(br);
-    }
-}
-
 /* New MAC address is stored in addr, which also holds the old value on entry.
    Return true if the address changed */
 static bool check_mac_address(char *name, __u8 *addr)
@@ -262,7 +302,7 @@ static void set_if_up(port_t *prt, bool up)
 int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
 {
     port_t *prt;
-    bridge_t *br = NULL, *other_br;
+    bridge_t *br = NULL;
     bool up = !!(flags & IFF_UP);
     bool running = up && (flags & IFF_RUNNING);
 
@@ -297,16 +337,12 @@ int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
                 return -1;
             }
             /* Check if this interface is slave of another bridge */
-            list_for_each_entry(other_br, &bridges, list)
+            if((prt = find_port(if_index)))
             {
-                if(other_br != br)
-                    if(delete_if_byindex(other_br, if_index))
-                    {
-                        INFO("Device %d has come to bridge %d. "
-                             "Missed notify for deletion from bridge %d",
-                             if_index, br_index, other_br->sysdeps.if_index);
-                        break;
-                    }
+                INFO("Device %d has come to bridge %d. "
+                     "Missed notify for deletion from bridge %d",
+                     if_index, br_index, prt->bridge->sysdeps.if_index);
+                delete_if(prt);
             }
             prt = create_if(br, if_index);
         }
@@ -329,12 +365,8 @@ int bridge_notify(int br_index, int if_index, bool newlink, unsigned flags)
         {
             /* DELLINK not from bridge means interface unregistered. */
             /* Cleanup removed bridge or removed bridge slave */
-            if(!delete_br_byindex(if_index))
-                list_for_each_entry(br, &bridges, list)
-                {
-                    if(delete_if_byindex(br, if_index))
-                        break;
-                }
+            if(!delete_br_byindex(if_index) && (prt = find_port(if_index)))
+                delete_if(prt);
             return 0;
         }
         else
@@ -381,22 +413,14 @@ static const __u8 bridge_group_address[ETH_ALEN] =
 
 void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len)
 {
-    port_t *prt = NULL;
+    port_t *prt;
     bridge_t *br;
 
     LOG("ifindex %d, len %d", if_index, len);
 
-    list_for_each_entry(br, &bridges, list)
-    {
-        if((prt = find_if(br, if_index)))
-            break;
-    }
-    if(!prt)
+    if(!(prt = find_port(if_index)))
         return;
-
-    /* sanity checks */
-    TSTM(br == prt->bridge,, "Bridge mismatch. This bridge is '%s' but port "
-        "'%s' belongs to bridge '%s'", br->sysdeps.name, prt->sysdeps.name, prt->bridge->sysdeps.name);
+    br = prt->bridge;
 
     if(!prt->sysdeps.up)
     {
@@ -404,6 +428,16 @@ void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len)
         return;
     }
 
+    /* Per-port rate limit, before any work is spent on the BPDU */
+    if(!MSTP_IN_rx_bpdu_admit(prt))
+        return;
+
+    if(rx_batch && list_empty(&br->sysdeps.rx_batch_list))
+    {
+        MSTP_IN_rx_batch_begin(br);
+        list_add_tail(&br->sysdeps.rx_batch_list, &rx_batch_bridges);
+    }
+
     /* Validate Ethernet and LLC header,
      * maybe we can skip this check thanks to Berkeley filter in packet socket?
      */
@@ -421,11 +455,83 @@ void bridge_bpdu_rcv(int if_index, const unsigned char *data, int len)
     TST(l <= ETH_DATA_LEN && l <= len - ETH_HLEN && l >= LLC_PDU_LEN_U, );
     TST(h->d_sap == LLC_SAP_BSPAN && h->s_sap == LLC_SAP_BSPAN && (h->llc_ctrl & 0x3) == LLC_PDU_TYPE_U,);
 
+    /* The hash the filter drops repeats by, see MSTP_OUT_set_rx_suppress() */
+    if(br->rx_suppress)
+        prt->sysdeps.rx_hash = packet_filter_hash(data + sizeof(*h), l);
+
     MSTP_IN_rx_bpdu(prt,
                     /* Don't include LLC header */
                     (bpdu_t *)(data + sizeof(*h)), l - LLC_PDU_LEN_U);
 }
 
+/* Report a BPDU which the packet layer failed to send on the port.
+ * err is the errno of the failed send, or 0 for a short write.
+ */
+void bridge_bpdu_tx_error(int if_index, int err, int sent, int len)
+{
+    port_t *prt = find_port(if_index);
+
+    if(!prt)
+    {
+        ERROR("ifindex %d: BPDU send failed: %s", if_index,
+              err ? strerror(err) : "short write");
+        return;
+    }
+
+    if(err)
+        ERROR_PRTNAME(prt, "BPDU send failed: %s", strerror(err));
+    else
+        ERROR_PRTNAME(prt, "short write of BPDU: %d instead of %d", sent, len);
+}
+
+/* Account a BPDU which met a full packet socket */
+void bridge_bpdu_tx_backlog(int if_index, bpdu_tx_backlog_t ev)
+{
+    port_t *prt = find_port(if_index);
+
+    if(!prt)
+        return;
+
+    switch(ev)
+    {
+        case BPDU_TX_DEFERRED:
+            ++(prt->num_tx_deferred);
+            LOG_PRTNAME(prt, "BPDU deferred, socket buffer full");
+            break;
+        case BPDU_TX_COALESCED:
+            ++(prt->num_tx_coalesced);
+            LOG_PRTNAME(prt, "deferred BPDU replaced by newer one");
+            break;
+        case BPDU_TX_DROPPED:
+            ++(prt->num_tx_dropped);
+            INFO_PRTNAME(prt, "BPDU dropped, transmit backlog full");
+            break;
+    }
+}
+
+/* Received BPDUs between these two calls are delivered to the ports as they
+ * come, but the state machines of each bridge are run only once at the end.
+ * Only the bridges which received a BPDU of the batch are visited, see
+ * bridge_bpdu_rcv().
+ */
+void bridge_bpdu_rcv_batch_begin(void)
+{
+    rx_batch = true;
+}
+
+void bridge_bpdu_rcv_batch_end(void)
+{
+    bridge_t *br;
+
+    rx_batch = false;
+    while(!list_empty(&rx_batch_bridges))
+    {
+        br = list_entry(rx_batch_bridges.next, bridge_t, sysdeps.rx_batch_list);
+        list_del_init(&br->sysdeps.rx_batch_list);
+        MSTP_IN_rx_batch_end(br);
+    }
+}
+
 static int br_set_state(struct rtnl_handle *rth, unsigned ifindex, __u8 state)
 {
     struct
@@ -636,6 +742,24 @@ void MSTP_OUT_shutdown_port(port_t *prt)
         ERROR_PRTNAME(prt, "Couldn't shutdown port");
 }
 
+void MSTP_OUT_set_rx_suppress(port_t *prt, bool suppress)
+{
+    LOG_PRTNAME(prt, "%s suppression of repeated BPDUs",
+                suppress ? "Start" : "Stop");
+    packet_filter_set_suppress(prt->sysdeps.if_index, prt->sysdeps.rx_hash,
+                               suppress);
+}
+
+bool MSTP_OUT_get_rx_last_seen(port_t *prt, unsigned int *age_ms)
+{
+    return 0 == packet_filter_last_seen(prt->sysdeps.if_index, age_ms);
+}
+
+unsigned int MSTP_OUT_get_time_ms(void)
+{
+    return epoll_now_ms();
+}
+
 /* User interface commands */
 
 #define CTL_CHECK_BRIDGE                                       \
@@ -657,37 +781,23 @@ void MSTP_OUT_shutdown_port(port_t *prt)
 
 #define CTL_CHECK_BRIDGE_TREE                                      \
     CTL_CHECK_BRIDGE;                                              \
-    tree_t *tree;                                                  \
-    bool found = false;                                            \
-    __be16 MSTID = __cpu_to_be16(mstid);                           \
-    list_for_each_entry(tree, &br->trees, bridge_list)             \
-        if(tree->MSTID == MSTID)                                   \
-        {                                                          \
-            found = true;                                          \
-            break;                                                 \
-        }                                                          \
-    if(!found)                                                     \
+    tree_t *tree = find_tree(br, mstid);                           \
+    if(NULL == tree)                                               \
     {                                                              \
         ERROR_BRNAME(br, "Couldn't find MSTI with ID %hu", mstid); \
         return -1;                                                 \
     }
 
+/* ptp is NULL if the port has no state in the sparse tree */
 #define CTL_CHECK_BRIDGE_PERTREEPORT                                     \
     CTL_CHECK_BRIDGE_PORT;                                               \
-    per_tree_port_t *ptp;                                                \
-    bool found = false;                                                  \
-    __be16 MSTID = __cpu_to_be16(mstid);                                 \
-    list_for_each_entry(ptp, &prt->trees, port_list)                     \
-        if(ptp->MSTID == MSTID)                                          \
-        {                                                                \
-            found = true;                                                \
-            break;                                                       \
-        }                                                                \
-    if(!found)                                                           \
+    tree_t *tree = find_tree(br, mstid);                                 \
+    if(NULL == tree)                                                     \
     {                                                                    \
         ERROR_PRTNAME(prt, "Couldn't find MSTI with ID %hu", mstid);     \
         return -1;                                                       \
-    }
+    }                                                                    \
+    per_tree_port_t *ptp = find_ptp(prt, mstid);
 
 int CTL_get_cist_bridge_status(int br_index, CIST_BridgeStatus *status,
                                char *root_port_name)
@@ -753,7 +863,10 @@ int CTL_get_msti_port_status(int br_index, int port_index, __u16 mstid,
                              MSTI_PortStatus *status)
 {
     CTL_CHECK_BRIDGE_PERTREEPORT;
-    MSTP_IN_get_msti_port_status(ptp, status);
+    if(ptp)
+        MSTP_IN_get_msti_port_status(ptp, status);
+    else
+        MSTP_IN_get_absent_msti_port_status(prt, tree, status);
     return 0;
 }
 
@@ -768,6 +881,8 @@ int CTL_set_msti_port_config(int br_index, int port_index, __u16 mstid,
                              MSTI_PortConfig *cfg)
 {
     CTL_CHECK_BRIDGE_PERTREEPORT;
+    if(!ptp && !(ptp = MSTP_IN_add_msti_port(prt, tree)))
+        return -1;
     return MSTP_IN_set_msti_port_config(ptp, cfg);
 }
 
@@ -784,6 +899,11 @@ int CTL_set_debug_level(int level)
     return 0;
 }
 
+int CTL_get_packet_filter_stats(packet_filter_stats_t *stats)
+{
+    return packet_filter_get_stats(stats);
+}
+
 int CTL_get_mstilist(int br_index, int *num_mstis, __u16 *mstids)
 {
     CTL_CHECK_BRIDGE;
@@ -823,16 +943,14 @@ int CTL_set_mstconfid(int br_index, __u16 revision, __u8 *name)
 int CTL_get_vids2fids(int br_index, __u16 *vids2fids)
 {
     CTL_CHECK_BRIDGE;
-    memcpy(vids2fids, br->vid2fid, sizeof(br->vid2fid));
+    MSTP_IN_get_all_vids2fids(br, vids2fids);
     return 0;
 }
 
 int CTL_get_fids2mstids(int br_index, __u16 *fids2mstids)
 {
     CTL_CHECK_BRIDGE;
-    int i;
-    for(i = 0; i < COUNT_OF(br->fid2mstid); ++i)
-        fids2mstids[i] = __be16_to_cpu(br->fid2mstid[i]);
+    MSTP_IN_get_all_fids2mstids(br, fids2mstids);
     return 0;
 }
 
@@ -860,6 +978,19 @@ int CTL_set_fids2mstids(int br_index, __u16 *fids2mstids)
     return MSTP_IN_set_all_fids2mstids(br, fids2mstids) ? 0 : -1;
 }
 
+int CTL_begin_vlan_map(int br_index)
+{
+    CTL_CHECK_BRIDGE;
+    return MSTP_IN_begin_vlan_map(br) ? 0 : -1;
+}
+
+int CTL_commit_vlan_map(int br_index)
+{
+    CTL_CHECK_BRIDGE;
+    MSTP_IN_commit_vlan_map(br);
+    return 0;
+}
+
 int CTL_add_bridges(int *br_array)
 {
     int i, brcount = br_array[0];
@@ -883,6 +1014,8 @@ int CTL_add_bridges(int *br_array)
 
         br->stp_enabled = true;
         INFO("Enable STP on bridge %s", br->sysdeps.name);
+        br->sysdeps.tick_interval = MSTP_IN_get_tick_interval(br);
+        epoll_timer_arm(&br->sysdeps.tick_timer, br->sysdeps.tick_interval);
 
         /* Enable the bridge directly - sysdeps.up may already be set
          * from monitoring, so set_br_up would not detect a change */
@@ -918,6 +1051,7 @@ int CTL_del_bridges(int *br_array)
             /* Disable the bridge */
             MSTP_IN_set_bridge_enable(br, false);
             br->stp_enabled = false;
+            epoll_timer_cancel(&br->sysdeps.tick_timer);
         }
     }
 
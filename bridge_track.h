@@ -5,4 +5,9 @@
 
 int bridge_track_fini(void);
 
+/* Process repeated BPDUs without running the state machines when proven
+ * safe, see bridge_t.rx_fast_path */
+extern bool bridge_rx_fast_path;
+extern bool bridge_lazy_msti_ports;
+
 #endif
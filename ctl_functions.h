@@ -18,6 +18,7 @@
 #include <asm/byteorder.h>
 
 #include "mstp.h"
+#include "packet.h"
 
 struct ctl_msg_hdr
 {
@@ -445,6 +446,51 @@ CTL_DECLARE(add_bridges);
 #define del_bridges_ARGS (int *br_array)
 CTL_DECLARE(del_bridges);
 
+/* get_packet_filter_stats */
+#define CMD_CODE_get_packet_filter_stats    124
+#define get_packet_filter_stats_ARGS (packet_filter_stats_t *stats)
+struct get_packet_filter_stats_IN
+{
+};
+struct get_packet_filter_stats_OUT
+{
+    packet_filter_stats_t stats;
+};
+#define get_packet_filter_stats_COPY_IN  ({ (void)0; })
+#define get_packet_filter_stats_COPY_OUT ({ *stats = out->stats; })
+#define get_packet_filter_stats_CALL (&out->stats)
+CTL_DECLARE(get_packet_filter_stats);
+
+/* begin_vlan_map */
+#define CMD_CODE_begin_vlan_map 125
+#define begin_vlan_map_ARGS (int br_index)
+struct begin_vlan_map_IN
+{
+    int br_index;
+};
+struct begin_vlan_map_OUT
+{
+};
+#define begin_vlan_map_COPY_IN  ({ in->br_index = br_index; })
+#define begin_vlan_map_COPY_OUT ({ (void)0; })
+#define begin_vlan_map_CALL (in->br_index)
+CTL_DECLARE(begin_vlan_map);
+
+/* commit_vlan_map */
+#define CMD_CODE_commit_vlan_map    126
+#define commit_vlan_map_ARGS (int br_index)
+struct commit_vlan_map_IN
+{
+    int br_index;
+};
+struct commit_vlan_map_OUT
+{
+};
+#define commit_vlan_map_COPY_IN  ({ in->br_index = br_index; })
+#define commit_vlan_map_COPY_OUT ({ (void)0; })
+#define commit_vlan_map_CALL (in->br_index)
+CTL_DECLARE(commit_vlan_map);
+
 /* General case part in ctl command server switch */
 #define SERVER_MESSAGE_CASE(name)                            \
     case CMD_CODE_ ## name : do                              \
@@ -116,6 +116,9 @@ typedef enum {
     PARAM_TOPCHNGTIME,
     PARAM_TOPCHNGCNT,
     PARAM_TOPCHNGSTATE,
+    PARAM_BRFWDDELAYMS,
+    PARAM_TICKINTERVAL,
+    PARAM_VLANMAPTXN,
     /* port params */
     PARAM_ROLE,
     PARAM_STATE,
@@ -157,6 +160,16 @@ typedef enum {
     PARAM_SENDRSTP,
     PARAM_RCVDTCACK,
     PARAM_RCVDTCN,
+    PARAM_PORTHELLOTIMEMS,
+    PARAM_NUMTXDEFERRED,
+    PARAM_NUMTXCOALESCED,
+    PARAM_NUMTXDROPPED,
+    PARAM_BPDURXRATE,
+    PARAM_BPDURXBURST,
+    PARAM_BPDURXPOLICY,
+    PARAM_BPDURXRATEERROR,
+    PARAM_NUMRXRATELIMITED,
+    PARAM_NUMRXUNKNOWNMSTI,
     /* Not standard */
     PARAM_STPENABLED,
 } param_id_t;
@@ -187,6 +200,9 @@ static const cmd_param_t cist_bridge_params[] = {
     { PARAM_TOPCHNGTIME,  "time-since-topology-change" },
     { PARAM_TOPCHNGCNT,   "topology-change-count" },
     { PARAM_TOPCHNGSTATE, "topology-change" },
+    { PARAM_BRFWDDELAYMS, "bridge-forward-delay-ms" },
+    { PARAM_TICKINTERVAL, "tick-interval" },
+    { PARAM_VLANMAPTXN,   "vlan-map-transaction" },
 };
 
 static int do_showbridge_fmt_plain(const CIST_BridgeStatus *s,
@@ -223,6 +239,8 @@ static int do_showbridge_fmt_plain(const CIST_BridgeStatus *s,
             printf("max hops             %hhu\n", s->max_hops);
             printf("  hello time    %-10u ", s->bridge_hello_time);
             printf("ageing time          %u\n", s->Ageing_Time);
+            printf("  tick interval %-10u ", s->tick_interval);
+            printf("bridge fwd delay ms  %u\n", s->bridge_forward_delay_ms);
             printf("  force protocol version     %s\n",
                    PROTO_VERS_STR(s->protocol_version));
             printf("  time since topology change %u\n",
@@ -235,6 +253,11 @@ static int do_showbridge_fmt_plain(const CIST_BridgeStatus *s,
                    s->topology_change_port);
             printf("  last topology change port  %s\n",
                    s->last_topology_change_port);
+            printf("  vlan map transaction       ");
+            if(s->vlan_map_txn)
+                printf("open for %u s\n", s->vlan_map_txn_time);
+            else
+                printf("none\n");
             break;
         case PARAM_STPENABLED:
             printf("%s\n", BOOL_STR(s->stp_enabled));
@@ -299,6 +322,18 @@ static int do_showbridge_fmt_plain(const CIST_BridgeStatus *s,
         case PARAM_TOPCHNGSTATE:
             printf("%s\n", BOOL_STR(s->topology_change));
             break;
+        case PARAM_BRFWDDELAYMS:
+            printf("%u\n", s->bridge_forward_delay_ms);
+            break;
+        case PARAM_TICKINTERVAL:
+            printf("%u\n", s->tick_interval);
+            break;
+        case PARAM_VLANMAPTXN:
+            if(s->vlan_map_txn)
+                printf("%u\n", s->vlan_map_txn_time);
+            else
+                printf("none\n");
+            break;
         default:
             return -2; /* -2 = unknown param */
     }
@@ -346,6 +381,9 @@ static int do_showbridge_fmt_json(const CIST_BridgeStatus *s,
             printf("\"hello-time\":\"%u\",",
                    s->bridge_hello_time);
             printf("\"ageing-time\":\"%u\",", s->Ageing_Time);
+            printf("\"tick-interval\":\"%u\",", s->tick_interval);
+            printf("\"bridge-forward-delay-ms\":\"%u\",",
+                   s->bridge_forward_delay_ms);
             printf("\"force-protocol-version\":\"%s\",",
                    PROTO_VERS_STR(s->protocol_version));
             printf("\"time-since-topology-change\":\"%u\",",
@@ -356,8 +394,13 @@ static int do_showbridge_fmt_json(const CIST_BridgeStatus *s,
                    BOOL_STR(s->topology_change));
             printf("\"topology-change-port\":\"%s\",",
                    s->topology_change_port);
-            printf("\"last-topology-change-port\":\"%s\"",
+            printf("\"last-topology-change-port\":\"%s\",",
                    s->last_topology_change_port);
+            if(s->vlan_map_txn)
+                printf("\"vlan-map-transaction\":\"%u\"",
+                       s->vlan_map_txn_time);
+            else
+                printf("\"vlan-map-transaction\":\"none\"");
             printf("}");
             break;
         case PARAM_STPENABLED:
@@ -380,6 +423,9 @@ static int do_showbridge_fmt_json(const CIST_BridgeStatus *s,
         case PARAM_TOPCHNGTIME:
         case PARAM_TOPCHNGCNT:
         case PARAM_TOPCHNGSTATE:
+        case PARAM_BRFWDDELAYMS:
+        case PARAM_TICKINTERVAL:
+        case PARAM_VLANMAPTXN:
             /* Output individual parameters for the JSON
                format as plain text in quotes */
             printf("\"");
@@ -639,6 +685,19 @@ static int cmd_showtree(int argc, char *const *argv)
         _str;                                        \
     })
 
+#define RX_POLICY_STR(_policy)                                  \
+    ({                                                          \
+        rx_limit_policy_t _p = _policy;                         \
+        char *_str = "unkn";                                    \
+        switch(_p)                                              \
+        {                                                       \
+            case rxLimitDrop:       _str = "drop"; break;       \
+            case rxLimitErrdisable: _str = "errdisable"; break; \
+            case rxLimitAlert:      _str = "alert"; break;      \
+        }                                                       \
+        _str;                                                   \
+    })
+
 #define ROLE_STR(_role)                                     \
     ({                                                      \
         port_role_t _r = _role;                             \
@@ -695,6 +754,7 @@ static const cmd_param_t cist_port_params[] = {
     { PARAM_RESTRROLE,      "restricted-role" },
     { PARAM_RESTRTCN,       "restricted-TCN" },
     { PARAM_PORTHELLOTIME,  "port-hello-time" },
+    { PARAM_PORTHELLOTIMEMS,"port-hello-time-ms" },
     { PARAM_DISPUTED,       "disputed" },
     { PARAM_BPDUGUARDPORT,  "bpdu-guard-port" },
     { PARAM_BPDUGUARDERROR, "bpdu-guard-error" },
@@ -708,6 +768,15 @@ static const cmd_param_t cist_port_params[] = {
     { PARAM_NUMTRANSFWD,    "num-transition-fwd" },
     { PARAM_NUMTRANSBLK,    "num-transition-blk" },
     { PARAM_NUMBPDUFILTERED,"num-rx-bpdu-filtered" },
+    { PARAM_NUMTXDEFERRED,  "num-tx-deferred" },
+    { PARAM_NUMTXCOALESCED, "num-tx-coalesced" },
+    { PARAM_NUMTXDROPPED,   "num-tx-dropped" },
+    { PARAM_BPDURXRATE,     "bpdu-rx-rate" },
+    { PARAM_BPDURXBURST,    "bpdu-rx-burst" },
+    { PARAM_BPDURXPOLICY,   "bpdu-rx-policy" },
+    { PARAM_BPDURXRATEERROR,"bpdu-rx-rate-error" },
+    { PARAM_NUMRXRATELIMITED,"num-rx-rate-limited" },
+    { PARAM_NUMRXUNKNOWNMSTI,"num-rx-unknown-msti" },
     { PARAM_RCVDBPDU,       "received-bpdu" },
     { PARAM_RCVDSTP,        "received-stp" },
     { PARAM_RCVDRSTP,       "received-rstp" },
@@ -770,6 +839,7 @@ static int do_showport_fmt_plain(const CIST_PortStatus *s,
                        BOOL_STR(s->restricted_tcn));
                 printf("  port hello time    %-23hhu ", s->port_hello_time);
                 printf("disputed             %s\n", BOOL_STR(s->disputed));
+                printf("  port hello time ms %-23u\n", s->port_hello_time_ms);
                 printf("  bpdu guard port    %-23s ",
                        BOOL_STR(s->bpdu_guard_port));
                 printf("bpdu guard error     %s\n",
@@ -787,6 +857,17 @@ static int do_showport_fmt_plain(const CIST_PortStatus *s,
                 printf("Num RX TCN           %u\n", s->num_rx_tcn);
                 printf("  Num Transition FWD %-23u ", s->num_trans_fwd);
                 printf("Num Transition BLK   %u\n", s->num_trans_blk);
+                printf("  Num TX Deferred    %-23u ", s->num_tx_deferred);
+                printf("Num TX Coalesced     %u\n", s->num_tx_coalesced);
+                printf("  Num TX Dropped     %-23u ", s->num_tx_dropped);
+                printf("Num RX Rate Limited  %u\n", s->num_rx_rate_limited);
+                printf("  bpdu rx rate       %-23u ", s->bpdu_rx_rate);
+                printf("bpdu rx burst        %u\n", s->bpdu_rx_burst);
+                printf("  bpdu rx policy     %-23s ",
+                       RX_POLICY_STR(s->bpdu_rx_policy));
+                printf("bpdu rx rate error   %s\n",
+                       BOOL_STR(s->bpdu_rx_rate_error));
+                printf("  Num RX Unknown MSTI %u\n", s->num_rx_unknown_msti);
                 printf("  Rcvd BPDU          %-23s ", BOOL_STR(s->rcvdBpdu));
                 printf("Rcvd STP             %s\n", BOOL_STR(s->rcvdSTP));
                 printf("  Rcvd RSTP          %-23s ", BOOL_STR(s->rcvdRSTP));
@@ -878,6 +959,9 @@ static int do_showport_fmt_plain(const CIST_PortStatus *s,
         case PARAM_PORTHELLOTIME:
             printf("%hhu\n", s->port_hello_time);
             break;
+        case PARAM_PORTHELLOTIMEMS:
+            printf("%u\n", s->port_hello_time_ms);
+            break;
         case PARAM_DISPUTED:
             printf("%s\n", BOOL_STR(s->disputed));
             break;
@@ -917,6 +1001,33 @@ static int do_showport_fmt_plain(const CIST_PortStatus *s,
         case PARAM_NUMBPDUFILTERED:
             printf("%u\n", s->num_rx_bpdu_filtered);
             break;
+        case PARAM_NUMTXDEFERRED:
+            printf("%u\n", s->num_tx_deferred);
+            break;
+        case PARAM_NUMTXCOALESCED:
+            printf("%u\n", s->num_tx_coalesced);
+            break;
+        case PARAM_NUMTXDROPPED:
+            printf("%u\n", s->num_tx_dropped);
+            break;
+        case PARAM_BPDURXRATE:
+            printf("%u\n", s->bpdu_rx_rate);
+            break;
+        case PARAM_BPDURXBURST:
+            printf("%u\n", s->bpdu_rx_burst);
+            break;
+        case PARAM_BPDURXPOLICY:
+            printf("%s\n", RX_POLICY_STR(s->bpdu_rx_policy));
+            break;
+        case PARAM_BPDURXRATEERROR:
+            printf("%s\n", BOOL_STR(s->bpdu_rx_rate_error));
+            break;
+        case PARAM_NUMRXRATELIMITED:
+            printf("%u\n", s->num_rx_rate_limited);
+            break;
+        case PARAM_NUMRXUNKNOWNMSTI:
+            printf("%u\n", s->num_rx_unknown_msti);
+            break;
         case PARAM_RCVDBPDU:
             printf("%s\n", BOOL_STR(s->rcvdBpdu));
             break;
@@ -998,6 +1109,8 @@ static int do_showport_fmt_json(const CIST_PortStatus *s,
                        BOOL_STR(s->restricted_tcn));
                 printf("\"port-hello-time\":\"%hhu\",",
                        s->port_hello_time);
+                printf("\"port-hello-time-ms\":\"%u\",",
+                       s->port_hello_time_ms);
                 printf("\"disputed\":\"%s\",",
                        BOOL_STR(s->disputed));
                 printf("\"bpdu-guard-port\":\"%s\",",
@@ -1020,6 +1133,20 @@ static int do_showport_fmt_json(const CIST_PortStatus *s,
                        s->num_trans_fwd);
                 printf("\"num-transition-blk\":\"%u\",",
                        s->num_trans_blk);
+                printf("\"num-tx-deferred\":\"%u\",", s->num_tx_deferred);
+                printf("\"num-tx-coalesced\":\"%u\",",
+                       s->num_tx_coalesced);
+                printf("\"num-tx-dropped\":\"%u\",", s->num_tx_dropped);
+                printf("\"bpdu-rx-rate\":\"%u\",", s->bpdu_rx_rate);
+                printf("\"bpdu-rx-burst\":\"%u\",", s->bpdu_rx_burst);
+                printf("\"bpdu-rx-policy\":\"%s\",",
+                       RX_POLICY_STR(s->bpdu_rx_policy));
+                printf("\"bpdu-rx-rate-error\":\"%s\",",
+                       BOOL_STR(s->bpdu_rx_rate_error));
+                printf("\"num-rx-rate-limited\":\"%u\",",
+                       s->num_rx_rate_limited);
+                printf("\"num-rx-unknown-msti\":\"%u\",",
+                       s->num_rx_unknown_msti);
                 printf("\"received-bpdu\":\"%s\",",
                        BOOL_STR(s->rcvdBpdu));
                 printf("\"received-stp\":\"%s\",",
@@ -1085,6 +1212,7 @@ static int do_showport_fmt_json(const CIST_PortStatus *s,
         case PARAM_RESTRROLE:
         case PARAM_RESTRTCN:
         case PARAM_PORTHELLOTIME:
+        case PARAM_PORTHELLOTIMEMS:
         case PARAM_DISPUTED:
         case PARAM_BPDUGUARDPORT:
         case PARAM_BPDUGUARDERROR:
@@ -1097,6 +1225,15 @@ static int do_showport_fmt_json(const CIST_PortStatus *s,
         case PARAM_NUMTRANSFWD:
         case PARAM_NUMTRANSBLK:
         case PARAM_NUMBPDUFILTERED:
+        case PARAM_NUMTXDEFERRED:
+        case PARAM_NUMTXCOALESCED:
+        case PARAM_NUMTXDROPPED:
+        case PARAM_BPDURXRATE:
+        case PARAM_BPDURXBURST:
+        case PARAM_BPDURXPOLICY:
+        case PARAM_BPDURXRATEERROR:
+        case PARAM_NUMRXRATELIMITED:
+        case PARAM_NUMRXUNKNOWNMSTI:
         case PARAM_RCVDBPDU:
         case PARAM_RCVDSTP:
         case PARAM_RCVDRSTP:
@@ -1531,6 +1668,14 @@ static int cmd_setbridgefdelay(int argc, char *const *argv)
     return set_bridge_cfg(bridge_forward_delay, forward_delay);
 }
 
+static int cmd_setbridgefdelayms(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    return set_bridge_cfg(bridge_forward_delay_ms, getuint(argv[2]));
+}
+
 static int cmd_setbridgemaxhops(int argc, char *const *argv)
 {
     int br_index = get_index(argv[1], "bridge");
@@ -1694,6 +1839,52 @@ static int cmd_setportdonttxmt(int argc, char *const *argv)
     return set_port_cfg(dont_txmt, getyesno(argv[3], "yes", "no"));
 }
 
+static int cmd_setporthelloms(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    int port_index = get_index(argv[2], "port");
+    if(0 > port_index)
+        return port_index;
+    return set_port_cfg(port_hello_time_ms, getuint(argv[3]));
+}
+
+static int cmd_setportbpdurxrate(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    int port_index = get_index(argv[2], "port");
+    if(0 > port_index)
+        return port_index;
+    return set_port_cfg(bpdu_rx_rate, getuint(argv[3]));
+}
+
+static int cmd_setportbpdurxburst(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    int port_index = get_index(argv[2], "port");
+    if(0 > port_index)
+        return port_index;
+    return set_port_cfg(bpdu_rx_burst, getuint(argv[3]));
+}
+
+static int cmd_setportbpdurxpolicy(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    int port_index = get_index(argv[2], "port");
+    if(0 > port_index)
+        return port_index;
+    const char *opts[] = { "drop", "errdisable", "alert", NULL };
+    int vals[] = { rxLimitDrop, rxLimitErrdisable, rxLimitAlert };
+    return set_port_cfg(bpdu_rx_policy, vals[getenum(argv[3], opts)]);
+}
+
 static int cmd_settreeportprio(int argc, char *const *argv)
 {
     int br_index = get_index(argv[1], "bridge");
@@ -1741,6 +1932,55 @@ static int cmd_debuglevel(int argc, char *const *argv)
     return CTL_set_debug_level(getuint(argv[1]));
 }
 
+static int cmd_showfilter(int argc, char *const *argv)
+{
+    packet_filter_stats_t s;
+
+    if(CTL_get_packet_filter_stats(&s))
+        return -1;
+
+    switch(format)
+    {
+        case FORMAT_PLAIN:
+            if(!s.ebpf)
+            {
+                printf("classic BPF filter, no counters available\n");
+                return 0;
+            }
+            printf("eBPF filter on managed ports\n");
+            printf("  accepted           %llu\n",
+                   (unsigned long long)s.accepted);
+            printf("  dropped unmanaged  %llu\n",
+                   (unsigned long long)s.drop_unmanaged);
+            printf("  dropped address    %llu\n",
+                   (unsigned long long)s.drop_address);
+            printf("  dropped LLC        %llu\n",
+                   (unsigned long long)s.drop_llc);
+            printf("  dropped protocol   %llu\n",
+                   (unsigned long long)s.drop_protocol);
+            printf("  suppressed         %llu\n",
+                   (unsigned long long)s.suppressed);
+            return 0;
+        case FORMAT_JSON:
+            printf("{\"ebpf\":\"%s\",", BOOL_STR(s.ebpf));
+            printf("\"accepted\":\"%llu\",",
+                   (unsigned long long)s.accepted);
+            printf("\"dropped-unmanaged\":\"%llu\",",
+                   (unsigned long long)s.drop_unmanaged);
+            printf("\"dropped-address\":\"%llu\",",
+                   (unsigned long long)s.drop_address);
+            printf("\"dropped-llc\":\"%llu\",",
+                   (unsigned long long)s.drop_llc);
+            printf("\"dropped-protocol\":\"%llu\",",
+                   (unsigned long long)s.drop_protocol);
+            printf("\"suppressed\":\"%llu\"}\n",
+                   (unsigned long long)s.suppressed);
+            return 0;
+        default:
+            return -3; /* -3 = unsupported or unknown format */
+    }
+}
+
 static int do_showmstilist_fmt_plain(const char *br_name,
                                      int num_mstis,
                                      const __u16 *mstids)
@@ -2172,6 +2412,22 @@ static int cmd_setfid2mstid(int argc, char *const *argv)
     return CTL_set_fids2mstids(br_index, fids2mstids);
 }
 
+static int cmd_beginvlanmap(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    return CTL_begin_vlan_map(br_index);
+}
+
+static int cmd_commitvlanmap(int argc, char *const *argv)
+{
+    int br_index = get_index(argv[1], "bridge");
+    if(0 > br_index)
+        return br_index;
+    return CTL_commit_vlan_map(br_index);
+}
+
 struct command
 {
     int nargs;
@@ -2201,6 +2457,8 @@ static const struct command commands[] =
      "<bridge>", "Show VID-to-FID allocation table"},
     {1, 0, "showfid2mstid", cmd_showfid2mstid,
      "<bridge>", "Show FID-to-MSTID allocation table"},
+    {0, 0, "showfilter", cmd_showfilter,
+     "", "Show BPDU socket filter counters"},
     /* Show global port */
     {1, 32, "showport", cmd_showport,
      "<bridge> [<port>...[port] [param]]", "Show port state for the CIST"},
@@ -2225,10 +2483,17 @@ static const struct command commands[] =
     {2, 32, "setfid2mstid", cmd_setfid2mstid,
      "<bridge> <mstid>:<FIDs List> [<mstid>:<FIDs List> ...]",
      "Set FIDs-to-MSTIDs allocation"},
+    {1, 0, "beginvlanmap", cmd_beginvlanmap,
+     "<bridge>", "Defer the effect of setvid2fid/setfid2mstid"},
+    {1, 0, "commitvlanmap", cmd_commitvlanmap,
+     "<bridge>", "Apply the deferred VID-to-MSTID changes at once"},
     {2, 0, "setmaxage", cmd_setbridgemaxage,
      "<bridge> <max_age>", "Set bridge max age (6-40)"},
     {2, 0, "setfdelay", cmd_setbridgefdelay,
      "<bridge> <fwd_delay>", "Set bridge forward delay (4-30)"},
+    {2, 0, "setfdelayms", cmd_setbridgefdelayms,
+     "<bridge> <fwd_delay_ms>",
+     "Set local forward delay in ms (0 = off, 100-30000)"},
     {2, 0, "setmaxhops", cmd_setbridgemaxhops,
      "<bridge> <max_hops>", "Set bridge max hops (6-40)"},
     {2, 0, "sethello", cmd_setbridgehello,
@@ -2279,6 +2544,18 @@ static const struct command commands[] =
      "<bridge> <port> {yes|no}", "Disable/Enable sending BPDU"},
     {3, 0, "setportbpdufilter", cmd_setportbpdufilter,
      "<bridge> <port> {yes|no}", "Set BPDU filter state"},
+    {3, 0, "setporthelloms", cmd_setporthelloms,
+     "<bridge> <port> <hello_time_ms>",
+     "Set local port hello time in ms (0 = off, 10-2000)"},
+    {3, 0, "setportbpdurxrate", cmd_setportbpdurxrate,
+     "<bridge> <port> <bpdus_per_second>",
+     "Set port BPDU receive rate limit (0 = off)"},
+    {3, 0, "setportbpdurxburst", cmd_setportbpdurxburst,
+     "<bridge> <port> <bpdus>",
+     "Set port BPDU receive burst (0 = same as the rate)"},
+    {3, 0, "setportbpdurxpolicy", cmd_setportbpdurxpolicy,
+     "<bridge> <port> {drop|errdisable|alert}",
+     "Set action on BPDUs over the receive rate limit"},
 
     /* Other */
     {1, 0, "debuglevel", cmd_debuglevel, "<level>", "Level of verbosity"},
@@ -2569,6 +2846,9 @@ CLIENT_SIDE_FUNCTION(set_vid2fid)
 CLIENT_SIDE_FUNCTION(set_fid2mstid)
 CLIENT_SIDE_FUNCTION(set_vids2fids)
 CLIENT_SIDE_FUNCTION(set_fids2mstids)
+CLIENT_SIDE_FUNCTION(get_packet_filter_stats)
+CLIENT_SIDE_FUNCTION(begin_vlan_map)
+CLIENT_SIDE_FUNCTION(commit_vlan_map)
 
 CTL_DECLARE(add_bridges)
 {
@@ -74,6 +74,9 @@ static int handle_message(int cmd, void *inbuf, int lin,
         SERVER_MESSAGE_CASE(set_fid2mstid);
         SERVER_MESSAGE_CASE(set_vids2fids);
         SERVER_MESSAGE_CASE(set_fids2mstids);
+        SERVER_MESSAGE_CASE(get_packet_filter_stats);
+        SERVER_MESSAGE_CASE(begin_vlan_map);
+        SERVER_MESSAGE_CASE(commit_vlan_map);
 
         case CMD_CODE_add_bridges:
         {
@@ -177,6 +180,7 @@ static bool ctl_access_ok(const struct ucred *creds, int cmd)
         case CMD_CODE_get_mstconfid:
         case CMD_CODE_get_vids2fids:
         case CMD_CODE_get_fids2mstids:
+        case CMD_CODE_get_packet_filter_stats:
             return true;
         default:
             return creds->uid == 0;
@@ -16,15 +16,34 @@
 
 #include "log.h"
 #include "epoll_loop.h"
-#include "bridge_ctl.h"
 #include "clock_gettime.h"
 
 /* globals */
 static int epoll_fd = -1;
-static struct timespec nexttimeout;
+
+/* Timer wheel.
+ * An armed timer sits in the slot of the wheel tick in which it expires.
+ * Timers expiring more than one wheel revolution ahead just stay in
+ * their slot until the wheel comes around again, so arm/cancel are O(1)
+ * and only the slots up to the current tick are visited on each wakeup.
+ */
+#define TIMER_WHEEL_TICK    16  /* ms */
+#define TIMER_WHEEL_SLOTS   256
+static struct list_head timer_wheel[TIMER_WHEEL_SLOTS];
+static unsigned long long wheel_tick; /* first tick not yet fully processed */
+
+static LIST_HEAD(idle_handlers);
+
+unsigned long long epoll_now_ms(void)
+{
+    struct timespec tv;
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (unsigned long long)tv.tv_sec * 1000 + tv.tv_nsec / 1000000;
+}
 
 int init_epoll(void)
 {
+    int i;
     int r = epoll_create(128);
     if(r < 0)
     {
@@ -32,6 +51,10 @@ int init_epoll(void)
         return -1;
     }
     epoll_fd = r;
+
+    for(i = 0; i < TIMER_WHEEL_SLOTS; ++i)
+        INIT_LIST_HEAD(&timer_wheel[i]);
+    wheel_tick = epoll_now_ms() / TIMER_WHEEL_TICK;
     return 0;
 }
 
@@ -68,28 +91,155 @@ int remove_epoll(struct epoll_event_handler *h)
     return 0;
 }
 
+int epoll_want_output(struct epoll_event_handler *h, bool want)
+{
+    struct epoll_event ev =
+    {
+        .events = want ? (EPOLLIN | EPOLLOUT) : EPOLLIN,
+        .data.ptr = h,
+    };
+    int r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, h->fd, &ev);
+    if(r < 0)
+    {
+        ERROR("epoll_ctl_mod: %m");
+        return -1;
+    }
+    return 0;
+}
+
+void add_epoll_idle(struct epoll_idle_handler *h)
+{
+    list_add_tail(&h->list, &idle_handlers);
+}
+
+void remove_epoll_idle(struct epoll_idle_handler *h)
+{
+    list_del_init(&h->list);
+}
+
+static void run_idle_handlers(void)
+{
+    struct epoll_idle_handler *h, *nxt;
+
+    list_for_each_entry_safe(h, nxt, &idle_handlers, list)
+        h->handler(h);
+}
+
 void clear_epoll(void)
 {
     if(epoll_fd >= 0)
         close(epoll_fd);
 }
 
-static inline int time_diff(struct timespec *second, struct timespec *first)
+static void wheel_add(struct epoll_timer *t)
+{
+    unsigned long long tick = t->expires / TIMER_WHEEL_TICK;
+    /* Already expired timers go to the current slot */
+    if(tick < wheel_tick)
+        tick = wheel_tick;
+    list_add_tail(&t->list, &timer_wheel[tick % TIMER_WHEEL_SLOTS]);
+}
+
+void epoll_timer_init(struct epoll_timer *t,
+                      void (*handler) (struct epoll_timer * t), void *arg)
 {
-    return (second->tv_sec - first->tv_sec) * 1000
-            + (second->tv_nsec - first->tv_nsec) / 1000000;
+    INIT_LIST_HEAD(&t->list);
+    t->expires = 0;
+    t->arg = arg;
+    t->handler = handler;
 }
 
-static inline void run_timeouts(void)
+void epoll_timer_arm(struct epoll_timer *t, unsigned int msec)
 {
-    bridge_one_second();
-    ++(nexttimeout.tv_sec);
+    list_del_init(&t->list);
+    t->expires = epoll_now_ms() + msec;
+    wheel_add(t);
+}
+
+void epoll_timer_rearm(struct epoll_timer *t, unsigned int msec)
+{
+    unsigned long long now = epoll_now_ms();
+
+    list_del_init(&t->list);
+    t->expires += msec;
+    /* Check if we are too far behind or ahead of the schedule.
+     * Most probably, system time has changed (when clock_gettime falls
+     * back to gettimeofday) or the host was suspended. Resync then.
+     */
+    if((t->expires + 4000 < now) || (t->expires > now + msec))
+        t->expires = now + msec;
+    wheel_add(t);
+}
+
+void epoll_timer_cancel(struct epoll_timer *t)
+{
+    list_del_init(&t->list);
+}
+
+static void run_timers(unsigned long long now)
+{
+    unsigned long long now_tick = now / TIMER_WHEEL_TICK;
+
+    /* No need to visit any slot twice after a long sleep */
+    if(now_tick >= wheel_tick + TIMER_WHEEL_SLOTS)
+        wheel_tick = now_tick - TIMER_WHEEL_SLOTS + 1;
+
+    for(;; ++wheel_tick)
+    {
+        struct list_head *slot = &timer_wheel[wheel_tick % TIMER_WHEEL_SLOTS];
+        LIST_HEAD(pending);
+
+        /* Handlers may arm/cancel any timer, including the ones from this
+         * slot, so work on a detached copy of the slot list. Timers re-armed
+         * for an already passed deadline are run on the next loop iteration.
+         */
+        list_splice_init(slot, &pending);
+        while(!list_empty(&pending))
+        {
+            struct epoll_timer *t =
+                list_entry(pending.next, struct epoll_timer, list);
+            list_del_init(&t->list);
+            if(t->expires <= now)
+                t->handler(t);
+            else
+                list_add_tail(&t->list, slot);
+        }
+
+        if(wheel_tick >= now_tick)
+            break;
+    }
+}
+
+/* Milliseconds until the earliest timer expires, -1 if none is armed */
+static int next_timeout(unsigned long long now)
+{
+    int i;
+
+    for(i = 0; i < TIMER_WHEEL_SLOTS; ++i)
+    {
+        unsigned long long tick = wheel_tick + i;
+        struct list_head *slot = &timer_wheel[tick % TIMER_WHEEL_SLOTS];
+        struct epoll_timer *t;
+        unsigned long long deadline;
+
+        if(list_empty(slot))
+            continue;
+        /* Never sleep past the end of the first non-empty slot: it may hold
+         * only timers from the later wheel revolutions */
+        deadline = (tick + 1) * TIMER_WHEEL_TICK;
+        list_for_each_entry(t, slot, list)
+        {
+            if(t->expires < deadline)
+                deadline = t->expires;
+        }
+        return (deadline > now) ? (int)(deadline - now) : 0;
+    }
+
+    return -1;
 }
 
 int epoll_main_loop(volatile bool *quit)
 {
-    clock_gettime(CLOCK_MONOTONIC, &nexttimeout);
-    ++(nexttimeout.tv_sec);
 #define EV_SIZE 8
     struct epoll_event ev[EV_SIZE];
 
@@ -98,23 +248,9 @@ int epoll_main_loop(volatile bool *quit)
         int r, i;
         int timeout;
 
-        struct timespec tv;
-        clock_gettime(CLOCK_MONOTONIC, &tv);
-        timeout = time_diff(&nexttimeout, &tv);
-        if(timeout < 0 || timeout > 1000)
-        {
-            run_timeouts();
-            /*
-             * Check if system time has changed.
-             */
-            if(timeout < -4000 || timeout > 1000)
-            {
-                /* Most probably, system time has changed */
-                nexttimeout.tv_nsec = tv.tv_nsec;
-                nexttimeout.tv_sec = tv.tv_sec + 1;
-            }
-            timeout = 0;
-        }
+        run_timers(epoll_now_ms());
+        run_idle_handlers();
+        timeout = next_timeout(epoll_now_ms());
 
         r = epoll_wait(epoll_fd, ev, EV_SIZE, timeout);
         if(r < 0 && errno != EINTR)
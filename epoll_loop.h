@@ -14,6 +14,9 @@
 #include <sys/epoll.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <stdbool.h>
+
+#include "list.h"
 
 struct epoll_event_handler
 {
@@ -24,14 +27,62 @@ struct epoll_event_handler
                                    so mark that ref as NULL while freeing */
 };
 
+/* Deadline timer, driven by the epoll loop.
+ * Armed timers live in the timer wheel (see epoll_loop.c),
+ * so the loop only wakes up when the earliest of them expires.
+ */
+struct epoll_timer
+{
+    struct list_head list; /* anchor in the timer wheel slot */
+    unsigned long long expires; /* CLOCK_MONOTONIC, in milliseconds */
+    void *arg;
+    void (*handler) (struct epoll_timer * t);
+};
+
+/* Handler run once per main loop iteration, before the loop goes to sleep.
+ * Used to flush work queued by the event and timer handlers.
+ */
+struct epoll_idle_handler
+{
+    struct list_head list;
+    void (*handler) (struct epoll_idle_handler * p);
+};
+
 int init_epoll(void);
 
 void clear_epoll(void);
 
 int epoll_main_loop(volatile bool *quit);
 
+/* CLOCK_MONOTONIC, in milliseconds */
+unsigned long long epoll_now_ms(void);
+
 int add_epoll(struct epoll_event_handler *h);
 
 int remove_epoll(struct epoll_event_handler *h);
 
+/* Wait for EPOLLOUT on the handler's fd in addition to EPOLLIN or stop */
+int epoll_want_output(struct epoll_event_handler *h, bool want);
+
+void add_epoll_idle(struct epoll_idle_handler *h);
+
+void remove_epoll_idle(struct epoll_idle_handler *h);
+
+void epoll_timer_init(struct epoll_timer *t,
+                      void (*handler) (struct epoll_timer * t), void *arg);
+
+/* Arm timer to expire msec milliseconds from now */
+void epoll_timer_arm(struct epoll_timer *t, unsigned int msec);
+
+/* Re-arm periodic timer msec milliseconds after its previous deadline.
+ * Should be called from the timer's own handler. */
+void epoll_timer_rearm(struct epoll_timer *t, unsigned int msec);
+
+void epoll_timer_cancel(struct epoll_timer *t);
+
+static inline bool epoll_timer_armed(const struct epoll_timer *t)
+{
+    return !list_empty(&t->list);
+}
+
 #endif /* EPOLL_LOOP_H */
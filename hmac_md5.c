@@ -91,6 +91,11 @@ Rotation is separate from addition to prevent recomputation.
  */
 static void Encode(unsigned char *output, const UINT4 *input, unsigned int len)
 {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* Not in RFC 1321: the words are little-endian already, copy them
+     * whole, whatever the alignment of output */
+    MD5_memcpy(output, input, len);
+#else
     unsigned int i, j;
 
     for(i = 0, j = 0; j < len; i++, j += 4)
@@ -100,6 +105,7 @@ static void Encode(unsigned char *output, const UINT4 *input, unsigned int len)
         output[j + 2] = (unsigned char)((input[i] >> 16) & 0xff);
         output[j + 3] = (unsigned char)((input[i] >> 24) & 0xff);
     }
+#endif
 }
 
 /* Decodes input (unsigned char) into output (UINT4). Assumes len is
@@ -107,11 +113,16 @@ static void Encode(unsigned char *output, const UINT4 *input, unsigned int len)
  */
 static void Decode(UINT4 *output, const unsigned char *input, unsigned int len)
 {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* Not in RFC 1321: see Encode() */
+    MD5_memcpy(output, input, len);
+#else
     unsigned int i, j;
 
     for(i = 0, j = 0; j < len; i++, j += 4)
         output[i] = ((UINT4)input[j]) | (((UINT4)input[j+1]) << 8) |
                     (((UINT4)input[j+2]) << 16) | (((UINT4)input[j+3]) << 24);
+#endif
 }
 
 /* MD5 basic transformation. Transforms state based on block.
@@ -279,13 +290,18 @@ static void MD5Final(unsigned char digest[16], MD5_CTX *context)
     /* MD5_memset((POINTER)context, 0, sizeof(*context)); */
 }
 
-/*
-** Function: hmac_md5 from RFC-2104
-*/
-void hmac_md5(const unsigned char* text, int text_len, const unsigned char* key,
-              int key_len, void* digest)
+/* Not in RFC 2104: the MD5 states after the inner and the outer pad.
+ * They depend on the key only, so for a fixed key they are computed once.
+ */
+typedef struct
+{
+    UINT4 istate[4];
+    UINT4 ostate[4];
+} HMAC_MD5_PADS;
+
+static void hmac_md5_pads(HMAC_MD5_PADS *pads, const unsigned char* key,
+                          int key_len)
 {
-    MD5_CTX context;
     unsigned char k_ipad[65];    /* inner padding -
                                   * key XORd with ipad
                                   */
@@ -293,6 +309,7 @@ void hmac_md5(const unsigned char* text, int text_len, const unsigned char* key,
                                   * key XORd with opad
                                   */
     unsigned char tk[16];
+    MD5_CTX context;
     int i;
     /* if key is longer than 64 bytes reset it to key=MD5(key) */
     if(key_len > 64)
@@ -330,25 +347,73 @@ void hmac_md5(const unsigned char* text, int text_len, const unsigned char* key,
         k_ipad[i] ^= 0x36;
         k_opad[i] ^= 0x5c;
     }
+    /* The pads are one block each */
+    MD5Init(&context);
+    MD5Transform(context.state, k_ipad);
+    MD5_memcpy(pads->istate, context.state, sizeof(pads->istate));
+    MD5Init(&context);
+    MD5Transform(context.state, k_opad);
+    MD5_memcpy(pads->ostate, context.state, sizeof(pads->ostate));
+}
+
+/* MD5 initialization after the 64 bytes of a pad */
+static void MD5InitPad(MD5_CTX *context, const UINT4 state[4])
+{
+    context->count[0] = 64 << 3;
+    context->count[1] = 0;
+    MD5_memcpy(context->state, state, sizeof(context->state));
+}
+
+static void hmac_md5_padded(const HMAC_MD5_PADS *pads,
+                            const unsigned char* text, int text_len,
+                            void* digest)
+{
+    MD5_CTX context;
+
     /*
      * perform inner MD5
      */
-    MD5Init(&context);                   /* init context for 1st
-                                          * pass */
-    MD5Update(&context, k_ipad, 64);     /* start with inner pad */
+    MD5InitPad(&context, pads->istate);  /* init context for 1st
+                                          * pass, inner pad done */
     MD5Update(&context, text, text_len); /* then text of datagram */
     MD5Final(digest, &context);          /* finish up 1st pass */
     /*
      * perform outer MD5
      */
-    MD5Init(&context);                   /* init context for 2nd
-                                          * pass */
-    MD5Update(&context, k_opad, 64);     /* start with outer pad */
+    MD5InitPad(&context, pads->ostate);  /* init context for 2nd
+                                          * pass, outer pad done */
     MD5Update(&context, digest, 16);     /* then results of 1st
                                           * hash */
     MD5Final(digest, &context);          /* finish up 2nd pass */
 }
 
+/*
+** Function: hmac_md5 from RFC-2104
+*/
+void hmac_md5(const unsigned char* text, int text_len, const unsigned char* key,
+              int key_len, void* digest)
+{
+    HMAC_MD5_PADS pads;
+
+    hmac_md5_pads(&pads, key, key_len);
+    hmac_md5_padded(&pads, text, text_len, digest);
+}
+
+/* hmac_md5 with the key of the MST Configuration Digest (13.7) */
+void hmac_md5_mstp(const unsigned char* text, int text_len, void* digest)
+{
+    static HMAC_MD5_PADS mstp_pads;
+    static bool mstp_pads_ready = false;
+    const unsigned char mstp_key[16] = HMAC_KEY;
+
+    if(!mstp_pads_ready)
+    {
+        hmac_md5_pads(&mstp_pads, mstp_key, sizeof(mstp_key));
+        mstp_pads_ready = true;
+    }
+    hmac_md5_padded(&mstp_pads, text, text_len, digest);
+}
+
 #ifdef HMAC_MDS_TEST_FUNCTIONS
 /* Digests a string */
 static void MD5String(const char *string, void *digest)
@@ -367,7 +432,7 @@ bool MD5TestSuite(void)
     unsigned char digest[16];
     unsigned char key[16];
     unsigned char mstp_key[16] = HMAC_KEY;
-    unsigned char data[4096 * 2];
+    unsigned char data[4096 * 2 + 1];
     int i;
 
     /* Tests from RFC-1231 */
@@ -489,6 +554,11 @@ bool MD5TestSuite(void)
         if(memcmp(expected_result, digest, 16))
             return false;
     }
+    /* Same with the precomputed pads, and from an unaligned buffer */
+    memmove(data + 1, data, 4096 * 2);
+    hmac_md5_mstp(data + 1, 4096 * 2, (void *)key);
+    if(memcmp(key, digest, 16))
+        return false;
 
     return true;
 }
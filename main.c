@@ -100,17 +100,31 @@ int main(int argc, char *argv[])
 {
     int c;
     int daemonize = 1;
+    bool mmap_rings = false;
+    bool rx_suppress = false;
 
-    while((c = getopt(argc, argv, "Vdsv:")) != -1)
+    while((c = getopt(argc, argv, "Vdflrsuv:")) != -1)
     {
         switch (c)
         {
             case 'd':
                 daemonize = 0;
                 break;
+            case 'f':
+                bridge_rx_fast_path = false;
+                break;
+            case 'l':
+                bridge_lazy_msti_ports = true;
+                break;
+            case 'r':
+                mmap_rings = true;
+                break;
             case 's':
                 print_to_syslog = 1;
                 break;
+            case 'u':
+                rx_suppress = true;
+                break;
             case 'v':
             {
                 char *end;
@@ -165,7 +179,7 @@ int main(int argc, char *argv[])
     TST(driver_mstp_init() == 0, -1);
     TST(init_epoll() == 0, -1);
     TST(ctl_socket_init() == 0, -1);
-    TST(packet_sock_init() == 0, -1);
+    TST(packet_sock_init(mmap_rings, rx_suppress) == 0, -1);
     TST(netsock_init() == 0, -1);
     TST(init_bridge_ops() == 0, -1);
 
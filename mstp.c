@@ -43,14 +43,29 @@
 #include "log.h"
 #include "clock_gettime.h"
 
-static void PTSM_tick(port_t *prt);
+static bool PTSM_tick(port_t *prt, unsigned int msec);
 static bool TCSM_run(per_tree_port_t *ptp, bool dry_run);
 static void BDSM_begin(port_t *prt);
 static void br_state_machines_begin(bridge_t *br);
 static void prt_state_machines_begin(port_t *prt);
 static void tree_state_machines_begin(tree_t *tree);
+static void ptp_state_machines_begin(per_tree_port_t *ptp);
 static void br_state_machines_run(bridge_t *br);
+static void br_dirty_state_machines_run(bridge_t *br);
+static void sm_changed_ptp(per_tree_port_t *ptp, unsigned int sm);
+static void updtPriorityKey(port_priority_vector_t *vec);
+static void roles_mark_ptp(per_tree_port_t *ptp);
+static void roles_mark_port(port_t *prt);
+static void root_heap_remove(per_tree_port_t *ptp);
+static void updtRcvdInfoWhile(per_tree_port_t *ptp);
 static void updtbrAssuRcvdInfoWhile(port_t *prt);
+static bool fromSameRegion(port_t *prt);
+static bool rxSuppressCheck(port_t *prt, rcvd_bpdu_t *msg,
+                            msti_configuration_message_t *msti_msgs,
+                            int num_mstis);
+static void rxSuppressUpdate(bridge_t *br);
+static void rxSuppressRefresh(port_t *prt, unsigned int msec);
+static void rxLimitFill(port_t *prt);
 
 #define FOREACH_PORT_IN_BRIDGE(port, bridge) \
     list_for_each_entry((port), &(bridge)->ports, br_list)
@@ -61,28 +76,500 @@ static void updtbrAssuRcvdInfoWhile(port_t *prt);
 #define FOREACH_PTP_IN_PORT(ptp, port) \
     list_for_each_entry((ptp), &(port)->trees, port_list)
 
+/* Ports with at least one running timer are kept in the bridge's
+ * timer_ports list, so that the tick (PTSM_tick) visits only them.
+ * Every place which starts a timer should use set_prt_timer() or
+ * set_ptp_timer().
+ */
+static inline void port_timers_armed(port_t *prt)
+{
+    if(list_empty(&prt->timer_list))
+        list_add_tail(&prt->timer_list, &prt->bridge->timer_ports);
+}
+
+#define set_timer(prt, timer, value) ({ \
+    (timer) = (value);                   \
+    if(0 != (timer))                     \
+        port_timers_armed(prt); })
+#define set_prt_timer(prt, name, value) \
+    set_timer((prt), PRT_TIMER((prt), name), (value))
+#define set_ptp_timer(_ptp, name, value) ({                   \
+    set_timer((_ptp)->port, PTP_TIMER((_ptp), name), (value));  \
+    (_ptp)->port->timer_started |= 1ull << (_ptp)->tree->slot; })
+
+/* Timer vectors of the tick, see PTSM_tick() */
+typedef unsigned int timer_vec_t __attribute__((vector_size(16)));
+#define TIMER_VEC_LANES (sizeof(timer_vec_t) / sizeof(unsigned int))
+
+#if (MAX_TREE_SLOTS > 64) || (MAX_TREE_SLOTS % 4) || (PORT_TIMER_COLUMNS % 4)
+#error "Tree slots must fit in __u64 and whole timer vectors"
+#endif
+
+/* Timers count milliseconds, while the protocol times (times_t) hold whole
+ * seconds, as they are carried in BPDUs. The not-in-standard millisecond
+ * overrides (per-port Hello Time, per-bridge Forward Delay) affect only
+ * the local timers and never the values sent on the wire.
+ */
+#define SECONDS_TO_MS(s) (1000u * (unsigned int)(s))
+
+/* Work-list scheduling of the state machines (not in standard).
+ *
+ * Every state machine instance has a dirty bit: port_t.sm_dirty for the
+ * per-port ones, per_tree_port_t.sm_dirty for the per-port per-tree ones
+ * and tree_t.sm_dirty for PRSSM. Only the dirty instances are evaluated by
+ * br_dirty_state_machines_run(), in the same order in which all of them are
+ * evaluated by a full sweep. An instance which is evaluated and does not
+ * change its state is clean until one of its inputs changes. So every
+ * change of state marks dirty all the instances which may read the changed
+ * variables (sm_changed_xxx below), and the external events mark the
+ * instances whose inputs they change.
+ */
+#define SM_BA       (1u << 0) /* bridge assurance check */
+#define SM_PRSM     (1u << 1)
+#define SM_PPMSM    (1u << 2)
+#define SM_BDSM     (1u << 3)
+#define SM_PTSM     (1u << 4)
+#define SM_PTPS     (1u << 5) /* some per-tree state machines of the port */
+#define SM_PORT_SMS (SM_BA | SM_PRSM | SM_PPMSM | SM_BDSM | SM_PTSM)
+#define SM_PORT_ALL (SM_PORT_SMS | SM_PTPS)
+
+#define SM_PISM     (1u << 0)
+#define SM_PRTSM    (1u << 1)
+#define SM_PSTSM    (1u << 2)
+#define SM_TCSM     (1u << 3)
+#define SM_PTP_ALL  (SM_PISM | SM_PRTSM | SM_PSTSM | SM_TCSM)
+
+static inline void sm_mark_ptp(per_tree_port_t *ptp, unsigned int sms)
+{
+    ptp->sm_dirty |= sms;
+    ptp->port->sm_dirty |= SM_PTPS;
+}
+
+/* All the state machines of the port, in all trees */
+static void sm_mark_port(port_t *prt)
+{
+    per_tree_port_t *ptp;
+
+    prt->sm_dirty = SM_PORT_ALL;
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        ptp->sm_dirty = SM_PTP_ALL;
+}
+
+static void sm_mark_tree(tree_t *tree, unsigned int sms)
+{
+    per_tree_port_t *ptp;
+
+    FOREACH_PTP_IN_TREE(ptp, tree)
+        sm_mark_ptp(ptp, sms);
+}
+
+static void sm_mark_bridge(bridge_t *br)
+{
+    port_t *prt;
+    tree_t *tree;
+
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        sm_mark_port(prt);
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        tree->sm_dirty = true;
+}
+
+static inline unsigned int portHelloTimeMs(port_t *prt)
+{
+    if(prt->Hello_Time_ms)
+        return prt->Hello_Time_ms;
+    return SECONDS_TO_MS(GET_CIST_PTP_FROM_PORT(prt)->portTimes.Hello_Time);
+}
+
+static inline unsigned int fwdDelayMs(bridge_t *br, __u8 Forward_Delay)
+{
+    if(br->Forward_Delay_ms)
+        return br->Forward_Delay_ms;
+    return SECONDS_TO_MS(Forward_Delay);
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+    while(b)
+    {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Tick often enough to hit every configured millisecond time exactly */
+static void recalc_tick_interval(bridge_t *br)
+{
+    port_t *prt;
+    unsigned int tick = gcd(MSTP_TICK_MS_DEFAULT, br->Forward_Delay_ms);
+
+    list_for_each_entry(prt, &br->ports, br_list)
+        tick = gcd(tick, prt->Hello_Time_ms);
+    br->tick_interval = tick;
+}
+
 /* 17.20.11 of 802.1D */
 #define rstpVersion(br) ((br)->ForceProtocolVersion >= protoRSTP)
 /* Bridge assurance is operational only when NetworkPort type is configured
  * and the operation status is pointToPoint and version is RSTP/MSTP
  */
 #define assurancePort(prt) ((prt)->NetworkPort && (prt)->operPointToPointMAC \
-                            && (prt)->sendRSTP)
+                            && PRT_FLAG(prt, sendRSTP))
+/* selected && !updtInfo, shared by most guards of the role transitions */
+#define selectedUpToDate(ptp) \
+    PTP_MATCH(ptp, PTP_BIT(selected) | PTP_BIT(updtInfo), PTP_BIT(selected))
+
+/* Every tree keeps bitmaps of its ports which are unsettled and unsynced
+ * (tree_t.unsettled_ports and tree_t.unsynced_ports), so that allSynced
+ * (13.25.1) tests a word of ports at a time instead of walking the tree.
+ * They follow selected, updtInfo, synced, role and selectedRole, so every
+ * place which changes these should use set_ptp_flag(), set_ptp_role() or
+ * set_ptp_selectedRole().
+ */
+#define BITS_PER_LONG   (8 * sizeof(unsigned long))
+#define PTP_ALLSYNCED_FLAGS \
+    (PTP_BIT(selected) | PTP_BIT(updtInfo) | PTP_BIT(synced))
+
+static inline void assign_port_bit(unsigned long *map, unsigned int row,
+                                   bool value)
+{
+    unsigned long bit = 1ul << (row % BITS_PER_LONG);
+
+    if(value)
+        map[row / BITS_PER_LONG] |= bit;
+    else
+        map[row / BITS_PER_LONG] &= ~bit;
+}
+
+static void update_port_bits(per_tree_port_t *ptp)
+{
+    tree_t *tree = ptp->tree;
+    unsigned int row = ptp->port->timer_row;
+
+    assign_port_bit(tree->unsettled_ports, row,
+                    !selectedUpToDate(ptp)
+                    || (ptp->role != ptp->selectedRole));
+    assign_port_bit(tree->unsynced_ports, row, !PTP_FLAG(ptp, synced));
+}
+
+static void clear_port_bits(per_tree_port_t *ptp)
+{
+    assign_port_bit(ptp->tree->unsettled_ports, ptp->port->timer_row, false);
+    assign_port_bit(ptp->tree->unsynced_ports, ptp->port->timer_row, false);
+}
+
+/* The BPDU of the port (port_t.txBpdu) is encoded from these flags */
+#define PTP_TX_FLAGS (PTP_BIT(proposing) | PTP_BIT(learning) \
+    | PTP_BIT(forwarding) | PTP_BIT(agree) | PTP_BIT(master))
+
+/* Encode the BPDU of the port again on the next transmission */
+static inline void tx_mark_port(port_t *prt)
+{
+    prt->txBpduSize = 0;
+}
+
+/* Encode the BPDUs of all ports of the bridge again */
+static inline void tx_mark_bridge(bridge_t *br)
+{
+    ++(br->txBpduGen);
+}
+
+static inline void set_prt_flags(port_t *prt, __u32 mask, bool value)
+{
+    if(value)
+        prt->flags |= mask;
+    else
+        prt->flags &= ~mask;
+}
+
+static inline void set_ptp_flags(per_tree_port_t *ptp, __u32 mask, bool value)
+{
+    __u32 flags = value ? (ptp->flags | mask) : (ptp->flags & ~mask);
+    __u32 changed = flags ^ ptp->flags;
+
+    ptp->flags = flags;
+    if(changed & PTP_ALLSYNCED_FLAGS)
+        update_port_bits(ptp);
+    if(changed & PTP_TX_FLAGS)
+        tx_mark_port(ptp->port);
+}
+
+#define set_prt_flag(prt, name, value) \
+    set_prt_flags((prt), PRT_BIT(name), (value))
+#define set_ptp_flag(ptp, name, value) \
+    set_ptp_flags((ptp), PTP_BIT(name), (value))
+
+static inline void set_ptp_role(per_tree_port_t *ptp, port_role_t role)
+{
+    if(ptp->role != role)
+        tx_mark_port(ptp->port);
+    ptp->role = role;
+    update_port_bits(ptp);
+}
+
+static inline void set_ptp_selectedRole(per_tree_port_t *ptp,
+                                        port_role_t role)
+{
+    ptp->selectedRole = role;
+    update_port_bits(ptp);
+}
+/*
+ * Maps of VIDs and FIDs (range_map_t, not in standard)
+ */
+
+/* The runs of all the maps which map every key to 0 */
+static map_run_t map_default_run = { .first = 0, .value = 0 };
+
+static void map_init(range_map_t *map, __u16 last_key)
+{
+    map->runs = &map_default_run;
+    map->num_runs = 1;
+    map->room = 0;
+    map->last_key = last_key;
+}
+
+static void map_free(range_map_t *map)
+{
+    if(map->room)
+        free(map->runs);
+    map_init(map, map->last_key);
+}
+
+/* Index of the run holding the key, by binary search */
+static unsigned int map_find(const range_map_t *map, __u16 key)
+{
+    unsigned int lo = 0, hi = map->num_runs - 1, mid;
+
+    while(lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        if(map->runs[mid].first <= key)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static inline __u16 map_get(const range_map_t *map, __u16 key)
+{
+    return map->runs[map_find(map, key)].value;
+}
+
+/* The key after the last one of the run */
+static inline unsigned int map_run_end(const range_map_t *map, unsigned int i)
+{
+    return (i + 1 < map->num_runs) ? map->runs[i + 1].first
+                                   : map->last_key + 1u;
+}
+
+/* Make the runs writable, with room for the given count of them */
+static bool map_reserve(range_map_t *map, unsigned int num)
+{
+    map_run_t *runs;
+
+    if(num <= map->room)
+        return true;
+    if(num < 2 * map->room)
+        num = 2 * map->room;
+    if(!(runs = realloc(map->room ? map->runs : NULL, num * sizeof(*runs))))
+        return false;
+    if(!map->room)
+        memcpy(runs, map->runs, map->num_runs * sizeof(*runs));
+    map->runs = runs;
+    map->room = num;
+    return true;
+}
+
+static void map_insert(range_map_t *map, unsigned int i,
+                       __u16 first, __u16 value)
+{
+    memmove(&map->runs[i + 1], &map->runs[i],
+            (map->num_runs - i) * sizeof(map_run_t));
+    map->runs[i].first = first;
+    map->runs[i].value = value;
+    ++(map->num_runs);
+}
+
+static void map_erase(range_map_t *map, unsigned int i)
+{
+    --(map->num_runs);
+    memmove(&map->runs[i], &map->runs[i + 1],
+            (map->num_runs - i) * sizeof(map_run_t));
+}
+
+/* Map the key to the value. Fails only if out of memory */
+static bool map_set(range_map_t *map, __u16 key, __u16 value)
+{
+    unsigned int i = map_find(map, key);
+    __u16 prev = map->runs[i].value;
+
+    if(prev == value)
+        return true;
+    if(!map_reserve(map, map->num_runs + 2))
+        return false;
+
+    /* Cut the key out of its run */
+    if((key < map->last_key) && (map_run_end(map, i) > key + 1u))
+        map_insert(map, i + 1, key + 1, prev);
+    if(map->runs[i].first < key)
+        map_insert(map, ++i, key, prev);
+    map->runs[i].value = value;
+
+    /* Join it with the neighbours of the same value */
+    if((i + 1 < map->num_runs) && (map->runs[i + 1].value == value))
+        map_erase(map, i + 1);
+    if((0 < i) && (map->runs[i - 1].value == value))
+        map_erase(map, i);
+
+    if((1 == map->num_runs) && (0 == value))
+        map_free(map); /* back to the default */
+    return true;
+}
+
+/* Replace the map with the values of all the keys from the array.
+ * Fails only if out of memory, leaving the map as it was.
+ */
+static bool map_assign_array(range_map_t *map, const __u16 *values)
+{
+    unsigned int num = 1, key;
+    map_run_t *runs;
+
+    for(key = 1; key <= map->last_key; ++key)
+        if(values[key] != values[key - 1])
+            ++num;
+    if((1 == num) && (0 == values[0]))
+    {
+        map_free(map);
+        return true;
+    }
+
+    if(!(runs = malloc(num * sizeof(*runs))))
+        return false;
+    runs[0].first = 0;
+    runs[0].value = values[0];
+    for(num = 1, key = 1; key <= map->last_key; ++key)
+    {
+        if(values[key] == values[key - 1])
+            continue;
+        runs[num].first = key;
+        runs[num].value = values[key];
+        ++num;
+    }
+    map_free(map);
+    map->runs = runs;
+    map->num_runs = map->room = num;
+    return true;
+}
+
+static void map_get_array(const range_map_t *map, __u16 *values)
+{
+    unsigned int i, key;
+
+    for(i = 0; i < map->num_runs; ++i)
+        for(key = map->runs[i].first; key < map_run_end(map, i); ++key)
+            values[key] = map->runs[i].value;
+}
+
+/* Is any key mapped to the value? */
+static bool map_has_value(const range_map_t *map, __u16 value)
+{
+    unsigned int i;
+
+    for(i = 0; i < map->num_runs; ++i)
+        if(map->runs[i].value == value)
+            return true;
+    return false;
+}
+
+/* Not in standard: the last digests computed, with the VID-to-MSTID runs
+ * (VIDs 1 to MAX_VID) they were computed for. Bridges with the same
+ * mapping, usually all of them, get the digest without the HMAC.
+ */
+#define DIGEST_MEMO_SIZE    4
+static struct
+{
+    map_run_t *runs;
+    unsigned int num_runs;
+    __u8 digest[16];
+} digest_memo[DIGEST_MEMO_SIZE];
+static unsigned int digest_memo_next;
+
+/* Next run of the VID-to-MSTID mapping, made of the runs of vid2fid from
+ * *i on. Returns false after the last one.
+ */
+static bool vid2mstid_next_run(bridge_t *br, unsigned int *i, map_run_t *run)
+{
+    const range_map_t *map = &br->vid2fid;
+
+    /* VID 0 is not in the digest */
+    if((0 == *i) && (map_run_end(map, 0) <= 1))
+        ++(*i);
+    if(*i >= map->num_runs)
+        return false;
+    run->first = map->runs[*i].first ? map->runs[*i].first : 1;
+    run->value = map_get(&br->fid2mstid, map->runs[*i].value);
+    for(++(*i); (*i < map->num_runs)
+                && (map_get(&br->fid2mstid, map->runs[*i].value) == run->value);
+        ++(*i))
+        ;
+    return true;
+}
+
 /*
  * Recalculate configuration digest. (13.7)
  */
 static void RecalcConfigDigest(bridge_t *br)
 {
     __be16 vid2mstid[MAX_VID + 2];
-    unsigned char mstp_key[] = HMAC_KEY;
-    int vid;
+    __u8 *digest = br->MstConfigId.s.configuration_digest;
+    map_run_t run, *runs;
+    unsigned int i, m, num_runs = 0, vid, end;
+    __be16 MSTID;
+
+    tx_mark_bridge(br);
+    /* There are no more runs than in vid2fid. The array becomes the memo
+     * entry, without it the digest is just not memoized */
+    if((runs = malloc(br->vid2fid.num_runs * sizeof(*runs))))
+    {
+        for(i = 0; vid2mstid_next_run(br, &i, &runs[num_runs]); ++num_runs)
+            ;
+        for(m = 0; m < DIGEST_MEMO_SIZE; ++m)
+        {
+            if(digest_memo[m].runs && (digest_memo[m].num_runs == num_runs)
+               && !memcmp(digest_memo[m].runs, runs,
+                          num_runs * sizeof(*runs)))
+            {
+                memcpy(digest, digest_memo[m].digest,
+                       sizeof(digest_memo[m].digest));
+                free(runs);
+                return;
+            }
+        }
+    }
 
     vid2mstid[0] = vid2mstid[MAX_VID + 1] = 0;
-    for(vid = 1; vid <= MAX_VID; ++vid)
-        vid2mstid[vid] = br->fid2mstid[br->vid2fid[vid]];
+    for(i = 0; vid2mstid_next_run(br, &i, &run);)
+    {
+        MSTID = __cpu_to_be16(run.value);
+        end = (i < br->vid2fid.num_runs) ? br->vid2fid.runs[i].first
+                                         : MAX_VID + 1;
+        for(vid = run.first; vid < end; ++vid)
+            vid2mstid[vid] = MSTID;
+    }
 
-    hmac_md5((void *)vid2mstid, sizeof(vid2mstid), mstp_key, sizeof(mstp_key),
-             (caddr_t)br->MstConfigId.s.configuration_digest);
+    hmac_md5_mstp((void *)vid2mstid, sizeof(vid2mstid), digest);
+
+    if(!runs)
+        return;
+    m = digest_memo_next;
+    digest_memo_next = (m + 1) % DIGEST_MEMO_SIZE;
+    free(digest_memo[m].runs);
+    digest_memo[m].runs = runs;
+    digest_memo[m].num_runs = num_runs;
+    memcpy(digest_memo[m].digest, digest, sizeof(digest_memo[m].digest));
 }
 
 /*
@@ -100,6 +587,7 @@ static __u32 compute_pcost(int speed)
 static void bridge_default_internal_vars(bridge_t *br)
 {
     br->uptime = 0;
+    br->uptime_ms = 0;
 }
 
 static void tree_default_internal_vars(tree_t *tree)
@@ -118,12 +606,12 @@ static void tree_default_internal_vars(tree_t *tree)
 
 static void port_default_internal_vars(port_t *prt)
 {
-    prt->infoInternal = false;
-    prt->rcvdInternal = false;
-    prt->rcvdTcAck = false;
-    prt->rcvdTcn = false;
-    assign(prt->rapidAgeingWhile, 0u);
-    assign(prt->brAssuRcvdInfoWhile, 0u);
+    set_prt_flag(prt, infoInternal, false);
+    set_prt_flag(prt, rcvdInternal, false);
+    set_prt_flag(prt, rcvdTcAck, false);
+    set_prt_flag(prt, rcvdTcn, false);
+    assign(PRT_TIMER(prt, rapidAgeingWhile), 0u);
+    assign(PRT_TIMER(prt, brAssuRcvdInfoWhile), 0u);
     prt->BaInconsistent = false;
     prt->num_rx_bpdu_filtered = 0;
     prt->num_rx_bpdu = 0;
@@ -132,6 +620,12 @@ static void port_default_internal_vars(port_t *prt)
     prt->num_tx_tcn = 0;
     prt->num_trans_fwd = 0;
     prt->num_trans_blk = 0;
+    prt->num_tx_deferred = 0;
+    prt->num_tx_coalesced = 0;
+    prt->num_tx_dropped = 0;
+    prt->num_rx_rate_limited = 0;
+    prt->num_rx_fast_path = 0;
+    prt->num_rx_unknown_msti = 0;
 
     /* The following are initialized in BEGIN state:
      * - mdelayWhile. mcheck, sendRSTP: in Port Protocol Migration SM
@@ -144,13 +638,13 @@ static void port_default_internal_vars(port_t *prt)
 
 static void ptp_default_internal_vars(per_tree_port_t *ptp)
 {
-    ptp->rcvdTc = false;
-    ptp->tcProp = false;
-    ptp->updtInfo = false;
-    ptp->master = false; /* 13.24.5 */
-    ptp->disputed = false;
+    set_ptp_flag(ptp, rcvdTc, false);
+    set_ptp_flag(ptp, tcProp, false);
+    set_ptp_flag(ptp, updtInfo, false);
+    set_ptp_flag(ptp, master, false); /* 13.24.5 */
+    set_ptp_flag(ptp, disputed, false);
     assign(ptp->rcvdInfo, (port_info_t)0);
-    ptp->mastered = false;
+    set_ptp_flag(ptp, mastered, false);
     memset(&ptp->msgPriority, 0, sizeof(ptp->msgPriority));
     memset(&ptp->msgTimes, 0, sizeof(ptp->msgTimes));
 
@@ -178,6 +672,8 @@ static tree_t * create_tree(bridge_t *br, __u8 *macaddr, __be16 MSTID)
     tree->bridge = br;
     tree->MSTID = MSTID;
     INIT_LIST_HEAD(&tree->ports);
+    INIT_LIST_HEAD(&tree->stale_ports);
+    tree->roles_rescan = true;
 
     memcpy(tree->BridgeIdentifier.s.mac_address, macaddr, ETH_ALEN);
     /* 0x8000 = default bridge priority (17.14 of 802.1D) */
@@ -185,6 +681,7 @@ static tree_t * create_tree(bridge_t *br, __u8 *macaddr, __be16 MSTID)
     assign(tree->BridgePriority.RootID, tree->BridgeIdentifier);
     assign(tree->BridgePriority.RRootID, tree->BridgeIdentifier);
     assign(tree->BridgePriority.DesignatedBridgeID, tree->BridgeIdentifier);
+    updtPriorityKey(&tree->BridgePriority);
     /* 13.23.4 */
     assign(tree->BridgeTimes.remainingHops, br->MaxHops);
     assign(tree->BridgeTimes.Forward_Delay, br->Forward_Delay);
@@ -197,6 +694,135 @@ static tree_t * create_tree(bridge_t *br, __u8 *macaddr, __be16 MSTID)
     return tree;
 }
 
+/* Make room for the given count of the Root Port candidates in the tree */
+static bool reserve_root_heap(tree_t *tree, unsigned int size)
+{
+    per_tree_port_t **heap;
+
+    if(size <= tree->root_heap_size)
+        return true;
+    if(!(heap = realloc(tree->root_heap, size * sizeof(*heap))))
+    {
+        ERROR_BRNAME(tree->bridge, "Out of memory");
+        return false;
+    }
+    tree->root_heap = heap;
+    tree->root_heap_size = size;
+    return true;
+}
+
+/* Make room in the tree's bitmaps of ports (tree_t.unsettled_ports and
+ * tree_t.unsynced_ports) for the given count of rows of the timer table */
+static bool reserve_port_bitmaps(tree_t *tree, unsigned int rows)
+{
+    unsigned int words = (rows + BITS_PER_LONG - 1) / BITS_PER_LONG;
+    unsigned int old = tree->port_bitmap_words;
+    unsigned long *map;
+
+    if(words <= old)
+        return true;
+    if(!(map = realloc(tree->unsettled_ports, words * sizeof(*map))))
+    {
+        ERROR_BRNAME(tree->bridge, "Out of memory");
+        return false;
+    }
+    memset(map + old, 0, (words - old) * sizeof(*map));
+    tree->unsettled_ports = map;
+    if(!(map = realloc(tree->unsynced_ports, words * sizeof(*map))))
+    {
+        ERROR_BRNAME(tree->bridge, "Out of memory");
+        return false;
+    }
+    memset(map + old, 0, (words - old) * sizeof(*map));
+    tree->unsynced_ports = map;
+    tree->port_bitmap_words = words;
+    return true;
+}
+
+static void free_tree(tree_t *tree)
+{
+    free(tree->root_heap);
+    free(tree->unsettled_ports);
+    free(tree->unsynced_ports);
+    free(tree);
+}
+
+/* Take a free row of the bridge's timer table for the port,
+ * grow the table if there is none */
+static bool alloc_timer_row(port_t *prt)
+{
+    bridge_t *br = prt->bridge;
+    unsigned int *timers;
+    port_t **owners;
+    unsigned int row, rows;
+
+    for(row = 0; row < br->timer_rows; ++row)
+        if(!br->timer_row_port[row])
+            break;
+    if(row == br->timer_rows)
+    {
+        rows = br->timer_rows ? 2 * br->timer_rows : 8;
+        if(!(timers = realloc(br->timers,
+                              rows * timer_row_size(br) * sizeof(*timers))))
+        {
+            ERROR_PRTNAME(prt, "Out of memory");
+            return false;
+        }
+        br->timers = timers;
+        if(!(owners = realloc(br->timer_row_port, rows * sizeof(*owners))))
+        {
+            ERROR_PRTNAME(prt, "Out of memory");
+            return false;
+        }
+        memset(owners + br->timer_rows, 0,
+               (rows - br->timer_rows) * sizeof(*owners));
+        br->timer_row_port = owners;
+        br->timer_rows = rows;
+    }
+
+    br->timer_row_port[row] = prt;
+    prt->timer_row = row;
+    memset(port_timers(prt), 0, timer_row_size(br) * sizeof(*br->timers));
+    prt->timer_started = 0;
+    return true;
+}
+
+/* Widen the rows of the bridge's timer table to room for slots tree slots,
+ * the timers of the slots in use keep their values */
+static bool grow_timer_slots(bridge_t *br, unsigned int slots)
+{
+    unsigned int old_size = timer_row_size(br);
+    unsigned int new_size = PORT_TIMER_COLUMNS + NUM_PTP_TIMERS * slots;
+    unsigned int *timers = NULL, *from, *to;
+    unsigned int row, timer;
+
+    if(br->timer_rows
+       && !(timers = calloc(br->timer_rows, new_size * sizeof(*timers))))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return false;
+    }
+    for(row = 0; row < br->timer_rows; ++row)
+    {
+        from = br->timers + row * old_size;
+        to = timers + row * new_size;
+        memcpy(to, from, PORT_TIMER_COLUMNS * sizeof(*to));
+        for(timer = 0; timer < NUM_PTP_TIMERS; ++timer)
+            memcpy(to + PORT_TIMER_COLUMNS + timer * slots,
+                   from + PORT_TIMER_COLUMNS + timer * br->timer_slots,
+                   br->timer_slots * sizeof(*to));
+    }
+    free(br->timers);
+    br->timers = timers;
+    br->timer_slots = slots;
+    return true;
+}
+
+static void free_timer_row(port_t *prt)
+{
+    prt->bridge->timer_row_port[prt->timer_row] = NULL;
+}
+
 static per_tree_port_t * create_ptp(tree_t *tree, port_t *prt)
 {
     /* Initialize all fields except anchors */
@@ -209,6 +835,8 @@ static per_tree_port_t * create_ptp(tree_t *tree, port_t *prt)
     ptp->port = prt;
     ptp->tree = tree;
     ptp->MSTID = tree->MSTID;
+    INIT_LIST_HEAD(&ptp->stale_list);
+    ptp->root_heap_pos = -1;
 
     ptp->state = BR_STATE_DISABLED;
     /* 0x80 = default port priority (17.14 of 802.1D) */
@@ -222,7 +850,54 @@ static per_tree_port_t * create_ptp(tree_t *tree, port_t *prt)
     ptp->calledFromFlushRoutine = false;
 
     ptp_default_internal_vars(ptp);
+    update_port_bits(ptp);
+
+    return ptp;
+}
+
+/* Link the new ptp of a port which is already in the bridge into the list
+ * of trees of the port, in MSTID order (13.26.20.f, see txMstpEncode), and
+ * into the list of ports of the tree, in the order of the bridge ports.
+ */
+static void link_ptp(per_tree_port_t *ptp)
+{
+    port_t *prt = ptp->port, *p;
+    tree_t *tree = ptp->tree;
+    per_tree_port_t *pos;
+    struct list_head *after = &tree->ports;
+
+    list_for_each_entry(pos, &prt->trees, port_list)
+        if(cmp(pos->MSTID, >, ptp->MSTID))
+            break;
+    list_add_tail(&ptp->port_list, &pos->port_list);
+
+    /* Look back, the previous port usually was the last one linked */
+    for(p = prt; p->br_list.prev != &prt->bridge->ports; )
+    {
+        p = list_entry(p->br_list.prev, port_t, br_list);
+        if(p->slot2ptp[tree->slot])
+        {
+            after = &p->slot2ptp[tree->slot]->tree_list;
+            break;
+        }
+    }
+    list_add(&ptp->tree_list, after);
+    prt->slot2ptp[tree->slot] = ptp;
+}
+
+/* Not in standard: give a port state in a sparse tree (see tree_t.sparse).
+ * The caller starts its state machines.
+ */
+static per_tree_port_t * add_ptp(tree_t *tree, port_t *prt)
+{
+    per_tree_port_t *ptp;
 
+    if(!(ptp = create_ptp(tree, prt)))
+        return NULL;
+    link_ptp(ptp);
+    tree->roles_rescan = true;
+    /* One more MSTI message in the BPDUs of the port */
+    tx_mark_port(prt);
     return ptp;
 }
 
@@ -235,9 +910,16 @@ bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr)
     /* Initialize all fields except sysdeps and anchor */
     INIT_LIST_HEAD(&br->ports);
     INIT_LIST_HEAD(&br->trees);
+    INIT_LIST_HEAD(&br->timer_ports);
+    br->timers = NULL;
+    br->timer_row_port = NULL;
+    br->timer_rows = 0;
+    br->timer_slots = TIMER_VEC_LANES; /* CIST */
     br->bridgeEnabled = false;
-    memset(br->vid2fid, 0, sizeof(br->vid2fid));
-    memset(br->fid2mstid, 0, sizeof(br->fid2mstid));
+    map_init(&br->vid2fid, MAX_VID);
+    map_init(&br->fid2mstid, MAX_FID);
+    memset(br->mstid2slot, NO_TREE_SLOT, sizeof(br->mstid2slot));
+    memset(br->slot2tree, 0, sizeof(br->slot2tree));
     assign(br->MstConfigId.s.selector, (__u8)0);
     sprintf((char *)br->MstConfigId.s.configuration_name,
             "%02hhX%02hhX%02hhX%02hhX%02hhX%02hhX",
@@ -253,13 +935,23 @@ bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr)
     assign(br->Migrate_Time, 3u); /* 17.14 of 802.1D */
     assign(br->Ageing_Time, 300u);/* 8.8.3 Table 8-3 */
     assign(br->Hello_Time, (__u8)2);     /* 17.14 of 802.1D */
+    assign(br->Forward_Delay_ms, 0u);
+    br->tick_interval = MSTP_TICK_MS_DEFAULT;
+    br->rx_fast_path = true;
+    br->lazy_msti_ports = false;
+    br->vlan_map_txn = false;
+    br->vlan_map_changed = false;
+    br->vlan_map_txn_start = 0;
 
     bridge_default_internal_vars(br);
 
     /* Create CIST */
     if(!(cist = create_tree(br, macaddr, 0)))
         return false;
+    cist->slot = 0;
     list_add_tail(&cist->bridge_list, &br->trees);
+    br->mstid2slot[0] = 0;
+    br->slot2tree[0] = cist;
 
     return true;
 }
@@ -268,10 +960,14 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
 {
     tree_t *tree;
     per_tree_port_t *ptp, *nxt;
+    port_t *p;
     bridge_t *br = prt->bridge;
+    unsigned int num_ports = 1;
 
     /* Initialize all fields except sysdeps and bridge */
     INIT_LIST_HEAD(&prt->trees);
+    INIT_LIST_HEAD(&prt->timer_list);
+    memset(prt->slot2ptp, 0, sizeof(prt->slot2ptp));
     prt->port_number = __cpu_to_be16(portno);
 
     assign(prt->AdminExternalPortPathCost, 0u);
@@ -281,7 +977,7 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
      * duplex is set to false (half) */
     prt->AdminP2P = p2pAuto;
     prt->operPointToPointMAC = false;
-    prt->portEnabled = false;
+    set_prt_flag(prt, portEnabled, false);
     prt->restrictedRole = false; /* 13.25.14 */
     prt->restrictedTcn = false; /* 13.25.15 */
     assign(prt->ExternalPortPathCost, MAX_PATH_COST); /* 13.37.1 */
@@ -292,26 +988,60 @@ bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno)
     prt->NetworkPort = false;
     prt->dontTxmtBpdu = false;
     prt->bpduFilterPort = false;
+    assign(prt->Hello_Time_ms, 0u);
+    assign(prt->rxLimitRate, 0u);
+    assign(prt->rxLimitBurst, 0u);
+    prt->rxLimitPolicy = rxLimitDrop;
+    prt->rxLimitError = false;
+    prt->txBpdu = NULL;
+    prt->txBpduRoom = 0;
+    prt->txBpduSize = 0;
+    prt->rcvdMstiMsgs = NULL;
+    prt->rcvdMstiMsgsRoom = 0;
+    prt->rcvdBpduNumOfMstis = 0;
     prt->deleted = false;
 
+    if(!alloc_timer_row(prt))
+        return false;
+
     port_default_internal_vars(prt);
 
-    /* Create PerTreePort structures for all existing trees */
+    /* Make room for the new port among the Root Port candidates */
+    FOREACH_PORT_IN_BRIDGE(p, br)
+        ++num_ports;
     FOREACH_TREE_IN_BRIDGE(tree, br)
     {
+        if(!reserve_root_heap(tree, num_ports)
+           || !reserve_port_bitmaps(tree, br->timer_rows))
+        {
+            free_timer_row(prt);
+            return false;
+        }
+    }
+
+    /* Create PerTreePort structures for all existing trees,
+     * but the sparse ones */
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+    {
+        if(tree->sparse)
+            continue;
         if(!(ptp = create_ptp(tree, prt)))
         {
             /* Remove and free all previously created entries in port's list */
             list_for_each_entry_safe(ptp, nxt, &prt->trees, port_list)
             {
+                clear_port_bits(ptp);
                 list_del(&ptp->port_list);
                 list_del(&ptp->tree_list);
                 free(ptp);
             }
+            free_timer_row(prt);
             return false;
         }
         list_add_tail(&ptp->port_list, &prt->trees);
         list_add_tail(&ptp->tree_list, &tree->ports);
+        prt->slot2ptp[tree->slot] = ptp;
+        tree->roles_rescan = true;
     }
 
     /* Add new port to the tail of the list in the bridge */
@@ -331,20 +1061,33 @@ void MSTP_IN_delete_port(port_t *prt)
     bridge_t *br = prt->bridge;
 
     prt->deleted = true;
-    if(prt->portEnabled)
+    if(PRT_FLAG(prt, portEnabled))
     {
-        prt->portEnabled = false;
+        set_prt_flag(prt, portEnabled, false);
         br_state_machines_run(br);
     }
 
     list_for_each_entry_safe(ptp, nxt, &prt->trees, port_list)
     {
+        root_heap_remove(ptp);
+        list_del(&ptp->stale_list);
+        clear_port_bits(ptp);
+        ptp->tree->roles_rescan = true;
         list_del(&ptp->port_list);
         list_del(&ptp->tree_list);
         free(ptp);
     }
 
     list_del(&prt->br_list);
+    list_del_init(&prt->timer_list);
+    free_timer_row(prt);
+    free(prt->rcvdMstiMsgs);
+    prt->rcvdMstiMsgs = NULL;
+    free(prt->txBpdu);
+    prt->txBpdu = NULL;
+    prt->txBpduRoom = 0;
+    if(prt->Hello_Time_ms)
+        recalc_tick_interval(br);
     br_state_machines_run(br);
 }
 
@@ -371,8 +1114,13 @@ void MSTP_IN_delete_bridge(bridge_t *br)
     list_for_each_entry_safe(tree, nxt_tree, &br->trees, bridge_list)
     {
         list_del(&tree->bridge_list);
-        free(tree);
+        free_tree(tree);
     }
+
+    free(br->timers);
+    free(br->timer_row_port);
+    map_free(&br->vid2fid);
+    map_free(&br->fid2mstid);
 }
 
 void MSTP_IN_set_bridge_address(bridge_t *br, __u8 *macaddr)
@@ -388,6 +1136,7 @@ void MSTP_IN_set_bridge_address(bridge_t *br, __u8 *macaddr)
         memcpy(tree->BridgeIdentifier.s.mac_address, macaddr, ETH_ALEN);
         tree->BridgePriority.RootID = tree->BridgePriority.RRootID =
             tree->BridgePriority.DesignatedBridgeID = tree->BridgeIdentifier;
+        updtPriorityKey(&tree->BridgePriority);
     }
 
     if(changed)
@@ -417,7 +1166,7 @@ void MSTP_IN_set_bridge_enable(bridge_t *br, bool up)
         /* NOTE: In the port_default_internal_vars() rapidAgeingWhile will be
          *  reset, so we should stop rapid ageing procedure here.
          */
-        if(prt->rapidAgeingWhile)
+        if(PRT_TIMER(prt, rapidAgeingWhile))
         {
             MSTP_OUT_set_ageing_time(prt, br->Ageing_Time);
         }
@@ -450,6 +1199,7 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
         if(prt->ExternalPortPathCost != new_ExternalPathCost)
         {
             assign(prt->ExternalPortPathCost, new_ExternalPathCost);
+            roles_mark_ptp(GET_CIST_PTP_FROM_PORT(prt));
             changed = true;
         }
         FOREACH_PTP_IN_PORT(ptp, prt)
@@ -460,6 +1210,7 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
             if(ptp->InternalPortPathCost != new_InternalPathCost)
             {
                 assign(ptp->InternalPortPathCost, new_InternalPathCost);
+                roles_mark_ptp(ptp);
                 changed = true;
             }
         }
@@ -483,9 +1234,9 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
             changed = true;
         }
 
-        if(!prt->portEnabled)
+        if(!PRT_FLAG(prt, portEnabled))
         {
-            prt->portEnabled = true;
+            set_prt_flag(prt, portEnabled, true);
             prt->BpduGuardError = false;
             prt->BaInconsistent = false;
             prt->num_rx_bpdu_filtered = 0;
@@ -493,6 +1244,14 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
             prt->num_rx_tcn = 0;
             prt->num_tx_bpdu = 0;
             prt->num_tx_tcn = 0;
+            prt->num_tx_deferred = 0;
+            prt->num_tx_coalesced = 0;
+            prt->num_tx_dropped = 0;
+            prt->num_rx_rate_limited = 0;
+            prt->num_rx_fast_path = 0;
+            prt->num_rx_unknown_msti = 0;
+            prt->rxLimitError = false;
+            rxLimitFill(prt);
             changed = true;
             /* When port is enabled, initialize bridge assurance timer,
              * so that enough time is given before port is put in
@@ -503,9 +1262,9 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
     }
     else
     {
-        if(prt->portEnabled)
+        if(PRT_FLAG(prt, portEnabled))
         {
-            prt->portEnabled = false;
+            set_prt_flag(prt, portEnabled, false);
             changed = true;
         }
     }
@@ -514,56 +1273,256 @@ void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex)
         br_state_machines_run(prt->bridge);
 }
 
-void MSTP_IN_one_second(bridge_t *br)
+void MSTP_IN_tick(bridge_t *br, unsigned int msec)
 {
-    port_t *prt;
+    port_t *prt, *nxt;
     tree_t *tree;
+    unsigned int seconds;
 
-    ++(br->uptime);
+    br->uptime_ms += msec;
+    seconds = br->uptime_ms / 1000;
+    br->uptime_ms %= 1000;
+    br->uptime += seconds;
 
     if(!br->bridgeEnabled)
         return;
 
-    FOREACH_TREE_IN_BRIDGE(tree, br)
-        if(!(tree->topology_change))
-            ++(tree->time_since_topology_change);
+    if(seconds)
+    {
+        FOREACH_TREE_IN_BRIDGE(tree, br)
+            if(!(tree->topology_change))
+                tree->time_since_topology_change += seconds;
+    }
 
-    FOREACH_PORT_IN_BRIDGE(prt, br)
+    /* No running timers - the tick can not change anything,
+     * state machines were already run to completion after the last event.
+     */
+    if(list_empty(&br->timer_ports))
+        return;
+
+    list_for_each_entry_safe(prt, nxt, &br->timer_ports, timer_list)
     {
-        PTSM_tick(prt);
-        /* support for rapid ageing */
-        if(prt->rapidAgeingWhile)
-        {
-            if((--(prt->rapidAgeingWhile)) == 0)
-            {
-                if(!prt->deleted)
-                    MSTP_OUT_set_ageing_time(prt, br->Ageing_Time);
-            }
-        }
+        /* Only the ports with running timers may change their state,
+         * PTSM_tick marks the state machines whose timers expired,
+         * crossed a tested value or were started since the last tick.
+         */
+        if(prt->rxSuppress)
+            rxSuppressRefresh(prt, msec);
+        if(!PTSM_tick(prt, msec))
+            list_del_init(&prt->timer_list);
     }
 
-    br_state_machines_run(br);
+    br_dirty_state_machines_run(br);
+}
+
+void MSTP_IN_one_second(bridge_t *br)
+{
+    MSTP_IN_tick(br, 1000);
+}
+
+unsigned int MSTP_IN_get_tick_interval(bridge_t *br)
+{
+    return br->tick_interval;
 }
 
 void MSTP_IN_all_fids_flushed(per_tree_port_t *ptp)
 {
     bridge_t *br = ptp->port->bridge;
-    ptp->fdbFlush = false;
+    set_ptp_flag(ptp, fdbFlush, false);
     if(!br->bridgeEnabled)
         return;
     if(!ptp->calledFromFlushRoutine)
     {
         TCSM_run(ptp, false /* actual run */);
-        br_state_machines_run(br);
+        sm_changed_ptp(ptp, SM_TCSM);
+        br_dirty_state_machines_run(br);
+    }
+}
+
+/* Not in standard: BPDU receive rate limit.
+ * The token bucket is refilled lazily from the monotonic clock when a BPDU
+ * arrives, so it costs nothing on the ports without traffic and does not
+ * depend on the tick interval. One BPDU takes 1000 tokens.
+ */
+
+static unsigned int rxLimitBucketSize(port_t *prt)
+{
+    return 1000u * (prt->rxLimitBurst ? prt->rxLimitBurst : prt->rxLimitRate);
+}
+
+static void rxLimitFill(port_t *prt)
+{
+    prt->rxLimitTokens = rxLimitBucketSize(prt);
+    prt->rxLimitStamp = MSTP_OUT_get_time_ms();
+    prt->rxLimitExceeded = false;
+}
+
+/* Called for every received BPDU before any other work is done on it.
+ * Returns false if the BPDU has to be discarded.
+ */
+bool MSTP_IN_rx_bpdu_admit(port_t *prt)
+{
+    unsigned int now, size;
+    __u64 tokens;
+
+    if(!prt->rxLimitRate)
+        return true;
+
+    now = MSTP_OUT_get_time_ms();
+    size = rxLimitBucketSize(prt);
+    tokens = prt->rxLimitTokens
+             + (__u64)(now - prt->rxLimitStamp) * prt->rxLimitRate;
+    prt->rxLimitTokens = (tokens < size) ? tokens : size;
+    prt->rxLimitStamp = now;
+
+    if(1000 <= prt->rxLimitTokens)
+    {
+        prt->rxLimitTokens -= 1000;
+        prt->rxLimitExceeded = false;
+        return true;
+    }
+
+    ++(prt->num_rx_rate_limited);
+    if(!prt->rxLimitExceeded)
+    {
+        prt->rxLimitExceeded = true;
+        ERROR_PRTNAME(prt, "BPDU receive rate %u/s exceeded",
+                      prt->rxLimitRate);
+    }
+
+    switch(prt->rxLimitPolicy)
+    {
+        case rxLimitErrdisable:
+            if(!prt->rxLimitError)
+            {
+                prt->rxLimitError = true;
+                ERROR_PRTNAME(prt, "BPDU receive rate exceeded - Port Down");
+                MSTP_OUT_shutdown_port(prt);
+            }
+            return false;
+        case rxLimitAlert:
+            return true;
+        case rxLimitDrop:
+        default:
+            return false;
+    }
+}
+
+/* Decode the parts of a valid BPDU the state machines read. The BPDU is
+ * read in place, only the CIST part is decoded here.
+ */
+static void rxDecode(rcvd_bpdu_t *msg, bpdu_t *bpdu, __u8 protocolVersion)
+{
+#define NEAREST_WHOLE_SECOND(msgTime)  \
+    ((128 > msgTime[1]) ? msgTime[0] : msgTime[0] + 1)
+
+    memset(msg, 0, sizeof(*msg));
+    msg->protocolVersion = protocolVersion;
+    msg->bpduType = bpdu->bpduType;
+    if(bpduTypeTCN == bpdu->bpduType)
+        return;
+
+    msg->flags = bpdu->flags;
+    assign(msg->cistRootID, bpdu->cistRootID);
+    assign(msg->cistExtRootPathCost, bpdu->cistExtRootPathCost);
+    assign(msg->cistRRootID, bpdu->cistRRootID);
+    assign(msg->cistPortID, bpdu->cistPortID);
+    msg->times.Forward_Delay = NEAREST_WHOLE_SECOND(bpdu->ForwardDelay);
+    msg->times.Max_Age = NEAREST_WHOLE_SECOND(bpdu->MaxAge);
+    msg->times.Message_Age = NEAREST_WHOLE_SECOND(bpdu->MessageAge);
+    msg->times.Hello_Time = NEAREST_WHOLE_SECOND(bpdu->HelloTime);
+    if(protoMSTP > protocolVersion)
+        return;
+
+    assign(msg->mstConfigurationIdentifier, bpdu->mstConfigurationIdentifier);
+    assign(msg->cistIntRootPathCost, bpdu->cistIntRootPathCost);
+    assign(msg->cistBridgeID, bpdu->cistBridgeID);
+    assign(msg->times.remainingHops, bpdu->cistRemainingHops);
+#undef NEAREST_WHOLE_SECOND
+}
+
+/* Not in standard: make room for num MSTI messages in rcvdMstiMsgs.
+ * The buffer only grows, and the messages the per-tree ports point to move
+ * along with it.
+ */
+static bool rcvdMstiMsgsReserve(port_t *prt, int num)
+{
+    msti_configuration_message_t *msgs, *old = prt->rcvdMstiMsgs;
+    per_tree_port_t *ptp;
+
+    if(num <= prt->rcvdMstiMsgsRoom)
+        return true;
+    if(!(msgs = malloc(num * sizeof(*msgs))))
+    {
+        ERROR_PRTNAME(prt, "Out of memory");
+        return false;
+    }
+    if(old)
+        memcpy(msgs, old, prt->rcvdMstiMsgsRoom * sizeof(*msgs));
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        if(ptp->rcvdMstiConfig && (ptp->rcvdMstiConfig >= old)
+           && (ptp->rcvdMstiConfig < old + prt->rcvdMstiMsgsRoom))
+            ptp->rcvdMstiConfig = msgs + (ptp->rcvdMstiConfig - old);
+        if(ptp->rxMstiMsg && (ptp->rxMstiMsg >= old)
+           && (ptp->rxMstiMsg < old + prt->rcvdMstiMsgsRoom))
+            ptp->rxMstiMsg = msgs + (ptp->rxMstiMsg - old);
+    }
+    free(old);
+    prt->rcvdMstiMsgs = msgs;
+    prt->rcvdMstiMsgsRoom = num;
+    return true;
+}
+
+/* Not in standard: find the message for each MSTI of the port in the
+ * received BPDU (rxMstiMsg), in one pass over the messages, so that
+ * setRcvdMsgs() does not have to search for them.
+ * A message from the region for a sparse MSTI the port has no state in
+ * gives the port its state there.
+ */
+static void rxIndexMstiMsgs(port_t *prt)
+{
+    per_tree_port_t *ptp;
+    tree_t *tree;
+    msti_configuration_message_t *msti_msg;
+    __u16 mstid;
+    int i;
+
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        ptp->rxMstiMsg = NULL;
+
+    for(i = 0, msti_msg = prt->rcvdMstiMsgs; i < prt->rcvdBpduNumOfMstis;
+        ++i, ++msti_msg)
+    {
+        mstid = __be16_to_cpu(msti_msg->mstiRRootID.s.priority) & 0x0FFF;
+        /* MSTID 0 would be the CIST */
+        if((0 == mstid) || !(tree = find_tree(prt->bridge, mstid)))
+        {
+            ++(prt->num_rx_unknown_msti);
+            continue;
+        }
+        if(!(ptp = prt->slot2ptp[tree->slot]))
+        {
+            if(!tree->sparse || !fromSameRegion(prt)
+               || !(ptp = add_ptp(tree, prt)))
+                continue;
+            ptp_state_machines_begin(ptp);
+        }
+        /* The first message for the MSTI wins */
+        if(!ptp->rxMstiMsg)
+            ptp->rxMstiMsg = msti_msg;
     }
 }
 
 /* NOTE: bpdu pointer is unaligned, but it works because
  * bpdu_t is packed. Don't try to cast bpdu to non-packed type ;)
+ * The BPDU is not modified, nor used after the return.
  */
 void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
 {
-    int mstis_size;
+    int mstis_size, num_mstis = 0;
+    __u8 protocolVersion;
+    rcvd_bpdu_t msg;
     bridge_t *br = prt->bridge;
 
     ++(prt->num_rx_bpdu);
@@ -591,7 +1550,16 @@ void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size)
         return;
     }
 
-    if(prt->rcvdBpdu)
+    /* Inside of a receive batch the previous BPDU for this port may still
+     * wait for the state machines, let them consume it first.
+     */
+    if(PRT_FLAG(prt, rcvdBpdu) && br->sm_pending)
+    {
+        br->sm_pending = false;
+        br_dirty_state_machines_run(br);
+    }
+
+    if(PRT_FLAG(prt, rcvdBpdu))
     {
         ERROR_PRTNAME(prt, "Port hasn't processed previous BPDU");
         return;
@@ -604,12 +1572,13 @@ bpdu_validation_failed:
         INFO_PRTNAME(prt, "BPDU validation failed");
         return;
     }
+    protocolVersion = bpdu->protocolVersion;
     switch(bpdu->bpduType)
     {
         case bpduTypeTCN:
             /* 14.4.b) */
             /* Valid TCN BPDU */
-            bpdu->protocolVersion = protoSTP;
+            protocolVersion = protoSTP;
             LOG_PRTNAME(prt, "received TCN BPDU");
             break;
         case bpduTypeConfig:
@@ -617,24 +1586,24 @@ bpdu_validation_failed:
             if(CONFIG_BPDU_SIZE > size)
                 goto bpdu_validation_failed;
             /* Valid Config BPDU */
-            bpdu->protocolVersion = protoSTP;
+            protocolVersion = protoSTP;
             LOG_PRTNAME(prt, "received Config BPDU%s",
                         (bpdu->flags & (1 << offsetTc)) ? ", tcFlag" : ""
                        );
             break;
         case bpduTypeRST:
-            if(protoRSTP == bpdu->protocolVersion)
+            if(protoRSTP == protocolVersion)
             { /* 14.4.c) */
                 if(RST_BPDU_SIZE > size)
                     goto bpdu_validation_failed;
                 /* Valid RST BPDU */
-                /* bpdu->protocolVersion = protoRSTP; */
+                /* protocolVersion = protoRSTP; */
                 LOG_PRTNAME(prt, "received RST BPDU%s",
                             (bpdu->flags & (1 << offsetTc)) ? ", tcFlag" : ""
                            );
                 break;
             }
-            if(protoMSTP > bpdu->protocolVersion)
+            if(protoMSTP > protocolVersion)
                 goto bpdu_validation_failed;
             /* Yes, 802.1Q-2005 says here to check if it contains
              * "35 or more octets", not 36! (see 14.4.d).1) )
@@ -650,49 +1619,324 @@ bpdu_validation_failed:
                || ((MAX_STANDARD_MSTIS * sizeof(msti_configuration_message_t))
                    < mstis_size)
                || (0 != (mstis_size % sizeof(msti_configuration_message_t)))
+               /* the MSTI messages must be in the frame */
+               || (MST_BPDU_SIZE_WO_MSTI_MSGS + mstis_size > size)
               )
             { /* 14.4.d) */
                 /* Valid RST BPDU */
-                bpdu->protocolVersion = protoRSTP;
+                protocolVersion = protoRSTP;
                 LOG_PRTNAME(prt, "received RST BPDU");
                 break;
             }
             /* 14.4.e) */
             /* Valid MST BPDU */
-            bpdu->protocolVersion = protoMSTP;
-            prt->rcvdBpduNumOfMstis = mstis_size
-                                      / sizeof(msti_configuration_message_t);
+            protocolVersion = protoMSTP;
+            num_mstis = mstis_size / sizeof(msti_configuration_message_t);
             LOG_PRTNAME(prt, "received MST BPDU%s with %d MSTIs",
                         (bpdu->flags & (1 << offsetTc)) ? ", tcFlag" : "",
-                        prt->rcvdBpduNumOfMstis
+                        num_mstis
                        );
             break;
         default:
             goto bpdu_validation_failed;
     }
 
-    if((protoSTP == bpdu->protocolVersion) && (bpduTypeTCN == bpdu->bpduType))
+    rxDecode(&msg, bpdu, protocolVersion);
+    if(bpduTypeTCN == msg.bpduType)
     {
         ++(prt->num_rx_tcn);
     }
     else
     {
-        if(bpdu->flags & (1 << offsetTc))
+        if(msg.flags & (1 << offsetTc))
             ++(prt->num_rx_tcn);
     }
 
-    assign(prt->rcvdBpduData, *bpdu);
-    prt->rcvdBpdu = true;
+    if((br->rx_suppress || br->rx_fast_path)
+       && rxSuppressCheck(prt, &msg, bpdu->mstConfiguration, num_mstis))
+        return;
+    if(!rcvdMstiMsgsReserve(prt, num_mstis))
+        return;
+    memcpy(&prt->rcvdBpduData, &msg, sizeof(msg));
+    /* Only the messages actually received */
+    memcpy(prt->rcvdMstiMsgs, bpdu->mstConfiguration,
+           num_mstis * sizeof(msti_configuration_message_t));
+    prt->rcvdBpduNumOfMstis = num_mstis;
+    rxIndexMstiMsgs(prt);
+    set_prt_flag(prt, rcvdBpdu, true);
 
     /* Reset bridge assurance on receipt of valid BPDU */
     if(prt->BaInconsistent)
     {
         prt->BaInconsistent = false;
         INFO_PRTNAME(prt, "Clear Bridge assurance inconsistency");
+        sm_mark_port(prt);
     }
     updtbrAssuRcvdInfoWhile(prt);
 
-    br_state_machines_run(br);
+    /* The BPDU is an input of this port's PRSM only, which in turn passes
+     * the messages to the trees they are for (setRcvdMsgs).
+     */
+    prt->sm_dirty |= SM_PORT_SMS;
+    if(br->rx_batch)
+        br->sm_pending = true;
+    else
+        br_dirty_state_machines_run(br);
+}
+
+/* Start a batch of received BPDUs: state machines are not run for each
+ * BPDU, but once in MSTP_IN_rx_batch_end().
+ */
+void MSTP_IN_rx_batch_begin(bridge_t *br)
+{
+    br->rx_batch = true;
+}
+
+void MSTP_IN_rx_batch_end(bridge_t *br)
+{
+    br->rx_batch = false;
+    if(br->sm_pending)
+    {
+        br->sm_pending = false;
+        br_dirty_state_machines_run(br);
+    }
+}
+
+/*
+ * Suppression of the unchanged periodic BPDUs (not in standard).
+ *
+ * In the steady state the designated port of the neighbour sends the same
+ * BPDU every Hello Time, and processing it only restarts the timers which
+ * age the received information. When a repeat of the previous BPDU is
+ * processed without any change to the protocol state of the port
+ * (portStateUnchanged), further repeats will not change it either, so the packet
+ * filter is asked to drop them. It remembers when it last dropped one;
+ * before the timers restarted by the BPDU expire, rxSuppressRefresh()
+ * restarts them as if that BPDU had been processed. Any other BPDU is
+ * passed through by the filter and turns the suppression off, as does any
+ * change of the port state.
+ *
+ * The same proof lets the repeats which still reach MSTP_IN_rx_bpdu() take
+ * a fast path (rx_fast_path): while the port is in the proven state, such a
+ * repeat only restarts the timers the proven one restarted, and the state
+ * machines are not run for it.
+ */
+
+#define SNAPSHOT_BR(type, name)  snap->name = br->name;
+#define SNAPSHOT_PRT(type, name) snap->name = prt->name;
+#define SNAPSHOT_PTP(type, name) snap->name = ptp->name;
+
+static void portStateSnapshot(port_t *prt, port_state_snapshot_t *snap)
+{
+    bridge_t *br = prt->bridge;
+    per_tree_port_t *ptp;
+
+    /* Zeroed padding, the snapshots are compared with memcmp() */
+    memset(snap, 0, sizeof(*snap));
+    BRIDGE_STATE_SNAPSHOT(SNAPSHOT_BR)
+    PORT_STATE_SNAPSHOT(SNAPSHOT_PRT)
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        ++(snap->num_trees);
+}
+
+static void ptpStateSnapshot(per_tree_port_t *ptp, ptp_state_snapshot_t *snap)
+{
+    memset(snap, 0, sizeof(*snap));
+    snap->rolesPending = ptp->tree->roles_rescan
+                         || !list_empty(&ptp->tree->stale_ports);
+    PTP_STATE_SNAPSHOT(SNAPSHOT_PTP)
+}
+
+/* Remember the state of the port in rxSuppressState */
+static void portStateSave(port_t *prt)
+{
+    per_tree_port_t *ptp;
+
+    portStateSnapshot(prt, &prt->rxSuppressState);
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        ptpStateSnapshot(ptp, &ptp->rxSuppressState);
+}
+
+/* Is the state of the port the one remembered in rxSuppressState?
+ * A per-tree port created since has no snapshot and never matches, one
+ * deleted since changes the number of trees.
+ */
+static bool portStateUnchanged(port_t *prt)
+{
+    port_state_snapshot_t snap;
+    ptp_state_snapshot_t ptp_snap;
+    per_tree_port_t *ptp;
+
+    portStateSnapshot(prt, &snap);
+    if(memcmp(&snap, &prt->rxSuppressState, sizeof(snap)))
+        return false;
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        ptpStateSnapshot(ptp, &ptp_snap);
+        if(memcmp(&ptp_snap, &ptp->rxSuppressState, sizeof(ptp_snap)))
+            return false;
+    }
+    return true;
+}
+
+/* Flags of the BPDUs which have an effect even when repeated */
+#define RX_SUPPRESS_NEVER_FLAGS \
+    ((1 << offsetTc) | (1 << offsetProposal) | (1 << offsetTcAck))
+
+static bool bpduSuppressible(rcvd_bpdu_t *msg,
+                             msti_configuration_message_t *msti_msgs,
+                             int num_mstis)
+{
+    int i;
+
+    if((bpduTypeTCN == msg->bpduType)
+       || (msg->flags & RX_SUPPRESS_NEVER_FLAGS))
+        return false;
+    for(i = 0; i < num_mstis; ++i)
+        if(msti_msgs[i].flags & RX_SUPPRESS_NEVER_FLAGS)
+            return false;
+    return true;
+}
+
+static void rxSuppressStop(port_t *prt)
+{
+    if(!prt->rxSuppress)
+        return;
+    prt->rxSuppress = false;
+    MSTP_OUT_set_rx_suppress(prt, false);
+}
+
+/* Restart the timers as the proven repeat did (PRSM RECEIVE and
+ * updtRcvdInfoWhile() of the PISM), without running the state machines.
+ */
+static void rxRepeatFastPath(port_t *prt)
+{
+    per_tree_port_t *ptp;
+
+    ++(prt->num_rx_fast_path);
+    updtbrAssuRcvdInfoWhile(prt);
+    set_prt_timer(prt, edgeDelayWhile,
+                  SECONDS_TO_MS(prt->bridge->Migrate_Time));
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        if(ptp->rcvdInfoRestarted)
+            updtRcvdInfoWhile(ptp);
+}
+
+/* Called for each valid BPDU, decoded to msg, before it is copied to
+ * rcvdBpduData. Returns true if the BPDU has been processed by the fast path.
+ */
+static bool rxSuppressCheck(port_t *prt, rcvd_bpdu_t *msg,
+                            msti_configuration_message_t *msti_msgs,
+                            int num_mstis)
+{
+    per_tree_port_t *ptp;
+
+    if(memcmp(msg, &prt->rcvdBpduData, sizeof(*msg))
+       || (num_mstis != prt->rcvdBpduNumOfMstis)
+       || memcmp(msti_msgs, prt->rcvdMstiMsgs,
+                 num_mstis * sizeof(msti_configuration_message_t))
+       || !bpduSuppressible(msg, msti_msgs, num_mstis))
+    {
+        prt->rxSuppressProbe = false;
+        prt->rxRepeatProven = false;
+        rxSuppressStop(prt);
+        return false;
+    }
+
+    /* With a BPDU waiting for the transmit hold count (txCount, not in
+     * the snapshot) the repeat may let it go out, so take the full path */
+    if(prt->bridge->rx_fast_path && prt->rxRepeatProven
+       && portStateUnchanged(prt)
+       && !PRT_ANY(prt, PRT_BIT(newInfo) | PRT_BIT(newInfoMsti)))
+    {
+        rxRepeatFastPath(prt);
+        return true;
+    }
+
+    prt->rxSuppressProbe = true;
+    prt->rxRepeatProven = false;
+    portStateSave(prt);
+    prt->rxSuppressTxCount = prt->txCount;
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        ptp->rcvdInfoRestarted = false;
+    return false;
+}
+
+/* Called after the state machines of the bridge have been run */
+static void rxSuppressUpdate(bridge_t *br)
+{
+    port_t *prt;
+
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(PRT_FLAG(prt, rcvdBpdu) || !(prt->rxSuppress || prt->rxSuppressProbe))
+            continue;
+        if(!portStateUnchanged(prt))
+        {
+            prt->rxSuppressProbe = false;
+            prt->rxRepeatProven = false;
+            rxSuppressStop(prt);
+            continue;
+        }
+        /* A repeat which made the port transmit is not proven either */
+        if(prt->rxSuppressProbe
+           && (prt->txCount != prt->rxSuppressTxCount))
+        {
+            prt->rxSuppressProbe = false;
+            continue;
+        }
+        if(prt->rxSuppressProbe)
+        {
+            prt->rxSuppressProbe = false;
+            prt->rxRepeatProven = true;
+            if(br->rx_suppress && !prt->rxSuppress
+               && PRT_FLAG(prt, portEnabled))
+            {
+                prt->rxSuppress = true;
+                MSTP_OUT_set_rx_suppress(prt, true);
+            }
+        }
+    }
+}
+
+/* What is left of a timer started to value age ms ago, 0 if it expired */
+static unsigned int agedTimerValue(unsigned int value, unsigned int age)
+{
+    return (value > age) ? (value - age) : 0;
+}
+
+/* Restart the timers the dropped repeats would have restarted, before they
+ * expire within the next msec milliseconds.
+ */
+static void rxSuppressRefresh(port_t *prt, unsigned int msec)
+{
+    per_tree_port_t *ptp;
+    unsigned int age, aged, helloMs = portHelloTimeMs(prt);
+    bool expiring;
+
+    expiring = (PRT_TIMER(prt, brAssuRcvdInfoWhile)
+                && (PRT_TIMER(prt, brAssuRcvdInfoWhile) <= msec))
+               || (PRT_TIMER(prt, edgeDelayWhile)
+                   && (PRT_TIMER(prt, edgeDelayWhile) <= msec));
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        if(ptp->rcvdInfoRestarted && PTP_TIMER(ptp, rcvdInfoWhile)
+           && PTP_TIMER(ptp, rcvdInfoWhile) <= msec)
+            expiring = true;
+    if(!expiring || !MSTP_OUT_get_rx_last_seen(prt, &age))
+        return;
+
+    /* Only ever later, through the usual helpers, so the tick sees them */
+    aged = agedTimerValue(3 * helloMs, age);
+    if(aged > PRT_TIMER(prt, brAssuRcvdInfoWhile))
+        set_prt_timer(prt, brAssuRcvdInfoWhile, aged);
+    aged = agedTimerValue(SECONDS_TO_MS(prt->bridge->Migrate_Time), age);
+    if(aged > PRT_TIMER(prt, edgeDelayWhile))
+        set_prt_timer(prt, edgeDelayWhile, aged);
+    aged = agedTimerValue(3 * helloMs, age);
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        if(ptp->rcvdInfoRestarted && PTP_TIMER(ptp, rcvdInfoWhile)
+           && (aged > PTP_TIMER(ptp, rcvdInfoWhile)))
+            set_ptp_timer(ptp, rcvdInfoWhile, aged);
 }
 
 /* 12.8.1.1 Read CIST Bridge Protocol Parameters */
@@ -726,6 +1970,11 @@ void MSTP_IN_get_cist_bridge_status(bridge_t *br, CIST_BridgeStatus *status)
     status->stp_enabled = br->stp_enabled;
     assign(status->bridge_hello_time, br->Hello_Time);
     assign(status->Ageing_Time, br->Ageing_Time);
+    assign(status->bridge_forward_delay_ms, br->Forward_Delay_ms);
+    assign(status->tick_interval, br->tick_interval);
+    status->vlan_map_txn = br->vlan_map_txn;
+    assign(status->vlan_map_txn_time,
+           (MSTP_OUT_get_time_ms() - br->vlan_map_txn_start) / 1000);
 }
 
 /* 12.8.1.2 Read MSTI Bridge Protocol Parameters */
@@ -846,6 +2095,19 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
         }
     }
 
+    if(cfg->set_bridge_forward_delay_ms && cfg->bridge_forward_delay_ms)
+    {
+        if((MIN_FORWARD_DELAY_MS > cfg->bridge_forward_delay_ms)
+           || (MAX_FORWARD_DELAY_MS < cfg->bridge_forward_delay_ms)
+           || (0 != cfg->bridge_forward_delay_ms % MSTP_TICK_MS_MIN))
+        {
+            ERROR_BRNAME(br, "Bridge Forward Delay in ms must be 0 or "
+                "between %u and %u, in steps of %u ms", MIN_FORWARD_DELAY_MS,
+                MAX_FORWARD_DELAY_MS, MSTP_TICK_MS_MIN);
+            r = -1;
+        }
+    }
+
     if(r)
         return r;
 
@@ -869,6 +2131,7 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
       )
     {
         br->ForceProtocolVersion = cfg->protocol_version;
+        tx_mark_bridge(br);
         changed = init = true;
     }
 
@@ -902,6 +2165,18 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
         }
     }
 
+    if(cfg->set_bridge_forward_delay_ms)
+    {
+        if(cfg->bridge_forward_delay_ms != br->Forward_Delay_ms)
+        {
+            INFO_BRNAME(br, "bridge forward delay ms new=%u, old=%u",
+                        cfg->bridge_forward_delay_ms, br->Forward_Delay_ms);
+            assign(br->Forward_Delay_ms, cfg->bridge_forward_delay_ms);
+            recalc_tick_interval(br);
+            changed = true;
+        }
+    }
+
     /* Thirdly, finalize changes */
     if(changedBridgeTimes)
     {
@@ -919,17 +2194,21 @@ int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg)
          */
             FOREACH_PTP_IN_TREE(ptp, tree)
             {
-                ptp->selected = false;
-                ptp->reselect = true;
+                set_ptp_flag(ptp, selected, false);
+                set_ptp_flag(ptp, reselect, true);
                 /* TODO: change this when Hello_Time will be configurable
                  *   per-port. For now, copy Bridge's Hello_Time
                  *   to the port's Hello_Time.
                  */
                 assign(ptp->portTimes.Hello_Time, br->Hello_Time);
+                roles_mark_ptp(ptp);
+                tx_mark_port(ptp->port);
             }
         }
     }
 
+    /* The state machines may be run only by the next event */
+    sm_mark_bridge(br);
     if(changed && br->bridgeEnabled)
     {
         if(init)
@@ -961,13 +2240,17 @@ int MSTP_IN_set_msti_bridge_config(tree_t *tree, __u8 bridge_priority)
     SET_PRIORITY_IN_IDENTIFIER(valuePri, tree->BridgeIdentifier);
     tree->BridgePriority.RootID = tree->BridgePriority.RRootID =
         tree->BridgePriority.DesignatedBridgeID = tree->BridgeIdentifier;
+    updtPriorityKey(&tree->BridgePriority);
+    tree->roles_rescan = true;
     /* 12.8.1.4.4 do not require reselect, but I think it is needed,
      *  because 12.8.1.3.4.c) requires it */
     FOREACH_PTP_IN_TREE(ptp, tree)
     {
-        ptp->selected = false;
-        ptp->reselect = true;
+        set_ptp_flag(ptp, selected, false);
+        set_ptp_flag(ptp, reselect, true);
     }
+    /* The state machines are run by the next event */
+    sm_mark_bridge(tree->bridge);
     return 0;
 }
 
@@ -991,18 +2274,19 @@ void MSTP_IN_get_cist_port_status(port_t *prt, CIST_PortStatus *status)
     assign(status->designated_regional_root, cist->portPriority.RRootID);
     assign(status->designated_internal_cost,
            __be32_to_cpu(cist->portPriority.IntRootPathCost));
-    status->tc_ack = prt->tcAck;
+    status->tc_ack = PRT_FLAG(prt, tcAck);
     assign(status->port_hello_time, cist->portTimes.Hello_Time);
+    assign(status->port_hello_time_ms, prt->Hello_Time_ms);
     status->admin_edge_port = prt->AdminEdgePort;
     status->auto_edge_port = prt->AutoEdge;
-    status->oper_edge_port = prt->operEdge;
-    status->enabled = prt->portEnabled;
+    status->oper_edge_port = PRT_FLAG(prt, operEdge);
+    status->enabled = PRT_FLAG(prt, portEnabled);
     status->admin_p2p = prt->AdminP2P;
     status->oper_p2p = prt->operPointToPointMAC;
     status->restricted_role = prt->restrictedRole;
     status->restricted_tcn = prt->restrictedTcn;
     status->role = cist->role;
-    status->disputed = cist->disputed;
+    status->disputed = PTP_FLAG(cist, disputed);
     assign(status->admin_internal_port_path_cost,
            cist->AdminInternalPortPathCost);
     assign(status->internal_port_path_cost, cist->InternalPortPathCost);
@@ -1018,12 +2302,21 @@ void MSTP_IN_get_cist_port_status(port_t *prt, CIST_PortStatus *status)
     status->num_tx_tcn = prt->num_tx_tcn;
     status->num_trans_fwd = prt->num_trans_fwd;
     status->num_trans_blk = prt->num_trans_blk;
-    status->rcvdBpdu = prt->rcvdBpdu;
-    status->rcvdRSTP = prt->rcvdRSTP;
-    status->rcvdSTP = prt->rcvdSTP;
-    status->rcvdTcAck = prt->rcvdTcAck;
-    status->rcvdTcn = prt->rcvdTcn;
-    status->sendRSTP = prt->sendRSTP;
+    status->num_tx_deferred = prt->num_tx_deferred;
+    status->num_tx_coalesced = prt->num_tx_coalesced;
+    status->num_tx_dropped = prt->num_tx_dropped;
+    status->bpdu_rx_rate = prt->rxLimitRate;
+    status->bpdu_rx_burst = prt->rxLimitBurst;
+    status->bpdu_rx_policy = prt->rxLimitPolicy;
+    status->bpdu_rx_rate_error = prt->rxLimitError;
+    status->num_rx_rate_limited = prt->num_rx_rate_limited;
+    status->num_rx_unknown_msti = prt->num_rx_unknown_msti;
+    status->rcvdBpdu = PRT_FLAG(prt, rcvdBpdu);
+    status->rcvdRSTP = PRT_FLAG(prt, rcvdRSTP);
+    status->rcvdSTP = PRT_FLAG(prt, rcvdSTP);
+    status->rcvdTcAck = PRT_FLAG(prt, rcvdTcAck);
+    status->rcvdTcn = PRT_FLAG(prt, rcvdTcn);
+    status->sendRSTP = PRT_FLAG(prt, sendRSTP);
 }
 
 /* 12.8.2.2 Read MSTI Port Parameters */
@@ -1043,7 +2336,27 @@ void MSTP_IN_get_msti_port_status(per_tree_port_t *ptp,
     assign(status->designated_bridge, ptp->portPriority.DesignatedBridgeID);
     assign(status->designated_port, ptp->portPriority.DesignatedPortID);
     status->role = ptp->role;
-    status->disputed = ptp->disputed;
+    status->disputed = PTP_FLAG(ptp, disputed);
+}
+
+void MSTP_IN_get_absent_msti_port_status(port_t *prt, tree_t *tree,
+                                         MSTI_PortStatus *status)
+{
+    /* What create_ptp() would start the port with, in the Disabled role */
+    status->uptime = 0;
+    status->state = BR_STATE_DISABLED;
+    status->port_id = __constant_cpu_to_be16(0x8000) | prt->port_number;
+    assign(status->admin_internal_port_path_cost, 0u);
+    assign(status->internal_port_path_cost,
+           compute_pcost(GET_PORT_SPEED(prt)));
+    assign(status->designated_regional_root, tree->BridgePriority.RRootID);
+    assign(status->designated_internal_cost,
+           __be32_to_cpu(tree->BridgePriority.IntRootPathCost));
+    assign(status->designated_bridge,
+           tree->BridgePriority.DesignatedBridgeID);
+    assign(status->designated_port, tree->BridgePriority.DesignatedPortID);
+    status->role = roleDisabled;
+    status->disputed = false;
 }
 
 /* 12.8.2.3 Set CIST port parameters */
@@ -1078,6 +2391,42 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
         }
     }
 
+    if(cfg->set_port_hello_time_ms && cfg->port_hello_time_ms)
+    {
+        if((MIN_HELLO_TIME_MS > cfg->port_hello_time_ms)
+           || (MAX_HELLO_TIME_MS < cfg->port_hello_time_ms)
+           || (0 != cfg->port_hello_time_ms % MSTP_TICK_MS_MIN))
+        {
+            ERROR_PRTNAME(prt, "Port Hello Time in ms must be 0 or "
+                "between %u and %u, in steps of %u ms", MIN_HELLO_TIME_MS,
+                MAX_HELLO_TIME_MS, MSTP_TICK_MS_MIN);
+            return -1;
+        }
+    }
+
+    if((cfg->set_bpdu_rx_rate && (MAX_BPDU_RX_RATE < cfg->bpdu_rx_rate))
+       || (cfg->set_bpdu_rx_burst && (MAX_BPDU_RX_RATE < cfg->bpdu_rx_burst)))
+    {
+        ERROR_PRTNAME(prt, "BPDU receive rate and burst must be between "
+                      "0 and %u", MAX_BPDU_RX_RATE);
+        return -1;
+    }
+
+    if(cfg->set_bpdu_rx_policy)
+    {
+        switch(cfg->bpdu_rx_policy)
+        {
+            case rxLimitDrop:
+            case rxLimitErrdisable:
+            case rxLimitAlert:
+                break;
+            default:
+                ERROR_PRTNAME(prt, "Invalid BPDU receive rate policy %d",
+                              cfg->bpdu_rx_policy);
+                return -1;
+        }
+    }
+
     /* Secondly, do set */
     changed = false;
 
@@ -1093,8 +2442,9 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
             changed = true;
             /* 12.8.2.3.4 */
             cist = GET_CIST_PTP_FROM_PORT(prt);
-            cist->selected = false;
-            cist->reselect = true;
+            set_ptp_flag(cist, selected, false);
+            set_ptp_flag(cist, reselect, true);
+            roles_mark_ptp(cist);
         }
     }
 
@@ -1145,6 +2495,7 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
         if(prt->restrictedRole != cfg->restricted_role)
         {
             prt->restrictedRole = cfg->restricted_role;
+            roles_mark_port(prt);
             changed = true;
         }
     }
@@ -1204,12 +2555,50 @@ int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg)
         }
     }
 
-    if(changed && prt->portEnabled)
-        br_state_machines_run(prt->bridge);
-
-    return 0;
-}
-
+    if(cfg->set_port_hello_time_ms)
+    {
+        if(prt->Hello_Time_ms != cfg->port_hello_time_ms)
+        {
+            INFO_PRTNAME(prt, "hello time ms new=%u, old=%u",
+                         cfg->port_hello_time_ms, prt->Hello_Time_ms);
+            assign(prt->Hello_Time_ms, cfg->port_hello_time_ms);
+            recalc_tick_interval(prt->bridge);
+            /* Do not wait for the old, longer period to expire */
+            if(PRT_TIMER(prt, helloWhen) > portHelloTimeMs(prt))
+                set_prt_timer(prt, helloWhen, portHelloTimeMs(prt));
+            changed = true;
+        }
+    }
+
+    if(cfg->set_bpdu_rx_rate || cfg->set_bpdu_rx_burst)
+    {
+        if(cfg->set_bpdu_rx_rate)
+            assign(prt->rxLimitRate, cfg->bpdu_rx_rate);
+        if(cfg->set_bpdu_rx_burst)
+            assign(prt->rxLimitBurst, cfg->bpdu_rx_burst);
+        INFO_PRTNAME(prt, "BPDU receive rate new=%u/s, burst %u",
+                     prt->rxLimitRate, prt->rxLimitBurst);
+        rxLimitFill(prt);
+    }
+
+    if(cfg->set_bpdu_rx_policy)
+    {
+        if(prt->rxLimitPolicy != cfg->bpdu_rx_policy)
+        {
+            prt->rxLimitPolicy = cfg->bpdu_rx_policy;
+            INFO_PRTNAME(prt, "BPDU receive rate policy new=%d",
+                         prt->rxLimitPolicy);
+        }
+    }
+
+    /* The state machines may be run only by the next event */
+    sm_mark_bridge(prt->bridge);
+    if(changed && PRT_FLAG(prt, portEnabled))
+        br_state_machines_run(prt->bridge);
+
+    return 0;
+}
+
 /* 12.8.2.4 Set MSTI port parameters */
 int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
 {
@@ -1245,6 +2634,7 @@ int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
         if(GET_PRIORITY_FROM_IDENTIFIER(ptp->portId) != valuePri)
         {
             SET_PRIORITY_IN_IDENTIFIER(valuePri, ptp->portId);
+            roles_mark_ptp(ptp);
             changed = true;
         }
     }
@@ -1258,15 +2648,18 @@ int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
         if(ptp->InternalPortPathCost != new_InternalPathCost)
         {
             assign(ptp->InternalPortPathCost, new_InternalPathCost);
+            roles_mark_ptp(ptp);
             changed = true;
         }
     }
 
-    if(changed && prt->portEnabled)
+    /* The state machines may be run only by the next event */
+    sm_mark_bridge(br);
+    if(changed && PRT_FLAG(prt, portEnabled))
     {
         /* 12.8.2.4.4 */
-        ptp->selected = false;
-        ptp->reselect = true;
+        set_ptp_flag(ptp, selected, false);
+        set_ptp_flag(ptp, reselect, true);
 
         br_state_machines_run(br);
     }
@@ -1274,22 +2667,73 @@ int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg)
     return 0;
 }
 
+per_tree_port_t *MSTP_IN_add_msti_port(port_t *prt, tree_t *tree)
+{
+    per_tree_port_t *ptp;
+
+    if((ptp = prt->slot2ptp[tree->slot]))
+        return ptp;
+    if(!(ptp = add_ptp(tree, prt)))
+        return NULL;
+    ptp_state_machines_begin(ptp);
+    br_state_machines_run(prt->bridge);
+    return ptp;
+}
+
 /* 12.8.2.5 Force BPDU Migration Check */
 int MSTP_IN_port_mcheck(port_t *prt)
 {
     bridge_t *br = prt->bridge;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
 
-    if(rstpVersion(br) && prt->portEnabled && br->bridgeEnabled)
+    if(rstpVersion(br) && PRT_FLAG(prt, portEnabled) && br->bridgeEnabled)
     {
-        prt->mcheck = true;
-        cist->proposing = true;
+        set_prt_flag(prt, mcheck, true);
+        set_ptp_flag(cist, proposing, true);
         br_state_machines_run(br);
     }
 
     return 0;
 }
 
+/* Not in standard: a sparse tree gets state for all the ports once some
+ * VLAN is allocated to it, and stays so (see tree_t.sparse) */
+static void populate_sparse_trees(bridge_t *br)
+{
+    const range_map_t *vid2fid = &br->vid2fid;
+    tree_t *tree;
+    port_t *prt;
+    unsigned int i;
+
+    for(i = 0; i < vid2fid->num_runs; ++i)
+    {
+        /* VID 0 is no VLAN */
+        if(map_run_end(vid2fid, i) <= 1)
+            continue;
+        tree = find_tree(br, map_get(&br->fid2mstid, vid2fid->runs[i].value));
+        if(!tree || !tree->sparse)
+            continue;
+        FOREACH_PORT_IN_BRIDGE(prt, br)
+        {
+            if(!prt->slot2ptp[tree->slot] && !add_ptp(tree, prt))
+                return;
+        }
+        tree->sparse = false;
+    }
+}
+
+static void vids2mstids_changed(bridge_t *br)
+{
+    if(br->vlan_map_txn)
+    {
+        br->vlan_map_changed = true;
+        return;
+    }
+    RecalcConfigDigest(br);
+    populate_sparse_trees(br);
+    br_state_machines_begin(br);
+}
+
 /* 12.10.3.8 Set VID to FID allocation */
 bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid)
 {
@@ -1302,12 +2746,16 @@ bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid)
     }
 
     vid2mstid_changed =
-        (br->fid2mstid[fid] != br->fid2mstid[br->vid2fid[vid]]);
-    br->vid2fid[vid] = fid;
+        (map_get(&br->fid2mstid, fid)
+         != map_get(&br->fid2mstid, map_get(&br->vid2fid, vid)));
+    if(!map_set(&br->vid2fid, vid, fid))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return false;
+    }
     if(vid2mstid_changed)
     {
-        RecalcConfigDigest(br);
-        br_state_machines_begin(br);
+        vids2mstids_changed(br);
     }
 
     return true;
@@ -1317,24 +2765,30 @@ bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid)
 bool MSTP_IN_set_all_vids2fids(bridge_t *br, __u16 *vids2fids)
 {
     bool vid2mstid_changed;
+    __u16 prev_fid;
     int vid;
 
     vid2mstid_changed = false;
     for(vid = 1; vid <= MAX_VID; ++vid)
     {
+        prev_fid = map_get(&br->vid2fid, vid);
         if(vids2fids[vid] > MAX_FID)
         { /* Incorrect value == keep prev value */
-            vids2fids[vid] = br->vid2fid[vid];
+            vids2fids[vid] = prev_fid;
             continue;
         }
-        if(br->fid2mstid[vids2fids[vid]] != br->fid2mstid[br->vid2fid[vid]])
+        if(map_get(&br->fid2mstid, vids2fids[vid])
+           != map_get(&br->fid2mstid, prev_fid))
             vid2mstid_changed = true;
     }
-    memcpy(br->vid2fid, vids2fids, sizeof(br->vid2fid));
+    if(!map_assign_array(&br->vid2fid, vids2fids))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return false;
+    }
     if(vid2mstid_changed)
     {
-        RecalcConfigDigest(br);
-        br_state_machines_begin(br);
+        vids2mstids_changed(br);
     }
 
     return true;
@@ -1343,45 +2797,29 @@ bool MSTP_IN_set_all_vids2fids(bridge_t *br, __u16 *vids2fids)
 /* 12.12.2.2 Set FID to MSTID allocation */
 bool MSTP_IN_set_fid2mstid(bridge_t *br, __u16 fid, __u16 mstid)
 {
-    tree_t *tree;
-    __be16 MSTID;
-    bool found;
-    int vid;
-
     if(fid > MAX_FID)
     {
         ERROR_BRNAME(br, "Bad FID(%hu)", fid);
         return false;
     }
 
-    MSTID = __cpu_to_be16(mstid);
-    found = false;
-    FOREACH_TREE_IN_BRIDGE(tree, br)
-    {
-        if(tree->MSTID == MSTID)
-        {
-            found = true;
-            break;
-        }
-    }
-    if(!found)
+    if(!find_tree(br, mstid))
     {
         ERROR_BRNAME(br, "MSTID(%hu) not found", mstid);
         return false;
     }
 
-    if(br->fid2mstid[fid] != MSTID)
+    if(map_get(&br->fid2mstid, fid) != mstid)
     {
-        br->fid2mstid[fid] = MSTID;
+        if(!map_set(&br->fid2mstid, fid, mstid))
+        {
+            ERROR_BRNAME(br, "Out of memory");
+            return false;
+        }
         /* check if there are VLANs using this FID */
-        for(vid = 1; vid <= MAX_VID; ++vid)
+        if(map_has_value(&br->vid2fid, fid))
         {
-            if(br->vid2fid[vid] == fid)
-            {
-                RecalcConfigDigest(br);
-                br_state_machines_begin(br);
-                break;
-            }
+            vids2mstids_changed(br);
         }
     }
 
@@ -1391,30 +2829,18 @@ bool MSTP_IN_set_fid2mstid(bridge_t *br, __u16 fid, __u16 mstid)
 /* Set all FID-to-MSTID mappings at once */
 bool MSTP_IN_set_all_fids2mstids(bridge_t *br, __u16 *fids2mstids)
 {
-    tree_t *tree;
-    __be16 MSTID[MAX_FID + 1];
-    bool found, vid2mstid_changed;
-    int fid, vid;
-    __be16 prev_vid2mstid[MAX_VID + 2];
+    range_map_t fid2mstid;
+    bool vid2mstid_changed;
+    unsigned int i;
+    int fid;
 
     for(fid = 0; fid <= MAX_FID; ++fid)
     {
         if(fids2mstids[fid] > MAX_MSTID)
         { /* Incorrect value == keep prev value */
-            fids2mstids[fid] = __be16_to_cpu(MSTID[fid] = br->fid2mstid[fid]);
-        }
-        else
-            MSTID[fid] = __cpu_to_be16(fids2mstids[fid]);
-        found = false;
-        FOREACH_TREE_IN_BRIDGE(tree, br)
-        {
-            if(tree->MSTID == MSTID[fid])
-            {
-                found = true;
-                break;
-            }
+            fids2mstids[fid] = map_get(&br->fid2mstid, fid);
         }
-        if(!found)
+        if(!find_tree(br, fids2mstids[fid]))
         {
             ERROR_BRNAME(br,
                 "Error allocating FID(%hu) to MSTID(%hu): MSTID not found",
@@ -1423,27 +2849,88 @@ bool MSTP_IN_set_all_fids2mstids(bridge_t *br, __u16 *fids2mstids)
         }
     }
 
-    for(vid = 1; vid <= MAX_VID; ++vid)
-        prev_vid2mstid[vid] = br->fid2mstid[br->vid2fid[vid]];
-    memcpy(br->fid2mstid, MSTID, sizeof(br->fid2mstid));
+    map_init(&fid2mstid, MAX_FID);
+    if(!map_assign_array(&fid2mstid, fids2mstids))
+    {
+        ERROR_BRNAME(br, "Out of memory");
+        return false;
+    }
+    /* Only the FIDs some VLANs use matter */
     vid2mstid_changed = false;
-    for(vid = 1; vid <= MAX_VID; ++vid)
+    for(i = 0; i < br->vid2fid.num_runs; ++i)
     {
-        if(prev_vid2mstid[vid] != br->fid2mstid[br->vid2fid[vid]])
+        if(map_get(&fid2mstid, br->vid2fid.runs[i].value)
+           != map_get(&br->fid2mstid, br->vid2fid.runs[i].value))
         {
             vid2mstid_changed = true;
             break;
         }
     }
+    map_free(&br->fid2mstid);
+    br->fid2mstid = fid2mstid;
     if(vid2mstid_changed)
     {
-        RecalcConfigDigest(br);
-        br_state_machines_begin(br);
+        vids2mstids_changed(br);
     }
 
     return true;
 }
 
+/* Get all VID-to-FID mappings at once, MAX_VID + 1 entries */
+void MSTP_IN_get_all_vids2fids(bridge_t *br, __u16 *vids2fids)
+{
+    map_get_array(&br->vid2fid, vids2fids);
+}
+
+/* Get all FID-to-MSTID mappings at once, MAX_FID + 1 entries */
+void MSTP_IN_get_all_fids2mstids(bridge_t *br, __u16 *fids2mstids)
+{
+    map_get_array(&br->fid2mstid, fids2mstids);
+}
+
+/* Not in standard: defer the consequences of the following changes of
+ * the VID-to-FID and FID-to-MSTID mappings to MSTP_IN_commit_vlan_map().
+ * The maps change at once, but the bridge keeps its MST Configuration
+ * Digest and its state machines run on until the commit.
+ * Transactions do not nest, and one left open stays open: committing a
+ * partial map on a timeout would be worse than not committing it.
+ */
+bool MSTP_IN_begin_vlan_map(bridge_t *br)
+{
+    if(br->vlan_map_txn)
+    {
+        ERROR_BRNAME(br, "VLAN map transaction is already open for %u s",
+                     (MSTP_OUT_get_time_ms() - br->vlan_map_txn_start) / 1000);
+        return false;
+    }
+    br->vlan_map_txn = true;
+    br->vlan_map_txn_start = MSTP_OUT_get_time_ms();
+    return true;
+}
+
+/* Recompute the digest once and, if the VID-to-MSTID mapping is not the
+ * same as at MSTP_IN_begin_vlan_map(), restart the state machines once */
+void MSTP_IN_commit_vlan_map(bridge_t *br)
+{
+    __u8 digest[sizeof(br->MstConfigId.s.configuration_digest)];
+
+    if(!br->vlan_map_txn)
+        return;
+    br->vlan_map_txn = false;
+    if(!br->vlan_map_changed)
+        return;
+    br->vlan_map_changed = false;
+
+    memcpy(digest, br->MstConfigId.s.configuration_digest, sizeof(digest));
+    RecalcConfigDigest(br);
+    /* Changed and changed back */
+    if(0 == memcmp(digest, br->MstConfigId.s.configuration_digest,
+                   sizeof(digest)))
+        return;
+    populate_sparse_trees(br);
+    br_state_machines_begin(br);
+}
+
 /* 12.12.1.1 Read MSTI List */
 bool MSTP_IN_get_mstilist(bridge_t *br, int *num_mstis, __u16 *mstids)
 {
@@ -1465,8 +2952,11 @@ bool MSTP_IN_get_mstilist(bridge_t *br, int *num_mstis, __u16 *mstids)
 bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid)
 {
     tree_t *tree, *tree_after, *new_tree;
-    per_tree_port_t *ptp, *nxt, *ptp_after, *new_ptp;
+    per_tree_port_t *ptp, *nxt, *new_ptp;
+    port_t *prt;
     int num_of_mstis;
+    unsigned int slot, num_ports;
+    __u64 used_slots;
     __be16 MSTID;
 
     if((mstid < 1) || (mstid > MAX_MSTID))
@@ -1475,23 +2965,25 @@ bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid)
         return false;
     }
 
+    if(find_tree(br, mstid))
+    {
+        INFO_BRNAME(br, "MSTID(%hu) is already in the list", mstid);
+        return true; /* yes, it is success */
+    }
+
     MSTID = __cpu_to_be16(mstid);
     /* Find place where to insert new MSTID.
-     * Also check if such MSTID is already in the list.
-     * Also count existing mstis.
+     * Also count existing mstis and collect the slots they take.
      */
     tree_after = NULL;
     num_of_mstis = 0;
+    used_slots = 0;
     FOREACH_TREE_IN_BRIDGE(tree, br)
     {
-        if(tree->MSTID == MSTID)
-        {
-            INFO_BRNAME(br, "MSTID(%hu) is already in the list", mstid);
-            return true; /* yes, it is success */
-        }
         if(cmp(tree->MSTID, <, MSTID))
             tree_after = tree;
         ++num_of_mstis;
+        used_slots |= 1ull << tree->slot;
     }
     /* Sanity check */
     if(NULL == tree_after)
@@ -1513,25 +3005,52 @@ bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid)
     tree = GET_CIST_TREE(br);
     if(!(new_tree=create_tree(br,tree->BridgeIdentifier.s.mac_address,MSTID)))
         return false;
+    /* There is a free slot, as the count of MSTIs was checked above */
+    for(slot = 1; used_slots & (1ull << slot); ++slot)
+        ;
+    new_tree->slot = slot;
+    /* No VLANs are allocated to the new MSTI yet */
+    new_tree->sparse = br->lazy_msti_ports;
+
+    /* Room for all the ports, also when the tree is sparse */
+    num_ports = 0;
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        ++num_ports;
+    if(!reserve_root_heap(new_tree, num_ports)
+       || !reserve_port_bitmaps(new_tree, br->timer_rows)
+       || ((br->timer_slots <= slot)
+           && !grow_timer_slots(br, (slot / TIMER_VEC_LANES + 1)
+                                    * TIMER_VEC_LANES)))
+    {
+        free_tree(new_tree);
+        return false;
+    }
 
-    FOREACH_PTP_IN_TREE(ptp_after, tree_after)
+    /* A sparse tree starts without ports */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
     {
-        if(!(new_ptp = create_ptp(new_tree, ptp_after->port)))
+        if(new_tree->sparse)
+            break;
+        if(!(new_ptp = create_ptp(new_tree, prt)))
         {
             /* Remove and free all previously created entries in tree's list */
             list_for_each_entry_safe(ptp, nxt, &new_tree->ports, tree_list)
             {
+                ptp->port->slot2ptp[slot] = NULL;
                 list_del(&ptp->port_list);
                 list_del(&ptp->tree_list);
                 free(ptp);
             }
+            free_tree(new_tree);
             return false;
         }
-        list_add(&new_ptp->port_list, &ptp_after->port_list);
-        list_add_tail(&new_ptp->tree_list, &new_tree->ports);
+        link_ptp(new_ptp);
     }
 
     list_add(&new_tree->bridge_list, &tree_after->bridge_list);
+    br->mstid2slot[mstid] = slot;
+    br->slot2tree[slot] = new_tree;
+    tx_mark_bridge(br);
     /* There are no FIDs allocated to this MSTID, so VID-to-MSTID mapping
      *  did not change. So, no need in RecalcConfigDigest.
      * Just initialize state machines for this tree.
@@ -1545,9 +3064,7 @@ bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid)
 {
     tree_t *tree;
     per_tree_port_t *ptp, *nxt;
-    int fid;
-    bool found;
-    __be16 MSTID = __cpu_to_be16(mstid);
+    unsigned int timer;
 
     if((mstid < 1) || (mstid > MAX_MSTID))
     {
@@ -1556,40 +3073,37 @@ bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid)
     }
 
     /* Check if there are FIDs associated with this MSTID */
-    for(fid = 0; fid <= MAX_FID; ++fid)
+    if(map_has_value(&br->fid2mstid, mstid))
     {
-        if(br->fid2mstid[fid] == MSTID)
-        {
-            ERROR_BRNAME(br,
-                "Can't delete MSTID(%hu): there are FIDs allocated to it",
-                mstid);
-            return false;
-        }
+        ERROR_BRNAME(br,
+            "Can't delete MSTID(%hu): there are FIDs allocated to it",
+            mstid);
+        return false;
     }
 
-    found = false;
-    FOREACH_TREE_IN_BRIDGE(tree, br)
-    {
-        if(tree->MSTID == MSTID)
-        {
-            found = true;
-            break;
-        }
-    }
-    if(!found)
+    if(!(tree = find_tree(br, mstid)))
     {
         INFO_BRNAME(br, "MSTID(%hu) is not in the list", mstid);
         return true; /* yes, it is success */
     }
 
     list_del(&tree->bridge_list);
+    br->mstid2slot[mstid] = NO_TREE_SLOT;
+    br->slot2tree[tree->slot] = NULL;
     list_for_each_entry_safe(ptp, nxt, &tree->ports, tree_list)
     {
+        /* The tick counts on the zeroed timers of the unused slots */
+        for(timer = 0; timer < NUM_PTP_TIMERS; ++timer)
+            port_timers(ptp->port)->ptp[timer * br->timer_slots
+                                        + tree->slot] = 0;
+        ptp->port->timer_started &= ~(1ull << tree->slot);
+        ptp->port->slot2ptp[tree->slot] = NULL;
         list_del(&ptp->port_list);
         list_del(&ptp->tree_list);
         free(ptp);
     }
-    free(tree);
+    free_tree(tree);
+    tx_mark_bridge(br);
 
     /* There are no FIDs allocated to this MSTID, so VID-to-MSTID mapping
      *  did not change. So, no need in RecalcConfigDigest.
@@ -1620,6 +3134,7 @@ void MSTP_IN_set_mst_config_id(bridge_t *br, __u16 revision, __u8 *name)
         strncpy((char *)br->MstConfigId.s.configuration_name, (char *)name,
                 sizeof(br->MstConfigId.s.configuration_name));
 #pragma GCC diagnostic pop
+        tx_mark_bridge(br);
         br_state_machines_begin(br);
     }
 }
@@ -1654,7 +3169,7 @@ static void set_TopologyChange(tree_t *tree, bool hint_SetToYes, port_t *port)
     tree->topology_change = false;
     FOREACH_PTP_IN_TREE(ptp, tree)
     {
-        if(0 != ptp->tcWhile)
+        if(0 != PTP_TIMER(ptp, tcWhile))
         {
             tree->topology_change = true;
             tree->time_since_topology_change = 0;
@@ -1663,6 +3178,39 @@ static void set_TopologyChange(tree_t *tree, bool hint_SetToYes, port_t *port)
     }
 }
 
+/* Aux functions, not in standard.
+ * Priority vectors are compared a lot: on every received BPDU in rcvInfo()
+ * and for every port in updtRolesTree(). Instead of comparing the big-endian
+ * fields one by one, compare the host order key kept in the vector.
+ */
+static void updtPriorityKey(port_priority_vector_t *vec)
+{
+    __u64 dbid = __be64_to_cpu(vec->DesignatedBridgeID.u);
+
+    vec->key[0] = __be64_to_cpu(vec->RootID.u);
+    vec->key[1] = __be32_to_cpu(vec->ExtRootPathCost);
+    vec->key[2] = __be64_to_cpu(vec->RRootID.u);
+    vec->key[3] = ((__u64)__be32_to_cpu(vec->IntRootPathCost) << 32)
+                  | (dbid >> 32);
+    vec->key[4] = (dbid << 32)
+                  | ((__u64)__be16_to_cpu(vec->DesignatedPortID) << 16);
+}
+
+/* Returns <0 if vec1 is better, >0 if it is worse and 0 if it is the same */
+static inline int cmpPriorityKey(port_priority_vector_t *vec1,
+                                 port_priority_vector_t *vec2,
+                                 bool cist)
+{
+    unsigned int i;
+
+    for(i = cist ? 0 : 2; i < COUNT_OF(vec1->key); ++i)
+    {
+        if(vec1->key[i] != vec2->key[i])
+            return (vec1->key[i] < vec2->key[i]) ? -1 : 1;
+    }
+    return 0;
+}
+
 /* Helper functions, compare two priority vectors */
 static bool samePriorityAndTimers(port_priority_vector_t *vec1,
                                   port_priority_vector_t *vec2,
@@ -1680,26 +3228,12 @@ static bool samePriorityAndTimers(port_priority_vector_t *vec1,
             return false;
         if(cmp(time1->Hello_Time, !=, time2->Hello_Time))
             return false;
-
-        if(cmp(vec1->RootID, !=, vec2->RootID))
-            return false;
-        if(cmp(vec1->ExtRootPathCost, !=, vec2->ExtRootPathCost))
-            return false;
     }
 
     if(cmp(time1->remainingHops, !=, time2->remainingHops))
         return false;
 
-    if(cmp(vec1->RRootID, !=, vec2->RRootID))
-        return false;
-    if(cmp(vec1->IntRootPathCost, !=, vec2->IntRootPathCost))
-        return false;
-    if(cmp(vec1->DesignatedBridgeID, !=, vec2->DesignatedBridgeID))
-        return false;
-    if(cmp(vec1->DesignatedPortID, !=, vec2->DesignatedPortID))
-        return false;
-
-    return true;
+    return 0 == cmpPriorityKey(vec1, vec2, cist);
 }
 
 static bool betterorsamePriority(port_priority_vector_t *vec1,
@@ -1708,47 +3242,11 @@ static bool betterorsamePriority(port_priority_vector_t *vec1,
                                  port_identifier_t pId2,
                                  bool cist)
 {
-    int result;
+    int result = cmpPriorityKey(vec1, vec2, cist);
 
-    if(cist)
-    {
-        if(0 < (result = _ncmp(vec1->RootID, vec2->RootID)))
-            return false; /* worse */
-        else if(0 > result)
-            return true; /* better */
-        /* The same. Check further. */
-        if(0 < (result = _ncmp(vec1->ExtRootPathCost, vec2->ExtRootPathCost)))
-            return false; /* worse */
-        else if(0 > result)
-            return true; /* better */
-        /* The same. Check further. */
-    }
-
-    if(0 < (result = _ncmp(vec1->RRootID, vec2->RRootID)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
-    if(0 < (result = _ncmp(vec1->IntRootPathCost, vec2->IntRootPathCost)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
-    if(0 < (result = _ncmp(vec1->DesignatedBridgeID, vec2->DesignatedBridgeID)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
-    if(0 < (result = _ncmp(vec1->DesignatedPortID, vec2->DesignatedPortID)))
-        return false; /* worse */
-    else if(0 > result)
-        return true; /* better */
-    /* The same. Check further. */
-
-    /* Port ID is a tie-breaker */
+    if(0 != result)
+        return 0 > result; /* better or worse */
+    /* The same. Port ID is a tie-breaker */
     return cmp(pId1, <=, pId2);
 }
 
@@ -1774,13 +3272,13 @@ static bool clearAllRcvdMsgs(port_t *prt, bool dry_run)
     if(dry_run)
     {
         FOREACH_PTP_IN_PORT(ptp, prt)
-            if(ptp->rcvdMsg)
+            if(PTP_FLAG(ptp, rcvdMsg))
                 return true;
         return false;
     }
 
     FOREACH_PTP_IN_PORT(ptp, prt)
-        ptp->rcvdMsg = false;
+        set_ptp_flag(ptp, rcvdMsg, false);
 
     return false;
 }
@@ -1791,14 +3289,14 @@ static void clearReselectTree(tree_t *tree)
     per_tree_port_t *ptp;
 
     FOREACH_PTP_IN_TREE(ptp, tree)
-        ptp->reselect = false;
+        set_ptp_flag(ptp, reselect, false);
 }
 
 /* 13.26.4 fromSameRegion */
 static bool fromSameRegion(port_t *prt)
 {
     /* Check for rcvdRSTP is superfluous here */
-    if((protoMSTP > prt->rcvdBpduData.protocolVersion)/* || (!prt->rcvdRSTP)*/)
+    if((protoMSTP > prt->rcvdBpduData.protocolVersion)/* || (!PRT_FLAG(prt, rcvdRSTP))*/)
         return false;
     return cmp(prt->bridge->MstConfigId,
                ==, prt->rcvdBpduData.mstConfigurationIdentifier);
@@ -1807,29 +3305,30 @@ static bool fromSameRegion(port_t *prt)
 /* 13.26.5 newTcWhile */
 static void newTcWhile(per_tree_port_t *ptp)
 {
-    if(0 != ptp->tcWhile)
+    if(0 != PTP_TIMER(ptp, tcWhile))
         return;
 
     tree_t *tree = ptp->tree;
     port_t *prt = ptp->port;
 
-    if(prt->sendRSTP)
+    if(PRT_FLAG(prt, sendRSTP))
     {
-        per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
-
-        ptp->tcWhile = cist->portTimes.Hello_Time + 1;
+        /* HelloTime + 1 second */
+        set_ptp_timer(ptp, tcWhile, portHelloTimeMs(prt) + 1000);
         set_TopologyChange(tree, true, prt);
 
         if(0 == ptp->MSTID)
-            prt->newInfo = true;
+            set_prt_flag(prt, newInfo, true);
         else
-            prt->newInfoMsti = true;
+            set_prt_flag(prt, newInfoMsti, true);
         return;
     }
 
     times_t *times = &tree->rootTimes;
 
-    ptp->tcWhile = times->Max_Age + times->Forward_Delay;
+    set_ptp_timer(ptp, tcWhile, SECONDS_TO_MS(times->Max_Age)
+                                 + fwdDelayMs(prt->bridge,
+                                              times->Forward_Delay));
     set_TopologyChange(tree, true, prt);
 }
 
@@ -1843,13 +3342,13 @@ static port_info_t rcvInfo(per_tree_port_t *ptp)
     port_priority_vector_t *mPri = &(ptp->msgPriority);
     times_t *mTimes = &(ptp->msgTimes);
     port_t *prt = ptp->port;
-    bpdu_t *b = &(prt->rcvdBpduData);
+    rcvd_bpdu_t *b = &(prt->rcvdBpduData);
 
     if(bpduTypeTCN == b->bpduType)
     {
-        prt->rcvdTcn = true;
+        set_prt_flag(prt, rcvdTcn, true);
         FOREACH_PTP_IN_PORT(ptp_1, prt)
-            ptp_1->rcvdTc = true;
+            set_ptp_flag(ptp_1, rcvdTc, true);
         return OtherInfo;
     }
 
@@ -1900,13 +3399,8 @@ static port_info_t rcvInfo(per_tree_port_t *ptp)
         assign(mPri->DesignatedPortID, b->cistPortID);
         assign(mPri->RootID, b->cistRootID);
         assign(mPri->ExtRootPathCost, b->cistExtRootPathCost);
-        /* messageTimes */
-#define NEAREST_WHOLE_SECOND(msgTime)  \
-    ((128 > msgTime[1]) ? msgTime[0] : msgTime[0] + 1)
-        mTimes->Forward_Delay = NEAREST_WHOLE_SECOND(b->ForwardDelay);
-        mTimes->Max_Age = NEAREST_WHOLE_SECOND(b->MaxAge);
-        mTimes->Message_Age = NEAREST_WHOLE_SECOND(b->MessageAge);
-        mTimes->Hello_Time = NEAREST_WHOLE_SECOND(b->HelloTime);
+        /* messageTimes, rounded to whole seconds by rxDecode() */
+        assign(*mTimes, b->times);
         if(protoMSTP > b->protocolVersion)
         { /* STP Configuration BPDU or RST BPDU */
             assign(mPri->IntRootPathCost, __constant_cpu_to_be32(0));
@@ -1918,8 +3412,7 @@ static port_info_t rcvInfo(per_tree_port_t *ptp)
         { /* MST BPDU */
             assign(mPri->IntRootPathCost, b->cistIntRootPathCost);
             assign(mPri->DesignatedBridgeID, b->cistBridgeID);
-            /* messageTimes.remainingHops */
-            assign(mTimes->remainingHops, b->cistRemainingHops);
+            /* messageTimes.remainingHops is already there */
         }
     }
     else
@@ -1956,6 +3449,7 @@ static port_info_t rcvInfo(per_tree_port_t *ptp)
         assign(mTimes->remainingHops, msti_msg->remainingHops);
     }
 
+    updtPriorityKey(mPri);
     msg_Better_port = !betterorsamePriority(&(ptp->portPriority), mPri,
                                             0, 0, cist);
     if(roleIsDesignated)
@@ -2010,7 +3504,7 @@ static void recordAgreement(per_tree_port_t *ptp)
     bool cist_agreed, cist_proposing;
     per_tree_port_t *cist;
     port_t *prt = ptp->port;
-    bpdu_t *b = &(prt->rcvdBpduData);
+    rcvd_bpdu_t *b = &(prt->rcvdBpduData);
 
     if(0 == ptp->MSTID)
     { /* CIST */
@@ -2018,18 +3512,18 @@ static void recordAgreement(per_tree_port_t *ptp)
            && (b->flags & (1 << offsetAgreement))
           )
         {
-            ptp->agreed = true;
-            ptp->proposing = false;
+            set_ptp_flag(ptp, agreed, true);
+            set_ptp_flag(ptp, proposing, false);
         }
         else
-            ptp->agreed = false;
-        cist_agreed = ptp->agreed;
-        cist_proposing = ptp->proposing;
-        if(!prt->rcvdInternal)
+            set_ptp_flag(ptp, agreed, false);
+        cist_agreed = PTP_FLAG(ptp, agreed);
+        cist_proposing = PTP_FLAG(ptp, proposing);
+        if(!PRT_FLAG(prt, rcvdInternal))
             list_for_each_entry_continue(ptp, &prt->trees, port_list)
             {
-                ptp->agreed = cist_agreed;
-                ptp->proposing = cist_proposing;
+                set_ptp_flag(ptp, agreed, cist_agreed);
+                set_ptp_flag(ptp, proposing, cist_proposing);
             }
         return;
     }
@@ -2042,11 +3536,11 @@ static void recordAgreement(per_tree_port_t *ptp)
        && (ptp->rcvdMstiConfig->flags & (1 << offsetAgreement))
       )
     {
-        ptp->agreed = true;
-        ptp->proposing = false;
+        set_ptp_flag(ptp, agreed, true);
+        set_ptp_flag(ptp, proposing, false);
     }
     else
-        ptp->agreed = false;
+        set_ptp_flag(ptp, agreed, false);
 }
 
 /* 13.26.8 recordDispute */
@@ -2068,13 +3562,13 @@ static void recordDispute(per_tree_port_t *ptp)
          */
         if(prt->rcvdBpduData.flags & (1 << offsetLearnig))
         {
-            ptp->disputed = true;
-            ptp->agreed = false;
-            if(!prt->rcvdInternal)
+            set_ptp_flag(ptp, disputed, true);
+            set_ptp_flag(ptp, agreed, false);
+            if(!PRT_FLAG(prt, rcvdInternal))
                 list_for_each_entry_continue(ptp, &prt->trees, port_list)
                 {
-                    ptp->disputed = true;
-                    ptp->agreed = false;
+                    set_ptp_flag(ptp, disputed, true);
+                    set_ptp_flag(ptp, agreed, false);
                 }
         }
         return;
@@ -2082,8 +3576,8 @@ static void recordDispute(per_tree_port_t *ptp)
     /* MSTI */
     if(ptp->rcvdMstiConfig->flags & (1 << offsetLearnig))
     {
-        ptp->disputed = true;
-        ptp->agreed = false;
+        set_ptp_flag(ptp, disputed, true);
+        set_ptp_flag(ptp, agreed, false);
     }
 }
 
@@ -2094,14 +3588,15 @@ static void recordMastered(per_tree_port_t *ptp)
 
     if(0 == ptp->MSTID)
     { /* CIST */
-        if(!prt->rcvdInternal)
+        if(!PRT_FLAG(prt, rcvdInternal))
             list_for_each_entry_continue(ptp, &prt->trees, port_list)
-                ptp->mastered = false;
+                set_ptp_flag(ptp, mastered, false);
         return;
     }
     /* MSTI */
-    ptp->mastered = prt->operPointToPointMAC
-                    && (ptp->rcvdMstiConfig->flags & (1 << offsetMaster));
+    set_ptp_flag(ptp, mastered,
+                 prt->operPointToPointMAC
+                 && (ptp->rcvdMstiConfig->flags & (1 << offsetMaster)));
 }
 
 /* 13.26.f) recordPriority */
@@ -2129,16 +3624,16 @@ static void recordProposal(per_tree_port_t *ptp)
     { /* CIST */
         prt = ptp->port;
         if(prt->rcvdBpduData.flags & (1 << offsetProposal))
-            ptp->proposed = true;
-        cist_proposed = ptp->proposed;
-        if(!prt->rcvdInternal)
+            set_ptp_flag(ptp, proposed, true);
+        cist_proposed = PTP_FLAG(ptp, proposed);
+        if(!PRT_FLAG(prt, rcvdInternal))
             list_for_each_entry_continue(ptp, &prt->trees, port_list)
-                ptp->proposed = cist_proposed;
+                set_ptp_flag(ptp, proposed, cist_proposed);
         return;
     }
     /* MSTI */
     if(ptp->rcvdMstiConfig->flags & (1 << offsetProposal))
-        ptp->proposed = true;
+        set_ptp_flag(ptp, proposed, true);
 }
 
 /* 13.26.11 recordTimes */
@@ -2163,9 +3658,9 @@ static void set_fdbFlush(per_tree_port_t *ptp)
 {
     port_t *prt = ptp->port;
 
-    if(prt->operEdge || prt->deleted)
+    if(PRT_FLAG(prt, operEdge) || prt->deleted)
     {
-        ptp->fdbFlush = false;
+        set_ptp_flag(ptp, fdbFlush, false);
         return;
     }
 
@@ -2173,7 +3668,7 @@ static void set_fdbFlush(per_tree_port_t *ptp)
 
     if(rstpVersion(br))
     {
-        ptp->fdbFlush = true;
+        set_ptp_flag(ptp, fdbFlush, true);
         ptp->calledFromFlushRoutine = true;
         MSTP_OUT_flush_all_fids(ptp);
         ptp->calledFromFlushRoutine = false;
@@ -2184,20 +3679,16 @@ static void set_fdbFlush(per_tree_port_t *ptp)
         unsigned int FwdDelay = cist->designatedTimes.Forward_Delay;
         /* Initiate rapid ageing */
         MSTP_OUT_set_ageing_time(prt, FwdDelay);
-        assign(prt->rapidAgeingWhile, FwdDelay);
-        ptp->fdbFlush = false;
+        set_prt_timer(prt, rapidAgeingWhile, SECONDS_TO_MS(FwdDelay));
+        set_ptp_flag(ptp, fdbFlush, false);
     }
 }
 
 /* 13.26.12 setRcvdMsgs */
 static void setRcvdMsgs(port_t *prt)
 {
-    msti_configuration_message_t *msti_msg;
-    int i;
-    __be16 msg_MSTID;
-    bool found;
     per_tree_port_t *ptp = GET_CIST_PTP_FROM_PORT(prt);
-    ptp->rcvdMsg = true;
+    set_ptp_flag(ptp, rcvdMsg, true);
 
     /* 802.1Q-2005 says:
      *   "Make the received CST or CIST message available to the CIST Port
@@ -2205,38 +3696,27 @@ static void setRcvdMsgs(port_t *prt)
      * No need to do something special here, we already have rcvdBpduData.
      */
 
-    if(prt->rcvdInternal)
+    if(PRT_FLAG(prt, rcvdInternal))
     {
         list_for_each_entry_continue(ptp, &prt->trees, port_list)
         {
-            found = false;
-            /* Find if message for this MSTI is conveyed in the BPDU */
-            for(i = 0, msti_msg = prt->rcvdBpduData.mstConfiguration;
-                i < prt->rcvdBpduNumOfMstis;
-                ++i, ++msti_msg)
-            {
-                msg_MSTID = msti_msg->mstiRRootID.s.priority
-                            & __constant_cpu_to_be16(0x0FFF);
-                if(msg_MSTID == ptp->MSTID)
-                {
-                    found = true;
-                    break;
-                }
-            }
-            if(found)
+            /* The message for this MSTI, if conveyed in the BPDU, has been
+             * found by rxIndexMstiMsgs() */
+            if(ptp->rxMstiMsg)
             {
-                ptp->rcvdMsg = true;
+                set_ptp_flag(ptp, rcvdMsg, true);
+                sm_mark_ptp(ptp, SM_PISM);
                 /* 802.1Q-2005 says:
                  *   "Make available each MSTI message and the common parts of
                  *    the CIST message priority (the CIST Root Identifier,
                  *    External Root Path Cost and Regional Root Identifier)
                  *    to the Port Information state machine for that MSTI"
                  * We set pointer to the MSTI configuration message for
-                 * fast access, while do not anything special for common
-                 * parts of the message, as the whole message is available
+                 * fast access, while nothing special is done for the common
+                 * parts of the message, as they are available
                  * in rcvdBpduData.
                  */
-                ptp->rcvdMstiConfig = msti_msg;
+                ptp->rcvdMstiConfig = ptp->rxMstiMsg;
             }
         }
     }
@@ -2248,7 +3728,10 @@ static void setReRootTree(tree_t *tree)
     per_tree_port_t *ptp;
 
     FOREACH_PTP_IN_TREE(ptp, tree)
-        ptp->reRoot = true;
+    {
+        set_ptp_flag(ptp, reRoot, true);
+        sm_mark_ptp(ptp, SM_PRTSM);
+    }
 }
 
 /* 13.26.14 setSelectedTree */
@@ -2269,7 +3752,7 @@ static void setSelectedTree(tree_t *tree)
      * and updtRolesTree() does not change value of "reselect".
      */
     FOREACH_PTP_IN_TREE(ptp, tree)
-        ptp->selected = true;
+        set_ptp_flag(ptp, selected, true);
 }
 
 /* 13.26.15 setSyncTree */
@@ -2278,7 +3761,10 @@ static void setSyncTree(tree_t *tree)
     per_tree_port_t *ptp;
 
     FOREACH_PTP_IN_TREE(ptp, tree)
-        ptp->sync = true;
+    {
+        set_ptp_flag(ptp, sync, true);
+        sm_mark_ptp(ptp, SM_PRTSM);
+    }
 }
 
 /* 13.26.16 setTcFlags */
@@ -2292,19 +3778,19 @@ static void setTcFlags(per_tree_port_t *ptp)
         prt = ptp->port;
         cistFlags = prt->rcvdBpduData.flags;
         if(cistFlags & (1 << offsetTcAck))
-            prt->rcvdTcAck = true;
+            set_prt_flag(prt, rcvdTcAck, true);
         if(cistFlags & (1 << offsetTc))
         {
-            ptp->rcvdTc = true;
-            if(!prt->rcvdInternal)
+            set_ptp_flag(ptp, rcvdTc, true);
+            if(!PRT_FLAG(prt, rcvdInternal))
                 list_for_each_entry_continue(ptp, &prt->trees, port_list)
-                    ptp->proposed = true;
+                    set_ptp_flag(ptp, proposed, true);
         }
         return;
     }
     /* MSTI */
     if(ptp->rcvdMstiConfig->flags & (1 << offsetTc))
-        ptp->rcvdTc = true;
+        set_ptp_flag(ptp, rcvdTc, true);
 }
 
 /* 13.26.17 setTcPropTree */
@@ -2318,7 +3804,10 @@ static void setTcPropTree(per_tree_port_t *ptp)
     FOREACH_PTP_IN_TREE(ptp_1, ptp->tree)
     {
         if(ptp != ptp_1)
-            ptp_1->tcProp = true;
+        {
+            set_ptp_flag(ptp_1, tcProp, true);
+            sm_mark_ptp(ptp_1, SM_TCSM);
+        }
     }
 }
 
@@ -2334,50 +3823,44 @@ static void syncMaster(bridge_t *br)
         FOREACH_PTP_IN_TREE(ptp, tree)
         {
             /* for each Port that has infoInternal set */
-            if(ptp->port->infoInternal)
+            if(PRT_FLAG(ptp->port, infoInternal))
             {
-                ptp->agree = false;
-                ptp->agreed = false;
-                ptp->synced = false;
-                ptp->sync = true;
+                set_ptp_flag(ptp, agree, false);
+                set_ptp_flag(ptp, agreed, false);
+                set_ptp_flag(ptp, synced, false);
+                set_ptp_flag(ptp, sync, true);
             }
         }
     }
+    /* Rare, do not bother to find out who reads what */
+    sm_mark_bridge(br);
 }
 
-/* 13.26.19 txConfig */
-static void txConfig(port_t *prt)
+/* 13.26.19 txConfig
+ * Not in standard: only the variables which change rarely, see txBpdu() */
+static int txConfigEncode(port_t *prt, bpdu_t *b)
 {
-    bpdu_t b;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
 
-    if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
-        return;
-
-    b.protocolIdentifier = 0;
-    b.protocolVersion = protoSTP;
-    b.bpduType = bpduTypeConfig;
-    /* Standard says "tcWhile ... for the Port". Which one tcWhile?
-     * I guess that this means tcWhile for the CIST.
-     * But that is only a guess and I could be wrong here ;)
-     */
-    b.flags = (0 != cist->tcWhile) ? (1 << offsetTc) : 0;
-    if(prt->tcAck)
-        b.flags |= (1 << offsetTcAck);
-    assign(b.cistRootID, cist->designatedPriority.RootID);
-    assign(b.cistExtRootPathCost, cist->designatedPriority.ExtRootPathCost);
-    assign(b.cistRRootID, cist->designatedPriority.DesignatedBridgeID);
-    assign(b.cistPortID, cist->designatedPriority.DesignatedPortID);
-    b.MessageAge[0] = cist->designatedTimes.Message_Age;
-    b.MessageAge[1] = 0;
-    b.MaxAge[0] = cist->designatedTimes.Max_Age;
-    b.MaxAge[1] = 0;
-    b.HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
-    b.HelloTime[1] = 0;
-    b.ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
-    b.ForwardDelay[1] = 0;
-
-    MSTP_OUT_tx_bpdu(prt, &b, CONFIG_BPDU_SIZE);
+    b->protocolIdentifier = 0;
+    b->protocolVersion = protoSTP;
+    b->bpduType = bpduTypeConfig;
+    /* Tc and TcAck are set by txConfig() */
+    b->flags = 0;
+    assign(b->cistRootID, cist->designatedPriority.RootID);
+    assign(b->cistExtRootPathCost, cist->designatedPriority.ExtRootPathCost);
+    assign(b->cistRRootID, cist->designatedPriority.DesignatedBridgeID);
+    assign(b->cistPortID, cist->designatedPriority.DesignatedPortID);
+    b->MessageAge[0] = cist->designatedTimes.Message_Age;
+    b->MessageAge[1] = 0;
+    b->MaxAge[0] = cist->designatedTimes.Max_Age;
+    b->MaxAge[1] = 0;
+    b->HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
+    b->HelloTime[1] = 0;
+    b->ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
+    b->ForwardDelay[1] = 0;
+
+    return CONFIG_BPDU_SIZE;
 }
 
 static inline __u8 message_role_from_port_role(per_tree_port_t *ptp)
@@ -2402,70 +3885,64 @@ static inline __u8 message_role_from_port_role(per_tree_port_t *ptp)
 
 /* 802.1Q-2005: 13.26.20 txMstp
  * 802.1Q-2011: 13.27.27 txRstp
- */
-static void txMstp(port_t *prt)
+ * Not in standard: only the variables which change rarely, see txBpdu() */
+static int txMstpEncode(port_t *prt, bpdu_t *b)
 {
-    bpdu_t b;
     bridge_t *br = prt->bridge;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
     int msti_msgs_total_size;
     per_tree_port_t *ptp;
     msti_configuration_message_t *msti_msg;
 
-    if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
-        return;
-
-    b.protocolIdentifier = 0;
-    b.bpduType = bpduTypeRST;
+    b->protocolIdentifier = 0;
+    b->bpduType = bpduTypeRST;
     /* Standard says "{tcWhile, agree, proposing} ... for the Port".
      * Which one {tcWhile, agree, proposing}?
      * I guess that this means {tcWhile, agree, proposing} for the CIST.
      * But that is only a guess and I could be wrong here ;)
+     * Tc is set by txMstp().
      */
-    b.flags = BPDU_FLAGS_ROLE_SET(message_role_from_port_role(cist));
-    if(0 != cist->tcWhile)
-        b.flags |= (1 << offsetTc);
-    if(cist->proposing)
-        b.flags |= (1 << offsetProposal);
-    if(cist->learning)
-        b.flags |= (1 << offsetLearnig);
-    if(cist->forwarding)
-        b.flags |= (1 << offsetForwarding);
-    if(cist->agree)
-        b.flags |= (1 << offsetAgreement);
-    assign(b.cistRootID, cist->designatedPriority.RootID);
-    assign(b.cistExtRootPathCost, cist->designatedPriority.ExtRootPathCost);
-    assign(b.cistRRootID, cist->designatedPriority.RRootID);
-    assign(b.cistPortID, cist->designatedPriority.DesignatedPortID);
-    b.MessageAge[0] = cist->designatedTimes.Message_Age;
-    b.MessageAge[1] = 0;
-    b.MaxAge[0] = cist->designatedTimes.Max_Age;
-    b.MaxAge[1] = 0;
-    b.HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
-    b.HelloTime[1] = 0;
-    b.ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
-    b.ForwardDelay[1] = 0;
-
-    b.version1_len = 0;
+    b->flags = BPDU_FLAGS_ROLE_SET(message_role_from_port_role(cist));
+    if(PTP_FLAG(cist, proposing))
+        b->flags |= (1 << offsetProposal);
+    if(PTP_FLAG(cist, learning))
+        b->flags |= (1 << offsetLearnig);
+    if(PTP_FLAG(cist, forwarding))
+        b->flags |= (1 << offsetForwarding);
+    if(PTP_FLAG(cist, agree))
+        b->flags |= (1 << offsetAgreement);
+    assign(b->cistRootID, cist->designatedPriority.RootID);
+    assign(b->cistExtRootPathCost, cist->designatedPriority.ExtRootPathCost);
+    assign(b->cistRRootID, cist->designatedPriority.RRootID);
+    assign(b->cistPortID, cist->designatedPriority.DesignatedPortID);
+    b->MessageAge[0] = cist->designatedTimes.Message_Age;
+    b->MessageAge[1] = 0;
+    b->MaxAge[0] = cist->designatedTimes.Max_Age;
+    b->MaxAge[1] = 0;
+    b->HelloTime[0] = cist->portTimes.Hello_Time; /* ! use portTimes ! */
+    b->HelloTime[1] = 0;
+    b->ForwardDelay[0] = cist->designatedTimes.Forward_Delay;
+    b->ForwardDelay[1] = 0;
+
+    b->version1_len = 0;
 
     if(br->ForceProtocolVersion < protoMSTP)
     {
-        b.protocolVersion = protoRSTP;
-        MSTP_OUT_tx_bpdu(prt, &b, RST_BPDU_SIZE);
-        return;
+        b->protocolVersion = protoRSTP;
+        return RST_BPDU_SIZE;
     }
 
-    b.protocolVersion = protoMSTP;
+    b->protocolVersion = protoMSTP;
 
     /* MST specific fields */
-    assign(b.mstConfigurationIdentifier, br->MstConfigId);
-    assign(b.cistIntRootPathCost, cist->designatedPriority.IntRootPathCost);
-    assign(b.cistBridgeID, cist->designatedPriority.DesignatedBridgeID);
-    assign(b.cistRemainingHops, cist->designatedTimes.remainingHops);
+    assign(b->mstConfigurationIdentifier, br->MstConfigId);
+    assign(b->cistIntRootPathCost, cist->designatedPriority.IntRootPathCost);
+    assign(b->cistBridgeID, cist->designatedPriority.DesignatedBridgeID);
+    assign(b->cistRemainingHops, cist->designatedTimes.remainingHops);
 
     msti_msgs_total_size = 0;
     ptp = cist;
-    msti_msg = b.mstConfiguration;
+    msti_msg = b->mstConfiguration;
     /* 13.26.20.f) requires that msti configs should be inserted in
      * MSTID order. This is met by inserting trees in port's list of trees
      * in sorted (by MSTID) order (see MSTP_IN_create_msti) */
@@ -2473,17 +3950,15 @@ static void txMstp(port_t *prt)
     {
         msti_msg->flags =
             BPDU_FLAGS_ROLE_SET(message_role_from_port_role(ptp));
-        if(0 != ptp->tcWhile)
-            msti_msg->flags |= (1 << offsetTc);
-        if(ptp->proposing)
+        if(PTP_FLAG(ptp, proposing))
             msti_msg->flags |= (1 << offsetProposal);
-        if(ptp->learning)
+        if(PTP_FLAG(ptp, learning))
             msti_msg->flags |= (1 << offsetLearnig);
-        if(ptp->forwarding)
+        if(PTP_FLAG(ptp, forwarding))
             msti_msg->flags |= (1 << offsetForwarding);
-        if(ptp->agree)
+        if(PTP_FLAG(ptp, agree))
             msti_msg->flags |= (1 << offsetAgreement);
-        if(ptp->master)
+        if(PTP_FLAG(ptp, master))
             msti_msg->flags |= (1 << offsetMaster);
         assign(msti_msg->mstiRRootID, ptp->designatedPriority.RRootID);
         assign(msti_msg->mstiIntRootPathCost,
@@ -2498,36 +3973,153 @@ static void txMstp(port_t *prt)
         ++msti_msg;
     }
 
-    assign(b.version3_len, __cpu_to_be16(MST_BPDU_VER3LEN_WO_MSTI_MSGS
-                                         + msti_msgs_total_size));
-    MSTP_OUT_tx_bpdu(prt, &b, MST_BPDU_SIZE_WO_MSTI_MSGS
-                              + msti_msgs_total_size);
+    assign(b->version3_len, __cpu_to_be16(MST_BPDU_VER3LEN_WO_MSTI_MSGS
+                                          + msti_msgs_total_size));
+    return MST_BPDU_SIZE_WO_MSTI_MSGS + msti_msgs_total_size;
 }
 
-/* 13.26.a) txTcn */
-static void txTcn(port_t *prt)
+/* Not in standard: make room for size bytes in txBpdu.
+ * The buffer only grows, the BPDUs of a port rarely change their size.
+ */
+static bool txBpduReserve(port_t *prt, int size)
+{
+    bpdu_t *b;
+
+    if(size <= prt->txBpduRoom)
+        return true;
+    if(!(b = malloc(size)))
+    {
+        ERROR_PRTNAME(prt, "Out of memory");
+        return false;
+    }
+    free(prt->txBpdu);
+    prt->txBpdu = b;
+    prt->txBpduRoom = size;
+    return true;
+}
+
+/* Not in standard: copy the BPDU of the port to b, encoding it first if
+ * any of the variables it is made of have changed since port_t.txBpdu was
+ * encoded. Periodic transmission then costs a copy instead of a walk over
+ * all the trees of the port.
+ */
+static int txBpdu(port_t *prt, bpdu_t *b, bool config)
+{
+    bridge_t *br = prt->bridge;
+    int (*encode)(port_t *, bpdu_t *) = config ? txConfigEncode
+                                               : txMstpEncode;
+    int size;
+
+    if(prt->txBpduSize && (prt->txBpduGen == br->txBpduGen)
+       && ((bpduTypeConfig == prt->txBpdu->bpduType) == config))
+    {
+        if(!br->sm_cross_check)
+        {
+            memcpy(b, prt->txBpdu, prt->txBpduSize);
+            return prt->txBpduSize;
+        }
+        size = encode(prt, b);
+        if((size == prt->txBpduSize) && !memcmp(b, prt->txBpdu, size))
+            return size;
+        ++(br->sm_cross_check_errors);
+        ERROR_PRTNAME(prt, "Stale %s BPDU template",
+                      config ? "Config" : "RST/MST");
+    }
+    else
+        size = encode(prt, b);
+
+    /* Without room for the template the BPDU is still sent,
+     * it is just encoded again the next time */
+    prt->txBpduSize = 0;
+    if(txBpduReserve(prt, size))
+    {
+        memcpy(prt->txBpdu, b, size);
+        prt->txBpduSize = size;
+        prt->txBpduGen = br->txBpduGen;
+    }
+    return size;
+}
+
+/* 13.26.19 txConfig */
+static void txConfig(port_t *prt)
 {
     bpdu_t b;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
+    int size;
 
     if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
         return;
 
-    b.protocolIdentifier = 0;
-    b.protocolVersion = protoSTP;
-    b.bpduType = bpduTypeTCN;
+    size = txBpdu(prt, &b, true);
+    /* Standard says "tcWhile ... for the Port". Which one tcWhile?
+     * I guess that this means tcWhile for the CIST.
+     * But that is only a guess and I could be wrong here ;)
+     */
+    if(0 != PTP_TIMER(cist, tcWhile))
+        b.flags |= (1 << offsetTc);
+    if(PRT_FLAG(prt, tcAck))
+        b.flags |= (1 << offsetTcAck);
 
-    MSTP_OUT_tx_bpdu(prt, &b, TCN_BPDU_SIZE);
+    MSTP_OUT_tx_bpdu(prt, &b, size);
 }
 
-/* 13.26.21 updtBPDUVersion */
-static void updtBPDUVersion(port_t *prt)
+/* 802.1Q-2005: 13.26.20 txMstp
+ * 802.1Q-2011: 13.27.27 txRstp
+ */
+static void txMstp(port_t *prt)
 {
-    if(protoRSTP <= prt->rcvdBpduData.protocolVersion)
-        prt->rcvdRSTP = true;
-    else
-        prt->rcvdSTP = true;
-}
+    bpdu_t b;
+    per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
+    per_tree_port_t *ptp;
+    msti_configuration_message_t *msti_msg;
+    int size;
+
+    if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
+        return;
+
+    size = txBpdu(prt, &b, false);
+    if(0 != PTP_TIMER(cist, tcWhile))
+        b.flags |= (1 << offsetTc);
+
+    if(protoMSTP == b.protocolVersion)
+    {
+        ptp = cist;
+        msti_msg = b.mstConfiguration;
+        list_for_each_entry_continue(ptp, &prt->trees, port_list)
+        {
+            if(0 != PTP_TIMER(ptp, tcWhile))
+                msti_msg->flags |= (1 << offsetTc);
+            ++msti_msg;
+        }
+    }
+
+    MSTP_OUT_tx_bpdu(prt, &b, size);
+}
+
+/* 13.26.a) txTcn */
+static void txTcn(port_t *prt)
+{
+    bpdu_t b;
+    per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
+
+    if(prt->deleted || (roleDisabled == cist->role) || prt->dontTxmtBpdu)
+        return;
+
+    b.protocolIdentifier = 0;
+    b.protocolVersion = protoSTP;
+    b.bpduType = bpduTypeTCN;
+
+    MSTP_OUT_tx_bpdu(prt, &b, TCN_BPDU_SIZE);
+}
+
+/* 13.26.21 updtBPDUVersion */
+static void updtBPDUVersion(port_t *prt)
+{
+    if(protoRSTP <= prt->rcvdBpduData.protocolVersion)
+        set_prt_flag(prt, rcvdRSTP, true);
+    else
+        set_prt_flag(prt, rcvdSTP, true);
+}
 
 /* 13.26.22 updtRcvdInfoWhile */
 static void updtRcvdInfoWhile(per_tree_port_t *ptp)
@@ -2536,7 +4128,6 @@ static void updtRcvdInfoWhile(per_tree_port_t *ptp)
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
     unsigned int Message_Age = cist->portTimes.Message_Age;
     unsigned int Max_Age = cist->portTimes.Max_Age;
-    unsigned int Hello_Time = cist->portTimes.Hello_Time;
 
     /* NOTE: 802.1Q-2005(-2011) says that we should use
      *  "remainingHops ... from the CIST's portTimes parameter"
@@ -2562,28 +4153,42 @@ static void updtRcvdInfoWhile(per_tree_port_t *ptp)
      *  In this situation we certainly must use counter from tree 1,
      *  not CIST's.
      */
-    if((!prt->rcvdInternal && ((Message_Age + 1) <= Max_Age))
-       || (prt->rcvdInternal && (ptp->portTimes.remainingHops > 1))
+    if((!PRT_FLAG(prt, rcvdInternal) && ((Message_Age + 1) <= Max_Age))
+       || (PRT_FLAG(prt, rcvdInternal) && (ptp->portTimes.remainingHops > 1))
       )
-        ptp->rcvdInfoWhile = 3 * Hello_Time;
+    {
+        set_ptp_timer(ptp, rcvdInfoWhile, 3 * portHelloTimeMs(prt));
+        ptp->rcvdInfoRestarted = true;
+    }
     else
-        ptp->rcvdInfoWhile = 0;
+    {
+        PTP_TIMER(ptp, rcvdInfoWhile) = 0;
+        ptp->rcvdInfoRestarted = false;
+    }
 }
 
 static void updtbrAssuRcvdInfoWhile(port_t *prt)
 {
-    per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
-
-    prt->brAssuRcvdInfoWhile = 3 * cist->portTimes.Hello_Time;
+    set_prt_timer(prt, brAssuRcvdInfoWhile, 3 * portHelloTimeMs(prt));
 }
 
 /* 13.26.24 updtRolesDisabledTree */
 static void updtRolesDisabledTree(tree_t *tree)
 {
     per_tree_port_t *ptp;
+    bridge_t *br = tree->bridge;
 
     FOREACH_PTP_IN_TREE(ptp, tree)
-        ptp->selectedRole = roleDisabled;
+        set_ptp_selectedRole(ptp, roleDisabled);
+
+    /* Not in standard: roles of the MSTIs depend on the CIST roles */
+    if(0 == tree->MSTID)
+    {
+        FOREACH_TREE_IN_BRIDGE(tree, br)
+            tree->roles_rescan = true;
+    }
+    else
+        tree->roles_rescan = true;
 }
 
 /* Aux function, not in standard.
@@ -2595,70 +4200,232 @@ static void reselectMSTIs(port_t *prt)
 
     /* For each non-CIST ptp */
     list_for_each_entry_continue(ptp, &prt->trees, port_list)
-        ptp->reselect = true;
+        set_ptp_flag(ptp, reselect, true);
+}
+
+/* Aux functions, not in standard.
+ * Inputs of the role selection for the port changed: its root path priority
+ * vector has to be recalculated and its role re-evaluated by the next
+ * updtRolesTree. Ports with unchanged inputs keep their roles as long as
+ * rootPriority, rootPortId and rootTimes of the tree stay the same.
+ */
+static void roles_mark_ptp(per_tree_port_t *ptp)
+{
+    if(list_empty(&ptp->stale_list))
+        list_add_tail(&ptp->stale_list, &ptp->tree->stale_ports);
+}
+
+/* Mark the port in all trees */
+static void roles_mark_port(port_t *prt)
+{
+    per_tree_port_t *ptp;
+
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        roles_mark_ptp(ptp);
+}
+
+/* infoIs or portPriority changed. The roles of the boundary ports in the
+ * MSTIs follow the CIST (13.26.23.g), so the change in the CIST marks the
+ * port in all trees */
+static void roles_mark_info(per_tree_port_t *ptp)
+{
+    if(0 == ptp->MSTID)
+        roles_mark_port(ptp->port);
+    else
+        roles_mark_ptp(ptp);
+}
+
+/* 13.26.23.a) Calculate the root path priority vector of the port.
+ * Returns false if the port can not be the Root Port.
+ */
+static bool calcRootPathPriority(per_tree_port_t *ptp,
+                                 port_priority_vector_t *root_path_priority)
+{
+    port_t *prt = ptp->port;
+    tree_t *tree = ptp->tree;
+    __u32 newRootPathCost;
+
+    /* 802.1Q says to calculate root priority vector only if port
+     * is not Disabled, but check (infoIs == ioReceived) covers
+     * the case (infoIs != ioDisabled).
+     */
+    if((ioReceived != ptp->infoIs) || prt->restrictedRole
+       || cmp(ptp->portPriority.DesignatedBridgeID, ==,
+              tree->BridgeIdentifier)
+      )
+        return false;
+
+    assign(*root_path_priority, ptp->portPriority);
+    if(PRT_FLAG(prt, rcvdInternal))
+    {
+        newRootPathCost = __be32_to_cpu(root_path_priority->IntRootPathCost);
+
+        if(newRootPathCost > (UINT32_MAX - ptp->InternalPortPathCost))
+            newRootPathCost = UINT32_MAX;
+        else
+            newRootPathCost += ptp->InternalPortPathCost;
+
+        assign(root_path_priority->IntRootPathCost,
+               __cpu_to_be32(newRootPathCost));
+    }
+    else if(0 == tree->MSTID) /* Yes, this check might be superfluous,
+                               * but I want to be on the safe side */
+    {
+        newRootPathCost = __be32_to_cpu(root_path_priority->ExtRootPathCost);
+
+        if(newRootPathCost > (UINT32_MAX - prt->ExternalPortPathCost))
+            newRootPathCost = UINT32_MAX;
+        else
+            newRootPathCost += prt->ExternalPortPathCost;
+
+        assign(root_path_priority->ExtRootPathCost,
+               __be32_to_cpu(newRootPathCost));
+        assign(root_path_priority->RRootID, tree->BridgeIdentifier);
+        assign(root_path_priority->IntRootPathCost,
+               __constant_cpu_to_be32(0));
+    }
+    updtPriorityKey(root_path_priority);
+    return true;
+}
+
+/* Aux functions, not in standard.
+ * tree->root_heap keeps the Root Port candidates ordered by their
+ * {root path priority vector, portId}, best one first. Thus the Root Port
+ * is selected without a scan of all ports, and when it fails the best
+ * alternate is already on top.
+ */
+static bool root_heap_better(tree_t *tree, int i, int j)
+{
+    per_tree_port_t *a = tree->root_heap[i], *b = tree->root_heap[j];
+
+    return betterorsamePriority(&a->rootPathPriority, &b->rootPathPriority,
+                                a->portId, b->portId, 0 == tree->MSTID);
+}
+
+static void root_heap_swap(tree_t *tree, int i, int j)
+{
+    per_tree_port_t *ptp = tree->root_heap[i];
+
+    tree->root_heap[i] = tree->root_heap[j];
+    tree->root_heap[i]->root_heap_pos = i;
+    tree->root_heap[j] = ptp;
+    ptp->root_heap_pos = j;
+}
+
+/* Restore the heap order after the candidate at pos i changed */
+static void root_heap_sift(tree_t *tree, int i)
+{
+    int child;
+
+    while((0 < i) && root_heap_better(tree, i, (i - 1) / 2))
+    {
+        root_heap_swap(tree, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while((child = 2 * i + 1) < tree->root_heap_len)
+    {
+        if((child + 1 < tree->root_heap_len)
+           && root_heap_better(tree, child + 1, child))
+            ++child;
+        if(!root_heap_better(tree, child, i))
+            break;
+        root_heap_swap(tree, i, child);
+        i = child;
+    }
+}
+
+static void root_heap_remove(per_tree_port_t *ptp)
+{
+    tree_t *tree = ptp->tree;
+    int i = ptp->root_heap_pos;
+
+    if(0 > i)
+        return;
+    ptp->root_heap_pos = -1;
+    if(i == --tree->root_heap_len)
+        return;
+    tree->root_heap[i] = tree->root_heap[tree->root_heap_len];
+    tree->root_heap[i]->root_heap_pos = i;
+    root_heap_sift(tree, i);
+}
+
+static void root_heap_update(per_tree_port_t *ptp)
+{
+    tree_t *tree = ptp->tree;
+
+    if(!calcRootPathPriority(ptp, &ptp->rootPathPriority))
+    {
+        root_heap_remove(ptp);
+        return;
+    }
+    if(0 > ptp->root_heap_pos)
+    {
+        /* There is room, see reserve_root_heap() */
+        ptp->root_heap_pos = tree->root_heap_len++;
+        tree->root_heap[ptp->root_heap_pos] = ptp;
+    }
+    root_heap_sift(tree, ptp->root_heap_pos);
 }
 
 /* 13.26.23 updtRolesTree */
 static void updtRolesTree(tree_t *tree)
 {
-    per_tree_port_t *ptp, *root_ptp = NULL;
+    per_tree_port_t *ptp, *nxt, *root_ptp = NULL;
     port_priority_vector_t root_path_priority;
-    bridge_identifier_t prevRRootID = tree->rootPriority.RRootID;
-    __be32 prevExtRootPathCost = tree->rootPriority.ExtRootPathCost;
-    __u32 newRootPathCost;
+    port_priority_vector_t prevRootPriority = tree->rootPriority;
+    port_identifier_t prevRootPortId = tree->rootPortId;
+    times_t prevRootTimes = tree->rootTimes;
     bool cist = (0 == tree->MSTID);
+    bool full_scan = tree->bridge->roles_full_scan;
+    bool rescan;
 
     /* a), b) Select new root priority vector = {rootPriority, rootPortId} */
       /* Initial value = bridge priority vector = {BridgePriority, 0} */
     assign(tree->rootPriority, tree->BridgePriority);
     assign(tree->rootPortId, __constant_cpu_to_be16(0));
+    if(full_scan)
+    {
       /* Now check root path priority vectors of all ports in tree and see if
        * there is a better vector */
-    FOREACH_PTP_IN_TREE(ptp, tree)
-    {
-        port_t *prt = ptp->port;
-        /* 802.1Q says to calculate root priority vector only if port
-         * is not Disabled, but check (infoIs == ioReceived) covers
-         * the case (infoIs != ioDisabled).
-         */
-        if((ioReceived == ptp->infoIs) && !prt->restrictedRole
-           && cmp(ptp->portPriority.DesignatedBridgeID, !=,
-                  tree->BridgeIdentifier)
-          )
+        FOREACH_PTP_IN_TREE(ptp, tree)
         {
-            root_path_priority = ptp->portPriority;
-            if(prt->rcvdInternal)
+            if(calcRootPathPriority(ptp, &root_path_priority)
+               && betterorsamePriority(&root_path_priority,
+                                       &tree->rootPriority, ptp->portId,
+                                       tree->rootPortId, cist))
             {
-                newRootPathCost = __be32_to_cpu(root_path_priority.IntRootPathCost);
-
-                if(newRootPathCost > (UINT32_MAX - ptp->InternalPortPathCost))
-                    newRootPathCost = UINT32_MAX;
-                else
-                    newRootPathCost += ptp->InternalPortPathCost;
-
-                assign(root_path_priority.IntRootPathCost,
-                       __cpu_to_be32(newRootPathCost));
+                assign(tree->rootPriority, root_path_priority);
+                assign(tree->rootPortId, ptp->portId);
+                root_ptp = ptp;
             }
-            else if(cist) /* Yes, this check might be superfluous,
-                           * but I want to be on the safe side */
+        }
+    }
+    else
+    {
+        /* Re-rank only the ports whose inputs changed, the best root path
+         * priority vector is then on top of the heap */
+        if(tree->roles_rescan)
+        {
+            tree->root_heap_len = 0;
+            FOREACH_PTP_IN_TREE(ptp, tree)
             {
-                newRootPathCost = __be32_to_cpu(root_path_priority.ExtRootPathCost);
-
-                if(newRootPathCost > (UINT32_MAX - prt->ExternalPortPathCost))
-                    newRootPathCost = UINT32_MAX;
-                else
-                    newRootPathCost += prt->ExternalPortPathCost;
-
-                assign(root_path_priority.ExtRootPathCost,
-                       __be32_to_cpu(newRootPathCost));
-                assign(root_path_priority.RRootID, tree->BridgeIdentifier);
-                assign(root_path_priority.IntRootPathCost,
-                       __constant_cpu_to_be32(0));
+                ptp->root_heap_pos = -1;
+                root_heap_update(ptp);
             }
-            if(betterorsamePriority(&root_path_priority, &tree->rootPriority,
-                                    ptp->portId, tree->rootPortId, cist))
+        }
+        else
+        {
+            list_for_each_entry(ptp, &tree->stale_ports, stale_list)
+                root_heap_update(ptp);
+        }
+        if(tree->root_heap_len)
+        {
+            ptp = tree->root_heap[0];
+            if(betterorsamePriority(&ptp->rootPathPriority,
+                                    &tree->rootPriority, ptp->portId,
+                                    tree->rootPortId, cist))
             {
-                assign(tree->rootPriority, root_path_priority);
+                assign(tree->rootPriority, ptp->rootPathPriority);
                 assign(tree->rootPortId, ptp->portId);
                 root_ptp = ptp;
             }
@@ -2682,7 +4449,7 @@ static void updtRolesTree(tree_t *tree)
     {
         assign(tree->rootTimes, root_ptp->portTimes);
         port_t *prt = root_ptp->port;
-        if(prt->rcvdInternal)
+        if(PRT_FLAG(prt, rcvdInternal))
         {
             if(tree->rootTimes.remainingHops)
                 --(tree->rootTimes.remainingHops);
@@ -2695,9 +4462,23 @@ static void updtRolesTree(tree_t *tree)
         assign(tree->rootTimes, tree->BridgeTimes);
     }
 
+    /* Not in standard: while the root priority vector and rootTimes stay
+     * the same, only the ports whose inputs changed can get a new role */
+    rescan = full_scan || tree->roles_rescan
+             || cmp(tree->rootPortId, !=, prevRootPortId)
+             || cmp(tree->rootPriority, !=, prevRootPriority)
+             || cmp(tree->rootTimes, !=, prevRootTimes);
+
     FOREACH_PTP_IN_TREE(ptp, tree)
     {
         port_t *prt = ptp->port;
+        port_priority_vector_t prevDesignatedPriority;
+        times_t prevDesignatedTimes;
+
+        if(!rescan && list_empty(&ptp->stale_list))
+            continue;
+        assign(prevDesignatedPriority, ptp->designatedPriority);
+        assign(prevDesignatedTimes, ptp->designatedTimes);
 
         /* d) Set new designatedPriority */
         assign(ptp->designatedPriority, tree->rootPriority);
@@ -2710,8 +4491,9 @@ static void updtRolesTree(tree_t *tree)
          * machine) ..." -- why not to mention explicit var name? Bad IEEE.
          * But I guess that sendSTP (i.e. !sendRSTP) var will do ;)
          */
-        if(cist && !prt->sendRSTP)
+        if(cist && !PRT_FLAG(prt, sendRSTP))
             assign(ptp->designatedPriority.RRootID, tree->BridgeIdentifier);
+        updtPriorityKey(&ptp->designatedPriority);
 
         /* e) Set new designatedTimes */
         assign(ptp->designatedTimes, tree->rootTimes);
@@ -2722,12 +4504,16 @@ static void updtRolesTree(tree_t *tree)
          *    don't have Hello_Time member.
          */
         assign(ptp->designatedTimes.Hello_Time, ptp->portTimes.Hello_Time);
+
+        if(cmp(prevDesignatedPriority, !=, ptp->designatedPriority)
+           || cmp(prevDesignatedTimes, !=, ptp->designatedTimes))
+            tx_mark_port(prt);
     }
 
     /* syncMaster */
-    if(cist && cmp(tree->rootPriority.RRootID, !=, prevRRootID)
+    if(cist && cmp(tree->rootPriority.RRootID, !=, prevRootPriority.RRootID)
        && ((0 != tree->rootPriority.ExtRootPathCost)
-           || (0 != prevExtRootPathCost)
+           || (0 != prevRootPriority.ExtRootPathCost)
           )
       )
         syncMaster(tree->bridge);
@@ -2737,25 +4523,39 @@ static void updtRolesTree(tree_t *tree)
         port_t *prt = ptp->port;
         per_tree_port_t *cist_tree = GET_CIST_PTP_FROM_PORT(prt);
 
+        if(!rescan && list_empty(&ptp->stale_list))
+        {
+            /* Role stays the same, but see the note about reselectMSTIs
+             * at the end of the loop */
+            if(cist && (ioReceived == ptp->infoIs)
+               && (ptp->selectedRole != ptp->role))
+                reselectMSTIs(prt);
+            continue;
+        }
+        /* The new CIST role can change the roles in the MSTIs */
+        if(cist)
+            roles_mark_port(prt);
+
         /* f) Set Disabled role */
         if(ioDisabled == ptp->infoIs)
         {
-            ptp->selectedRole = roleDisabled;
+            set_ptp_selectedRole(ptp, roleDisabled);
             continue;
         }
 
-        if(!cist && (ioReceived == cist_tree->infoIs) && !prt->infoInternal)
+        if(!cist && (ioReceived == cist_tree->infoIs)
+           && !PRT_FLAG(prt, infoInternal))
         {
             /* g) Set role for the boundary port in MSTI */
             if(roleRoot == cist_tree->selectedRole)
             {
-                ptp->selectedRole = roleMaster;
+                set_ptp_selectedRole(ptp, roleMaster);
                 if(!samePriorityAndTimers(&ptp->portPriority,
                                           &ptp->designatedPriority,
                                           &ptp->portTimes,
                                           &ptp->designatedTimes,
                                           /*cist*/ false))
-                    ptp->updtInfo = true;
+                    set_ptp_flag(ptp, updtInfo, true);
                 continue;
             }
             /* Bad IEEE again! It says in 13.26.23 g) 2) that
@@ -2773,36 +4573,36 @@ static void updtRolesTree(tree_t *tree)
              */
             /* if(roleAlternate == cist_tree->selectedRole) */
             {
-                ptp->selectedRole = cist_tree->selectedRole;
+                set_ptp_selectedRole(ptp, cist_tree->selectedRole);
                 if(!samePriorityAndTimers(&ptp->portPriority,
                                           &ptp->designatedPriority,
                                           &ptp->portTimes,
                                           &ptp->designatedTimes,
                                           /*cist*/ false))
-                    ptp->updtInfo = true;
+                    set_ptp_flag(ptp, updtInfo, true);
                 continue;
             }
         }
         else
-     /* if(cist || (ioReceived != cist_tree->infoIs) || prt->infoInternal) */
+     /* if(cist || (ioReceived != cist_tree->infoIs) || PRT_FLAG(prt, infoInternal)) */
         {
             /* h) Set role for the aged info */
             if(ioAged == ptp->infoIs)
             {
-                ptp->selectedRole = roleDesignated;
-                ptp->updtInfo = true;
+                set_ptp_selectedRole(ptp, roleDesignated);
+                set_ptp_flag(ptp, updtInfo, true);
                 continue;
             }
             /* i) Set role for the mine info */
             if(ioMine == ptp->infoIs)
             {
-                ptp->selectedRole = roleDesignated;
+                set_ptp_selectedRole(ptp, roleDesignated);
                 if(!samePriorityAndTimers(&ptp->portPriority,
                                           &ptp->designatedPriority,
                                           &ptp->portTimes,
                                           &ptp->designatedTimes,
                                           cist))
-                    ptp->updtInfo = true;
+                    set_ptp_flag(ptp, updtInfo, true);
                 continue;
             }
             if(ioReceived == ptp->infoIs)
@@ -2810,8 +4610,8 @@ static void updtRolesTree(tree_t *tree)
                 /* j) Set Root role */
                 if(root_ptp == ptp)
                 {
-                    ptp->selectedRole = roleRoot;
-                    ptp->updtInfo = false;
+                    set_ptp_selectedRole(ptp, roleRoot);
+                    set_ptp_flag(ptp, updtInfo, false);
                 }
                 else
                 {
@@ -2823,21 +4623,21 @@ static void updtRolesTree(tree_t *tree)
                                tree->BridgeIdentifier))
                         {
                             /* k) Set Alternate role */
-                            ptp->selectedRole = roleAlternate;
+                            set_ptp_selectedRole(ptp, roleAlternate);
                         }
                         else
                         {
                             /* l) Set Backup role */
-                            ptp->selectedRole = roleBackup;
+                            set_ptp_selectedRole(ptp, roleBackup);
                         }
                         /* reset updtInfo for both k) and l) */
-                        ptp->updtInfo = false;
+                        set_ptp_flag(ptp, updtInfo, false);
                     }
                     else /* designatedPriority is better than portPriority */
                     {
                         /* m) Set Designated role */
-                        ptp->selectedRole = roleDesignated;
-                        ptp->updtInfo = true;
+                        set_ptp_selectedRole(ptp, roleDesignated);
+                        set_ptp_flag(ptp, updtInfo, true);
                     }
                 }
                 /* This is not in standard. But we really should set here
@@ -2855,41 +4655,175 @@ static void updtRolesTree(tree_t *tree)
             }
         }
     }
+
+    list_for_each_entry_safe(ptp, nxt, &tree->stale_ports, stale_list)
+        list_del_init(&ptp->stale_list);
+    /* The full scan does not maintain the heap */
+    tree->roles_rescan = full_scan;
 }
 
 /* 13.27  The Port Timers state machine */
 
-static void PTSM_tick(port_t *prt)
+/* The tick (PTSM_tick) decrements the timers of the bridge's table
+ * (bridge_t.timers) a vector of them at a time. A lane which does not reach
+ * zero keeps (timer - msec), the other ones are cleared by the comparison mask.
+ */
+static inline timer_vec_t timer_vec_load(const unsigned int *timers)
+{
+    timer_vec_t v;
+
+    /* The rows are realloc()-ed, do not count on their alignment */
+    memcpy(&v, timers, sizeof(v));
+    return v;
+}
+
+static inline void timer_vec_store(unsigned int *timers, timer_vec_t v)
+{
+    memcpy(timers, &v, sizeof(v));
+}
+
+static inline timer_vec_t timer_vec_tick(timer_vec_t v, timer_vec_t msec)
+{
+    return (v - msec) & (timer_vec_t)(v > msec);
+}
+
+static inline bool timer_vec_any(timer_vec_t v)
+{
+    unsigned int i, any = 0;
+
+    for(i = 0; i < TIMER_VEC_LANES; ++i)
+        any |= v[i];
+    return 0 != any;
+}
+
+/* Bit (first + i) is set for each nonzero lane i of the mask */
+static inline __u64 timer_vec_bits(timer_vec_t mask, unsigned int first)
+{
+    __u64 bits = 0;
+    unsigned int i;
+
+    for(i = 0; i < TIMER_VEC_LANES; ++i)
+        if(mask[i])
+            bits |= 1ull << (first + i);
+    return bits;
+}
+
+/* The port state machines which test each of the port timers */
+static const unsigned int portTimerSms[PORT_TIMER_COLUMNS] =
+{
+    [TIMER_mdelayWhile] = SM_PPMSM,
+    [TIMER_helloWhen] = SM_PTSM,
+    [TIMER_edgeDelayWhile] = SM_PRSM | SM_BDSM,
+    /* rapidAgeingWhile is not tested by any, see the end of PTSM_tick */
+    [TIMER_brAssuRcvdInfoWhile] = SM_BA,
+};
+
+/* Returns true if some of the port's timers are still running.
+ * The state machines compare the per-tree timers with zero and with the
+ * values they were started with, so only the per-tree data whose timers
+ * expired or were started since the last tick is marked dirty.
+ */
+static bool PTSM_tick(port_t *prt, unsigned int msec)
 {
+    bridge_t *br = prt->bridge;
+    port_timers_t *timers = port_timers(prt);
+    timer_vec_t dec = { msec, msec, msec, msec };
+    timer_vec_t v, after, expired, left = { 0 };
+    timer_vec_t rrExpired, tcExpired;
+    __u64 events = prt->timer_started, rrEvents = 0, tcEvents = 0, bit;
+    __u64 prtEvents = 0;
+    unsigned int slot, i;
+    unsigned int migrateMs = SECONDS_TO_MS(br->Migrate_Time);
+    bool rapidAgeing = (0 != timers->port[TIMER_rapidAgeingWhile]);
+    bool edgeDelayStarted = (migrateMs == timers->port[TIMER_edgeDelayWhile]);
+    bool mdelayStarted = (migrateMs == timers->port[TIMER_mdelayWhile]);
+    bool running = false;
     per_tree_port_t *ptp;
 
-    if(prt->helloWhen)
-        --(prt->helloWhen);
-    if(prt->mdelayWhile)
-        --(prt->mdelayWhile);
-    if(prt->edgeDelayWhile)
-        --(prt->edgeDelayWhile);
+    for(i = 0; i < PORT_TIMER_COLUMNS; i += TIMER_VEC_LANES)
+    {
+        v = timer_vec_load(&timers->port[i]);
+        after = timer_vec_tick(v, dec);
+        timer_vec_store(&timers->port[i], after);
+        left |= after;
+        prtEvents |= timer_vec_bits(v & (timer_vec_t)(0 == after), i);
+    }
+    /* PRSM and PPMSM also test these two against Migrate_Time */
+    if(edgeDelayStarted && (migrateMs != timers->port[TIMER_edgeDelayWhile]))
+        prtEvents |= 1ull << TIMER_edgeDelayWhile;
+    if(mdelayStarted && (migrateMs != timers->port[TIMER_mdelayWhile]))
+        prtEvents |= 1ull << TIMER_mdelayWhile;
+    for(; prtEvents; prtEvents &= prtEvents - 1)
+        prt->sm_dirty |= portTimerSms[__builtin_ctzll(prtEvents)];
+
+    /* txCount is not a timer but a counter, decremented once per second
+     * (17.22 of 802.1D). With the fast hello it is decremented once per
+     * Hello Time, so Transmit_Hold_Count keeps its meaning
+     * "BPDUs per Hello Time interval".
+     */
     if(prt->txCount)
-        --(prt->txCount);
-    if(prt->brAssuRcvdInfoWhile)
-        --(prt->brAssuRcvdInfoWhile);
+    {
+        unsigned int quantum = portHelloTimeMs(prt);
+        if(quantum > 1000)
+            quantum = 1000;
+        prt->txCountTick += msec;
+        while(prt->txCount && (prt->txCountTick >= quantum))
+        {
+            --(prt->txCount);
+            prt->txCountTick -= quantum;
+            prt->sm_dirty |= SM_PTSM; /* txCount < TxHoldCount */
+        }
+        if(prt->txCount)
+            running = true;
+        else
+            prt->txCountTick = 0;
+    }
 
-    FOREACH_PTP_IN_PORT(ptp, prt)
+    /* Columns of the unused slots are always zero */
+    prt->timer_started = 0;
+    for(slot = 0; slot < br->timer_slots; slot += TIMER_VEC_LANES)
     {
-        if(ptp->fdWhile)
-            --(ptp->fdWhile);
-        if(ptp->rrWhile)
-            --(ptp->rrWhile);
-        if(ptp->rbWhile)
-            --(ptp->rbWhile);
-        if(ptp->tcWhile)
+        expired = rrExpired = tcExpired = (timer_vec_t){ 0 };
+        for(i = 0; i < NUM_PTP_TIMERS; ++i)
         {
-            if(0 == --(ptp->tcWhile))
-                set_TopologyChange(ptp->tree, false, prt);
+            v = timer_vec_load(&timers->ptp[i * br->timer_slots + slot]);
+            if(!timer_vec_any(v))
+                continue;
+            after = timer_vec_tick(v, dec);
+            timer_vec_store(&timers->ptp[i * br->timer_slots + slot], after);
+            left |= after;
+            v &= (timer_vec_t)(0 == after);
+            expired |= v;
+            if(TIMER_rrWhile == i)
+                rrExpired = v;
+            else if(TIMER_tcWhile == i)
+                tcExpired = v;
         }
-        if(ptp->rcvdInfoWhile)
-            --(ptp->rcvdInfoWhile);
+        if(!timer_vec_any(expired))
+            continue;
+        events |= timer_vec_bits(expired, slot);
+        rrEvents |= timer_vec_bits(rrExpired, slot);
+        tcEvents |= timer_vec_bits(tcExpired, slot);
+    }
+
+    for(; events; events &= events - 1)
+    {
+        slot = __builtin_ctzll(events);
+        bit = 1ull << slot;
+        ptp = prt->slot2ptp[slot];
+        sm_mark_ptp(ptp, SM_PTP_ALL);
+        if(rrEvents & bit) /* reRooted of the other ports of the tree */
+            sm_mark_tree(ptp->tree, SM_PRTSM);
+        if(tcEvents & bit)
+            set_TopologyChange(ptp->tree, false, prt);
     }
+
+    /* support for rapid ageing */
+    if(rapidAgeing && (0 == timers->port[TIMER_rapidAgeingWhile])
+       && !prt->deleted)
+        MSTP_OUT_set_ageing_time(prt, br->Ageing_Time);
+
+    return running || timer_vec_any(left);
 }
 
 /* 13.28  Port Receive state machine */
@@ -2899,18 +4833,21 @@ static bool PRSM_to_DISCARD(port_t *prt, bool dry_run)
     if(dry_run)
     {
         return (prt->PRSM_state != PRSM_DISCARD)
-               || prt->rcvdBpdu || prt->rcvdRSTP || prt->rcvdSTP
-               || (prt->edgeDelayWhile != prt->bridge->Migrate_Time)
+               || PRT_ANY(prt, PRT_BIT(rcvdBpdu) | PRT_BIT(rcvdRSTP)
+                               | PRT_BIT(rcvdSTP))
+               || (PRT_TIMER(prt, edgeDelayWhile)
+                   != SECONDS_TO_MS(prt->bridge->Migrate_Time))
                || clearAllRcvdMsgs(prt, dry_run);
     }
 
     prt->PRSM_state = PRSM_DISCARD;
 
-    prt->rcvdBpdu = false;
-    prt->rcvdRSTP = false;
-    prt->rcvdSTP = false;
+    set_prt_flag(prt, rcvdBpdu, false);
+    set_prt_flag(prt, rcvdRSTP, false);
+    set_prt_flag(prt, rcvdSTP, false);
     clearAllRcvdMsgs(prt, false /* actual run */);
-    assign(prt->edgeDelayWhile, prt->bridge->Migrate_Time);
+    set_prt_timer(prt, edgeDelayWhile,
+              SECONDS_TO_MS(prt->bridge->Migrate_Time));
 
     /* No need to run, no one condition will be met
      * if(!begin)
@@ -2920,14 +4857,22 @@ static bool PRSM_to_DISCARD(port_t *prt, bool dry_run)
 
 static void PRSM_to_RECEIVE(port_t *prt)
 {
+    bool rcvdInternal = fromSameRegion(prt);
+
     prt->PRSM_state = PRSM_RECEIVE;
 
+    /* operEdge and rcvdInternal are read by all trees of the port */
+    if(PRT_FLAG(prt, operEdge) || (PRT_FLAG(prt, rcvdInternal) != rcvdInternal))
+        sm_mark_port(prt);
+    if(PRT_FLAG(prt, rcvdInternal) != rcvdInternal)
+        roles_mark_port(prt);
     updtBPDUVersion(prt);
-    prt->rcvdInternal = fromSameRegion(prt);
+    set_prt_flag(prt, rcvdInternal, rcvdInternal);
     setRcvdMsgs(prt);
-    prt->operEdge = false;
-    prt->rcvdBpdu = false;
-    assign(prt->edgeDelayWhile, prt->bridge->Migrate_Time);
+    set_prt_flag(prt, operEdge, false);
+    set_prt_flag(prt, rcvdBpdu, false);
+    set_prt_timer(prt, edgeDelayWhile,
+              SECONDS_TO_MS(prt->bridge->Migrate_Time));
 
     /* No need to run, no one condition will be met
       PRSM_run(prt, false); */
@@ -2938,8 +4883,9 @@ static bool PRSM_run(port_t *prt, bool dry_run)
     per_tree_port_t *ptp;
     bool rcvdAnyMsg;
 
-    if((prt->rcvdBpdu || (prt->edgeDelayWhile != prt->bridge->Migrate_Time))
-       && !prt->portEnabled)
+    if((PRT_FLAG(prt, rcvdBpdu) || (PRT_TIMER(prt, edgeDelayWhile)
+                          != SECONDS_TO_MS(prt->bridge->Migrate_Time)))
+       && !PRT_FLAG(prt, portEnabled))
     {
         return PRSM_to_DISCARD(prt, dry_run);
     }
@@ -2947,7 +4893,7 @@ static bool PRSM_run(port_t *prt, bool dry_run)
     switch(prt->PRSM_state)
     {
         case PRSM_DISCARD:
-            if(prt->rcvdBpdu && prt->portEnabled)
+            if(PRT_FLAG(prt, rcvdBpdu) && PRT_FLAG(prt, portEnabled))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -2958,13 +4904,15 @@ static bool PRSM_run(port_t *prt, bool dry_run)
             rcvdAnyMsg = false;
             FOREACH_PTP_IN_PORT(ptp, prt)
             {
-                if(ptp->rcvdMsg)
+                if(PTP_FLAG(ptp, rcvdMsg))
                 {
                     rcvdAnyMsg = true;
                     break;
                 }
             }
-            if(prt->rcvdBpdu && prt->portEnabled && !rcvdAnyMsg)
+            if(PRT_MATCH(prt, PRT_BIT(rcvdBpdu) | PRT_BIT(portEnabled),
+                         PRT_BIT(rcvdBpdu) | PRT_BIT(portEnabled))
+               && !rcvdAnyMsg)
             {
                 if(dry_run) /* at least rcvdBpdu will change */
                     return true;
@@ -2985,9 +4933,11 @@ static void PPMSM_to_CHECKING_RSTP(port_t *prt/*, bool begin*/)
     prt->PPMSM_state = PPMSM_CHECKING_RSTP;
 
     bridge_t *br = prt->bridge;
-    prt->mcheck = false;
-    prt->sendRSTP = rstpVersion(br);
-    assign(prt->mdelayWhile, br->Migrate_Time);
+    set_prt_flag(prt, mcheck, false);
+    if(PRT_FLAG(prt, sendRSTP) != rstpVersion(br))
+        roles_mark_ptp(GET_CIST_PTP_FROM_PORT(prt));
+    set_prt_flag(prt, sendRSTP, rstpVersion(br));
+    set_prt_timer(prt, mdelayWhile, SECONDS_TO_MS(br->Migrate_Time));
 
     /* No need to run, no one condition will be met
      * if(!begin)
@@ -2998,8 +4948,11 @@ static void PPMSM_to_SELECTING_STP(port_t *prt)
 {
     prt->PPMSM_state = PPMSM_SELECTING_STP;
 
-    prt->sendRSTP = false;
-    assign(prt->mdelayWhile, prt->bridge->Migrate_Time);
+    if(PRT_FLAG(prt, sendRSTP))
+        roles_mark_ptp(GET_CIST_PTP_FROM_PORT(prt));
+    set_prt_flag(prt, sendRSTP, false);
+    set_prt_timer(prt, mdelayWhile,
+              SECONDS_TO_MS(prt->bridge->Migrate_Time));
 
     PPMSM_run(prt, false /* actual run */);
 }
@@ -3008,8 +4961,8 @@ static void PPMSM_to_SENSING(port_t *prt)
 {
     prt->PPMSM_state = PPMSM_SENSING;
 
-    prt->rcvdRSTP = false;
-    prt->rcvdSTP = false;
+    set_prt_flag(prt, rcvdRSTP, false);
+    set_prt_flag(prt, rcvdSTP, false);
 
     PPMSM_run(prt, false /* actual run */);
 }
@@ -3021,15 +4974,15 @@ static bool PPMSM_run(port_t *prt, bool dry_run)
     switch(prt->PPMSM_state)
     {
         case PPMSM_CHECKING_RSTP:
-            if((prt->mdelayWhile != br->Migrate_Time)
-               && !prt->portEnabled)
+            if((PRT_TIMER(prt, mdelayWhile) != SECONDS_TO_MS(br->Migrate_Time))
+               && !PRT_FLAG(prt, portEnabled))
             {
                 if(dry_run) /* at least mdelayWhile will change */
                     return true;
                 PPMSM_to_CHECKING_RSTP(prt);
                 return false;
             }
-            if(0 == prt->mdelayWhile)
+            if(0 == PRT_TIMER(prt, mdelayWhile))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -3037,7 +4990,8 @@ static bool PPMSM_run(port_t *prt, bool dry_run)
             }
             return false;
         case PPMSM_SELECTING_STP:
-            if(0 == prt->mdelayWhile || !prt->portEnabled || prt->mcheck)
+            if(0 == PRT_TIMER(prt, mdelayWhile) || !PRT_FLAG(prt, portEnabled)
+               || PRT_FLAG(prt, mcheck))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -3045,15 +4999,17 @@ static bool PPMSM_run(port_t *prt, bool dry_run)
             }
             return false;
         case PPMSM_SENSING:
-            if(!prt->portEnabled || prt->mcheck
-               || (rstpVersion(br) && !prt->sendRSTP && prt->rcvdRSTP))
+            if(!PRT_FLAG(prt, portEnabled) || PRT_FLAG(prt, mcheck)
+               || (rstpVersion(br)
+                   && PRT_MATCH(prt, PRT_BIT(sendRSTP) | PRT_BIT(rcvdRSTP),
+                                PRT_BIT(rcvdRSTP))))
             {
                 if(dry_run) /* state change */
                     return true;
                 PPMSM_to_CHECKING_RSTP(prt);
                 return false;
             }
-            if(prt->sendRSTP && prt->rcvdSTP)
+            if(PRT_FLAG(prt, sendRSTP) && PRT_FLAG(prt, rcvdSTP))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -3070,7 +5026,7 @@ static void BDSM_to_EDGE(port_t *prt/*, bool begin*/)
 {
     prt->BDSM_state = BDSM_EDGE;
 
-    prt->operEdge = true;
+    set_prt_flag(prt, operEdge, true);
 
     /* No need to run, no one condition will be met
      * if(!begin)
@@ -3081,7 +5037,7 @@ static void BDSM_to_NOT_EDGE(port_t *prt/*, bool begin*/)
 {
     prt->BDSM_state = BDSM_NOT_EDGE;
 
-    prt->operEdge = false;
+    set_prt_flag(prt, operEdge, false);
 
     /* No need to run, no one condition will be met
      * if(!begin)
@@ -3103,8 +5059,9 @@ static bool BDSM_run(port_t *prt, bool dry_run)
     switch(prt->BDSM_state)
     {
         case BDSM_EDGE:
-            if(((!prt->portEnabled || !prt->AutoEdge) && !prt->AdminEdgePort)
-               || !prt->operEdge
+            if(((!PRT_FLAG(prt, portEnabled) || !prt->AutoEdge)
+                && !prt->AdminEdgePort)
+               || !PRT_FLAG(prt, operEdge)
               )
             {
                 if(dry_run) /* state change */
@@ -3120,9 +5077,9 @@ static bool BDSM_run(port_t *prt, bool dry_run)
              * So, I decide that it will be the "proposing" flag
              *  from CIST tree - it seems like a good bet.
              */
-            if((!prt->portEnabled && prt->AdminEdgePort)
-               || ((0 == prt->edgeDelayWhile) && prt->AutoEdge && prt->sendRSTP
-                   && cist->proposing)
+            if((!PRT_FLAG(prt, portEnabled) && prt->AdminEdgePort)
+               || ((0 == PRT_TIMER(prt, edgeDelayWhile)) && prt->AutoEdge
+                   && PRT_FLAG(prt, sendRSTP) && PTP_FLAG(cist, proposing))
               )
             {
                 if(dry_run) /* state change */
@@ -3144,17 +5101,17 @@ static bool PTSM_to_TRANSMIT_INIT(port_t *prt, bool begin, bool dry_run)
     if(dry_run)
     {
         return (prt->PTSM_state != PTSM_TRANSMIT_INIT)
-               || (!prt->newInfo) || (!prt->newInfoMsti)
+               || (!PRT_FLAG(prt, newInfo)) || (!PRT_FLAG(prt, newInfoMsti))
                || (0 != prt->txCount);
     }
 
     prt->PTSM_state = PTSM_TRANSMIT_INIT;
 
-    prt->newInfo = true;
-    prt->newInfoMsti = true;
+    set_prt_flag(prt, newInfo, true);
+    set_prt_flag(prt, newInfoMsti, true);
     assign(prt->txCount, 0u);
 
-    if(!begin && prt->portEnabled) /* prevent infinite loop */
+    if(!begin && PRT_FLAG(prt, portEnabled)) /* prevent infinite loop */
         PTSM_run(prt, false /* actual run */);
     return false;
 }
@@ -3163,10 +5120,11 @@ static void PTSM_to_TRANSMIT_CONFIG(port_t *prt)
 {
     prt->PTSM_state = PTSM_TRANSMIT_CONFIG;
 
-    prt->newInfo = false;
+    set_prt_flag(prt, newInfo, false);
     txConfig(prt);
     ++(prt->txCount);
-    prt->tcAck = false;
+    port_timers_armed(prt);
+    set_prt_flag(prt, tcAck, false);
 
     PTSM_run(prt, false /* actual run */);
 }
@@ -3175,9 +5133,10 @@ static void PTSM_to_TRANSMIT_TCN(port_t *prt)
 {
     prt->PTSM_state = PTSM_TRANSMIT_TCN;
 
-    prt->newInfo = false;
+    set_prt_flag(prt, newInfo, false);
     txTcn(prt);
     ++(prt->txCount);
+    port_timers_armed(prt);
 
     PTSM_run(prt, false /* actual run */);
 }
@@ -3186,11 +5145,12 @@ static void PTSM_to_TRANSMIT_RSTP(port_t *prt)
 {
     prt->PTSM_state = PTSM_TRANSMIT_RSTP;
 
-    prt->newInfo = false;
-    prt->newInfoMsti = false;
+    set_prt_flag(prt, newInfo, false);
+    set_prt_flag(prt, newInfoMsti, false);
     txMstp(prt);
     ++(prt->txCount);
-    prt->tcAck = false;
+    port_timers_armed(prt);
+    set_prt_flag(prt, tcAck, false);
 
     PTSM_run(prt, false /* actual run */);
 }
@@ -3202,14 +5162,14 @@ static void PTSM_to_TRANSMIT_PERIODIC(port_t *prt)
     per_tree_port_t *ptp = GET_CIST_PTP_FROM_PORT(prt);
     bool cistDesignatedOrTCpropagatingRootPort =
         (roleDesignated == ptp->role)
-        || ((roleRoot == ptp->role) && (0 != ptp->tcWhile));
+        || ((roleRoot == ptp->role) && (0 != PTP_TIMER(ptp, tcWhile)));
     bool mstiDesignatedOrTCpropagatingRootPort;
 
     mstiDesignatedOrTCpropagatingRootPort = false;
     list_for_each_entry_continue(ptp, &prt->trees, port_list)
     {
         if((roleDesignated == ptp->role)
-           || ((roleRoot == ptp->role) && (0 != ptp->tcWhile))
+           || ((roleRoot == ptp->role) && (0 != PTP_TIMER(ptp, tcWhile)))
           )
         {
             mstiDesignatedOrTCpropagatingRootPort = true;
@@ -3217,9 +5177,10 @@ static void PTSM_to_TRANSMIT_PERIODIC(port_t *prt)
         }
     }
 
-    prt->newInfo = prt->newInfo || cistDesignatedOrTCpropagatingRootPort;
-    prt->newInfoMsti = prt->newInfoMsti
-                       || mstiDesignatedOrTCpropagatingRootPort;
+    set_prt_flag(prt, newInfo, PRT_FLAG(prt, newInfo)
+                               || cistDesignatedOrTCpropagatingRootPort);
+    set_prt_flag(prt, newInfoMsti, PRT_FLAG(prt, newInfoMsti)
+                                   || mstiDesignatedOrTCpropagatingRootPort);
 
     PTSM_run(prt, false /* actual run */);
 }
@@ -3228,20 +5189,20 @@ static void PTSM_to_IDLE(port_t *prt)
 {
     prt->PTSM_state = PTSM_IDLE;
 
-    per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
-    prt->helloWhen = cist->portTimes.Hello_Time;
+    set_prt_timer(prt, helloWhen, portHelloTimeMs(prt));
 
     PTSM_run(prt, false /* actual run */);
 }
 
-static bool PTSM_run(port_t *prt, bool dry_run)
+/* Reference implementation, see the transition tables below */
+static bool PTSM_run_ref(port_t *prt, bool dry_run)
 {
    /* bool allTransmitReady; */
     per_tree_port_t *ptp;
     port_role_t cistRole;
     bool mstiMasterPort;
 
-    if(!prt->portEnabled)
+    if(!PRT_FLAG(prt, portEnabled))
     {
         return PTSM_to_TRANSMIT_INIT(prt, false, dry_run);
     }
@@ -3264,7 +5225,7 @@ static bool PTSM_run(port_t *prt, bool dry_run)
         case PTSM_IDLE:
             /* allTransmitReady = true; */
             ptp = GET_CIST_PTP_FROM_PORT(prt);
-            if(!ptp->selected || ptp->updtInfo)
+            if(!selectedUpToDate(ptp))
             {
                 /* allTransmitReady = false; */
                 return false;
@@ -3273,7 +5234,7 @@ static bool PTSM_run(port_t *prt, bool dry_run)
             mstiMasterPort = false;
             list_for_each_entry_continue(ptp, &prt->trees, port_list)
             {
-                if(!ptp->selected || ptp->updtInfo)
+                if(!selectedUpToDate(ptp))
                 {
                     /* allTransmitReady = false; */
                     return false;
@@ -3281,7 +5242,7 @@ static bool PTSM_run(port_t *prt, bool dry_run)
                 if(roleMaster == ptp->role)
                     mstiMasterPort = true;
             }
-            if(0 == prt->helloWhen)
+            if(0 == PRT_TIMER(prt, helloWhen))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -3294,9 +5255,10 @@ static bool PTSM_run(port_t *prt, bool dry_run)
             if(prt->bpduFilterPort)
                 return false;
 
-            if(prt->sendRSTP)
+            if(PRT_FLAG(prt, sendRSTP))
             { /* implement MSTP */
-                if(prt->newInfo || (prt->newInfoMsti && !mstiMasterPort)
+                if(PRT_FLAG(prt, newInfo)
+                   || (PRT_FLAG(prt, newInfoMsti) && !mstiMasterPort)
                    || assurancePort(prt)
                   )
                 {
@@ -3308,14 +5270,14 @@ static bool PTSM_run(port_t *prt, bool dry_run)
             }
             else
             { /* fallback to STP */
-                if(prt->newInfo && (roleDesignated == cistRole))
+                if(PRT_FLAG(prt, newInfo) && (roleDesignated == cistRole))
                 {
                     if(dry_run) /* state change */
                         return true;
                     PTSM_to_TRANSMIT_CONFIG(prt);
                     return false;
                 }
-                if(prt->newInfo && (roleRoot == cistRole))
+                if(PRT_FLAG(prt, newInfo) && (roleRoot == cistRole))
                 {
                     if(dry_run) /* state change */
                         return true;
@@ -3345,15 +5307,16 @@ static void PISM_to_DISABLED(per_tree_port_t *ptp, bool begin)
     PISM_LOG("");
     ptp->PISM_state = PISM_DISABLED;
 
-    ptp->rcvdMsg = false;
-    ptp->proposing = false;
-    ptp->proposed = false;
-    ptp->agree = false;
-    ptp->agreed = false;
-    assign(ptp->rcvdInfoWhile, 0u);
+    set_ptp_flag(ptp, rcvdMsg, false);
+    set_ptp_flag(ptp, proposing, false);
+    set_ptp_flag(ptp, proposed, false);
+    set_ptp_flag(ptp, agree, false);
+    set_ptp_flag(ptp, agreed, false);
+    assign(PTP_TIMER(ptp, rcvdInfoWhile), 0u);
     ptp->infoIs = ioDisabled;
-    ptp->reselect = true;
-    ptp->selected = false;
+    roles_mark_info(ptp);
+    set_ptp_flag(ptp, reselect, true);
+    set_ptp_flag(ptp, selected, false);
 
     if(!begin)
         PISM_run(ptp, false /* actual run */);
@@ -3365,8 +5328,9 @@ static void PISM_to_AGED(per_tree_port_t *ptp)
     ptp->PISM_state = PISM_AGED;
 
     ptp->infoIs = ioAged;
-    ptp->reselect = true;
-    ptp->selected = false;
+    roles_mark_info(ptp);
+    set_ptp_flag(ptp, reselect, true);
+    set_ptp_flag(ptp, selected, false);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3376,20 +5340,22 @@ static void PISM_to_UPDATE(per_tree_port_t *ptp)
     PISM_LOG("");
     ptp->PISM_state = PISM_UPDATE;
 
-    ptp->proposing = false;
-    ptp->proposed = false;
-    ptp->agreed = ptp->agreed && betterorsameInfo(ptp, ioMine);
-    ptp->synced = ptp->synced && ptp->agreed;
+    set_ptp_flag(ptp, proposing, false);
+    set_ptp_flag(ptp, proposed, false);
+    set_ptp_flag(ptp, agreed,
+                 PTP_FLAG(ptp, agreed) && betterorsameInfo(ptp, ioMine));
+    set_ptp_flag(ptp, synced, PTP_FLAG(ptp, synced) && PTP_FLAG(ptp, agreed));
     assign(ptp->portPriority, ptp->designatedPriority);
     assign(ptp->portTimes, ptp->designatedTimes);
-    ptp->updtInfo = false;
+    set_ptp_flag(ptp, updtInfo, false);
     ptp->infoIs = ioMine;
+    roles_mark_info(ptp);
     /* newInfoXst = TRUE; */
     port_t *prt = ptp->port;
     if(0 == ptp->MSTID)
-        prt->newInfo = true;
+        set_prt_flag(prt, newInfo, true);
     else
-        prt->newInfoMsti = true;
+        set_prt_flag(prt, newInfoMsti, true);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3401,21 +5367,25 @@ static void PISM_to_SUPERIOR_DESIGNATED(per_tree_port_t *ptp)
 
     port_t *prt = ptp->port;
 
-    prt->infoInternal = prt->rcvdInternal;
-    ptp->agreed = false;
-    ptp->proposing = false;
+    if(PRT_FLAG(prt, infoInternal) != PRT_FLAG(prt, rcvdInternal))
+        roles_mark_port(prt);
+    set_prt_flag(prt, infoInternal, PRT_FLAG(prt, rcvdInternal));
+    set_ptp_flag(ptp, agreed, false);
+    set_ptp_flag(ptp, proposing, false);
     recordProposal(ptp);
     setTcFlags(ptp);
-    ptp->agree = ptp->agree && betterorsameInfo(ptp, ioReceived);
+    set_ptp_flag(ptp, agree,
+                 PTP_FLAG(ptp, agree) && betterorsameInfo(ptp, ioReceived));
     recordAgreement(ptp);
-    ptp->synced = ptp->synced && ptp->agreed;
+    set_ptp_flag(ptp, synced, PTP_FLAG(ptp, synced) && PTP_FLAG(ptp, agreed));
     recordPriority(ptp);
     recordTimes(ptp);
     updtRcvdInfoWhile(ptp);
     ptp->infoIs = ioReceived;
-    ptp->reselect = true;
-    ptp->selected = false;
-    ptp->rcvdMsg = false;
+    roles_mark_info(ptp);
+    set_ptp_flag(ptp, reselect, true);
+    set_ptp_flag(ptp, selected, false);
+    set_ptp_flag(ptp, rcvdMsg, false);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3427,12 +5397,14 @@ static void PISM_to_REPEATED_DESIGNATED(per_tree_port_t *ptp)
 
     port_t *prt = ptp->port;
 
-    prt->infoInternal = prt->rcvdInternal;
+    if(PRT_FLAG(prt, infoInternal) != PRT_FLAG(prt, rcvdInternal))
+        roles_mark_port(prt);
+    set_prt_flag(prt, infoInternal, PRT_FLAG(prt, rcvdInternal));
     recordProposal(ptp);
     setTcFlags(ptp);
     recordAgreement(ptp);
     updtRcvdInfoWhile(ptp);
-    ptp->rcvdMsg = false;
+    set_ptp_flag(ptp, rcvdMsg, false);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3443,7 +5415,7 @@ static void PISM_to_INFERIOR_DESIGNATED(per_tree_port_t *ptp)
     ptp->PISM_state = PISM_INFERIOR_DESIGNATED;
 
     recordDispute(ptp);
-    ptp->rcvdMsg = false;
+    set_ptp_flag(ptp, rcvdMsg, false);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3455,7 +5427,7 @@ static void PISM_to_NOT_DESIGNATED(per_tree_port_t *ptp)
 
     recordAgreement(ptp);
     setTcFlags(ptp);
-    ptp->rcvdMsg = false;
+    set_ptp_flag(ptp, rcvdMsg, false);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3465,7 +5437,7 @@ static void PISM_to_OTHER(per_tree_port_t *ptp)
     PISM_LOG("");
     ptp->PISM_state = PISM_OTHER;
 
-    ptp->rcvdMsg = false;
+    set_ptp_flag(ptp, rcvdMsg, false);
 
     PISM_run(ptp, false /* actual run */);
 }
@@ -3489,12 +5461,13 @@ static void PISM_to_RECEIVE(per_tree_port_t *ptp)
     PISM_run(ptp, false /* actual run */);
 }
 
-static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
+/* Reference implementation, see the transition tables below */
+static bool PISM_run_ref(per_tree_port_t *ptp, bool dry_run)
 {
     bool rcvdXstMsg, updtXstInfo;
     port_t *prt = ptp->port;
 
-    if((!prt->portEnabled) && (ioDisabled != ptp->infoIs))
+    if((!PRT_FLAG(prt, portEnabled)) && (ioDisabled != ptp->infoIs))
     {
         if(dry_run) /* at least infoIs will change */
             return true;
@@ -3505,14 +5478,14 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
     switch(ptp->PISM_state)
     {
         case PISM_DISABLED:
-            if(prt->portEnabled)
+            if(PRT_FLAG(prt, portEnabled))
             {
                 if(dry_run) /* state change */
                     return true;
                 PISM_to_AGED(ptp);
                 return false;
             }
-            if(ptp->rcvdMsg)
+            if(PTP_FLAG(ptp, rcvdMsg))
             {
                 if(dry_run) /* at least rcvdMsg will change */
                     return true;
@@ -3520,7 +5493,7 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
             }
             return false;
         case PISM_AGED:
-            if(ptp->selected && ptp->updtInfo)
+            if(PTP_FLAG(ptp, selected) && PTP_FLAG(ptp, updtInfo))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -3553,14 +5526,17 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
              */
             if(0 == ptp->MSTID)
             { /* CIST */
-                rcvdXstMsg = ptp->rcvdMsg; /* 13.25.12 */
-                updtXstInfo = ptp->updtInfo; /* 13.25.16 */
+                rcvdXstMsg = PTP_FLAG(ptp, rcvdMsg); /* 13.25.12 */
+                updtXstInfo = PTP_FLAG(ptp, updtInfo); /* 13.25.16 */
             }
             else
             { /* MSTI */
                 per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(prt);
-                rcvdXstMsg = !cist->rcvdMsg && ptp->rcvdMsg; /* 13.25.13 */
-                updtXstInfo = ptp->updtInfo || cist->updtInfo; /* 13.25.17 */
+                /* 13.25.13 */
+                rcvdXstMsg = !PTP_FLAG(cist, rcvdMsg) && PTP_FLAG(ptp, rcvdMsg);
+                /* 13.25.17 */
+                updtXstInfo = PTP_FLAG(ptp, updtInfo)
+                              || PTP_FLAG(cist, updtInfo);
             }
             if(rcvdXstMsg && !updtXstInfo)
             {
@@ -3569,15 +5545,16 @@ static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
                 PISM_to_RECEIVE(ptp);
                 return false;
             }
-            if((ioReceived == ptp->infoIs) && (0 == ptp->rcvdInfoWhile)
-               && !ptp->updtInfo && !rcvdXstMsg)
+            if((ioReceived == ptp->infoIs)
+               && (0 == PTP_TIMER(ptp, rcvdInfoWhile))
+               && !PTP_FLAG(ptp, updtInfo) && !rcvdXstMsg)
             {
                 if(dry_run) /* state change */
                     return true;
                 PISM_to_AGED(ptp);
                 return false;
             }
-            if(ptp->selected && ptp->updtInfo)
+            if(PTP_FLAG(ptp, selected) && PTP_FLAG(ptp, updtInfo))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -3662,7 +5639,7 @@ static bool PRSSM_run(tree_t *tree, bool dry_run)
             return false;
         case PRSSM_ROLE_SELECTION:
             FOREACH_PTP_IN_TREE(ptp, tree)
-                if(ptp->reselect)
+                if(PTP_FLAG(ptp, reselect))
                 {
                     if(dry_run) /* at least reselect will change */
                         return true;
@@ -3683,8 +5660,7 @@ static bool PRSSM_run(tree_t *tree, bool dry_run)
 #define PRTSM_LOG(_fmt, _args...) {}
 #endif /* PRTSM_ENABLE_LOG */
 
-static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run);
-#define PRTSM_run(ptp, dry_run) PRTSM_runr((ptp), false, (dry_run))
+static bool PRTSM_run(per_tree_port_t *ptp, bool dry_run);
 #define PRTSM_begin(ptp) PRTSM_to_INIT_PORT(ptp)
 
  /* Disabled Port role transitions */
@@ -3697,25 +5673,27 @@ static void PRTSM_to_INIT_PORT(per_tree_port_t *ptp/*, bool begin*/)
     unsigned int MaxAge, FwdDelay;
     per_tree_port_t *cist = GET_CIST_PTP_FROM_PORT(ptp->port);
 
-    ptp->role = roleDisabled;
-    ptp->learn = false;
-    ptp->forward = false;
-    ptp->synced = false;
-    ptp->sync = true;
-    ptp->reRoot = true;
+    set_ptp_role(ptp, roleDisabled);
+    set_ptp_flag(ptp, learn, false);
+    set_ptp_flag(ptp, forward, false);
+    set_ptp_flag(ptp, synced, false);
+    set_ptp_flag(ptp, sync, true);
+    set_ptp_flag(ptp, reRoot, true);
     /* 13.25.6 */
-    FwdDelay = cist->designatedTimes.Forward_Delay;
-    assign(ptp->rrWhile, FwdDelay);
+    FwdDelay = fwdDelayMs(ptp->port->bridge,
+                          cist->designatedTimes.Forward_Delay);
+    set_ptp_timer(ptp, rrWhile, FwdDelay);
     /* 13.25.8 */
-    MaxAge = cist->designatedTimes.Max_Age;
-    assign(ptp->fdWhile, MaxAge);
-    assign(ptp->rbWhile, 0u);
+    MaxAge = SECONDS_TO_MS(cist->designatedTimes.Max_Age);
+    set_ptp_timer(ptp, fdWhile, MaxAge);
+    assign(PTP_TIMER(ptp, rbWhile), 0u);
 
     /* No need to check, as we assume begin = true here
      * because transition to this state can be initiated only by BEGIN var.
      * In other words, this function is called via xxx_begin macro only.
-     * if(!begin)
-     *     PRTSM_runr(ptp, false, false); */
+     * The other PRTSM_to_xxx() functions do not run the state machine
+     * either, PRTSM_run() loops until no transition is taken.
+     */
 }
 
 static void PRTSM_to_DISABLE_PORT(per_tree_port_t *ptp)
@@ -3742,11 +5720,9 @@ static void PRTSM_to_DISABLE_PORT(per_tree_port_t *ptp)
      * Solution: do not follow the standard, and do role = roleDisabled
      *  instead of role = selectedRole.
      */
-    ptp->role = roleDisabled;
-    ptp->learn = false;
-    ptp->forward = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_role(ptp, roleDisabled);
+    set_ptp_flag(ptp, learn, false);
+    set_ptp_flag(ptp, forward, false);
 }
 
 static void PRTSM_to_DISABLED_PORT(per_tree_port_t *ptp, unsigned int MaxAge)
@@ -3754,13 +5730,11 @@ static void PRTSM_to_DISABLED_PORT(per_tree_port_t *ptp, unsigned int MaxAge)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DISABLED_PORT;
 
-    assign(ptp->fdWhile, MaxAge);
-    ptp->synced = true;
-    assign(ptp->rrWhile, 0u);
-    ptp->sync = false;
-    ptp->reRoot = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_timer(ptp, fdWhile, MaxAge);
+    set_ptp_flag(ptp, synced, true);
+    assign(PTP_TIMER(ptp, rrWhile), 0u);
+    set_ptp_flag(ptp, sync, false);
+    set_ptp_flag(ptp, reRoot, false);
 }
 
  /* MasterPort role transitions */
@@ -3771,9 +5745,7 @@ static void PRTSM_to_MASTER_PROPOSED(per_tree_port_t *ptp)
     ptp->PRTSM_state = PRTSM_MASTER_PROPOSED;
 
     setSyncTree(ptp->tree);
-    ptp->proposed = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, proposed, false);
 }
 
 static void PRTSM_to_MASTER_AGREED(per_tree_port_t *ptp)
@@ -3781,11 +5753,9 @@ static void PRTSM_to_MASTER_AGREED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_AGREED;
 
-    ptp->proposed = false;
-    ptp->sync = false;
-    ptp->agree = true;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, proposed, false);
+    set_ptp_flag(ptp, sync, false);
+    set_ptp_flag(ptp, agree, true);
 }
 
 static void PRTSM_to_MASTER_SYNCED(per_tree_port_t *ptp)
@@ -3793,11 +5763,9 @@ static void PRTSM_to_MASTER_SYNCED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_SYNCED;
 
-    assign(ptp->rrWhile, 0u);
-    ptp->synced = true;
-    ptp->sync = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    assign(PTP_TIMER(ptp, rrWhile), 0u);
+    set_ptp_flag(ptp, synced, true);
+    set_ptp_flag(ptp, sync, false);
 }
 
 static void PRTSM_to_MASTER_RETIRED(per_tree_port_t *ptp)
@@ -3805,9 +5773,7 @@ static void PRTSM_to_MASTER_RETIRED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_RETIRED;
 
-    ptp->reRoot = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, reRoot, false);
 }
 
 static void PRTSM_to_MASTER_FORWARD(per_tree_port_t *ptp)
@@ -3815,11 +5781,9 @@ static void PRTSM_to_MASTER_FORWARD(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_FORWARD;
 
-    ptp->forward = true;
-    assign(ptp->fdWhile, 0u);
-    ptp->agreed = ptp->port->sendRSTP;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, forward, true);
+    assign(PTP_TIMER(ptp, fdWhile), 0u);
+    set_ptp_flag(ptp, agreed, PRT_FLAG(ptp->port, sendRSTP));
 }
 
 static void PRTSM_to_MASTER_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -3827,10 +5791,8 @@ static void PRTSM_to_MASTER_LEARN(per_tree_port_t *ptp, unsigned int forwardDela
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_LEARN;
 
-    ptp->learn = true;
-    assign(ptp->fdWhile, forwardDelay);
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, learn, true);
+    set_ptp_timer(ptp, fdWhile, forwardDelay);
 }
 
 static void PRTSM_to_MASTER_DISCARD(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -3838,12 +5800,10 @@ static void PRTSM_to_MASTER_DISCARD(per_tree_port_t *ptp, unsigned int forwardDe
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_DISCARD;
 
-    ptp->learn = false;
-    ptp->forward = false;
-    ptp->disputed = false;
-    assign(ptp->fdWhile, forwardDelay);
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, learn, false);
+    set_ptp_flag(ptp, forward, false);
+    set_ptp_flag(ptp, disputed, false);
+    set_ptp_timer(ptp, fdWhile, forwardDelay);
 }
 
 static void PRTSM_to_MASTER_PORT(per_tree_port_t *ptp)
@@ -3851,9 +5811,7 @@ static void PRTSM_to_MASTER_PORT(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_MASTER_PORT;
 
-    ptp->role = roleMaster;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_role(ptp, roleMaster);
 }
 
  /* RootPort role transitions */
@@ -3864,9 +5822,7 @@ static void PRTSM_to_ROOT_PROPOSED(per_tree_port_t *ptp)
     ptp->PRTSM_state = PRTSM_ROOT_PROPOSED;
 
     setSyncTree(ptp->tree);
-    ptp->proposed = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, proposed, false);
 }
 
 static void PRTSM_to_ROOT_AGREED(per_tree_port_t *ptp)
@@ -3874,17 +5830,15 @@ static void PRTSM_to_ROOT_AGREED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ROOT_AGREED;
 
-    ptp->proposed = false;
-    ptp->sync = false;
-    ptp->agree = true;
+    set_ptp_flag(ptp, proposed, false);
+    set_ptp_flag(ptp, sync, false);
+    set_ptp_flag(ptp, agree, true);
     /* newInfoXst = TRUE; */
     port_t *prt = ptp->port;
     if(0 == ptp->MSTID)
-        prt->newInfo = true;
+        set_prt_flag(prt, newInfo, true);
     else
-        prt->newInfoMsti = true;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+        set_prt_flag(prt, newInfoMsti, true);
 }
 
 static void PRTSM_to_ROOT_SYNCED(per_tree_port_t *ptp)
@@ -3892,10 +5846,8 @@ static void PRTSM_to_ROOT_SYNCED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ROOT_SYNCED;
 
-    ptp->synced = true;
-    ptp->sync = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, synced, true);
+    set_ptp_flag(ptp, sync, false);
 }
 
 static void PRTSM_to_REROOT(per_tree_port_t *ptp)
@@ -3904,8 +5856,6 @@ static void PRTSM_to_REROOT(per_tree_port_t *ptp)
     ptp->PRTSM_state = PRTSM_REROOT;
 
     setReRootTree(ptp->tree);
-
-    PRTSM_runr(ptp, true, false /* actual run */);
 }
 
 static void PRTSM_to_ROOT_FORWARD(per_tree_port_t *ptp)
@@ -3913,10 +5863,8 @@ static void PRTSM_to_ROOT_FORWARD(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ROOT_FORWARD;
 
-    assign(ptp->fdWhile, 0u);
-    ptp->forward = true;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    assign(PTP_TIMER(ptp, fdWhile), 0u);
+    set_ptp_flag(ptp, forward, true);
 }
 
 static void PRTSM_to_ROOT_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -3924,10 +5872,8 @@ static void PRTSM_to_ROOT_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ROOT_LEARN;
 
-    assign(ptp->fdWhile, forwardDelay);
-    ptp->learn = true;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_timer(ptp, fdWhile, forwardDelay);
+    set_ptp_flag(ptp, learn, true);
 }
 
 static void PRTSM_to_REROOTED(per_tree_port_t *ptp)
@@ -3935,9 +5881,7 @@ static void PRTSM_to_REROOTED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_REROOTED;
 
-    ptp->reRoot = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, reRoot, false);
 }
 
 static void PRTSM_to_ROOT_PORT(per_tree_port_t *ptp, unsigned int FwdDelay)
@@ -3945,10 +5889,8 @@ static void PRTSM_to_ROOT_PORT(per_tree_port_t *ptp, unsigned int FwdDelay)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ROOT_PORT;
 
-    ptp->role = roleRoot;
-    assign(ptp->rrWhile, FwdDelay);
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_role(ptp, roleRoot);
+    set_ptp_timer(ptp, rrWhile, FwdDelay);
 }
 
  /* DesignatedPort role transitions */
@@ -3960,23 +5902,21 @@ static void PRTSM_to_DESIGNATED_PROPOSE(per_tree_port_t *ptp)
 
     port_t *prt = ptp->port;
 
-    ptp->proposing = true;
+    set_ptp_flag(ptp, proposing, true);
     /* newInfoXst = TRUE; */
     if(0 == ptp->MSTID)
     { /* CIST */
         /* 13.25.8. This tree is CIST. */
-        unsigned int MaxAge = ptp->designatedTimes.Max_Age;
+        unsigned int MaxAge = SECONDS_TO_MS(ptp->designatedTimes.Max_Age);
         /* 13.25.c) -> 17.20.4 of 802.1D : EdgeDelay */
         unsigned int EdgeDelay = prt->operPointToPointMAC ?
-                                   prt->bridge->Migrate_Time
+                                   SECONDS_TO_MS(prt->bridge->Migrate_Time)
                                  : MaxAge;
-        assign(prt->edgeDelayWhile, EdgeDelay);
-        prt->newInfo = true;
+        set_prt_timer(prt, edgeDelayWhile, EdgeDelay);
+        set_prt_flag(prt, newInfo, true);
     }
     else
-        prt->newInfoMsti = true;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+        set_prt_flag(prt, newInfoMsti, true);
 }
 
 static void PRTSM_to_DESIGNATED_AGREED(per_tree_port_t *ptp)
@@ -3984,17 +5924,15 @@ static void PRTSM_to_DESIGNATED_AGREED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_AGREED;
 
-    ptp->proposed = false;
-    ptp->sync = false;
-    ptp->agree = true;
+    set_ptp_flag(ptp, proposed, false);
+    set_ptp_flag(ptp, sync, false);
+    set_ptp_flag(ptp, agree, true);
     /* newInfoXst = TRUE; */
     port_t *prt = ptp->port;
     if(0 == ptp->MSTID)
-        prt->newInfo = true;
+        set_prt_flag(prt, newInfo, true);
     else
-        prt->newInfoMsti = true;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+        set_prt_flag(prt, newInfoMsti, true);
 }
 
 static void PRTSM_to_DESIGNATED_SYNCED(per_tree_port_t *ptp)
@@ -4002,11 +5940,9 @@ static void PRTSM_to_DESIGNATED_SYNCED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_SYNCED;
 
-    assign(ptp->rrWhile, 0u);
-    ptp->synced = true;
-    ptp->sync = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    assign(PTP_TIMER(ptp, rrWhile), 0u);
+    set_ptp_flag(ptp, synced, true);
+    set_ptp_flag(ptp, sync, false);
 }
 
 static void PRTSM_to_DESIGNATED_RETIRED(per_tree_port_t *ptp)
@@ -4014,9 +5950,7 @@ static void PRTSM_to_DESIGNATED_RETIRED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_RETIRED;
 
-    ptp->reRoot = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, reRoot, false);
 }
 
 static void PRTSM_to_DESIGNATED_FORWARD(per_tree_port_t *ptp)
@@ -4024,11 +5958,9 @@ static void PRTSM_to_DESIGNATED_FORWARD(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_FORWARD;
 
-    ptp->forward = true;
-    assign(ptp->fdWhile, 0u);
-    ptp->agreed = ptp->port->sendRSTP;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, forward, true);
+    assign(PTP_TIMER(ptp, fdWhile), 0u);
+    set_ptp_flag(ptp, agreed, PRT_FLAG(ptp->port, sendRSTP));
 }
 
 static void PRTSM_to_DESIGNATED_LEARN(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -4036,10 +5968,8 @@ static void PRTSM_to_DESIGNATED_LEARN(per_tree_port_t *ptp, unsigned int forward
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_LEARN;
 
-    ptp->learn = true;
-    assign(ptp->fdWhile, forwardDelay);
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, learn, true);
+    set_ptp_timer(ptp, fdWhile, forwardDelay);
 }
 
 static void PRTSM_to_DESIGNATED_DISCARD(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -4047,12 +5977,10 @@ static void PRTSM_to_DESIGNATED_DISCARD(per_tree_port_t *ptp, unsigned int forwa
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_DISCARD;
 
-    ptp->learn = false;
-    ptp->forward = false;
-    ptp->disputed = false;
-    assign(ptp->fdWhile, forwardDelay);
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, learn, false);
+    set_ptp_flag(ptp, forward, false);
+    set_ptp_flag(ptp, disputed, false);
+    set_ptp_timer(ptp, fdWhile, forwardDelay);
 }
 
 static void PRTSM_to_DESIGNATED_PORT(per_tree_port_t *ptp)
@@ -4060,9 +5988,7 @@ static void PRTSM_to_DESIGNATED_PORT(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_DESIGNATED_PORT;
 
-    ptp->role = roleDesignated;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_role(ptp, roleDesignated);
 }
 
  /* AlternatePort and BackupPort role transitions */
@@ -4072,11 +5998,9 @@ static void PRTSM_to_BLOCK_PORT(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_BLOCK_PORT;
 
-    ptp->role = ptp->selectedRole;
-    ptp->learn = false;
-    ptp->forward = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_role(ptp, ptp->selectedRole);
+    set_ptp_flag(ptp, learn, false);
+    set_ptp_flag(ptp, forward, false);
 }
 
 static void PRTSM_to_BACKUP_PORT(per_tree_port_t *ptp, unsigned int HelloTime)
@@ -4084,9 +6008,7 @@ static void PRTSM_to_BACKUP_PORT(per_tree_port_t *ptp, unsigned int HelloTime)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_BACKUP_PORT;
 
-    assign(ptp->rbWhile, 2 * HelloTime);
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_timer(ptp, rbWhile, 2 * HelloTime);
 }
 
 static void PRTSM_to_ALTERNATE_PROPOSED(per_tree_port_t *ptp)
@@ -4095,9 +6017,7 @@ static void PRTSM_to_ALTERNATE_PROPOSED(per_tree_port_t *ptp)
     ptp->PRTSM_state = PRTSM_ALTERNATE_PROPOSED;
 
     setSyncTree(ptp->tree);
-    ptp->proposed = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_flag(ptp, proposed, false);
 }
 
 static void PRTSM_to_ALTERNATE_AGREED(per_tree_port_t *ptp)
@@ -4105,16 +6025,14 @@ static void PRTSM_to_ALTERNATE_AGREED(per_tree_port_t *ptp)
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ALTERNATE_AGREED;
 
-    ptp->proposed = false;
-    ptp->agree = true;
+    set_ptp_flag(ptp, proposed, false);
+    set_ptp_flag(ptp, agree, true);
     /* newInfoXst = TRUE; */
     port_t *prt = ptp->port;
     if(0 == ptp->MSTID)
-        prt->newInfo = true;
+        set_prt_flag(prt, newInfo, true);
     else
-        prt->newInfoMsti = true;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+        set_prt_flag(prt, newInfoMsti, true);
 }
 
 static void PRTSM_to_ALTERNATE_PORT(per_tree_port_t *ptp, unsigned int forwardDelay)
@@ -4122,16 +6040,16 @@ static void PRTSM_to_ALTERNATE_PORT(per_tree_port_t *ptp, unsigned int forwardDe
     PRTSM_LOG("");
     ptp->PRTSM_state = PRTSM_ALTERNATE_PORT;
 
-    assign(ptp->fdWhile, forwardDelay);
-    ptp->synced = true;
-    assign(ptp->rrWhile, 0u);
-    ptp->sync = false;
-    ptp->reRoot = false;
-
-    PRTSM_runr(ptp, true, false /* actual run */);
+    set_ptp_timer(ptp, fdWhile, forwardDelay);
+    set_ptp_flag(ptp, synced, true);
+    assign(PTP_TIMER(ptp, rrWhile), 0u);
+    set_ptp_flag(ptp, sync, false);
+    set_ptp_flag(ptp, reRoot, false);
 }
 
-static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
+/* Reference implementation, see the transition tables below */
+static bool PRTSM_runr_ref(per_tree_port_t *ptp, bool recursive_call,
+                           bool dry_run)
 {
     /* Following vars do not need recalculating on recursive calls */
     static unsigned int MaxAge, FwdDelay, forwardDelay, HelloTime;
@@ -4152,21 +6070,22 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
         cist = GET_CIST_PTP_FROM_PORT(prt);
 
         /* 13.25.6 */
-        FwdDelay = cist->designatedTimes.Forward_Delay;
+        FwdDelay = fwdDelayMs(prt->bridge, cist->designatedTimes.Forward_Delay);
 
         /* 13.25.7 */
-        HelloTime = cist->portTimes.Hello_Time;
+        HelloTime = portHelloTimeMs(prt);
 
         /* 13.25.d) -> 17.20.5 of 802.1D */
-        forwardDelay = prt->sendRSTP ? HelloTime : FwdDelay;
+        forwardDelay = PRT_FLAG(prt, sendRSTP) ? HelloTime : FwdDelay;
 
         /* 13.25.8 */
-        MaxAge = cist->designatedTimes.Max_Age;
+        MaxAge = SECONDS_TO_MS(cist->designatedTimes.Max_Age);
     }
 
     PRTSM_LOG("role = %d, selectedRole = %d, selected = %d, updtInfo = %d",
-              ptp->role, ptp->selectedRole, ptp->selected, ptp->updtInfo);
-    if((ptp->role != ptp->selectedRole) && ptp->selected && !ptp->updtInfo)
+              ptp->role, ptp->selectedRole, PTP_FLAG(ptp, selected),
+              PTP_FLAG(ptp, updtInfo));
+    if((ptp->role != ptp->selectedRole) && selectedUpToDate(ptp))
     {
         switch(ptp->selectedRole)
         {
@@ -4174,28 +6093,28 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
                 if(dry_run) /* at least role will change */
                     return true;
                 PRTSM_to_DISABLE_PORT(ptp);
-                return false;
+                return true;
             case roleMaster:
                 if(dry_run) /* at least role will change */
                     return true;
                 PRTSM_to_MASTER_PORT(ptp);
-                return false;
+                return true;
             case roleRoot:
                 if(dry_run) /* at least role will change */
                     return true;
                 PRTSM_to_ROOT_PORT(ptp, FwdDelay);
-                return false;
+                return true;
             case roleDesignated:
                 if(dry_run) /* at least role will change */
                     return true;
                 PRTSM_to_DESIGNATED_PORT(ptp);
-                return false;
+                return true;
             case roleAlternate:
             case roleBackup:
                 if(dry_run) /* at least role will change */
                     return true;
                 PRTSM_to_BLOCK_PORT(ptp);
-                return false;
+                return true;
         }
     }
 
@@ -4204,9 +6123,9 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
     FOREACH_PTP_IN_TREE(ptp_1, tree)
     {
         /* a) */
-        if(!ptp_1->selected
+        if(!PTP_FLAG(ptp_1, selected)
            || (ptp_1->role != ptp_1->selectedRole)
-           || ptp_1->updtInfo
+           || PTP_FLAG(ptp_1, updtInfo)
           )
         {
             allSynced = false;
@@ -4218,12 +6137,12 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
         {
             case roleRoot:
             case roleAlternate:
-                if((roleRoot != ptp_1->role) && !ptp_1->synced)
+                if((roleRoot != ptp_1->role) && !PTP_FLAG(ptp_1, synced))
                     allSynced = false;
                 break;
             case roleDesignated:
             case roleMaster:
-                if((ptp != ptp_1) && !ptp_1->synced)
+                if((ptp != ptp_1) && !PTP_FLAG(ptp_1, synced))
                     allSynced = false;
                 break;
             default:
@@ -4240,26 +6159,29 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
             if(dry_run) /* state change */
                 return true;
             PRTSM_to_DISABLE_PORT(ptp);
-            return false;
+            return true;
         case PRTSM_DISABLE_PORT:
-            if(ptp->selected && !ptp->updtInfo
-               && !ptp->learning && !ptp->forwarding
+            if(selectedUpToDate(ptp)
+               && !PTP_ANY(ptp, PTP_BIT(learning) | PTP_BIT(forwarding))
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_DISABLED_PORT(ptp, MaxAge);
+                return true;
             }
             return false;
         case PRTSM_DISABLED_PORT:
-            if(ptp->selected && !ptp->updtInfo
-               && (ptp->sync || ptp->reRoot || !ptp->synced
-                   || (ptp->fdWhile != MaxAge))
+            if(selectedUpToDate(ptp)
+               && (PTP_ANY(ptp, PTP_BIT(sync) | PTP_BIT(reRoot))
+                   || !PTP_FLAG(ptp, synced)
+                   || (PTP_TIMER(ptp, fdWhile) != MaxAge))
               )
             {
                 if(dry_run) /* one of (sync,reRoot,synced,fdWhile) will change */
                     return true;
                 PRTSM_to_DISABLED_PORT(ptp, MaxAge);
+                return true;
             }
             return false;
      /* MasterPort role transitions */
@@ -4279,73 +6201,75 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
             if(dry_run) /* state change */
                 return true;
             PRTSM_to_MASTER_PORT(ptp);
-            return false;
+            return true;
         case PRTSM_MASTER_PORT:
-            if(!(ptp->selected && !ptp->updtInfo))
+            if(!selectedUpToDate(ptp))
                 return false;
-            if(ptp->reRoot && (0 == ptp->rrWhile))
+            if(PTP_FLAG(ptp, reRoot) && (0 == PTP_TIMER(ptp, rrWhile)))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_MASTER_RETIRED(ptp);
-                return false;
+                return true;
             }
-            if((!ptp->learning && !ptp->forwarding && !ptp->synced)
-               || (ptp->agreed && !ptp->synced)
-               || (prt->operEdge && !ptp->synced)
-               || (ptp->sync && ptp->synced)
+            if(!PTP_ANY(ptp, PTP_BIT(learning) | PTP_BIT(forwarding)
+                             | PTP_BIT(synced))
+               || (PTP_FLAG(ptp, agreed) && !PTP_FLAG(ptp, synced))
+               || (PRT_FLAG(prt, operEdge) && !PTP_FLAG(ptp, synced))
+               || (PTP_FLAG(ptp, sync) && PTP_FLAG(ptp, synced))
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_MASTER_SYNCED(ptp);
-                return false;
+                return true;
             }
-            if((allSynced && !ptp->agree)
-               || (ptp->proposed && ptp->agree)
+            if((allSynced && !PTP_FLAG(ptp, agree))
+               || (PTP_FLAG(ptp, proposed) && PTP_FLAG(ptp, agree))
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_MASTER_AGREED(ptp);
-                return false;
+                return true;
             }
-            if(ptp->proposed && !ptp->agree)
+            if(PTP_FLAG(ptp, proposed) && !PTP_FLAG(ptp, agree))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_MASTER_PROPOSED(ptp);
-                return false;
+                return true;
             }
-            if(((0 == ptp->fdWhile) || allSynced)
-               && ptp->learn && !ptp->forward
+            if(((0 == PTP_TIMER(ptp, fdWhile)) || allSynced)
+               && PTP_FLAG(ptp, learn) && !PTP_FLAG(ptp, forward)
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_MASTER_FORWARD(ptp);
-                return false;
+                return true;
             }
-            if(((0 == ptp->fdWhile) || allSynced)
-               && !ptp->learn
+            if(((0 == PTP_TIMER(ptp, fdWhile)) || allSynced)
+               && !PTP_FLAG(ptp, learn)
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_MASTER_LEARN(ptp, forwardDelay);
-                return false;
+                return true;
             }
-            if(((ptp->sync && !ptp->synced)
-                || (ptp->reRoot && (0 != ptp->rrWhile))
-                || ptp->disputed
+            if(((PTP_FLAG(ptp, sync) && !PTP_FLAG(ptp, synced))
+                || (PTP_FLAG(ptp, reRoot) && (0 != PTP_TIMER(ptp, rrWhile)))
+                || PTP_FLAG(ptp, disputed)
                )
-               && !prt->operEdge && (ptp->learn || ptp->forward)
+               && !PRT_FLAG(prt, operEdge)
+               && PTP_ANY(ptp, PTP_BIT(learn) | PTP_BIT(forward))
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_MASTER_DISCARD(ptp, forwardDelay);
-                return false;
+                return true;
             }
             return false;
      /* RootPort role transitions */
@@ -4365,80 +6289,83 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
             if(dry_run) /* state change */
                 return true;
             PRTSM_to_ROOT_PORT(ptp, FwdDelay);
-            return false;
+            return true;
         case PRTSM_ROOT_PORT:
-            if(!(ptp->selected && !ptp->updtInfo))
+            if(!selectedUpToDate(ptp))
                 return false;
-            if(!ptp->forward && !ptp->reRoot)
+            if(!PTP_FLAG(ptp, forward) && !PTP_FLAG(ptp, reRoot))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_REROOT(ptp);
-                return false;
+                return true;
             }
-            if((ptp->agreed && !ptp->synced) || (ptp->sync && ptp->synced))
+            if((PTP_FLAG(ptp, agreed) && !PTP_FLAG(ptp, synced))
+               || (PTP_FLAG(ptp, sync) && PTP_FLAG(ptp, synced)))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ROOT_SYNCED(ptp);
-                return false;
+                return true;
             }
-            if((allSynced && !ptp->agree) || (ptp->proposed && ptp->agree))
+            if((allSynced && !PTP_FLAG(ptp, agree))
+               || (PTP_FLAG(ptp, proposed) && PTP_FLAG(ptp, agree)))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ROOT_AGREED(ptp);
-                return false;
+                return true;
             }
-            if(ptp->proposed && !ptp->agree)
+            if(PTP_FLAG(ptp, proposed) && !PTP_FLAG(ptp, agree))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ROOT_PROPOSED(ptp);
-                return false;
+                return true;
             }
             /* 17.20.10 of 802.1D : reRooted */
             reRooted = true;
             FOREACH_PTP_IN_TREE(ptp_1, tree)
             {
-                if((ptp != ptp_1) && (0 != ptp_1->rrWhile))
+                if((ptp != ptp_1) && (0 != PTP_TIMER(ptp_1, rrWhile)))
                 {
                     reRooted = false;
                     break;
                 }
             }
-            if((0 == ptp->fdWhile)
-               || (reRooted && (0 == ptp->rbWhile) && rstpVersion(prt->bridge))
+            if((0 == PTP_TIMER(ptp, fdWhile))
+               || (reRooted && (0 == PTP_TIMER(ptp, rbWhile))
+                   && rstpVersion(prt->bridge))
               )
             {
-                if(!ptp->learn)
+                if(!PTP_FLAG(ptp, learn))
                 {
                     if(dry_run) /* state change */
                         return true;
                     PRTSM_to_ROOT_LEARN(ptp, forwardDelay);
-                    return false;
+                    return true;
                 }
-                else if(!ptp->forward)
+                else if(!PTP_FLAG(ptp, forward))
                 {
                     if(dry_run) /* state change */
                         return true;
                     PRTSM_to_ROOT_FORWARD(ptp);
-                    return false;
+                    return true;
                 }
             }
-            if(ptp->reRoot && ptp->forward)
+            if(PTP_FLAG(ptp, reRoot) && PTP_FLAG(ptp, forward))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_REROOTED(ptp);
-                return false;
+                return true;
             }
-            if(ptp->rrWhile != FwdDelay)
+            if(PTP_TIMER(ptp, rrWhile) != FwdDelay)
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ROOT_PORT(ptp, FwdDelay);
-                return false;
+                return true;
             }
             return false;
      /* DesignatedPort role transitions */
@@ -4458,88 +6385,94 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
             if(dry_run) /* state change */
                 return true;
             PRTSM_to_DESIGNATED_PORT(ptp);
-            return false;
+            return true;
         case PRTSM_DESIGNATED_PORT:
-            if(!(ptp->selected && !ptp->updtInfo))
+            if(!selectedUpToDate(ptp))
                 return false;
-            if(ptp->reRoot && (0 == ptp->rrWhile))
+            if(PTP_FLAG(ptp, reRoot) && (0 == PTP_TIMER(ptp, rrWhile)))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_DESIGNATED_RETIRED(ptp);
-                return false;
+                return true;
             }
-            if((!ptp->learning && !ptp->forwarding && !ptp->synced)
-               || (ptp->agreed && !ptp->synced)
-               || (prt->operEdge && !ptp->synced)
-               || (ptp->sync && ptp->synced)
+            if(!PTP_ANY(ptp, PTP_BIT(learning) | PTP_BIT(forwarding)
+                             | PTP_BIT(synced))
+               || (PTP_FLAG(ptp, agreed) && !PTP_FLAG(ptp, synced))
+               || (PRT_FLAG(prt, operEdge) && !PTP_FLAG(ptp, synced))
+               || (PTP_FLAG(ptp, sync) && PTP_FLAG(ptp, synced))
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_DESIGNATED_SYNCED(ptp);
-                return false;
+                return true;
             }
-            if(allSynced && (ptp->proposed || !ptp->agree))
+            if(allSynced && (PTP_FLAG(ptp, proposed) || !PTP_FLAG(ptp, agree)))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_DESIGNATED_AGREED(ptp);
-                return false;
+                return true;
             }
-            if(!ptp->forward && !ptp->agreed && !ptp->proposing
-               && !prt->operEdge)
+            if(!PTP_ANY(ptp, PTP_BIT(forward) | PTP_BIT(agreed)
+                             | PTP_BIT(proposing))
+               && !PRT_FLAG(prt, operEdge))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_DESIGNATED_PROPOSE(ptp);
-                return false;
+                return true;
             }
             /* Dont transition to learn/forward when BA inconsistent */
-            if(((0 == ptp->fdWhile) || ptp->agreed || prt->operEdge)
-               && ((0 == ptp->rrWhile) || !ptp->reRoot) && !ptp->sync
+            if(((0 == PTP_TIMER(ptp, fdWhile)) || PTP_FLAG(ptp, agreed)
+                || PRT_FLAG(prt, operEdge))
+               && ((0 == PTP_TIMER(ptp, rrWhile)) || !PTP_FLAG(ptp, reRoot))
+               && !PTP_FLAG(ptp, sync)
                && !ptp->port->BaInconsistent
               )
             {
-                if(!ptp->learn)
+                if(!PTP_FLAG(ptp, learn))
                 {
                     if(dry_run) /* state change */
                         return true;
                     PRTSM_to_DESIGNATED_LEARN(ptp, forwardDelay);
-                    return false;
+                    return true;
                 }
-                else if(!ptp->forward)
+                else if(!PTP_FLAG(ptp, forward))
                 {
                     if(dry_run) /* state change */
                         return true;
                     PRTSM_to_DESIGNATED_FORWARD(ptp);
-                    return false;
+                    return true;
                 }
             }
             /* Transition to discarding when BA inconsistent */
-            if(((ptp->sync && !ptp->synced)
-                || (ptp->reRoot && (0 != ptp->rrWhile))
-                || ptp->disputed
+            if(((PTP_FLAG(ptp, sync) && !PTP_FLAG(ptp, synced))
+                || (PTP_FLAG(ptp, reRoot) && (0 != PTP_TIMER(ptp, rrWhile)))
+                || PTP_FLAG(ptp, disputed)
                 || ptp->port->BaInconsistent
                )
-               && !prt->operEdge && (ptp->learn || ptp->forward)
+               && !PRT_FLAG(prt, operEdge)
+               && PTP_ANY(ptp, PTP_BIT(learn) | PTP_BIT(forward))
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_DESIGNATED_DISCARD(ptp, forwardDelay);
-                return false;
+                return true;
             }
             return false;
      /* AlternatePort and BackupPort role transitions */
         case PRTSM_BLOCK_PORT:
-            if(ptp->selected && !ptp->updtInfo
-               && !ptp->learning && !ptp->forwarding
+            if(selectedUpToDate(ptp)
+               && !PTP_ANY(ptp, PTP_BIT(learning) | PTP_BIT(forwarding))
               )
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ALTERNATE_PORT(ptp, forwardDelay);
+                return true;
             }
             return false;
         case PRTSM_BACKUP_PORT:
@@ -4550,38 +6483,40 @@ static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
             if(dry_run) /* state change */
                 return true;
             PRTSM_to_ALTERNATE_PORT(ptp, forwardDelay);
-            return false;
+            return true;
         case PRTSM_ALTERNATE_PORT:
-            if(!(ptp->selected && !ptp->updtInfo))
+            if(!selectedUpToDate(ptp))
                 return false;
-            if((allSynced && !ptp->agree) || (ptp->proposed && ptp->agree))
+            if((allSynced && !PTP_FLAG(ptp, agree))
+               || (PTP_FLAG(ptp, proposed) && PTP_FLAG(ptp, agree)))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ALTERNATE_AGREED(ptp);
-                return false;
+                return true;
             }
-            if(ptp->proposed && !ptp->agree)
+            if(PTP_FLAG(ptp, proposed) && !PTP_FLAG(ptp, agree))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ALTERNATE_PROPOSED(ptp);
-                return false;
+                return true;
             }
-            if((ptp->rbWhile != 2 * HelloTime) && (roleBackup == ptp->role))
+            if((PTP_TIMER(ptp, rbWhile) != 2 * HelloTime)
+               && (roleBackup == ptp->role))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_BACKUP_PORT(ptp, HelloTime);
-                return false;
+                return true;
             }
-            if((ptp->fdWhile != forwardDelay) || ptp->sync || ptp->reRoot
-               || !ptp->synced)
+            if((PTP_TIMER(ptp, fdWhile) != forwardDelay) || PTP_FLAG(ptp, sync)
+               || PTP_FLAG(ptp, reRoot) || !PTP_FLAG(ptp, synced))
             {
                 if(dry_run) /* state change */
                     return true;
                 PRTSM_to_ALTERNATE_PORT(ptp, forwardDelay);
-                return false;
+                return true;
             }
             return false;
     }
@@ -4607,8 +6542,8 @@ static void PSTSM_to_DISCARDING(per_tree_port_t *ptp, bool begin)
         if(!ptp->port->deleted)
             MSTP_OUT_set_state(ptp, BR_STATE_BLOCKING);
     }
-    ptp->learning = false;
-    ptp->forwarding = false;
+    set_ptp_flag(ptp, learning, false);
+    set_ptp_flag(ptp, forwarding, false);
 
     if(!begin)
         PSTSM_run(ptp, false /* actual run */);
@@ -4624,7 +6559,7 @@ static void PSTSM_to_LEARNING(per_tree_port_t *ptp)
         if(!ptp->port->deleted)
             MSTP_OUT_set_state(ptp, BR_STATE_LEARNING);
     }
-    ptp->learning = true;
+    set_ptp_flag(ptp, learning, true);
 
     PSTSM_run(ptp, false /* actual run */);
 }
@@ -4639,7 +6574,7 @@ static void PSTSM_to_FORWARDING(per_tree_port_t *ptp)
         if(!ptp->port->deleted)
             MSTP_OUT_set_state(ptp, BR_STATE_FORWARDING);
     }
-    ptp->forwarding = true;
+    set_ptp_flag(ptp, forwarding, true);
 
     /* No need to run, no one condition will be met
       PSTSM_run(ptp, false); */
@@ -4650,7 +6585,7 @@ static bool PSTSM_run(per_tree_port_t *ptp, bool dry_run)
     switch(ptp->PSTSM_state)
     {
         case PSTSM_DISCARDING:
-            if(ptp->learn)
+            if(PTP_FLAG(ptp, learn))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -4658,13 +6593,13 @@ static bool PSTSM_run(per_tree_port_t *ptp, bool dry_run)
             }
             return false;
         case PSTSM_LEARNING:
-            if(!ptp->learn)
+            if(!PTP_FLAG(ptp, learn))
             {
                 if(dry_run) /* state change */
                     return true;
                 PSTSM_to_DISCARDING(ptp, false);
             }
-            else if(ptp->forward)
+            else if(PTP_FLAG(ptp, forward))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -4672,7 +6607,7 @@ static bool PSTSM_run(per_tree_port_t *ptp, bool dry_run)
             }
             return false;
         case PSTSM_FORWARDING:
-            if(!ptp->forward)
+            if(!PTP_FLAG(ptp, forward))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -4693,10 +6628,10 @@ static void TCSM_to_INACTIVE(per_tree_port_t *ptp, bool begin)
     ptp->TCSM_state = TCSM_INACTIVE;
 
     set_fdbFlush(ptp);
-    assign(ptp->tcWhile, 0u);
+    assign(PTP_TIMER(ptp, tcWhile), 0u);
     set_TopologyChange(ptp->tree, false, ptp->port);
     if(0 == ptp->MSTID) /* CIST */
-        ptp->port->tcAck = false;
+        set_prt_flag(ptp->port, tcAck, false);
 
     if(!begin)
         TCSM_run(ptp, false /* actual run */);
@@ -4706,12 +6641,13 @@ static bool TCSM_to_LEARNING(per_tree_port_t *ptp, bool dry_run)
 {
     if(dry_run)
     {
-        if((ptp->TCSM_state != TCSM_LEARNING) || ptp->rcvdTc || ptp->tcProp)
+        if((ptp->TCSM_state != TCSM_LEARNING)
+           || PTP_ANY(ptp, PTP_BIT(rcvdTc) | PTP_BIT(tcProp)))
             return true;
         if(0 == ptp->MSTID) /* CIST */
         {
             port_t *prt = ptp->port;
-            if(prt->rcvdTcn || prt->rcvdTcAck)
+            if(PRT_FLAG(prt, rcvdTcn) || PRT_FLAG(prt, rcvdTcAck))
                 return true;
         }
         return false;
@@ -4722,11 +6658,11 @@ static bool TCSM_to_LEARNING(per_tree_port_t *ptp, bool dry_run)
     if(0 == ptp->MSTID) /* CIST */
     {
         port_t *prt = ptp->port;
-        prt->rcvdTcn = false;
-        prt->rcvdTcAck = false;
+        set_prt_flag(prt, rcvdTcn, false);
+        set_prt_flag(prt, rcvdTcAck, false);
     }
-    ptp->rcvdTc = false;
-    ptp->tcProp = false;
+    set_ptp_flag(ptp, rcvdTc, false);
+    set_ptp_flag(ptp, tcProp, false);
 
     TCSM_run(ptp, false /* actual run */);
     return false;
@@ -4741,9 +6677,9 @@ static void TCSM_to_DETECTED(per_tree_port_t *ptp)
     /* newInfoXst = TRUE; */
     port_t *prt = ptp->port;
     if(0 == ptp->MSTID)
-        prt->newInfo = true;
+        set_prt_flag(prt, newInfo, true);
     else
-        prt->newInfoMsti = true;
+        set_prt_flag(prt, newInfoMsti, true);
 
     TCSM_run(ptp, false /* actual run */);
 }
@@ -4761,13 +6697,13 @@ static void TCSM_to_NOTIFIED_TC(per_tree_port_t *ptp)
 {
     ptp->TCSM_state = TCSM_NOTIFIED_TC;
 
-    ptp->rcvdTc = false;
+    set_ptp_flag(ptp, rcvdTc, false);
     if(0 == ptp->MSTID) /* CIST */
     {
         port_t *prt = ptp->port;
-        prt->rcvdTcn = false;
+        set_prt_flag(prt, rcvdTcn, false);
         if(roleDesignated == ptp->role)
-            prt->tcAck = true;
+            set_prt_flag(prt, tcAck, true);
     }
     setTcPropTree(ptp);
 
@@ -4780,7 +6716,7 @@ static void TCSM_to_PROPAGATING(per_tree_port_t *ptp)
 
     newTcWhile(ptp);
     set_fdbFlush(ptp);
-    ptp->tcProp = false;
+    set_ptp_flag(ptp, tcProp, false);
 
     TCSM_run(ptp, false /* actual run */);
 }
@@ -4789,9 +6725,9 @@ static void TCSM_to_ACKNOWLEDGED(per_tree_port_t *ptp)
 {
     ptp->TCSM_state = TCSM_ACKNOWLEDGED;
 
-    assign(ptp->tcWhile, 0u);
+    assign(PTP_TIMER(ptp, tcWhile), 0u);
     set_TopologyChange(ptp->tree, false, ptp->port);
-    ptp->port->rcvdTcAck = false;
+    set_prt_flag(ptp->port, rcvdTcAck, false);
 
     TCSM_run(ptp, false /* actual run */);
 }
@@ -4803,7 +6739,8 @@ static void TCSM_to_ACTIVE(per_tree_port_t *ptp)
     TCSM_run(ptp, false /* actual run */);
 }
 
-static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
+/* Reference implementation, see the transition tables below */
+static bool TCSM_run_ref(per_tree_port_t *ptp, bool dry_run)
 {
     bool active_port;
     port_t *prt = ptp->port;
@@ -4811,7 +6748,7 @@ static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
     switch(ptp->TCSM_state)
     {
         case TCSM_INACTIVE:
-            if(ptp->learn && !ptp->fdbFlush)
+            if(PTP_FLAG(ptp, learn) && !PTP_FLAG(ptp, fdbFlush))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -4822,19 +6759,21 @@ static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
             active_port = (roleRoot == ptp->role)
                           || (roleDesignated == ptp->role)
                           || (roleMaster == ptp->role);
-            if(active_port && ptp->forward && !prt->operEdge)
+            if(active_port && PTP_FLAG(ptp, forward) && !PRT_FLAG(prt, operEdge))
             {
                 if(dry_run) /* state change */
                     return true;
                 TCSM_to_DETECTED(ptp);
                 return false;
             }
-            if(ptp->rcvdTc || ptp->tcProp
-               || ((0 == ptp->MSTID) && (prt->rcvdTcn || prt->rcvdTcAck)))
+            if(PTP_ANY(ptp, PTP_BIT(rcvdTc) | PTP_BIT(tcProp))
+               || ((0 == ptp->MSTID)
+                   && PRT_ANY(prt, PRT_BIT(rcvdTcn) | PRT_BIT(rcvdTcAck))))
             {
                 return TCSM_to_LEARNING(ptp, dry_run);
             }
-            else if(!active_port && !(ptp->learn || ptp->learning))
+            else if(!active_port
+                    && !PTP_ANY(ptp, PTP_BIT(learn) | PTP_BIT(learning)))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -4861,35 +6800,35 @@ static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
             active_port = (roleRoot == ptp->role)
                           || (roleDesignated == ptp->role)
                           || (roleMaster == ptp->role);
-            if(!active_port || prt->operEdge)
+            if(!active_port || PRT_FLAG(prt, operEdge))
             {
                 if(dry_run) /* state change */
                     return true;
                 TCSM_to_LEARNING(ptp, false /* actual run */);
                 return false;
             }
-            if((0 == ptp->MSTID) && prt->rcvdTcn)
+            if((0 == ptp->MSTID) && PRT_FLAG(prt, rcvdTcn))
             {
                 if(dry_run) /* state change */
                     return true;
                 TCSM_to_NOTIFIED_TCN(ptp);
                 return false;
             }
-            if(ptp->rcvdTc)
+            if(PTP_FLAG(ptp, rcvdTc))
             {
                 if(dry_run) /* state change */
                     return true;
                 TCSM_to_NOTIFIED_TC(ptp);
                 return false;
             }
-            if(ptp->tcProp/* && !prt->operEdge */)
+            if(PTP_FLAG(ptp, tcProp)/* && !PRT_FLAG(prt, operEdge) */)
             {
                 if(dry_run) /* state change */
                     return true;
                 TCSM_to_PROPAGATING(ptp);
                 return false;
             }
-            if((0 == ptp->MSTID) && prt->rcvdTcAck)
+            if((0 == ptp->MSTID) && PRT_FLAG(prt, rcvdTcAck))
             {
                 if(dry_run) /* state change */
                     return true;
@@ -4902,208 +6841,1224 @@ static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
     return false;
 }
 
-/* Execute BEGIN state. We do not define BEGIN variable
- * but instead xxx_state_machines_begin execute begin state
- * abd do one step out of it
+/* Dispatch of PTSM, PISM, PRTSM and TCSM generated from their transition
+ * lists.
+ * Each state of these state machines has the list of its transitions
+ * T(guard, enter) in the order of priority, and the transitions which may
+ * be taken from any state have a list of their own which is tried first.
+ * The first guard that holds selects the transition. sm_always is the guard
+ * of an UnConditional Transition, sm_stay the entry function of a guard
+ * which keeps the state machine in its state without evaluating the
+ * further guards.
+ * The lists are expanded into a switch over the states, i.e. into a jump
+ * table in which only the guards of the current state are evaluated, and
+ * -Wswitch reports a state without its list. The conditions shared by
+ * several guards (allSynced, reRooted, allTransmitReady) are computed on
+ * first use, and the guards test the own variables of the port first, as
+ * these conditions walk all the ports of the tree.
+ * The xxx_run_ref() functions above are the reference implementation,
+ * see bridge_t.sm_ref_dispatch and bridge_t.sm_cross_check.
  */
 
-static void tree_state_machines_begin(tree_t *tree)
+/* What the guards and the entry functions work on */
+typedef struct
 {
-    bridge_t *br = tree->bridge;
+    port_t *prt;
     per_tree_port_t *ptp;
+    /* PRTSM timer values: 13.25.6, 13.25.7, 13.25.8 and 13.25.d) */
+    unsigned int FwdDelay, HelloTime, MaxAge, forwardDelay;
+    /* Conditions computed on first use, -1 means not yet */
+    signed char allSynced, reRooted, allTransmitReady;
+    bool mstiMasterPort; /* valid after allTransmitReady */
+} sm_env_t;
 
-    if(!br->bridgeEnabled)
-        return;
+static inline bool sm_always(sm_env_t *env)
+{
+    return true;
+}
 
-    /* 13.32  Port Information state machine */
-    FOREACH_PTP_IN_TREE(ptp, tree)
-    {
-        ptp->start_time = br->uptime; /* 12.8.2.2.3 b) */
-        PISM_begin(ptp);
+static inline void sm_stay(sm_env_t *env)
+{
+}
+
+/* Returns true if the state changes (dry run) or was entered (actual run) */
+#define SM_TRANSITION(_guard, _enter)        \
+    if(_guard(env))                          \
+    {                                        \
+        if(sm_stay == (_enter))              \
+            return false;                    \
+        if(dry_run) /* state change */       \
+            return true;                     \
+        (_enter)(env);                       \
+        return true;                         \
     }
 
-    /* 13.33  Port Role Selection state machine */
-    PRSSM_begin(tree);
+#define SM_CASE(_state, _transitions)        \
+    case _state:                             \
+        _transitions(SM_TRANSITION)          \
+        return false;
 
-    /* 13.34  Port Role Transitions state machine */
-    FOREACH_PTP_IN_TREE(ptp, tree)
-        PRTSM_begin(ptp);
-    /* 13.35  Port State Transition state machine */
-    FOREACH_PTP_IN_TREE(ptp, tree)
-        PSTSM_begin(ptp);
-    /* 13.36  Topology Change state machine */
-    FOREACH_PTP_IN_TREE(ptp, tree)
-        TCSM_begin(ptp);
+#define SM_ENTER(_name, _action)             \
+    static void _name(sm_env_t *env)         \
+    {                                        \
+        _action;                             \
+    }
 
-    br_state_machines_run(br);
+static void sm_env_init(sm_env_t *env, port_t *prt, per_tree_port_t *ptp)
+{
+    memset(env, 0, sizeof(*env));
+    env->prt = prt;
+    env->ptp = ptp;
+    env->allSynced = -1;
+    env->reRooted = -1;
+    env->allTransmitReady = -1;
 }
 
-static void prt_state_machines_begin(port_t *prt)
+/* Compare the dry run of the generated dispatch with the one of the
+ * reference implementation */
+static void sm_cross_check(bridge_t *br, const char *sm, unsigned int state,
+                           bool generated, bool ref)
 {
-    bridge_t *br = prt->bridge;
-    tree_t *tree;
-    per_tree_port_t *ptp;
+    if(generated != ref)
+    {
+        ++(br->sm_cross_check_errors);
+        ERROR_BRNAME(br, "%s in state %u: %s, reference %s", sm, state,
+                     generated ? "transition" : "stay",
+                     ref ? "transition" : "stay");
+    }
+}
 
-    if(!br->bridgeEnabled)
-        return;
+/* 13.31  Port Transmit state machine */
 
-    /* 13.28  Port Receive state machine */
-    PRSM_begin(prt);
-    /* 13.29  Port Protocol Migration state machine */
-    PPMSM_begin(prt);
-    /* 13.30  Bridge Detection state machine */
-    BDSM_begin(prt);
-    /* 13.31  Port Transmit state machine */
-    PTSM_begin(prt);
+static bool PTSM_allTransmitReady(sm_env_t *env)
+{
+    per_tree_port_t *ptp;
 
-    /* 13.32  Port Information state machine */
-    FOREACH_PTP_IN_PORT(ptp, prt)
+    if(env->allTransmitReady < 0)
     {
-        ptp->start_time = br->uptime; /* 12.8.2.2.3 b) */
-        PISM_begin(ptp);
+        env->allTransmitReady = true;
+        FOREACH_PTP_IN_PORT(ptp, env->prt)
+        {
+            if(!selectedUpToDate(ptp))
+            {
+                env->allTransmitReady = false;
+                break;
+            }
+            if((0 != ptp->MSTID) && (roleMaster == ptp->role))
+                env->mstiMasterPort = true;
+        }
     }
+    return env->allTransmitReady;
+}
 
-    /* 13.33  Port Role Selection state machine */
-    FOREACH_TREE_IN_BRIDGE(tree, br)
-        PRSSM_run(tree, false /* actual run */);
+static bool PTSM_if_disabled_init(sm_env_t *env)
+{
+    return !PRT_FLAG(env->prt, portEnabled)
+           && PTSM_to_TRANSMIT_INIT(env->prt, false, true /* dry run */);
+}
 
-    /* 13.34  Port Role Transitions state machine */
-    FOREACH_PTP_IN_PORT(ptp, prt)
-        PRTSM_begin(ptp);
-    /* 13.35  Port State Transition state machine */
-    FOREACH_PTP_IN_PORT(ptp, prt)
-        PSTSM_begin(ptp);
-    /* 13.36  Topology Change state machine */
-    FOREACH_PTP_IN_PORT(ptp, prt)
-        TCSM_begin(ptp);
+static bool PTSM_if_disabled(sm_env_t *env)
+{
+    return !PRT_FLAG(env->prt, portEnabled);
+}
 
-    br_state_machines_run(br);
+/* None of the transitions from IDLE can be taken, whatever allTransmitReady
+ * is. Tested first, as allTransmitReady walks all the trees of the port.
+ */
+static bool PTSM_if_quiet(sm_env_t *env)
+{
+    port_t *prt = env->prt;
+
+    if(0 == PRT_TIMER(prt, helloWhen))
+        return false;
+    if(!(prt->txCount < prt->bridge->Transmit_Hold_Count)
+       || prt->bpduFilterPort)
+        return true;
+    return !PRT_FLAG(prt, newInfo)
+           && !(PRT_FLAG(prt, sendRSTP)
+                && (PRT_FLAG(prt, newInfoMsti) || assurancePort(prt)));
 }
 
-static void br_state_machines_begin(bridge_t *br)
+static bool PTSM_if_not_ready(sm_env_t *env)
 {
-    port_t *prt;
-    per_tree_port_t *ptp;
-    tree_t *tree;
+    return !PTSM_allTransmitReady(env);
+}
 
-    if(!br->bridgeEnabled)
-        return;
+static bool PTSM_if_hello(sm_env_t *env)
+{
+    return 0 == PRT_TIMER(env->prt, helloWhen);
+}
 
-    /* 13.28  Port Receive state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-        PRSM_begin(prt);
-    /* 13.29  Port Protocol Migration state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-        PPMSM_begin(prt);
-    /* 13.30  Bridge Detection state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-        BDSM_begin(prt);
-    /* 13.31  Port Transmit state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-        PTSM_begin(prt);
+static bool PTSM_if_hold(sm_env_t *env)
+{
+    port_t *prt = env->prt;
 
-    /* 13.32  Port Information state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        FOREACH_PTP_IN_PORT(ptp, prt)
-        {
-            ptp->start_time = br->uptime; /* 12.8.2.2.3 b) */
-            PISM_begin(ptp);
-        }
-    }
+    return !(prt->txCount < prt->bridge->Transmit_Hold_Count)
+           || prt->bpduFilterPort;
+}
 
-    /* 13.33  Port Role Selection state machine */
-    FOREACH_TREE_IN_BRIDGE(tree, br)
-        PRSSM_begin(tree);
+static bool PTSM_if_rstp(sm_env_t *env)
+{
+    port_t *prt = env->prt;
 
-    /* 13.34  Port Role Transitions state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        FOREACH_PTP_IN_PORT(ptp, prt)
-            PRTSM_begin(ptp);
-    }
-    /* 13.35  Port State Transition state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        FOREACH_PTP_IN_PORT(ptp, prt)
-            PSTSM_begin(ptp);
-    }
-    /* 13.36  Topology Change state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        FOREACH_PTP_IN_PORT(ptp, prt)
-            TCSM_begin(ptp);
-    }
+    return PRT_FLAG(prt, sendRSTP)
+           && (PRT_FLAG(prt, newInfo)
+               || (PRT_FLAG(prt, newInfoMsti) && !env->mstiMasterPort)
+               || assurancePort(prt));
+}
 
-    br_state_machines_run(br);
+static bool PTSM_if_config(sm_env_t *env)
+{
+    port_t *prt = env->prt;
+
+    return !PRT_FLAG(prt, sendRSTP) && PRT_FLAG(prt, newInfo)
+           && (roleDesignated == GET_CIST_PTP_FROM_PORT(prt)->role);
 }
 
-/* Run each state machine.
- * Return false iff all state machines in dry run indicate that
- * state will not be changed. Otherwise return true.
- */
-static bool __br_state_machines_run(bridge_t *br, bool dry_run)
+static bool PTSM_if_tcn(sm_env_t *env)
 {
-    port_t *prt;
-    per_tree_port_t *ptp;
-    tree_t *tree;
+    port_t *prt = env->prt;
 
-    /* Check if bridge assurance timer expires */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        if(prt->portEnabled && assurancePort(prt)
-           && (0 == prt->brAssuRcvdInfoWhile) && !prt->BaInconsistent
-          )
-        {
-            if(dry_run) /* state change */
-                return true;
-            prt->BaInconsistent = true;
-            ERROR_PRTNAME(prt, "Bridge assurance inconsistent");
-        }
-    }
+    return !PRT_FLAG(prt, sendRSTP) && PRT_FLAG(prt, newInfo)
+           && (roleRoot == GET_CIST_PTP_FROM_PORT(prt)->role);
+}
 
-    /* 13.28  Port Receive state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        if(PRSM_run(prt, dry_run) && dry_run)
-            return true;
-    }
-    /* 13.29  Port Protocol Migration state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        if(PPMSM_run(prt, dry_run) && dry_run)
-            return true;
-    }
-    /* 13.30  Bridge Detection state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        if(BDSM_run(prt, dry_run) && dry_run)
-            return true;
-    }
-    /* 13.31  Port Transmit state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        if(PTSM_run(prt, dry_run) && dry_run)
-            return true;
-    }
+SM_ENTER(PTSM_do_TRANSMIT_INIT, PTSM_to_TRANSMIT_INIT(env->prt, false, false))
+SM_ENTER(PTSM_do_TRANSMIT_CONFIG, PTSM_to_TRANSMIT_CONFIG(env->prt))
+SM_ENTER(PTSM_do_TRANSMIT_TCN, PTSM_to_TRANSMIT_TCN(env->prt))
+SM_ENTER(PTSM_do_TRANSMIT_RSTP, PTSM_to_TRANSMIT_RSTP(env->prt))
+SM_ENTER(PTSM_do_TRANSMIT_PERIODIC, PTSM_to_TRANSMIT_PERIODIC(env->prt))
+SM_ENTER(PTSM_do_IDLE, PTSM_to_IDLE(env->prt))
 
-    /* 13.32  Port Information state machine */
-    FOREACH_PORT_IN_BRIDGE(prt, br)
-    {
-        FOREACH_PTP_IN_PORT(ptp, prt)
-        {
-            if(PISM_run(ptp, dry_run) && dry_run)
-                return true;
-        }
-    }
+#define PTSM_FROM_ANY(T)                            \
+    T(PTSM_if_disabled_init, PTSM_do_TRANSMIT_INIT) \
+    T(PTSM_if_disabled, sm_stay)
+#define PTSM_UCT_TO_IDLE(T)                     \
+    T(sm_always, PTSM_do_IDLE)
+#define PTSM_FROM_IDLE(T)                       \
+    T(PTSM_if_quiet, sm_stay)                   \
+    T(PTSM_if_not_ready, sm_stay)               \
+    T(PTSM_if_hello, PTSM_do_TRANSMIT_PERIODIC) \
+    T(PTSM_if_hold, sm_stay)                    \
+    T(PTSM_if_rstp, PTSM_do_TRANSMIT_RSTP)      \
+    T(PTSM_if_config, PTSM_do_TRANSMIT_CONFIG)  \
+    T(PTSM_if_tcn, PTSM_do_TRANSMIT_TCN)
+#define PTSM_STATES(S)                          \
+    S(PTSM_TRANSMIT_INIT, PTSM_UCT_TO_IDLE)     \
+    S(PTSM_TRANSMIT_CONFIG, PTSM_UCT_TO_IDLE)   \
+    S(PTSM_TRANSMIT_TCN, PTSM_UCT_TO_IDLE)      \
+    S(PTSM_TRANSMIT_RSTP, PTSM_UCT_TO_IDLE)     \
+    S(PTSM_TRANSMIT_PERIODIC, PTSM_UCT_TO_IDLE) \
+    S(PTSM_IDLE, PTSM_FROM_IDLE)
 
-    /* 13.33  Port Role Selection state machine */
-    FOREACH_TREE_IN_BRIDGE(tree, br)
+static bool PTSM_dispatch(sm_env_t *env, bool dry_run)
+{
+    PTSM_FROM_ANY(SM_TRANSITION)
+    switch(env->prt->PTSM_state)
     {
-        if(PRSSM_run(tree, dry_run) && dry_run)
-            return true;
+        PTSM_STATES(SM_CASE)
     }
-
+    return false;
+}
+
+static bool PTSM_run(port_t *prt, bool dry_run)
+{
+    bridge_t *br = prt->bridge;
+    sm_env_t env;
+    bool res;
+
+    if(br->sm_ref_dispatch)
+        return PTSM_run_ref(prt, dry_run);
+
+    sm_env_init(&env, prt, NULL);
+    res = PTSM_dispatch(&env, dry_run);
+    if(dry_run && br->sm_cross_check)
+        sm_cross_check(br, "PTSM", prt->PTSM_state, res,
+                       PTSM_run_ref(prt, true /* dry run */));
+    return res;
+}
+
+/* 13.32  Port Information state machine */
+
+static bool PISM_if_disabled(sm_env_t *env)
+{
+    return !PRT_FLAG(env->prt, portEnabled) && (ioDisabled != env->ptp->infoIs);
+}
+
+static bool PISM_if_enabled(sm_env_t *env)
+{
+    return PRT_FLAG(env->prt, portEnabled);
+}
+
+static bool PISM_if_rcvdMsg(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, rcvdMsg);
+}
+
+static bool PISM_if_update(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, selected) && PTP_FLAG(env->ptp, updtInfo);
+}
+
+/* rcvdXstMsg and updtXstInfo, see the comment in PISM_run_ref() */
+static bool PISM_rcvdXstMsg(sm_env_t *env)
+{
+    if(0 == env->ptp->MSTID)
+        return PTP_FLAG(env->ptp, rcvdMsg); /* 13.25.12 */
+    return !PTP_FLAG(GET_CIST_PTP_FROM_PORT(env->prt), rcvdMsg)
+           && PTP_FLAG(env->ptp, rcvdMsg); /* 13.25.13 */
+}
+
+static bool PISM_updtXstInfo(sm_env_t *env)
+{
+    if(0 == env->ptp->MSTID)
+        return PTP_FLAG(env->ptp, updtInfo); /* 13.25.16 */
+    return PTP_FLAG(env->ptp, updtInfo)
+           || PTP_FLAG(GET_CIST_PTP_FROM_PORT(env->prt), updtInfo); /* 13.25.17 */
+}
+
+static bool PISM_if_receive(sm_env_t *env)
+{
+    return PISM_rcvdXstMsg(env) && !PISM_updtXstInfo(env);
+}
+
+static bool PISM_if_aged(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return (ioReceived == ptp->infoIs) && (0 == PTP_TIMER(ptp, rcvdInfoWhile))
+           && !PTP_FLAG(ptp, updtInfo) && !PISM_rcvdXstMsg(env);
+}
+
+static bool PISM_if_superior_designated(sm_env_t *env)
+{
+    return SuperiorDesignatedInfo == env->ptp->rcvdInfo;
+}
+
+static bool PISM_if_repeated_designated(sm_env_t *env)
+{
+    return RepeatedDesignatedInfo == env->ptp->rcvdInfo;
+}
+
+static bool PISM_if_inferior_designated(sm_env_t *env)
+{
+    return InferiorDesignatedInfo == env->ptp->rcvdInfo;
+}
+
+static bool PISM_if_not_designated(sm_env_t *env)
+{
+    return InferiorRootAlternateInfo == env->ptp->rcvdInfo;
+}
+
+static bool PISM_if_other(sm_env_t *env)
+{
+    return OtherInfo == env->ptp->rcvdInfo;
+}
+
+SM_ENTER(PISM_do_DISABLED, PISM_to_DISABLED(env->ptp, false))
+SM_ENTER(PISM_do_AGED, PISM_to_AGED(env->ptp))
+SM_ENTER(PISM_do_UPDATE, PISM_to_UPDATE(env->ptp))
+SM_ENTER(PISM_do_SUPERIOR_DESIGNATED, PISM_to_SUPERIOR_DESIGNATED(env->ptp))
+SM_ENTER(PISM_do_REPEATED_DESIGNATED, PISM_to_REPEATED_DESIGNATED(env->ptp))
+SM_ENTER(PISM_do_INFERIOR_DESIGNATED, PISM_to_INFERIOR_DESIGNATED(env->ptp))
+SM_ENTER(PISM_do_NOT_DESIGNATED, PISM_to_NOT_DESIGNATED(env->ptp))
+SM_ENTER(PISM_do_OTHER, PISM_to_OTHER(env->ptp))
+SM_ENTER(PISM_do_CURRENT, PISM_to_CURRENT(env->ptp))
+SM_ENTER(PISM_do_RECEIVE, PISM_to_RECEIVE(env->ptp))
+
+#define PISM_FROM_ANY(T)                        \
+    T(PISM_if_disabled, PISM_do_DISABLED)
+#define PISM_FROM_DISABLED(T)                   \
+    T(PISM_if_enabled, PISM_do_AGED)            \
+    T(PISM_if_rcvdMsg, PISM_do_DISABLED)
+#define PISM_FROM_AGED(T)                       \
+    T(PISM_if_update, PISM_do_UPDATE)
+#define PISM_UCT_TO_CURRENT(T)                  \
+    T(sm_always, PISM_do_CURRENT)
+#define PISM_FROM_CURRENT(T)                    \
+    T(PISM_if_receive, PISM_do_RECEIVE)         \
+    T(PISM_if_aged, PISM_do_AGED)               \
+    T(PISM_if_update, PISM_do_UPDATE)
+#define PISM_FROM_RECEIVE(T)                                    \
+    T(PISM_if_superior_designated, PISM_do_SUPERIOR_DESIGNATED) \
+    T(PISM_if_repeated_designated, PISM_do_REPEATED_DESIGNATED) \
+    T(PISM_if_inferior_designated, PISM_do_INFERIOR_DESIGNATED) \
+    T(PISM_if_not_designated, PISM_do_NOT_DESIGNATED)           \
+    T(PISM_if_other, PISM_do_OTHER)
+#define PISM_STATES(S)                               \
+    S(PISM_DISABLED, PISM_FROM_DISABLED)             \
+    S(PISM_AGED, PISM_FROM_AGED)                     \
+    S(PISM_UPDATE, PISM_UCT_TO_CURRENT)              \
+    S(PISM_SUPERIOR_DESIGNATED, PISM_UCT_TO_CURRENT) \
+    S(PISM_REPEATED_DESIGNATED, PISM_UCT_TO_CURRENT) \
+    S(PISM_INFERIOR_DESIGNATED, PISM_UCT_TO_CURRENT) \
+    S(PISM_NOT_DESIGNATED, PISM_UCT_TO_CURRENT)      \
+    S(PISM_OTHER, PISM_UCT_TO_CURRENT)               \
+    S(PISM_CURRENT, PISM_FROM_CURRENT)               \
+    S(PISM_RECEIVE, PISM_FROM_RECEIVE)
+
+static bool PISM_dispatch(sm_env_t *env, bool dry_run)
+{
+    PISM_FROM_ANY(SM_TRANSITION)
+    switch(env->ptp->PISM_state)
+    {
+        PISM_STATES(SM_CASE)
+    }
+    return false;
+}
+
+static bool PISM_run(per_tree_port_t *ptp, bool dry_run)
+{
+    bridge_t *br = ptp->port->bridge;
+    sm_env_t env;
+    bool res;
+
+    if(br->sm_ref_dispatch)
+        return PISM_run_ref(ptp, dry_run);
+
+    sm_env_init(&env, ptp->port, ptp);
+    res = PISM_dispatch(&env, dry_run);
+    if(dry_run && br->sm_cross_check)
+        sm_cross_check(br, "PISM", ptp->PISM_state, res,
+                       PISM_run_ref(ptp, true /* dry run */));
+    return res;
+}
+
+/* 13.34  Port Role Transitions state machine */
+
+/* 13.25.1, over the tree's bitmaps of ports, see update_port_bits() */
+static bool PRTSM_allSynced(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp, *ptp_1;
+    tree_t *tree = ptp->tree;
+    port_t **row2port = tree->bridge->timer_row_port;
+    unsigned int i, row = ptp->port->timer_row;
+    unsigned long unsynced;
+    bool rootOrAlternate;
+
+    if(env->allSynced >= 0)
+        return env->allSynced;
+
+    env->allSynced = false;
+    switch(ptp->role)
+    {
+        case roleRoot:
+        case roleAlternate:
+            rootOrAlternate = true;
+            break;
+        case roleDesignated:
+        case roleMaster:
+            rootOrAlternate = false;
+            break;
+        default:
+            return false;
+    }
+    /* a) */
+    for(i = 0; i < tree->port_bitmap_words; ++i)
+        if(tree->unsettled_ports[i])
+            return false;
+    /* b) */
+    for(i = 0; i < tree->port_bitmap_words; ++i)
+    {
+        unsynced = tree->unsynced_ports[i];
+        if(!rootOrAlternate)
+        {
+            if(row / BITS_PER_LONG == i)
+                unsynced &= ~(1ul << (row % BITS_PER_LONG));
+            if(unsynced)
+                return false;
+            continue;
+        }
+        /* Only the Root Port may be unsynced */
+        for(; unsynced; unsynced &= unsynced - 1)
+        {
+            ptp_1 = row2port[i * BITS_PER_LONG + __builtin_ctzl(unsynced)]
+                        ->slot2ptp[tree->slot];
+            if(roleRoot != ptp_1->role)
+                return false;
+        }
+    }
+    env->allSynced = true;
+    return true;
+}
+
+/* 17.20.10 of 802.1D : reRooted */
+static bool PRTSM_reRooted(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp, *ptp_1;
+
+    if(env->reRooted < 0)
+    {
+        env->reRooted = true;
+        FOREACH_PTP_IN_TREE(ptp_1, ptp->tree)
+        {
+            if((ptp != ptp_1) && (0 != PTP_TIMER(ptp_1, rrWhile)))
+            {
+                env->reRooted = false;
+                break;
+            }
+        }
+    }
+    return env->reRooted;
+}
+
+static bool PRTSM_if_new_role(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return (ptp->role != ptp->selectedRole) && PTP_FLAG(ptp, selected)
+           && !PTP_FLAG(ptp, updtInfo);
+}
+
+static bool PRTSM_if_not_ready(sm_env_t *env)
+{
+    return !selectedUpToDate(env->ptp);
+}
+
+static bool PRTSM_if_stopped(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return PTP_MATCH(ptp, PTP_BIT(selected) | PTP_BIT(updtInfo)
+                          | PTP_BIT(learning) | PTP_BIT(forwarding),
+                     PTP_BIT(selected));
+}
+
+static bool PRTSM_if_disabled_port(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return selectedUpToDate(ptp)
+           && (!PTP_MATCH(ptp, PTP_BIT(sync) | PTP_BIT(reRoot) | PTP_BIT(synced),
+                          PTP_BIT(synced))
+               || (PTP_TIMER(ptp, fdWhile) != env->MaxAge));
+}
+
+static bool PRTSM_if_retired(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, reRoot) && (0 == PTP_TIMER(env->ptp, rrWhile));
+}
+
+/* MASTER_SYNCED and DESIGNATED_SYNCED */
+static bool PRTSM_if_synced(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return !PTP_ANY(ptp, PTP_BIT(learning) | PTP_BIT(forwarding)
+                         | PTP_BIT(synced))
+           || (PTP_FLAG(ptp, agreed) && !PTP_FLAG(ptp, synced))
+           || (PRT_FLAG(env->prt, operEdge) && !PTP_FLAG(ptp, synced))
+           || (PTP_FLAG(ptp, sync) && PTP_FLAG(ptp, synced));
+}
+
+/* MASTER_AGREED, ROOT_AGREED and ALTERNATE_AGREED */
+static bool PRTSM_if_agreed(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return (!PTP_FLAG(ptp, agree) && PRTSM_allSynced(env))
+           || (PTP_FLAG(ptp, proposed) && PTP_FLAG(ptp, agree));
+}
+
+/* MASTER_PROPOSED, ROOT_PROPOSED and ALTERNATE_PROPOSED */
+static bool PRTSM_if_proposed(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, proposed) && !PTP_FLAG(env->ptp, agree);
+}
+
+static bool PRTSM_if_master_forward(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return PTP_FLAG(ptp, learn) && !PTP_FLAG(ptp, forward)
+           && ((0 == PTP_TIMER(ptp, fdWhile)) || PRTSM_allSynced(env));
+}
+
+static bool PRTSM_if_master_learn(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return !PTP_FLAG(ptp, learn)
+           && ((0 == PTP_TIMER(ptp, fdWhile)) || PRTSM_allSynced(env));
+}
+
+static bool PRTSM_if_master_discard(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return ((PTP_FLAG(ptp, sync) && !PTP_FLAG(ptp, synced))
+            || (PTP_FLAG(ptp, reRoot) && (0 != PTP_TIMER(ptp, rrWhile)))
+            || PTP_FLAG(ptp, disputed)
+           )
+           && !PRT_FLAG(env->prt, operEdge)
+           && PTP_ANY(ptp, PTP_BIT(learn) | PTP_BIT(forward));
+}
+
+static bool PRTSM_if_reroot(sm_env_t *env)
+{
+    return !PTP_FLAG(env->ptp, forward) && !PTP_FLAG(env->ptp, reRoot);
+}
+
+static bool PRTSM_if_root_synced(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return PTP_MATCH(ptp, PTP_BIT(agreed) | PTP_BIT(synced), PTP_BIT(agreed))
+           || PTP_MATCH(ptp, PTP_BIT(sync) | PTP_BIT(synced),
+                        PTP_BIT(sync) | PTP_BIT(synced));
+}
+
+static bool PRTSM_root_may_forward(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return (0 == PTP_TIMER(ptp, fdWhile))
+           || (PRTSM_reRooted(env) && (0 == PTP_TIMER(ptp, rbWhile))
+               && rstpVersion(env->prt->bridge));
+}
+
+static bool PRTSM_if_root_learn(sm_env_t *env)
+{
+    return PRTSM_root_may_forward(env) && !PTP_FLAG(env->ptp, learn);
+}
+
+static bool PRTSM_if_root_forward(sm_env_t *env)
+{
+    return PRTSM_root_may_forward(env) && PTP_FLAG(env->ptp, learn)
+           && !PTP_FLAG(env->ptp, forward);
+}
+
+static bool PRTSM_if_rerooted(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, reRoot) && PTP_FLAG(env->ptp, forward);
+}
+
+static bool PRTSM_if_root_port(sm_env_t *env)
+{
+    return PTP_TIMER(env->ptp, rrWhile) != env->FwdDelay;
+}
+
+static bool PRTSM_if_designated_agreed(sm_env_t *env)
+{
+    return (PTP_FLAG(env->ptp, proposed) || !PTP_FLAG(env->ptp, agree))
+           && PRTSM_allSynced(env);
+}
+
+static bool PRTSM_if_designated_propose(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return !PTP_ANY(ptp, PTP_BIT(forward) | PTP_BIT(agreed)
+                         | PTP_BIT(proposing))
+           && !PRT_FLAG(env->prt, operEdge);
+}
+
+/* Dont transition to learn/forward when BA inconsistent */
+static bool PRTSM_designated_may_forward(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return ((0 == PTP_TIMER(ptp, fdWhile)) || PTP_FLAG(ptp, agreed)
+            || PRT_FLAG(env->prt, operEdge))
+           && ((0 == PTP_TIMER(ptp, rrWhile)) || !PTP_FLAG(ptp, reRoot))
+           && !PTP_FLAG(ptp, sync)
+           && !env->prt->BaInconsistent;
+}
+
+static bool PRTSM_if_designated_learn(sm_env_t *env)
+{
+    return PRTSM_designated_may_forward(env) && !PTP_FLAG(env->ptp, learn);
+}
+
+static bool PRTSM_if_designated_forward(sm_env_t *env)
+{
+    return PRTSM_designated_may_forward(env) && PTP_FLAG(env->ptp, learn)
+           && !PTP_FLAG(env->ptp, forward);
+}
+
+/* Transition to discarding when BA inconsistent */
+static bool PRTSM_if_designated_discard(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return ((PTP_FLAG(ptp, sync) && !PTP_FLAG(ptp, synced))
+            || (PTP_FLAG(ptp, reRoot) && (0 != PTP_TIMER(ptp, rrWhile)))
+            || PTP_FLAG(ptp, disputed)
+            || env->prt->BaInconsistent
+           )
+           && !PRT_FLAG(env->prt, operEdge)
+           && PTP_ANY(ptp, PTP_BIT(learn) | PTP_BIT(forward));
+}
+
+static bool PRTSM_if_backup_port(sm_env_t *env)
+{
+    return (PTP_TIMER(env->ptp, rbWhile) != 2 * env->HelloTime)
+           && (roleBackup == env->ptp->role);
+}
+
+static bool PRTSM_if_alternate_port(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return (PTP_TIMER(ptp, fdWhile) != env->forwardDelay) || PTP_FLAG(ptp, sync)
+           || PTP_FLAG(ptp, reRoot) || !PTP_FLAG(ptp, synced);
+}
+
+SM_ENTER(PRTSM_do_DISABLE_PORT, PRTSM_to_DISABLE_PORT(env->ptp))
+SM_ENTER(PRTSM_do_DISABLED_PORT,
+         PRTSM_to_DISABLED_PORT(env->ptp, env->MaxAge))
+SM_ENTER(PRTSM_do_MASTER_PROPOSED, PRTSM_to_MASTER_PROPOSED(env->ptp))
+SM_ENTER(PRTSM_do_MASTER_AGREED, PRTSM_to_MASTER_AGREED(env->ptp))
+SM_ENTER(PRTSM_do_MASTER_SYNCED, PRTSM_to_MASTER_SYNCED(env->ptp))
+SM_ENTER(PRTSM_do_MASTER_RETIRED, PRTSM_to_MASTER_RETIRED(env->ptp))
+SM_ENTER(PRTSM_do_MASTER_FORWARD, PRTSM_to_MASTER_FORWARD(env->ptp))
+SM_ENTER(PRTSM_do_MASTER_LEARN,
+         PRTSM_to_MASTER_LEARN(env->ptp, env->forwardDelay))
+SM_ENTER(PRTSM_do_MASTER_DISCARD,
+         PRTSM_to_MASTER_DISCARD(env->ptp, env->forwardDelay))
+SM_ENTER(PRTSM_do_MASTER_PORT, PRTSM_to_MASTER_PORT(env->ptp))
+SM_ENTER(PRTSM_do_ROOT_PROPOSED, PRTSM_to_ROOT_PROPOSED(env->ptp))
+SM_ENTER(PRTSM_do_ROOT_AGREED, PRTSM_to_ROOT_AGREED(env->ptp))
+SM_ENTER(PRTSM_do_ROOT_SYNCED, PRTSM_to_ROOT_SYNCED(env->ptp))
+SM_ENTER(PRTSM_do_REROOT, PRTSM_to_REROOT(env->ptp))
+SM_ENTER(PRTSM_do_ROOT_FORWARD, PRTSM_to_ROOT_FORWARD(env->ptp))
+SM_ENTER(PRTSM_do_ROOT_LEARN,
+         PRTSM_to_ROOT_LEARN(env->ptp, env->forwardDelay))
+SM_ENTER(PRTSM_do_REROOTED, PRTSM_to_REROOTED(env->ptp))
+SM_ENTER(PRTSM_do_ROOT_PORT, PRTSM_to_ROOT_PORT(env->ptp, env->FwdDelay))
+SM_ENTER(PRTSM_do_DESIGNATED_PROPOSE, PRTSM_to_DESIGNATED_PROPOSE(env->ptp))
+SM_ENTER(PRTSM_do_DESIGNATED_AGREED, PRTSM_to_DESIGNATED_AGREED(env->ptp))
+SM_ENTER(PRTSM_do_DESIGNATED_SYNCED, PRTSM_to_DESIGNATED_SYNCED(env->ptp))
+SM_ENTER(PRTSM_do_DESIGNATED_RETIRED, PRTSM_to_DESIGNATED_RETIRED(env->ptp))
+SM_ENTER(PRTSM_do_DESIGNATED_FORWARD, PRTSM_to_DESIGNATED_FORWARD(env->ptp))
+SM_ENTER(PRTSM_do_DESIGNATED_LEARN,
+         PRTSM_to_DESIGNATED_LEARN(env->ptp, env->forwardDelay))
+SM_ENTER(PRTSM_do_DESIGNATED_DISCARD,
+         PRTSM_to_DESIGNATED_DISCARD(env->ptp, env->forwardDelay))
+SM_ENTER(PRTSM_do_DESIGNATED_PORT, PRTSM_to_DESIGNATED_PORT(env->ptp))
+SM_ENTER(PRTSM_do_BLOCK_PORT, PRTSM_to_BLOCK_PORT(env->ptp))
+SM_ENTER(PRTSM_do_BACKUP_PORT,
+         PRTSM_to_BACKUP_PORT(env->ptp, env->HelloTime))
+SM_ENTER(PRTSM_do_ALTERNATE_PROPOSED, PRTSM_to_ALTERNATE_PROPOSED(env->ptp))
+SM_ENTER(PRTSM_do_ALTERNATE_AGREED, PRTSM_to_ALTERNATE_AGREED(env->ptp))
+SM_ENTER(PRTSM_do_ALTERNATE_PORT,
+         PRTSM_to_ALTERNATE_PORT(env->ptp, env->forwardDelay))
+
+/* Enter the first state of the new role */
+static void PRTSM_do_new_role(sm_env_t *env)
+{
+    switch(env->ptp->selectedRole)
+    {
+        case roleDisabled:
+            PRTSM_do_DISABLE_PORT(env);
+            break;
+        case roleMaster:
+            PRTSM_do_MASTER_PORT(env);
+            break;
+        case roleRoot:
+            PRTSM_do_ROOT_PORT(env);
+            break;
+        case roleDesignated:
+            PRTSM_do_DESIGNATED_PORT(env);
+            break;
+        case roleAlternate:
+        case roleBackup:
+            PRTSM_do_BLOCK_PORT(env);
+            break;
+    }
+}
+
+#define PRTSM_FROM_ANY(T)                       \
+    T(PRTSM_if_new_role, PRTSM_do_new_role)
+ /* Disabled Port role transitions */
+#define PRTSM_FROM_INIT_PORT(T)                 \
+    T(sm_always, PRTSM_do_DISABLE_PORT)
+#define PRTSM_FROM_DISABLE_PORT(T)              \
+    T(PRTSM_if_stopped, PRTSM_do_DISABLED_PORT)
+#define PRTSM_FROM_DISABLED_PORT(T)                   \
+    T(PRTSM_if_disabled_port, PRTSM_do_DISABLED_PORT)
+ /* MasterPort role transitions */
+#define PRTSM_UCT_TO_MASTER_PORT(T)             \
+    T(sm_always, PRTSM_do_MASTER_PORT)
+#define PRTSM_FROM_MASTER_PORT(T)                       \
+    T(PRTSM_if_not_ready, sm_stay)                      \
+    T(PRTSM_if_retired, PRTSM_do_MASTER_RETIRED)        \
+    T(PRTSM_if_synced, PRTSM_do_MASTER_SYNCED)          \
+    T(PRTSM_if_agreed, PRTSM_do_MASTER_AGREED)          \
+    T(PRTSM_if_proposed, PRTSM_do_MASTER_PROPOSED)      \
+    T(PRTSM_if_master_forward, PRTSM_do_MASTER_FORWARD) \
+    T(PRTSM_if_master_learn, PRTSM_do_MASTER_LEARN)     \
+    T(PRTSM_if_master_discard, PRTSM_do_MASTER_DISCARD)
+ /* RootPort role transitions */
+#define PRTSM_UCT_TO_ROOT_PORT(T)               \
+    T(sm_always, PRTSM_do_ROOT_PORT)
+#define PRTSM_FROM_ROOT_PORT(T)                     \
+    T(PRTSM_if_not_ready, sm_stay)                  \
+    T(PRTSM_if_reroot, PRTSM_do_REROOT)             \
+    T(PRTSM_if_root_synced, PRTSM_do_ROOT_SYNCED)   \
+    T(PRTSM_if_agreed, PRTSM_do_ROOT_AGREED)        \
+    T(PRTSM_if_proposed, PRTSM_do_ROOT_PROPOSED)    \
+    T(PRTSM_if_root_learn, PRTSM_do_ROOT_LEARN)     \
+    T(PRTSM_if_root_forward, PRTSM_do_ROOT_FORWARD) \
+    T(PRTSM_if_rerooted, PRTSM_do_REROOTED)         \
+    T(PRTSM_if_root_port, PRTSM_do_ROOT_PORT)
+ /* DesignatedPort role transitions */
+#define PRTSM_UCT_TO_DESIGNATED_PORT(T)         \
+    T(sm_always, PRTSM_do_DESIGNATED_PORT)
+#define PRTSM_FROM_DESIGNATED_PORT(T)                           \
+    T(PRTSM_if_not_ready, sm_stay)                              \
+    T(PRTSM_if_retired, PRTSM_do_DESIGNATED_RETIRED)            \
+    T(PRTSM_if_synced, PRTSM_do_DESIGNATED_SYNCED)              \
+    T(PRTSM_if_designated_agreed, PRTSM_do_DESIGNATED_AGREED)   \
+    T(PRTSM_if_designated_propose, PRTSM_do_DESIGNATED_PROPOSE) \
+    T(PRTSM_if_designated_learn, PRTSM_do_DESIGNATED_LEARN)     \
+    T(PRTSM_if_designated_forward, PRTSM_do_DESIGNATED_FORWARD) \
+    T(PRTSM_if_designated_discard, PRTSM_do_DESIGNATED_DISCARD)
+ /* AlternatePort and BackupPort role transitions */
+#define PRTSM_FROM_BLOCK_PORT(T)                 \
+    T(PRTSM_if_stopped, PRTSM_do_ALTERNATE_PORT)
+#define PRTSM_UCT_TO_ALTERNATE_PORT(T)          \
+    T(sm_always, PRTSM_do_ALTERNATE_PORT)
+#define PRTSM_FROM_ALTERNATE_PORT(T)                    \
+    T(PRTSM_if_not_ready, sm_stay)                      \
+    T(PRTSM_if_agreed, PRTSM_do_ALTERNATE_AGREED)       \
+    T(PRTSM_if_proposed, PRTSM_do_ALTERNATE_PROPOSED)   \
+    T(PRTSM_if_backup_port, PRTSM_do_BACKUP_PORT)       \
+    T(PRTSM_if_alternate_port, PRTSM_do_ALTERNATE_PORT)
+#define PRTSM_STATES(S)                                       \
+    S(PRTSM_INIT_PORT, PRTSM_FROM_INIT_PORT)                  \
+    S(PRTSM_DISABLE_PORT, PRTSM_FROM_DISABLE_PORT)            \
+    S(PRTSM_DISABLED_PORT, PRTSM_FROM_DISABLED_PORT)          \
+    S(PRTSM_MASTER_PROPOSED, PRTSM_UCT_TO_MASTER_PORT)        \
+    S(PRTSM_MASTER_AGREED, PRTSM_UCT_TO_MASTER_PORT)          \
+    S(PRTSM_MASTER_SYNCED, PRTSM_UCT_TO_MASTER_PORT)          \
+    S(PRTSM_MASTER_RETIRED, PRTSM_UCT_TO_MASTER_PORT)         \
+    S(PRTSM_MASTER_FORWARD, PRTSM_UCT_TO_MASTER_PORT)         \
+    S(PRTSM_MASTER_LEARN, PRTSM_UCT_TO_MASTER_PORT)           \
+    S(PRTSM_MASTER_DISCARD, PRTSM_UCT_TO_MASTER_PORT)         \
+    S(PRTSM_MASTER_PORT, PRTSM_FROM_MASTER_PORT)              \
+    S(PRTSM_ROOT_PROPOSED, PRTSM_UCT_TO_ROOT_PORT)            \
+    S(PRTSM_ROOT_AGREED, PRTSM_UCT_TO_ROOT_PORT)              \
+    S(PRTSM_ROOT_SYNCED, PRTSM_UCT_TO_ROOT_PORT)              \
+    S(PRTSM_REROOT, PRTSM_UCT_TO_ROOT_PORT)                   \
+    S(PRTSM_ROOT_FORWARD, PRTSM_UCT_TO_ROOT_PORT)             \
+    S(PRTSM_ROOT_LEARN, PRTSM_UCT_TO_ROOT_PORT)               \
+    S(PRTSM_REROOTED, PRTSM_UCT_TO_ROOT_PORT)                 \
+    S(PRTSM_ROOT_PORT, PRTSM_FROM_ROOT_PORT)                  \
+    S(PRTSM_DESIGNATED_PROPOSE, PRTSM_UCT_TO_DESIGNATED_PORT) \
+    S(PRTSM_DESIGNATED_AGREED, PRTSM_UCT_TO_DESIGNATED_PORT)  \
+    S(PRTSM_DESIGNATED_SYNCED, PRTSM_UCT_TO_DESIGNATED_PORT)  \
+    S(PRTSM_DESIGNATED_RETIRED, PRTSM_UCT_TO_DESIGNATED_PORT) \
+    S(PRTSM_DESIGNATED_FORWARD, PRTSM_UCT_TO_DESIGNATED_PORT) \
+    S(PRTSM_DESIGNATED_LEARN, PRTSM_UCT_TO_DESIGNATED_PORT)   \
+    S(PRTSM_DESIGNATED_DISCARD, PRTSM_UCT_TO_DESIGNATED_PORT) \
+    S(PRTSM_DESIGNATED_PORT, PRTSM_FROM_DESIGNATED_PORT)      \
+    S(PRTSM_BLOCK_PORT, PRTSM_FROM_BLOCK_PORT)                \
+    S(PRTSM_BACKUP_PORT, PRTSM_UCT_TO_ALTERNATE_PORT)         \
+    S(PRTSM_ALTERNATE_PROPOSED, PRTSM_UCT_TO_ALTERNATE_PORT)  \
+    S(PRTSM_ALTERNATE_AGREED, PRTSM_UCT_TO_ALTERNATE_PORT)    \
+    S(PRTSM_ALTERNATE_PORT, PRTSM_FROM_ALTERNATE_PORT)
+
+static bool PRTSM_dispatch(sm_env_t *env, bool dry_run)
+{
+    PRTSM_FROM_ANY(SM_TRANSITION)
+    switch(env->ptp->PRTSM_state)
+    {
+        PRTSM_STATES(SM_CASE)
+    }
+    return false;
+}
+
+/* One evaluation of the state machine: returns true if a transition is
+ * (dry run) or was (actual run) taken */
+static bool PRTSM_runr(per_tree_port_t *ptp, bool recursive_call, bool dry_run)
+{
+    port_t *prt = ptp->port;
+    bridge_t *br = prt->bridge;
+    per_tree_port_t *cist;
+    sm_env_t env;
+    bool res;
+
+    if(br->sm_ref_dispatch)
+        return PRTSM_runr_ref(ptp, recursive_call, dry_run);
+
+    sm_env_init(&env, prt, ptp);
+    cist = GET_CIST_PTP_FROM_PORT(prt);
+    env.FwdDelay = fwdDelayMs(br, cist->designatedTimes.Forward_Delay);
+    env.HelloTime = portHelloTimeMs(prt);
+    env.forwardDelay = PRT_FLAG(prt, sendRSTP) ? env.HelloTime : env.FwdDelay;
+    env.MaxAge = SECONDS_TO_MS(cist->designatedTimes.Max_Age);
+
+    PRTSM_LOG("role = %d, selectedRole = %d, selected = %d, updtInfo = %d",
+              ptp->role, ptp->selectedRole, PTP_FLAG(ptp, selected),
+              PTP_FLAG(ptp, updtInfo));
+    res = PRTSM_dispatch(&env, dry_run);
+    if(dry_run && br->sm_cross_check)
+        sm_cross_check(br, "PRTSM", ptp->PRTSM_state, res,
+                       PRTSM_runr_ref(ptp, false, true /* dry run */));
+    return res;
+}
+
+/* Not in standard: the state entered is evaluated again in a loop, rather
+ * than by each PRTSM_to_xxx() calling the state machine recursively, so a
+ * chain of transitions (e.g. ROOT_PROPOSED, ROOT_PORT, REROOT, ROOT_PORT)
+ * does not grow the stack.
+ */
+static bool PRTSM_run(per_tree_port_t *ptp, bool dry_run)
+{
+    bool recursive_call = false;
+
+    if(dry_run)
+        return PRTSM_runr(ptp, false, true /* dry run */);
+    while(PRTSM_runr(ptp, recursive_call, false /* actual run */))
+        recursive_call = true;
+    return false;
+}
+
+/* 13.36  Topology Change state machine */
+
+static bool TCSM_active_port(per_tree_port_t *ptp)
+{
+    return (roleRoot == ptp->role) || (roleDesignated == ptp->role)
+           || (roleMaster == ptp->role);
+}
+
+static bool TCSM_if_learning(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, learn) && !PTP_FLAG(env->ptp, fdbFlush);
+}
+
+static bool TCSM_if_detected(sm_env_t *env)
+{
+    return TCSM_active_port(env->ptp) && PTP_FLAG(env->ptp, forward)
+           && !PRT_FLAG(env->prt, operEdge);
+}
+
+static bool TCSM_if_relearning(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return PTP_ANY(ptp, PTP_BIT(rcvdTc) | PTP_BIT(tcProp))
+           || ((0 == ptp->MSTID)
+               && PRT_ANY(env->prt, PRT_BIT(rcvdTcn) | PRT_BIT(rcvdTcAck)));
+}
+
+static bool TCSM_if_inactive(sm_env_t *env)
+{
+    per_tree_port_t *ptp = env->ptp;
+
+    return !TCSM_active_port(ptp)
+           && !PTP_ANY(ptp, PTP_BIT(learn) | PTP_BIT(learning));
+}
+
+static bool TCSM_if_stopped(sm_env_t *env)
+{
+    return !TCSM_active_port(env->ptp) || PRT_FLAG(env->prt, operEdge);
+}
+
+static bool TCSM_if_rcvdTcn(sm_env_t *env)
+{
+    return (0 == env->ptp->MSTID) && PRT_FLAG(env->prt, rcvdTcn);
+}
+
+static bool TCSM_if_rcvdTc(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, rcvdTc);
+}
+
+static bool TCSM_if_tcProp(sm_env_t *env)
+{
+    return PTP_FLAG(env->ptp, tcProp)/* && !PRT_FLAG(prt, operEdge) */;
+}
+
+static bool TCSM_if_rcvdTcAck(sm_env_t *env)
+{
+    return (0 == env->ptp->MSTID) && PRT_FLAG(env->prt, rcvdTcAck);
+}
+
+SM_ENTER(TCSM_do_INACTIVE, TCSM_to_INACTIVE(env->ptp, false))
+SM_ENTER(TCSM_do_LEARNING, TCSM_to_LEARNING(env->ptp, false))
+SM_ENTER(TCSM_do_DETECTED, TCSM_to_DETECTED(env->ptp))
+SM_ENTER(TCSM_do_NOTIFIED_TCN, TCSM_to_NOTIFIED_TCN(env->ptp))
+SM_ENTER(TCSM_do_NOTIFIED_TC, TCSM_to_NOTIFIED_TC(env->ptp))
+SM_ENTER(TCSM_do_PROPAGATING, TCSM_to_PROPAGATING(env->ptp))
+SM_ENTER(TCSM_do_ACKNOWLEDGED, TCSM_to_ACKNOWLEDGED(env->ptp))
+SM_ENTER(TCSM_do_ACTIVE, TCSM_to_ACTIVE(env->ptp))
+
+#define TCSM_FROM_INACTIVE(T)                   \
+    T(TCSM_if_learning, TCSM_do_LEARNING)
+#define TCSM_FROM_LEARNING(T)                   \
+    T(TCSM_if_detected, TCSM_do_DETECTED)       \
+    T(TCSM_if_relearning, TCSM_do_LEARNING)     \
+    T(TCSM_if_inactive, TCSM_do_INACTIVE)
+#define TCSM_FROM_NOTIFIED_TCN(T)               \
+    T(sm_always, TCSM_do_NOTIFIED_TC)
+#define TCSM_UCT_TO_ACTIVE(T)                   \
+    T(sm_always, TCSM_do_ACTIVE)
+#define TCSM_FROM_ACTIVE(T)                     \
+    T(TCSM_if_stopped, TCSM_do_LEARNING)        \
+    T(TCSM_if_rcvdTcn, TCSM_do_NOTIFIED_TCN)    \
+    T(TCSM_if_rcvdTc, TCSM_do_NOTIFIED_TC)      \
+    T(TCSM_if_tcProp, TCSM_do_PROPAGATING)      \
+    T(TCSM_if_rcvdTcAck, TCSM_do_ACKNOWLEDGED)
+#define TCSM_STATES(S)                           \
+    S(TCSM_INACTIVE, TCSM_FROM_INACTIVE)         \
+    S(TCSM_LEARNING, TCSM_FROM_LEARNING)         \
+    S(TCSM_DETECTED, TCSM_UCT_TO_ACTIVE)         \
+    S(TCSM_NOTIFIED_TCN, TCSM_FROM_NOTIFIED_TCN) \
+    S(TCSM_NOTIFIED_TC, TCSM_UCT_TO_ACTIVE)      \
+    S(TCSM_PROPAGATING, TCSM_UCT_TO_ACTIVE)      \
+    S(TCSM_ACKNOWLEDGED, TCSM_UCT_TO_ACTIVE)     \
+    S(TCSM_ACTIVE, TCSM_FROM_ACTIVE)
+
+static bool TCSM_dispatch(sm_env_t *env, bool dry_run)
+{
+    switch(env->ptp->TCSM_state)
+    {
+        TCSM_STATES(SM_CASE)
+    }
+    return false;
+}
+
+static bool TCSM_run(per_tree_port_t *ptp, bool dry_run)
+{
+    bridge_t *br = ptp->port->bridge;
+    sm_env_t env;
+    bool res;
+
+    if(br->sm_ref_dispatch)
+        return TCSM_run_ref(ptp, dry_run);
+
+    sm_env_init(&env, ptp->port, ptp);
+    res = TCSM_dispatch(&env, dry_run);
+    if(dry_run && br->sm_cross_check)
+        sm_cross_check(br, "TCSM", ptp->TCSM_state, res,
+                       TCSM_run_ref(ptp, true /* dry run */));
+    return res;
+}
+
+/* Execute BEGIN state. We do not define BEGIN variable
+ * but instead xxx_state_machines_begin execute begin state
+ * abd do one step out of it
+ */
+
+static void tree_state_machines_begin(tree_t *tree)
+{
+    bridge_t *br = tree->bridge;
+    per_tree_port_t *ptp;
+
+    if(!br->bridgeEnabled)
+        return;
+
+    /* 13.32  Port Information state machine */
+    FOREACH_PTP_IN_TREE(ptp, tree)
+    {
+        ptp->start_time = br->uptime; /* 12.8.2.2.3 b) */
+        PISM_begin(ptp);
+    }
+
+    /* 13.33  Port Role Selection state machine */
+    PRSSM_begin(tree);
+
+    /* 13.34  Port Role Transitions state machine */
+    FOREACH_PTP_IN_TREE(ptp, tree)
+        PRTSM_begin(ptp);
+    /* 13.35  Port State Transition state machine */
+    FOREACH_PTP_IN_TREE(ptp, tree)
+        PSTSM_begin(ptp);
+    /* 13.36  Topology Change state machine */
+    FOREACH_PTP_IN_TREE(ptp, tree)
+        TCSM_begin(ptp);
+
+    br_state_machines_run(br);
+}
+
+static void prt_state_machines_begin(port_t *prt)
+{
+    bridge_t *br = prt->bridge;
+    tree_t *tree;
+    per_tree_port_t *ptp;
+
+    if(!br->bridgeEnabled)
+        return;
+
+    /* 13.28  Port Receive state machine */
+    PRSM_begin(prt);
+    /* 13.29  Port Protocol Migration state machine */
+    PPMSM_begin(prt);
+    /* 13.30  Bridge Detection state machine */
+    BDSM_begin(prt);
+    /* 13.31  Port Transmit state machine */
+    PTSM_begin(prt);
+
+    /* 13.32  Port Information state machine */
+    FOREACH_PTP_IN_PORT(ptp, prt)
+    {
+        ptp->start_time = br->uptime; /* 12.8.2.2.3 b) */
+        PISM_begin(ptp);
+    }
+
+    /* 13.33  Port Role Selection state machine */
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        PRSSM_run(tree, false /* actual run */);
+
+    /* 13.34  Port Role Transitions state machine */
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        PRTSM_begin(ptp);
+    /* 13.35  Port State Transition state machine */
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        PSTSM_begin(ptp);
+    /* 13.36  Topology Change state machine */
+    FOREACH_PTP_IN_PORT(ptp, prt)
+        TCSM_begin(ptp);
+
+    br_state_machines_run(br);
+}
+
+/* For a ptp added to a sparse tree. Leaves the run to the caller,
+ * the tree is marked for the Port Role Selection.
+ */
+static void ptp_state_machines_begin(per_tree_port_t *ptp)
+{
+    bridge_t *br = ptp->port->bridge;
+
+    if(!br->bridgeEnabled)
+        return;
+
+    ptp->start_time = br->uptime; /* 12.8.2.2.3 b) */
+    PISM_begin(ptp);
+    PRTSM_begin(ptp);
+    PSTSM_begin(ptp);
+    TCSM_begin(ptp);
+
+    sm_mark_ptp(ptp, SM_PTP_ALL);
+    ptp->tree->sm_dirty = true;
+}
+
+static void br_state_machines_begin(bridge_t *br)
+{
+    port_t *prt;
+    per_tree_port_t *ptp;
+    tree_t *tree;
+
+    if(!br->bridgeEnabled)
+        return;
+
+    /* 13.28  Port Receive state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        PRSM_begin(prt);
+    /* 13.29  Port Protocol Migration state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        PPMSM_begin(prt);
+    /* 13.30  Bridge Detection state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        BDSM_begin(prt);
+    /* 13.31  Port Transmit state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        PTSM_begin(prt);
+
+    /* 13.32  Port Information state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        FOREACH_PTP_IN_PORT(ptp, prt)
+        {
+            ptp->start_time = br->uptime; /* 12.8.2.2.3 b) */
+            PISM_begin(ptp);
+        }
+    }
+
+    /* 13.33  Port Role Selection state machine */
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+        PRSSM_begin(tree);
+
+    /* 13.34  Port Role Transitions state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            PRTSM_begin(ptp);
+    }
+    /* 13.35  Port State Transition state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            PSTSM_begin(ptp);
+    }
+    /* 13.36  Topology Change state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            TCSM_begin(ptp);
+    }
+
+    br_state_machines_run(br);
+}
+
+/* Run each state machine.
+ * Return false iff all state machines in dry run indicate that
+ * state will not be changed. Otherwise return true.
+ */
+static bool __br_state_machines_run(bridge_t *br, bool dry_run)
+{
+    port_t *prt;
+    per_tree_port_t *ptp;
+    tree_t *tree;
+
+    /* Check if bridge assurance timer expires */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(PRT_FLAG(prt, portEnabled) && assurancePort(prt)
+           && (0 == PRT_TIMER(prt, brAssuRcvdInfoWhile)) && !prt->BaInconsistent
+          )
+        {
+            if(dry_run) /* state change */
+                return true;
+            prt->BaInconsistent = true;
+            ERROR_PRTNAME(prt, "Bridge assurance inconsistent");
+        }
+    }
+
+    /* 13.28  Port Receive state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(PRSM_run(prt, dry_run) && dry_run)
+            return true;
+    }
+    /* 13.29  Port Protocol Migration state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(PPMSM_run(prt, dry_run) && dry_run)
+            return true;
+    }
+    /* 13.30  Bridge Detection state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(BDSM_run(prt, dry_run) && dry_run)
+            return true;
+    }
+    /* 13.31  Port Transmit state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(PTSM_run(prt, dry_run) && dry_run)
+            return true;
+    }
+
+    /* 13.32  Port Information state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        FOREACH_PTP_IN_PORT(ptp, prt)
+        {
+            if(PISM_run(ptp, dry_run) && dry_run)
+                return true;
+        }
+    }
+
+    /* 13.33  Port Role Selection state machine */
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+    {
+        if(PRSSM_run(tree, dry_run) && dry_run)
+            return true;
+    }
+
     /* 13.34  Port Role Transitions state machine */
     FOREACH_PORT_IN_BRIDGE(prt, br)
     {
@@ -5135,34 +8090,287 @@ static bool __br_state_machines_run(bridge_t *br, bool dry_run)
     return false;
 }
 
-/* Run state machines until their state stabilizes.
- * Do not consume more than 1 second.
+/* Dependencies of the state machines, see the comment at SM_BA.
+ * A per-port state machine changes the variables of its port and of the
+ * port's per-tree data, which are read by the state machines of the port.
+ * Two of them touch less, which matters with many MSTIs:
+ *  - PRSM of an enabled port passes the received messages to the CIST and
+ *    to the MSTIs the BPDU has a message for (setRcvdMsgs marks them).
+ *    When it changes operEdge or rcvdInternal, PRSM_to_RECEIVE marks all
+ *    trees of the port itself.
+ *  - PTSM writes only the variables read by PTSM.
  */
-static void br_state_machines_run(bridge_t *br)
+static void sm_changed_port(port_t *prt, unsigned int sm)
+{
+    switch(sm)
+    {
+        case SM_PRSM:
+            if(!PRT_FLAG(prt, portEnabled))
+                break; /* to DISCARD, all rcvdMsg cleared */
+            prt->sm_dirty |= SM_PORT_SMS;
+            sm_mark_ptp(GET_CIST_PTP_FROM_PORT(prt), SM_PTP_ALL);
+            return;
+        case SM_PTSM:
+            prt->sm_dirty |= SM_PORT_SMS;
+            return;
+    }
+    sm_mark_port(prt);
+}
+
+/* A per-tree state machine of the port changes the variables of its port,
+ * its own per-tree data, the inputs of allSynced and reRooted of the other
+ * ports in the tree (PRTSM) and the reselect flags of the tree (PRSSM).
+ * Writes to the other ports (setSyncTree, setReRootTree, setTcPropTree,
+ * syncMaster) mark their targets themselves, and the MSTIs are reselected
+ * by PRSSM of the CIST (reselectMSTIs). So a change stays in its tree,
+ * with two exceptions for the CIST:
+ *  - the MSTIs with a received message wait for the CIST to consume its
+ *    own one (rcvdXstMsg, updtXstInfo of PISM);
+ *  - PISM of the CIST at the region boundary writes the per-tree data of
+ *    all MSTIs (recordProposal, recordAgreement, setTcFlags...).
+ */
+static void sm_changed_ptp(per_tree_port_t *ptp, unsigned int sm)
+{
+    port_t *prt = ptp->port;
+    tree_t *tree;
+
+    prt->sm_dirty |= SM_PORT_SMS;
+    sm_mark_ptp(ptp, SM_PTP_ALL);
+    sm_mark_tree(ptp->tree, SM_PRTSM);
+    ptp->tree->sm_dirty = true;
+    if(0 != ptp->MSTID)
+        return;
+
+    if((SM_PISM == sm) && !PRT_FLAG(prt, rcvdInternal))
+    {
+        sm_mark_port(prt);
+        FOREACH_TREE_IN_BRIDGE(tree, prt->bridge)
+            tree->sm_dirty = true;
+        return;
+    }
+    list_for_each_entry_continue(ptp, &prt->trees, port_list)
+        if(PTP_FLAG(ptp, rcvdMsg))
+            sm_mark_ptp(ptp, SM_PISM);
+}
+
+/* PRSSM assigns the roles of all ports in the tree, and in the CIST also
+ * the master flags of the MSTIs: in the CIST anything may change, in an
+ * MSTI only the state machines of that MSTI and of its ports.
+ */
+static void sm_changed_tree(tree_t *tree)
+{
+    per_tree_port_t *ptp;
+
+    if(0 == tree->MSTID)
+    {
+        sm_mark_bridge(tree->bridge);
+        return;
+    }
+    tree->sm_dirty = true;
+    FOREACH_PTP_IN_TREE(ptp, tree)
+    {
+        ptp->port->sm_dirty |= SM_PORT_SMS;
+        sm_mark_ptp(ptp, SM_PTP_ALL);
+    }
+}
+
+static bool sm_step_port(port_t *prt, unsigned int sm,
+                         bool (*run)(port_t *, bool))
+{
+    if(!(prt->sm_dirty & sm))
+        return false;
+    prt->sm_dirty &= ~sm;
+    if(!run(prt, true /* dry run */))
+        return false;
+    /* Mark before the run too: it may nest runs of the bridge (BPDUs looped
+     * back synchronously, flush callbacks), which must see both the
+     * changing state machine and its dependents as dirty.
+     */
+    prt->sm_dirty |= sm;
+    sm_changed_port(prt, sm);
+    run(prt, false /* actual run */);
+    sm_changed_port(prt, sm);
+    return true;
+}
+
+static bool sm_step_ptp(per_tree_port_t *ptp, unsigned int sm,
+                        bool (*run)(per_tree_port_t *, bool))
+{
+    if(!(ptp->sm_dirty & sm))
+        return false;
+    ptp->sm_dirty &= ~sm;
+    if(!run(ptp, true /* dry run */))
+        return false;
+    sm_mark_ptp(ptp, sm);
+    sm_changed_ptp(ptp, sm);
+    run(ptp, false /* actual run */);
+    sm_changed_ptp(ptp, sm);
+    return true;
+}
+
+static bool PRTSM_step(per_tree_port_t *ptp, bool dry_run)
+{
+    return PRTSM_run(ptp, dry_run);
+}
+
+/* One pass of the work-list scheduler: evaluate each dirty state machine
+ * instance in the order of __br_state_machines_run().
+ * Return true if some state machine changed its state.
+ */
+static bool __br_dirty_state_machines_run(bridge_t *br)
+{
+    port_t *prt;
+    per_tree_port_t *ptp;
+    tree_t *tree;
+    bool changed = false;
+
+    /* Check if bridge assurance timer expires */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(!(prt->sm_dirty & SM_BA))
+            continue;
+        prt->sm_dirty &= ~SM_BA;
+        if(PRT_FLAG(prt, portEnabled) && assurancePort(prt)
+           && (0 == PRT_TIMER(prt, brAssuRcvdInfoWhile)) && !prt->BaInconsistent
+          )
+        {
+            prt->BaInconsistent = true;
+            ERROR_PRTNAME(prt, "Bridge assurance inconsistent");
+            sm_changed_port(prt, SM_BA);
+            changed = true;
+        }
+    }
+
+    /* 13.28  Port Receive state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        changed |= sm_step_port(prt, SM_PRSM, PRSM_run);
+    /* 13.29  Port Protocol Migration state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        changed |= sm_step_port(prt, SM_PPMSM, PPMSM_run);
+    /* 13.30  Bridge Detection state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        changed |= sm_step_port(prt, SM_BDSM, BDSM_run);
+    /* 13.31  Port Transmit state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+        changed |= sm_step_port(prt, SM_PTSM, PTSM_run);
+
+    /* 13.32  Port Information state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(!(prt->sm_dirty & SM_PTPS))
+            continue;
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            changed |= sm_step_ptp(ptp, SM_PISM, PISM_run);
+    }
+
+    /* 13.33  Port Role Selection state machine */
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+    {
+        if(!tree->sm_dirty)
+            continue;
+        tree->sm_dirty = false;
+        if(PRSSM_run(tree, true /* dry run */))
+        {
+            sm_changed_tree(tree);
+            PRSSM_run(tree, false /* actual run */);
+            sm_changed_tree(tree);
+            changed = true;
+        }
+    }
+
+    /* 13.34  Port Role Transitions state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(!(prt->sm_dirty & SM_PTPS))
+            continue;
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            changed |= sm_step_ptp(ptp, SM_PRTSM, PRTSM_step);
+    }
+    /* 13.35  Port State Transition state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        if(!(prt->sm_dirty & SM_PTPS))
+            continue;
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            changed |= sm_step_ptp(ptp, SM_PSTSM, PSTSM_run);
+    }
+    /* 13.36  Topology Change state machine */
+    FOREACH_PORT_IN_BRIDGE(prt, br)
+    {
+        bool dirty = false;
+
+        if(!(prt->sm_dirty & SM_PTPS))
+            continue;
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            changed |= sm_step_ptp(ptp, SM_TCSM, TCSM_run);
+        /* Last per-tree state machine, recalculate the summary */
+        FOREACH_PTP_IN_PORT(ptp, prt)
+            dirty |= (0 != ptp->sm_dirty);
+        if(!dirty)
+            prt->sm_dirty &= ~SM_PTPS;
+    }
+
+    return changed;
+}
+
+/* Check for the timeout */
+static bool sm_timed_out(struct timespec *tv_end)
 {
-    struct timespec tv, tv_end;
+    struct timespec tv;
     signed long delta;
 
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    if(0 < (delta = tv.tv_sec - tv_end->tv_sec))
+        return true;
+    if(0 == delta)
+    {
+        delta = tv.tv_nsec - tv_end->tv_nsec;
+        if(0 < delta)
+            return true;
+    }
+    return false;
+}
+
+/* Run the dirty state machines until their state stabilizes.
+ * Do not consume more than 1 second.
+ */
+static void br_dirty_state_machines_run(bridge_t *br)
+{
+    struct timespec tv_end;
+
     if(!br->bridgeEnabled)
         return;
 
     clock_gettime(CLOCK_MONOTONIC, &tv_end);
     ++(tv_end.tv_sec);
 
-    do {
-        if(!__br_state_machines_run(br, true /* dry run */))
-            return;
-        __br_state_machines_run(br, false /* actual run */);
-
-        /* Check for the timeout */
-        clock_gettime(CLOCK_MONOTONIC, &tv);
-        if(0 < (delta = tv.tv_sec - tv_end.tv_sec))
-            return;
-        if(0 == delta)
+    if(br->sm_full_sweep)
+    {
+        do {
+            if(!__br_state_machines_run(br, true /* dry run */))
+                break;
+            __br_state_machines_run(br, false /* actual run */);
+        } while(!sm_timed_out(&tv_end));
+    }
+    else
+    {
+        while(__br_dirty_state_machines_run(br))
         {
-            delta = tv.tv_nsec - tv_end.tv_nsec;
-            if(0 < delta)
-                return;
+            if(sm_timed_out(&tv_end))
+                break;
         }
-    } while(true);
+    }
+
+    if(br->rx_suppress || br->rx_fast_path)
+        rxSuppressUpdate(br);
+}
+
+/* Run all state machines until their state stabilizes */
+static void br_state_machines_run(bridge_t *br)
+{
+    /* Enabling the bridge starts all of them anyway */
+    if(!br->bridgeEnabled)
+        return;
+    sm_mark_bridge(br);
+    br_dirty_state_machines_run(br);
 }
@@ -42,6 +42,8 @@
                      0xF9, 0x5D, 0x2B, 0xA2, 0x43, 0xCD, 0x03, 0x46}
 extern void hmac_md5(const unsigned char * text, int text_len,
                      const unsigned char * key, int key_len, void * digest);
+extern void hmac_md5_mstp(const unsigned char * text, int text_len,
+                          void * digest);
 #ifdef HMAC_MDS_TEST_FUNCTIONS
 extern bool MD5TestSuite(void);
 #endif /* HMAC_MDS_TEST_FUNCTIONS */
@@ -58,6 +60,18 @@ extern bool MD5TestSuite(void);
 /* 13.37.1 */
 #define MAX_PATH_COST   200000000u
 
+/* Not in standard: millisecond timers.
+ * Configured millisecond times must be multiples of MSTP_TICK_MS_MIN */
+#define MSTP_TICK_MS_DEFAULT    1000u
+#define MSTP_TICK_MS_MIN        10u
+#define MIN_HELLO_TIME_MS       MSTP_TICK_MS_MIN
+#define MAX_HELLO_TIME_MS       2000u
+#define MIN_FORWARD_DELAY_MS    100u
+#define MAX_FORWARD_DELAY_MS    30000u
+
+/* Not in standard: limit of the BPDU receive rate limit and burst */
+#define MAX_BPDU_RX_RATE        10000u
+
 typedef union
 {
     __u64 u;
@@ -101,6 +115,11 @@ typedef struct
     /* not used for MSTIs, only for CIST */
     bridge_identifier_t RootID;
     __be32 ExtRootPathCost;
+    /* not in standard: the above fields in host byte order, packed in the
+     * order of comparison (13.10) into integers. key[0] and key[1] are only
+     * compared for CIST. Must be refreshed by updtPriorityKey() after any
+     * change of the fields */
+    __u64 key[5];
 } port_priority_vector_t;
 
 typedef struct
@@ -166,6 +185,27 @@ typedef struct
 #define MST_BPDU_VER3LEN_WO_MSTI_MSGS (MST_BPDU_SIZE_WO_MSTI_MSGS \
                     - offsetof(bpdu_t, mstConfigurationIdentifier))
 
+/* Not in standard: the parts of a valid BPDU (14.4) which the state
+ * machines read, decoded by MSTP_IN_rx_bpdu(). The fields a BPDU of the
+ * received type does not carry are zero.
+ */
+typedef struct
+{
+    bridge_identifier_t cistRootID;
+    bridge_identifier_t cistRRootID;
+    bridge_identifier_t cistBridgeID;
+    __be32 cistExtRootPathCost;
+    __be32 cistIntRootPathCost;
+    port_identifier_t cistPortID;
+    __u8 protocolVersion; /* as determined by the validation */
+    __u8 bpduType;
+    __u8 flags;
+    /* CIST messageTimes rounded to whole seconds, remainingHops is only
+     * conveyed by MST BPDUs */
+    times_t times;
+    mst_configuration_identifier_t mstConfigurationIdentifier;
+} rcvd_bpdu_t;
+
 typedef enum
 {
     OtherInfo,
@@ -360,6 +400,136 @@ typedef enum
     TCSM_ACTIVE
 } TCSM_states_t;
 
+/* Not in standard: what to do with the BPDUs received on a port faster than
+ * its receive rate limit allows */
+typedef enum
+{
+    rxLimitDrop,       /* discard the excess BPDUs */
+    rxLimitErrdisable, /* shut the port down */
+    rxLimitAlert       /* only log, process them anyway */
+} rx_limit_policy_t;
+
+/* Trees of a bridge are numbered with slots, CIST always takes slot 0 */
+#define MAX_TREE_SLOTS  (MAX_IMPLEMENTATION_MSTIS + 1)
+/* Slot of the MSTIDs which are not created, br->slot2tree[] of it is NULL */
+#define NO_TREE_SLOT    MAX_TREE_SLOTS
+
+struct _tree;
+struct _per_tree_port;
+struct _port;
+
+/* Timers are kept apart from the ports and per-tree ports in one table per
+ * bridge, a row per port, so that a tick walks contiguous memory. The rows
+ * have room only for the tree slots in use, see bridge_t.timer_slots.
+ * All timers are in milliseconds.
+ */
+typedef enum
+{
+    /* 13.21.(d,e,f,g,h) Per-port per-tree timers */
+    TIMER_fdWhile,
+    TIMER_rrWhile,
+    TIMER_rbWhile,
+    TIMER_tcWhile,
+    TIMER_rcvdInfoWhile,
+    NUM_PTP_TIMERS
+} ptp_timer_t;
+
+typedef enum
+{
+    /* 13.21.(a,b,c) Per-port timers */
+    TIMER_mdelayWhile,
+    TIMER_helloWhen,
+    TIMER_edgeDelayWhile,
+    /* Not in standard timers */
+    TIMER_rapidAgeingWhile,
+    TIMER_brAssuRcvdInfoWhile,
+    NUM_PORT_TIMERS
+} port_timer_t;
+
+/* Room for the port timers, rounded up to whole vectors of the tick */
+#define PORT_TIMER_COLUMNS  8
+
+typedef struct
+{
+    unsigned int port[PORT_TIMER_COLUMNS];
+    /* Per-tree timers, bridge_t.timer_slots of each kind,
+     * indexed by tree_t.slot. See PTP_TIMER() */
+    unsigned int ptp[];
+} port_timers_t;
+
+/* Boolean state machine variables are kept as bits of a flag word,
+ * port_t.flags and per_tree_port_t.flags, so that a guard on several of them
+ * is a single mask test. See PRT_FLAG() and PTP_FLAG().
+ */
+typedef enum
+{
+    /* 13.24.(b,c,e,f,g,j,k,l,m,n,o,p,q,r) Per-port variables */
+    PRT_operEdge,
+    PRT_portEnabled,
+    PRT_infoInternal,
+    PRT_rcvdInternal,
+    PRT_mcheck,
+    PRT_rcvdBpdu,
+    PRT_rcvdRSTP,
+    PRT_rcvdSTP,
+    PRT_rcvdTcAck,
+    PRT_rcvdTcn,
+    PRT_sendRSTP,
+    PRT_tcAck,
+    PRT_newInfo,
+    PRT_newInfoMsti
+} port_flag_t;
+
+typedef enum
+{
+    /* 13.24.(s,t,u,v,w,x,y,z,ab,ac,ad,ae,af,ag,ai,aj,ak,as,at,au,av)
+     * Per-port per-tree variables */
+    PTP_agree,
+    PTP_agreed,
+    PTP_disputed,
+    PTP_forward,
+    PTP_forwarding,
+    PTP_learn,
+    PTP_learning,
+    PTP_proposed,
+    PTP_proposing,
+    PTP_rcvdMsg,
+    PTP_rcvdTc,
+    PTP_reRoot,
+    PTP_reselect,
+    PTP_selected,
+    PTP_fdbFlush,
+    PTP_tcProp,
+    PTP_updtInfo,
+    PTP_sync,
+    PTP_synced,
+    /* 13.24.(ax,ay) Per-port per-MSTI variables, not applicable to CIST */
+    PTP_master,
+    PTP_mastered
+} ptp_flag_t;
+
+#define PRT_BIT(name) (1u << PRT_##name)
+#define PTP_BIT(name) (1u << PTP_##name)
+
+/* Not in standard: a map of VIDs or FIDs kept as the runs of consecutive
+ * keys with the same value, sorted by key. runs[0].first is always 0.
+ * Most bridges keep the default map of all keys to 0, which shares a
+ * single run with all of them until it is changed (room is then 0).
+ */
+typedef struct
+{
+    __u16 first; /* first key of the run, the run ends before the next one */
+    __u16 value;
+} map_run_t;
+
+typedef struct
+{
+    map_run_t *runs;
+    unsigned int num_runs;
+    unsigned int room; /* 0 = the runs are shared, do not write to them */
+    __u16 last_key;
+} range_map_t;
+
 /*
  * Following standard-defined variables are not defined as variables.
  * Their functionality is implemented indirectly by other means:
@@ -375,6 +545,19 @@ typedef struct
     /* List of all tree instances, first in list (trees.next) is CIST */
     struct list_head trees;
 #define GET_CIST_TREE(br) list_entry((br)->trees.next, tree_t, bridge_list)
+    /* Index of the trees by MSTID: the slot of the tree, NO_TREE_SLOT for
+     * MSTIDs which are not created, and the tree in that slot */
+    __u8 mstid2slot[MAX_MSTID + 1];
+    struct _tree *slot2tree[MAX_TREE_SLOTS + 1];
+    /* List of ports which have at least one running timer */
+    struct list_head timer_ports;
+    /* Timers of all ports, rows of timer_row_size() timers,
+     * row port_t.timer_row belongs to the port */
+    unsigned int *timers;
+    struct _port **timer_row_port; /* owner of each row, NULL if free */
+    unsigned int timer_rows;
+    /* Number of tree slots the rows have room for and the tick looks at */
+    unsigned int timer_slots;
 
     bool bridgeEnabled;
 
@@ -393,24 +576,139 @@ typedef struct
     unsigned int Migrate_Time;        /* 13.22.h */
     unsigned int Ageing_Time;  /* 8.8.3 */
 
-    __u16 vid2fid[MAX_VID + 1];
-    __be16 fid2mstid[MAX_FID + 1];
+    range_map_t vid2fid;   /* keys 0 .. MAX_VID */
+    range_map_t fid2mstid; /* keys 0 .. MAX_FID, host byte order */
 
     /* not in standard */
     unsigned int uptime;
+    unsigned int uptime_ms; /* milliseconds part of the uptime */
     bool stp_enabled;
+    /* Local Forward Delay for the timers in milliseconds, 0 = use the
+     * Forward_Delay from the designatedTimes. Never goes to the wire. */
+    unsigned int Forward_Delay_ms;
+    /* Period in ms with which MSTP_IN_tick() should be called */
+    unsigned int tick_interval;
+    /* Changed to encode the BPDUs of all ports again, see port_t.txBpdu */
+    unsigned int txBpduGen;
+    /* Between MSTP_IN_rx_batch_begin() and MSTP_IN_rx_batch_end() received
+     * BPDUs only set sm_pending, state machines are run once at the end */
+    bool rx_batch;
+    bool sm_pending;
+    /* Let the packet filter drop repeats of BPDUs which are known to change
+     * nothing but the timers, see MSTP_OUT_set_rx_suppress() */
+    bool rx_suppress;
+    /* Process repeats of BPDUs which are known to change nothing but the
+     * timers by restarting the timers only, without running the state
+     * machines (on by default) */
+    bool rx_fast_path;
+    /* Create the MSTIs sparse: a port gets its state in an MSTI only when
+     * some VLAN of the bridge is allocated to the MSTI, or when the port
+     * receives an MSTI message for it (off by default) */
+    bool lazy_msti_ports;
+    /* Between MSTP_IN_begin_vlan_map() and MSTP_IN_commit_vlan_map() the
+     * changes of the VID-to-MSTID mapping only set vlan_map_changed */
+    bool vlan_map_txn;
+    bool vlan_map_changed;
+    unsigned int vlan_map_txn_start; /* MSTP_OUT_get_time_ms() it was opened */
+    /* Evaluate every state machine in every pass instead of only the ones
+     * whose inputs changed. Slow, kept to verify the work-list scheduler */
+    bool sm_full_sweep;
+    /* Select the Root Port by scanning all ports and re-evaluate the roles
+     * of all of them on each reselect. Slow, kept to verify the incremental
+     * role selection */
+    bool roles_full_scan;
+    /* Run PTSM, PISM, PRTSM and TCSM with their hand-coded reference
+     * implementation instead of the transition tables */
+    bool sm_ref_dispatch;
+    /* Evaluate each dry run of the tables with the reference too, compare
+     * each BPDU template with a fresh encoding and count the disagreements.
+     * Slow, kept for the tests */
+    bool sm_cross_check;
+    unsigned int sm_cross_check_errors;
 
     sysdep_br_data_t sysdeps;
 } bridge_t;
 
+/* Not in standard: a copy of everything processing of a BPDU on the port
+ * depends on or may change, except the timers and counters. Taken by
+ * rxSuppressCheck() in mstp.c, the parts of the port and of each of its
+ * trees are kept with the port and the per-tree port.
+ * The variables are listed once, as X(type, name) of the bridge_t, port_t
+ * and per_tree_port_t member; the lists generate both the snapshots and
+ * the code which takes them. A variable the state machines read or write
+ * when processing a BPDU is added to its list and nowhere else.
+ */
+#define BRIDGE_STATE_SNAPSHOT(X)                    \
+    X(mst_configuration_identifier_t, MstConfigId)  \
+    X(protocol_version_t, ForceProtocolVersion)     \
+    X(unsigned int, Migrate_Time)
+
+#define PORT_STATE_SNAPSHOT(X)          \
+    X(__u32, flags)                     \
+    X(bool, operPointToPointMAC)        \
+    X(bool, restrictedRole)             \
+    X(bool, restrictedTcn)              \
+    X(bool, AdminEdgePort)              \
+    X(bool, AutoEdge)                   \
+    X(bool, BpduGuardPort)              \
+    X(bool, NetworkPort)                \
+    X(bool, BaInconsistent)             \
+    X(bool, bpduFilterPort)             \
+    X(unsigned int, Hello_Time_ms)      \
+    X(PRSM_states_t, PRSM_state)        \
+    X(PPMSM_states_t, PPMSM_state)      \
+    X(BDSM_states_t, BDSM_state)        \
+    X(PTSM_states_t, PTSM_state)
+
+#define PTP_STATE_SNAPSHOT(X)                       \
+    X(__be16, MSTID)                                \
+    X(__u32, flags)                                 \
+    X(port_info_t, rcvdInfo)                        \
+    X(port_info_origin_t, infoIs)                   \
+    X(port_identifier_t, portId)                    \
+    X(port_role_t, role)                            \
+    X(port_role_t, selectedRole)                    \
+    X(port_priority_vector_t, designatedPriority)   \
+    X(port_priority_vector_t, msgPriority)          \
+    X(port_priority_vector_t, portPriority)         \
+    X(times_t, designatedTimes)                     \
+    X(times_t, msgTimes)                            \
+    X(times_t, portTimes)                           \
+    X(PISM_states_t, PISM_state)                    \
+    X(PRTSM_states_t, PRTSM_state)                  \
+    X(PSTSM_states_t, PSTSM_state)                  \
+    X(TCSM_states_t, TCSM_state)
+
+#define STATE_SNAPSHOT_MEMBER(type, name) type name;
+
+typedef struct
+{
+    BRIDGE_STATE_SNAPSHOT(STATE_SNAPSHOT_MEMBER)
+    PORT_STATE_SNAPSHOT(STATE_SNAPSHOT_MEMBER)
+    unsigned int num_trees;
+} port_state_snapshot_t;
+
 typedef struct
+{
+    /* The role selection of the tree has inputs it did not see yet */
+    bool rolesPending;
+    /* MSTID is 0 in a per-tree port which has no snapshot yet */
+    PTP_STATE_SNAPSHOT(STATE_SNAPSHOT_MEMBER)
+} ptp_state_snapshot_t;
+
+typedef struct _tree
 {
     struct list_head bridge_list; /* anchor in bridge's list of trees */
     bridge_t * bridge;
     __be16 MSTID; /* 0 == CIST */
+    unsigned int slot; /* index in port_t.slot2ptp */
 
     /* List of the per-port data structures for this tree instance */
     struct list_head ports;
+    /* not in standard: the list holds only the ports that received an MSTI
+     * message for the tree, the rest have no state in it and take the
+     * Disabled role, see bridge_t.lazy_msti_ports */
+    bool sparse;
 
     /* 13.23.(c,f,g) Per-bridge per-tree variables */
     bridge_identifier_t BridgeIdentifier;
@@ -434,10 +732,32 @@ typedef struct
 
     /* State machines */
     PRSSM_states_t PRSSM_state;
+    bool sm_dirty; /* PRSSM has to be re-evaluated */
+
+    /* not in standard, used by updtRolesTree() */
+    /* Root Port candidates, binary heap ordered by the root path priority
+     * vector, the best one first */
+    struct _per_tree_port **root_heap;
+    int root_heap_len;
+    unsigned int root_heap_size;
+    /* Ports whose inputs of the role selection changed since the last
+     * updtRolesTree() */
+    struct list_head stale_ports;
+    /* All ports have to be re-evaluated */
+    bool roles_rescan;
+
+    /* not in standard, used by allSynced (13.25.1) */
+    /* Bitmaps of the ports of the tree, indexed by port_t.timer_row.
+     * Unsettled ports are not selected, have updtInfo set or have their
+     * role different from selectedRole. Unsynced ports have synced cleared.
+     */
+    unsigned long *unsettled_ports;
+    unsigned long *unsynced_ports;
+    unsigned int port_bitmap_words;
 
 } tree_t;
 
-typedef struct
+typedef struct _port
 {
     struct list_head br_list; /* anchor in bridge's list of ports */
     bridge_t * bridge;
@@ -449,15 +769,27 @@ typedef struct
     struct list_head trees;
 #define GET_CIST_PTP_FROM_PORT(prt) \
     list_entry((prt)->trees.next, per_tree_port_t, port_list)
-
-    /* 13.21.(a,b,c) Per-port timers */
-    unsigned int mdelayWhile, helloWhen, edgeDelayWhile;
+    /* Index of the same per-tree data by tree_t.slot */
+    struct _per_tree_port *slot2ptp[MAX_TREE_SLOTS];
+    /* anchor in bridge's list of ports with running timers */
+    struct list_head timer_list;
+    /* Row of the timers in bridge_t.timers, see PRT_TIMER() and PTP_TIMER() */
+    unsigned int timer_row;
+    /* Tree slots with a timer started since the last tick */
+    __u64 timer_started;
 
     /* 13.24.(b,c,e,f,g,j,k,l,m,n,o,p,q,r,aw) Per-port variables */
     unsigned int txCount;
-    bool operEdge, portEnabled, infoInternal, rcvdInternal;
-    bool mcheck, rcvdBpdu, rcvdRSTP, rcvdSTP, rcvdTcAck, rcvdTcn, sendRSTP;
-    bool tcAck, newInfo, newInfoMsti;
+    unsigned int txCountTick; /* ms accumulated towards txCount decrement */
+    __u32 flags; /* PRT_BIT() of the boolean ones */
+
+    /* Not in standard: the BPDU encoded by the last txConfig() or txMstp(),
+     * without the flags which follow tcWhile and tcAck. It is only encoded
+     * again when the variables it is made of change */
+    bpdu_t *txBpdu; /* txBpduRoom bytes */
+    int txBpduRoom;
+    int txBpduSize; /* 0 = has to be encoded again */
+    unsigned int txBpduGen; /* bridge_t.txBpduGen it was encoded for */
 
     /* 6.4.3 */
     bool operPointToPointMAC;
@@ -476,19 +808,47 @@ typedef struct
     bool dontTxmtBpdu;
     bool bpduFilterPort;
 
-    unsigned int rapidAgeingWhile;
-    unsigned int brAssuRcvdInfoWhile;
+    /* Local "fast hello" Hello Time in milliseconds, 0 = use the
+     * Hello_Time from the portTimes. Never goes to the wire. */
+    unsigned int Hello_Time_ms;
+
+    /* Not in standard: BPDU receive rate limit, a token bucket refilled
+     * with rxLimitRate BPDUs per second up to rxLimitBurst BPDUs */
+    unsigned int rxLimitRate; /* 0 = no limit */
+    unsigned int rxLimitBurst; /* 0 = rxLimitRate */
+    rx_limit_policy_t rxLimitPolicy;
+    unsigned int rxLimitTokens; /* in 1/1000 of a BPDU */
+    unsigned int rxLimitStamp; /* MSTP_OUT_get_time_ms() of the last refill */
+    bool rxLimitExceeded; /* already logged, until the bucket refills */
+    bool rxLimitError; /* port was shut down by rxLimitErrdisable */
 
     /* State machines */
     PRSM_states_t PRSM_state;
     PPMSM_states_t PPMSM_state;
     BDSM_states_t BDSM_state;
     PTSM_states_t PTSM_state;
-
-    /* Copy of the received BPDU */
-    bpdu_t rcvdBpduData;
+    /* State machines of this port to be re-evaluated, SM_xxx bits in mstp.c */
+    unsigned int sm_dirty;
+
+    /* The received BPDU, decoded */
+    rcvd_bpdu_t rcvdBpduData;
+    /* MSTI Configuration Messages of the received MST BPDU. Not in
+     * standard: the buffer grows to the most messages the port received
+     * in one BPDU, rather than taking room for MAX_STANDARD_MSTIS */
+    msti_configuration_message_t *rcvdMstiMsgs;
+    int rcvdMstiMsgsRoom;
     int rcvdBpduNumOfMstis;
 
+    /* Repeats of rcvdBpduData are dropped by the packet filter */
+    bool rxSuppress;
+    /* rcvdBpduData is a repeat, check if processing it changed anything */
+    bool rxSuppressProbe;
+    port_state_snapshot_t rxSuppressState; /* of the port when suppressing */
+    unsigned int rxSuppressTxCount; /* txCount before the probe */
+    /* Processing a repeat of rcvdBpduData in the state rxSuppressState
+     * changed nothing but the timers */
+    bool rxRepeatProven;
+
     bool deleted;
 
     sysdep_if_data_t sysdeps;
@@ -499,9 +859,17 @@ typedef struct
     unsigned int num_tx_tcn;
     unsigned int num_trans_fwd;
     unsigned int num_trans_blk;
+    /* BPDUs held back while the packet socket was full */
+    unsigned int num_tx_deferred;
+    unsigned int num_tx_coalesced; /* held back BPDU replaced by newer one */
+    unsigned int num_tx_dropped;   /* backpressure queue was full */
+    unsigned int num_rx_rate_limited; /* BPDUs over the receive rate limit */
+    unsigned int num_rx_fast_path; /* repeats which only restarted timers */
+    /* MSTI Configuration Messages for MSTIDs the bridge does not have */
+    unsigned int num_rx_unknown_msti;
 } port_t;
 
-typedef struct
+typedef struct _per_tree_port
 {
     struct list_head port_list; /* anchor in port's list of trees */
     struct list_head tree_list; /* anchor in tree's list of per-port data */
@@ -511,16 +879,11 @@ typedef struct
 
     int state; /* BR_STATE_xxx */
 
-    /* 13.21.(d,e,f,g,h) Per-port per-tree timers */
-    unsigned int fdWhile, rrWhile, rbWhile, tcWhile, rcvdInfoWhile;
-
     /* 13.24.(s,t,u,v,w,x,y,z,aa,ab,ac,ad,ae,af,ag,ai,aj,ak,ap,as,at,au,av)
      * Per-port per-tree variables */
-    bool agree, agreed, disputed, forward, forwarding, learn, learning;
+    __u32 flags; /* PTP_BIT() of the boolean ones and of master, mastered */
     port_info_t rcvdInfo;
     port_info_origin_t infoIs;
-    bool proposed, proposing, rcvdMsg, rcvdTc, reRoot, reselect, selected;
-    bool fdbFlush, tcProp, updtInfo, sync, synced;
     port_identifier_t portId;
     port_role_t role, selectedRole;
 
@@ -534,9 +897,6 @@ typedef struct
      * but saves extra checks and improves readability */
     times_t designatedTimes, msgTimes, portTimes;
 
-    /* 13.24.(ax,ay) Per-port per-MSTI variables, not applicable to CIST */
-    bool master, mastered;
-
     /* Per-port per-tree configuration parameters */
     __u32 InternalPortPathCost; /* 13.22.q */
     __u32 AdminInternalPortPathCost; /* 0 = calculate from speed */
@@ -553,11 +913,72 @@ typedef struct
     /* Auxiliary flag, helps preventing infinite recursion */
     bool calledFromFlushRoutine;
 
+    /* State machines of this ptp to be re-evaluated, SM_xxx bits in mstp.c */
+    unsigned int sm_dirty;
+
+    /* rcvdInfoWhile was restarted by the last received BPDU */
+    bool rcvdInfoRestarted;
+    /* The tree's part of port_t.rxSuppressState */
+    ptp_state_snapshot_t rxSuppressState;
+
+    /* Root path priority vector (13.26.23.a) and position in the
+     * tree->root_heap, -1 if the port is not a Root Port candidate */
+    port_priority_vector_t rootPathPriority;
+    int root_heap_pos;
+    struct list_head stale_list; /* anchor in tree's list of stale ports */
+
     /* Pointer to the corresponding MSTI Configuration Message
-     * in the port->rcvdBpduData */
+     * in the port->rcvdMstiMsgs */
     msti_configuration_message_t *rcvdMstiConfig;
+    /* Not in standard: the same for the last received BPDU, NULL if it
+     * did not convey one. Set by MSTP_IN_rx_bpdu() */
+    msti_configuration_message_t *rxMstiMsg;
 } per_tree_port_t;
 
+/* Lookup of the tree and per-tree port data by MSTID in constant time.
+ * Return NULL if there is no such MSTI.
+ */
+static inline tree_t *find_tree(bridge_t *br, __u16 mstid)
+{
+    return (mstid <= MAX_MSTID) ? br->slot2tree[br->mstid2slot[mstid]] : NULL;
+}
+
+static inline per_tree_port_t *find_ptp(port_t *prt, __u16 mstid)
+{
+    tree_t *tree = find_tree(prt->bridge, mstid);
+    return tree ? prt->slot2ptp[tree->slot] : NULL;
+}
+
+/* Access to the timers of a port and of a per-tree port */
+static inline unsigned int timer_row_size(const bridge_t *br)
+{
+    return PORT_TIMER_COLUMNS + NUM_PTP_TIMERS * br->timer_slots;
+}
+
+static inline port_timers_t *port_timers(port_t *prt)
+{
+    bridge_t *br = prt->bridge;
+    return (port_timers_t *)(br->timers + prt->timer_row * timer_row_size(br));
+}
+
+#define PRT_TIMER(prt, name) (port_timers(prt)->port[TIMER_##name])
+#define PTP_TIMER(_ptp, name)                                 \
+    (port_timers((_ptp)->port)->ptp[TIMER_##name              \
+                                    * (_ptp)->port->bridge->timer_slots \
+                                    + (_ptp)->tree->slot])
+
+/* Read access to the flags of a port and of a per-tree port,
+ * they are changed by set_prt_flag() and set_ptp_flag() in mstp.c */
+#define PRT_FLAG(prt, name) (0 != ((prt)->flags & PRT_BIT(name)))
+#define PTP_FLAG(ptp, name) (0 != ((ptp)->flags & PTP_BIT(name)))
+/* Tests of several flags at once, mask is an OR of PRT_BIT() or PTP_BIT().
+ * xxx_MATCH() is true when, of the flags in mask, exactly those in value
+ * are set. */
+#define PRT_ANY(prt, mask) (0 != ((prt)->flags & (mask)))
+#define PTP_ANY(ptp, mask) (0 != ((ptp)->flags & (mask)))
+#define PRT_MATCH(prt, mask, value) ((value) == ((prt)->flags & (mask)))
+#define PTP_MATCH(ptp, mask, value) ((value) == ((ptp)->flags & (mask)))
+
 /* External events (inputs) */
 bool MSTP_IN_bridge_create(bridge_t *br, __u8 *macaddr);
 bool MSTP_IN_port_create_and_add_tail(port_t *prt, __u16 portno);
@@ -566,14 +987,23 @@ void MSTP_IN_delete_bridge(bridge_t *br);
 void MSTP_IN_set_bridge_address(bridge_t *br, __u8 *macaddr);
 void MSTP_IN_set_bridge_enable(bridge_t *br, bool up);
 void MSTP_IN_set_port_enable(port_t *prt, bool up, int speed, int duplex);
+void MSTP_IN_tick(bridge_t *br, unsigned int msec);
 void MSTP_IN_one_second(bridge_t *br);
+unsigned int MSTP_IN_get_tick_interval(bridge_t *br);
 void MSTP_IN_all_fids_flushed(per_tree_port_t *ptp);
 void MSTP_IN_rx_bpdu(port_t *prt, bpdu_t *bpdu, int size);
+bool MSTP_IN_rx_bpdu_admit(port_t *prt);
+void MSTP_IN_rx_batch_begin(bridge_t *br);
+void MSTP_IN_rx_batch_end(bridge_t *br);
 
 bool MSTP_IN_set_vid2fid(bridge_t *br, __u16 vid, __u16 fid);
 bool MSTP_IN_set_all_vids2fids(bridge_t *br, __u16 *vids2fids);
 bool MSTP_IN_set_fid2mstid(bridge_t *br, __u16 fid, __u16 mstid);
 bool MSTP_IN_set_all_fids2mstids(bridge_t *br, __u16 *fids2mstids);
+void MSTP_IN_get_all_vids2fids(bridge_t *br, __u16 *vids2fids);
+void MSTP_IN_get_all_fids2mstids(bridge_t *br, __u16 *fids2mstids);
+bool MSTP_IN_begin_vlan_map(bridge_t *br);
+void MSTP_IN_commit_vlan_map(bridge_t *br);
 bool MSTP_IN_get_mstilist(bridge_t *br, int *num_mstis, __u16 *mstids);
 bool MSTP_IN_create_msti(bridge_t *br, __u16 mstid);
 bool MSTP_IN_delete_msti(bridge_t *br, __u16 mstid);
@@ -585,6 +1015,14 @@ void MSTP_OUT_flush_all_fids(per_tree_port_t *ptp);
 void MSTP_OUT_set_ageing_time(port_t *prt, unsigned int ageingTime);
 void MSTP_OUT_tx_bpdu(port_t *prt, bpdu_t *bpdu, int size);
 void MSTP_OUT_shutdown_port(port_t *prt);
+/* Ask the packet filter to drop (or stop dropping) the repeats of the last
+ * BPDU received on the port */
+void MSTP_OUT_set_rx_suppress(port_t *prt, bool suppress);
+/* Returns false if no BPDU was dropped since suppression was enabled,
+ * otherwise the age of the newest dropped one in milliseconds */
+bool MSTP_OUT_get_rx_last_seen(port_t *prt, unsigned int *age_ms);
+/* Monotonic clock in milliseconds, only differences of it are meaningful */
+unsigned int MSTP_OUT_get_time_ms(void);
 
 /* Structures for communicating with user */
  /* 12.8.1.1 Read CIST Bridge Protocol Parameters */
@@ -612,6 +1050,10 @@ typedef struct
     unsigned int Ageing_Time;
     __u8 max_hops;
     __u8 bridge_hello_time;
+    unsigned int bridge_forward_delay_ms; /* not in standard. 0 = off */
+    unsigned int tick_interval; /* not in standard */
+    bool vlan_map_txn; /* not in standard */
+    unsigned int vlan_map_txn_time; /* not in standard */
 } CIST_BridgeStatus;
 
 void MSTP_IN_get_cist_bridge_status(bridge_t *br, CIST_BridgeStatus *status);
@@ -659,6 +1101,9 @@ typedef struct
 
     unsigned int bridge_ageing_time;
     bool set_bridge_ageing_time;
+
+    unsigned int bridge_forward_delay_ms; /* not in standard. 0 = off */
+    bool set_bridge_forward_delay_ms;
 } CIST_BridgeConfig;
 
 int MSTP_IN_set_cist_bridge_config(bridge_t *br, CIST_BridgeConfig *cfg);
@@ -682,6 +1127,7 @@ typedef struct
     port_identifier_t designated_port; /* from portPriority */
     bool tc_ack; /* tcAck */
     __u8 port_hello_time; /* from portTimes */
+    unsigned int port_hello_time_ms; /* not in standard. 0 = off */
     bool admin_edge_port;
     bool auto_edge_port; /* not in standard */
     bool oper_edge_port;
@@ -710,6 +1156,15 @@ typedef struct
     unsigned int num_tx_tcn;
     unsigned int num_trans_fwd;
     unsigned int num_trans_blk;
+    unsigned int num_tx_deferred;
+    unsigned int num_tx_coalesced;
+    unsigned int num_tx_dropped;
+    unsigned int bpdu_rx_rate; /* not in standard. 0 = no limit */
+    unsigned int bpdu_rx_burst; /* not in standard. 0 = bpdu_rx_rate */
+    rx_limit_policy_t bpdu_rx_policy; /* not in standard */
+    bool bpdu_rx_rate_error; /* not in standard */
+    unsigned int num_rx_rate_limited;
+    unsigned int num_rx_unknown_msti; /* not in standard */
     bool rcvdBpdu;
     bool rcvdRSTP;
     bool rcvdSTP;
@@ -738,6 +1193,9 @@ typedef struct
 
 void MSTP_IN_get_msti_port_status(per_tree_port_t *ptp,
                                   MSTI_PortStatus *status);
+/* Same for a port without state in a sparse MSTI (see tree_t.sparse) */
+void MSTP_IN_get_absent_msti_port_status(port_t *prt, tree_t *tree,
+                                         MSTI_PortStatus *status);
 
 /* 12.8.2.3 Set CIST port parameters */
 typedef struct
@@ -779,6 +1237,18 @@ typedef struct
 
     bool bpdu_filter_port;
     bool set_bpdu_filter_port;
+
+    unsigned int port_hello_time_ms; /* not in standard. 0 = off */
+    bool set_port_hello_time_ms;
+
+    unsigned int bpdu_rx_rate; /* not in standard. 0 = no limit */
+    bool set_bpdu_rx_rate;
+
+    unsigned int bpdu_rx_burst; /* not in standard. 0 = bpdu_rx_rate */
+    bool set_bpdu_rx_burst;
+
+    rx_limit_policy_t bpdu_rx_policy; /* not in standard */
+    bool set_bpdu_rx_policy;
 } CIST_PortConfig;
 
 int MSTP_IN_set_cist_port_config(port_t *prt, CIST_PortConfig *cfg);
@@ -794,6 +1264,9 @@ typedef struct
 } MSTI_PortConfig;
 
 int MSTP_IN_set_msti_port_config(per_tree_port_t *ptp, MSTI_PortConfig *cfg);
+/* Give a port state in a sparse MSTI (see tree_t.sparse), e.g. to configure
+ * it. Returns the existing state if the port already has it */
+per_tree_port_t *MSTP_IN_add_msti_port(port_t *prt, tree_t *tree);
 
 /* 12.8.2.5 Force BPDU Migration Check */
 int MSTP_IN_port_mcheck(port_t *prt);
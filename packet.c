@@ -13,9 +13,9 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <linux/if_packet.h>
-#include <linux/filter.h>
 #include <linux/pkt_sched.h>
 #include <asm/byteorder.h>
 
@@ -27,6 +27,110 @@
 
 static struct epoll_event_handler packet_event;
 
+/* Optional TPACKET_V3 memory-mapped receive ring.
+ * The kernel fills blocks of frames and hands over the whole block. The
+ * frames of all the filled blocks are parsed in place in one receive batch,
+ * and the blocks are returned to the kernel after it.
+ * Transmit does not use a ring: the kernel sends all pending frames of a
+ * TX ring through one interface, while the BPDUs of one main loop
+ * iteration go out through many. They are batched with sendmmsg() instead.
+ */
+#define RING_RX_BLOCK_SIZE  (1 << 14)
+#define RING_RX_BLOCK_NR    16
+#define RING_FRAME_SIZE     2048
+#define RING_RX_BLOCK_TOV   10 /* ms to retire a partially filled block */
+
+struct packet_ring
+{
+    unsigned char *map;
+    size_t map_size;
+    unsigned int block_size;
+    unsigned int nr; /* number of blocks */
+    unsigned int idx;
+};
+
+static struct packet_ring rx_ring;
+
+static int ring_setup(int s, struct tpacket_req3 *req)
+{
+    int version = TPACKET_V3;
+
+    if(setsockopt(s, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        ERROR("setsockopt PACKET_VERSION failed: %m");
+        return -1;
+    }
+    if(setsockopt(s, SOL_PACKET, PACKET_RX_RING, req, sizeof(*req)) < 0)
+    {
+        ERROR("setsockopt PACKET_RX_RING failed: %m");
+        return -1;
+    }
+    return 0;
+}
+
+static int ring_map(int s, struct packet_ring *r, unsigned int block_size,
+                    unsigned int block_nr)
+{
+    r->map_size = (size_t)block_size * block_nr;
+    r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_LOCKED, s, 0);
+    if(MAP_FAILED == r->map)
+    {
+        r->map = NULL;
+        ERROR("mmap packet ring failed: %m");
+        return -1;
+    }
+    r->block_size = block_size;
+    r->idx = 0;
+    return 0;
+}
+
+static void ring_unmap(struct packet_ring *r)
+{
+    if(r->map)
+        munmap(r->map, r->map_size);
+    r->map = NULL;
+}
+
+static int rx_ring_init(int s)
+{
+    struct tpacket_req3 req =
+    {
+        .tp_block_size = RING_RX_BLOCK_SIZE,
+        .tp_block_nr = RING_RX_BLOCK_NR,
+        .tp_frame_size = RING_FRAME_SIZE,
+        .tp_frame_nr = RING_RX_BLOCK_SIZE / RING_FRAME_SIZE * RING_RX_BLOCK_NR,
+        .tp_retire_blk_tov = RING_RX_BLOCK_TOV,
+    };
+
+    if(ring_setup(s, &req))
+        return -1;
+    if(ring_map(s, &rx_ring, RING_RX_BLOCK_SIZE, RING_RX_BLOCK_NR))
+        return -1;
+    rx_ring.nr = RING_RX_BLOCK_NR;
+    return 0;
+}
+
+/* Undo whatever a failed rx_ring_init() did, so the socket can be read
+ * with recvmmsg() */
+static void rx_ring_release(int s)
+{
+    struct tpacket_req3 req;
+    int version = TPACKET_V1;
+
+    ring_unmap(&rx_ring);
+    /* A zeroed request frees the ring, if there is one */
+    memset(&req, 0, sizeof(req));
+    setsockopt(s, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+    setsockopt(s, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+}
+
+static inline struct tpacket_block_desc *ring_block(struct packet_ring *r,
+                                                     unsigned int idx)
+{
+    return (struct tpacket_block_desc *)(r->map + idx * r->block_size);
+}
+
 #ifdef PACKET_DEBUG
 static void dump_packet(const unsigned char *buf, int cc)
 {
@@ -42,111 +146,322 @@ static void dump_packet(const unsigned char *buf, int cc)
 }
 #endif
 
+/* Per-loop-iteration transmit queue.
+ * BPDUs generated by the state machines are copied here and sent with
+ * one sendmmsg() from the idle handler (or earlier, if the queue fills up).
+ */
+#define PACKET_TX_BATCH 64
+
+struct tx_queue_entry
+{
+    struct sockaddr_ll sl;
+    int len;
+    unsigned char buf[ETH_FRAME_LEN];
+};
+
+static struct tx_queue_entry tx_queue[PACKET_TX_BATCH];
+static unsigned int tx_queue_len;
+static struct epoll_idle_handler tx_flush_handler;
+
+/* Backpressure queue.
+ * BPDUs which hit EWOULDBLOCK wait here until the socket drains (EPOLLOUT).
+ * Only the newest BPDU per port is kept: it carries the current
+ * information, an older one would be stale by the time it goes out.
+ */
+#define PACKET_TX_DEFERRED_MAX 256
+
+static struct tx_queue_entry tx_deferred[PACKET_TX_DEFERRED_MAX];
+static unsigned int tx_deferred_len;
+static bool tx_want_output;
+
+/* Send the entries with sendmmsg(). Return the number of entries which are
+ * done with (sent or failed), the rest did not fit into the socket buffer.
+ */
+static unsigned int tx_send_entries(struct tx_queue_entry *e, unsigned int n)
+{
+    struct mmsghdr msgs[PACKET_TX_BATCH];
+    struct iovec iov[PACKET_TX_BATCH];
+    unsigned int i, cnt, off = 0;
+    int r;
+
+    while(off < n)
+    {
+        cnt = n - off;
+        if(cnt > PACKET_TX_BATCH)
+            cnt = PACKET_TX_BATCH;
+        for(i = 0; i < cnt; ++i)
+        {
+            iov[i].iov_base = e[off + i].buf;
+            iov[i].iov_len = e[off + i].len;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &e[off + i].sl;
+            msgs[i].msg_hdr.msg_namelen = sizeof(e[off + i].sl);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        r = sendmmsg(packet_event.fd, msgs, cnt, MSG_DONTWAIT);
+        if(r <= 0)
+        {
+            if(r < 0 && EINTR == errno)
+                continue;
+            if(r < 0 && EWOULDBLOCK == errno)
+                break;
+            /* The first message failed, report and skip it */
+            bridge_bpdu_tx_error(e[off].sl.sll_ifindex,
+                                 (r < 0) ? errno : EIO, 0, e[off].len);
+            ++off;
+            continue;
+        }
+        for(i = 0; i < r; ++i)
+        {
+            if(msgs[i].msg_len != e[off + i].len)
+                bridge_bpdu_tx_error(e[off + i].sl.sll_ifindex, 0,
+                                     msgs[i].msg_len, e[off + i].len);
+        }
+        off += r;
+    }
+
+    return off;
+}
+
+static void tx_defer(const struct tx_queue_entry *e)
+{
+    unsigned int i;
+
+    for(i = 0; i < tx_deferred_len; ++i)
+    {
+        if(tx_deferred[i].sl.sll_ifindex == e->sl.sll_ifindex)
+        {
+            memcpy(&tx_deferred[i], e, sizeof(*e));
+            bridge_bpdu_tx_backlog(e->sl.sll_ifindex, BPDU_TX_COALESCED);
+            return;
+        }
+    }
+
+    if(PACKET_TX_DEFERRED_MAX == tx_deferred_len)
+    {
+        bridge_bpdu_tx_backlog(e->sl.sll_ifindex, BPDU_TX_DROPPED);
+        return;
+    }
+
+    memcpy(&tx_deferred[tx_deferred_len++], e, sizeof(*e));
+    bridge_bpdu_tx_backlog(e->sl.sll_ifindex, BPDU_TX_DEFERRED);
+}
+
+static void tx_deferred_flush(void)
+{
+    unsigned int done;
+
+    if(tx_deferred_len)
+    {
+        done = tx_send_entries(tx_deferred, tx_deferred_len);
+        tx_deferred_len -= done;
+        memmove(tx_deferred, tx_deferred + done,
+                tx_deferred_len * sizeof(tx_deferred[0]));
+    }
+
+    if(tx_want_output != (0 != tx_deferred_len))
+    {
+        tx_want_output = !tx_want_output;
+        epoll_want_output(&packet_event, tx_want_output);
+    }
+}
+
+static void tx_queue_flush(void)
+{
+    unsigned int i, done = 0;
+
+    /* While something is held back, new BPDUs queue up behind it,
+     * so the ports keep their order and only the newest one survives. */
+    if(!tx_deferred_len)
+        done = tx_send_entries(tx_queue, tx_queue_len);
+    for(i = done; i < tx_queue_len; ++i)
+        tx_defer(&tx_queue[i]);
+    tx_queue_len = 0;
+
+    tx_deferred_flush();
+}
+
+static void tx_flush_idle(struct epoll_idle_handler *h)
+{
+    tx_queue_flush();
+}
+
 /*
  * To send/receive Spanning Tree packets we use PF_PACKET because
  * it allows the filtering we want but gives raw data
  */
 void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len)
 {
-    int l;
-    struct sockaddr_ll sl =
+    struct tx_queue_entry *e;
+    unsigned char *data;
+    int i;
+
+    if(len > sizeof(e->buf))
     {
-        .sll_family = AF_PACKET,
-        .sll_protocol = __constant_cpu_to_be16(ETH_P_802_2),
-        .sll_ifindex = ifindex,
-        .sll_halen = ETH_ALEN,
-    };
+        ERROR("ifindex %d: BPDU too long: %d", ifindex, len);
+        return;
+    }
+
+    if(PACKET_TX_BATCH == tx_queue_len)
+        tx_queue_flush();
 
-    if(iov_count > 0 && iov[0].iov_len > ETH_ALEN)
-        memcpy(&sl.sll_addr, iov[0].iov_base, ETH_ALEN);
+    e = &tx_queue[tx_queue_len++];
+    memset(&e->sl, 0, sizeof(e->sl));
+    e->sl.sll_family = AF_PACKET;
+    e->sl.sll_protocol = __constant_cpu_to_be16(ETH_P_802_2);
+    e->sl.sll_ifindex = ifindex;
+    e->sl.sll_halen = ETH_ALEN;
 
-    struct msghdr msg =
+    data = e->buf;
+    for(i = 0; i < iov_count; ++i)
     {
-        .msg_name = &sl,
-        .msg_namelen = sizeof(sl),
-        .msg_iov = (struct iovec *)iov,
-        .msg_iovlen = iov_count,
-        .msg_control = NULL,
-        .msg_controllen = 0,
-        .msg_flags = 0,
-    };
+        memcpy(data, iov[i].iov_base, iov[i].iov_len);
+        data += iov[i].iov_len;
+    }
+    if(len > ETH_ALEN)
+        memcpy(&e->sl.sll_addr, e->buf, ETH_ALEN);
+    e->len = len;
 
 #ifdef PACKET_DEBUG
     printf("Transmit Dst index %d %02x:%02x:%02x:%02x:%02x:%02x\n",
-           sl.sll_ifindex,
-           sl.sll_addr[0], sl.sll_addr[1], sl.sll_addr[2],
-           sl.sll_addr[3], sl.sll_addr[4], sl.sll_addr[5]);
-    {
-        int i;
-        for(i = 0; i < iov_count; ++i)
-            dump_packet(iov[i].iov_base, iov[i].iov_len);
-    }
+           e->sl.sll_ifindex,
+           e->sl.sll_addr[0], e->sl.sll_addr[1], e->sl.sll_addr[2],
+           e->sl.sll_addr[3], e->sl.sll_addr[4], e->sl.sll_addr[5]);
+    dump_packet(e->buf, len);
 #endif
+}
+
+/* Maximum number of packets fetched with one recvmmsg() */
+#define PACKET_RX_BATCH 32
+#define PACKET_RX_BUFSIZE 2048
 
-    l = sendmsg(packet_event.fd, &msg, 0);
+static void packet_rcv(uint32_t events, struct epoll_event_handler *h)
+{
+    static unsigned char buf[PACKET_RX_BATCH][PACKET_RX_BUFSIZE];
+    struct sockaddr_ll sl[PACKET_RX_BATCH];
+    struct iovec iov[PACKET_RX_BATCH];
+    struct mmsghdr msgs[PACKET_RX_BATCH];
+    int i, cnt;
 
-    if(l < 0)
+    if(events & EPOLLOUT)
     {
-        if(errno != EWOULDBLOCK)
-            ERROR("send failed: %m");
+        /* Socket has drained, send held back BPDUs */
+        tx_deferred_flush();
+        if(!(events & ~EPOLLOUT))
+            return;
     }
-    else if(l != len)
-        ERROR("short write in sendto: %d instead of %d", l, len);
+
+    bridge_bpdu_rcv_batch_begin();
+
+    do
+    {
+        for(i = 0; i < PACKET_RX_BATCH; ++i)
+        {
+            iov[i].iov_base = buf[i];
+            iov[i].iov_len = PACKET_RX_BUFSIZE;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_name = &sl[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sl[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        cnt = recvmmsg(h->fd, msgs, PACKET_RX_BATCH, MSG_DONTWAIT, NULL);
+        if(cnt <= 0)
+        {
+            if(cnt < 0 && errno != EWOULDBLOCK && errno != EINTR)
+                ERROR("recvmmsg failed: %m");
+            break;
+        }
+
+        for(i = 0; i < cnt; ++i)
+        {
+            if(0 == msgs[i].msg_len)
+                continue;
+#ifdef PACKET_DEBUG
+            printf("Receive Src ifindex %d %02x:%02x:%02x:%02x:%02x:%02x\n",
+                   sl[i].sll_ifindex,
+                   sl[i].sll_addr[0], sl[i].sll_addr[1], sl[i].sll_addr[2],
+                   sl[i].sll_addr[3], sl[i].sll_addr[4], sl[i].sll_addr[5]);
+
+            dump_packet(buf[i], msgs[i].msg_len);
+#endif
+            bridge_bpdu_rcv(sl[i].sll_ifindex, buf[i], msgs[i].msg_len);
+        }
+    } while(PACKET_RX_BATCH == cnt);
+
+    bridge_bpdu_rcv_batch_end();
 }
 
-static void packet_rcv(uint32_t events, struct epoll_event_handler *h)
+static void packet_rcv_ring(uint32_t events, struct epoll_event_handler *h)
 {
-    int cc;
-    unsigned char buf[2048];
-    struct sockaddr_ll sl;
-    socklen_t salen = sizeof sl;
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ph;
+    struct sockaddr_ll *sl;
+    unsigned int i, n;
 
-    cc = recvfrom(h->fd, &buf, sizeof(buf), 0, (struct sockaddr *) &sl, &salen);
-    if(cc <= 0)
+    if(events & EPOLLOUT)
     {
-        ERROR("recvfrom failed: %m");
-        return;
+        /* Socket has drained, send held back BPDUs */
+        tx_deferred_flush();
+        if(!(events & ~EPOLLOUT))
+            return;
     }
 
+    bridge_bpdu_rcv_batch_begin();
+
+    /* The frames are passed on right from the ring: the receive path reads
+     * no further than the length of the frame and does not write to it */
+    for(n = 0; n < rx_ring.nr; ++n)
+    {
+        bd = ring_block(&rx_ring, (rx_ring.idx + n) % rx_ring.nr);
+        if(!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+        __sync_synchronize();
+
+        ph = (struct tpacket3_hdr *)((unsigned char *)bd
+                                     + bd->hdr.bh1.offset_to_first_pkt);
+        for(i = 0; i < bd->hdr.bh1.num_pkts; ++i)
+        {
+            sl = (struct sockaddr_ll *)((unsigned char *)ph
+                                        + TPACKET_ALIGN(sizeof(*ph)));
 #ifdef PACKET_DEBUG
-    printf("Receive Src ifindex %d %02x:%02x:%02x:%02x:%02x:%02x\n",
-           sl.sll_ifindex,
-           sl.sll_addr[0], sl.sll_addr[1], sl.sll_addr[2],
-           sl.sll_addr[3], sl.sll_addr[4], sl.sll_addr[5]);
+            printf("Receive Src ifindex %d %02x:%02x:%02x:%02x:%02x:%02x\n",
+                   sl->sll_ifindex,
+                   sl->sll_addr[0], sl->sll_addr[1], sl->sll_addr[2],
+                   sl->sll_addr[3], sl->sll_addr[4], sl->sll_addr[5]);
 
-    dump_packet(buf, cc);
+            dump_packet((unsigned char *)ph + ph->tp_mac, ph->tp_snaplen);
 #endif
+            bridge_bpdu_rcv(sl->sll_ifindex, (unsigned char *)ph + ph->tp_mac,
+                            ph->tp_snaplen);
+            ph = (struct tpacket3_hdr *)((unsigned char *)ph
+                                         + ph->tp_next_offset);
+        }
+    }
 
-    bridge_bpdu_rcv(sl.sll_ifindex, buf, cc);
-}
+    bridge_bpdu_rcv_batch_end();
 
-/* Berkeley Packet filter code to filter out spanning tree packets.
-   from tcpdump -s 1152 -dd stp
- */
-static struct sock_filter stp_filter[] = {
-    { 0x28, 0, 0, 0x0000000c },
-    { 0x25, 3, 0, 0x000005dc },
-    { 0x30, 0, 0, 0x0000000e },
-    { 0x15, 0, 1, 0x00000042 },
-    { 0x6, 0, 0, 0x00000480 },
-    { 0x6, 0, 0, 0x00000000 },
-};
+    /* Return the blocks of the batch */
+    __sync_synchronize();
+    for(i = 0; i < n; ++i)
+        ring_block(&rx_ring, (rx_ring.idx + i) % rx_ring.nr)
+            ->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    rx_ring.idx = (rx_ring.idx + n) % rx_ring.nr;
+}
 
 /*
  * Open up a raw packet socket to catch all 802.2 packets.
- * and install a packet filter to only see STP (SAP 42)
+ * and install a packet filter to only see BPDUs (see packet_filter.c)
  *
  * Since any bridged devices are already in promiscious mode
  * no need to add multicast address.
  */
-int packet_sock_init(void)
+int packet_sock_init(bool mmap_rings, bool rx_suppress)
 {
     int s;
-    struct sock_fprog prog =
-    {
-        .len = sizeof(stp_filter) / sizeof(stp_filter[0]),
-        .filter = stp_filter,
-    };
 
     s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_802_2));
     if(s < 0)
@@ -155,7 +470,26 @@ int packet_sock_init(void)
         return -1;
     }
 
-    if(setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+    packet_event.fd = s;
+    packet_event.handler = packet_rcv;
+
+    /* The ring first, so that falling back to recvmmsg() keeps the socket
+     * and the filter is attached once */
+    if(mmap_rings)
+    {
+        if(0 == rx_ring_init(s))
+        {
+            packet_event.handler = packet_rcv_ring;
+            INFO("Using TPACKET_V3 packet ring");
+        }
+        else
+        {
+            rx_ring_release(s);
+            ERROR("Packet ring unavailable, falling back to recvmmsg");
+        }
+    }
+
+    if(packet_filter_attach(s, rx_suppress) < 0)
         ERROR("setsockopt packet filter failed: %m");
     else if(fcntl(s, F_SETFL, O_NONBLOCK) < 0)
         ERROR("fcntl set nonblock failed: %m");
@@ -166,13 +500,15 @@ int packet_sock_init(void)
         if(setsockopt(s, SOL_SOCKET, SO_PRIORITY, &prio, sizeof(prio)) < 0)
             ERROR("setsockopt priority failed, BPDU delivery may be unreliable: %m");
 
-        packet_event.fd = s;
-        packet_event.handler = packet_rcv;
-
         if(0 == add_epoll(&packet_event))
+        {
+            tx_flush_handler.handler = tx_flush_idle;
+            add_epoll_idle(&tx_flush_handler);
             return 0;
+        }
     }
 
+    ring_unmap(&rx_ring);
     close(s);
     return -1;
 }
@@ -10,8 +10,31 @@
 #define PACKET_SOCK_H
 
 #include <sys/uio.h>
+#include <stdbool.h>
+#include <linux/types.h>
 
 void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len);
-int packet_sock_init(void);
+int packet_sock_init(bool mmap_rings, bool rx_suppress);
+
+/* Counters of the socket filter, only maintained by the eBPF filter */
+typedef struct
+{
+    bool ebpf; /* eBPF filter keyed on the managed ports is in use */
+    __u64 accepted;
+    __u64 drop_unmanaged; /* not from a port of a known bridge */
+    __u64 drop_address;   /* not sent to the bridge group address */
+    __u64 drop_llc;       /* bad 802.3 length or LLC header */
+    __u64 drop_protocol;  /* bad BPDU protocolIdentifier */
+    __u64 suppressed;     /* repeated BPDU dropped on daemon's request */
+} packet_filter_stats_t;
+
+int packet_filter_attach(int sock, bool suppress);
+void packet_filter_add_if(int ifindex);
+void packet_filter_del_if(int ifindex);
+int packet_filter_get_stats(packet_filter_stats_t *stats);
+bool packet_filter_suppressing(void);
+__u64 packet_filter_hash(const unsigned char *bpdu, unsigned int len);
+void packet_filter_set_suppress(int ifindex, __u64 hash, bool suppress);
+int packet_filter_last_seen(int ifindex, unsigned int *age_ms);
 
 #endif /* PACKET_SOCK_H */
@@ -0,0 +1,533 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*****************************************************************************
+  Socket filter for the BPDU packet socket.
+
+  The preferred filter is an eBPF program which only accepts frames from
+  the interfaces mstpd manages (kept in a hash map updated from
+  bridge_track.c) and validates the group address, the LLC header and the
+  BPDU protocolIdentifier, counting the drops per reason in an array map.
+  Where eBPF is not available, a classic BPF program does the same header
+  checks, but cannot filter on the ports and does not count.
+
+  Optionally the eBPF program also hashes every accepted BPDU and, for the
+  ports where the daemon asked for it, drops the repeats of the last
+  processed BPDU, remembering when it last did (see the suppression in
+  mstp.c). The hash is computed by the same algorithm in packet_filter_hash().
+
+******************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+
+#include "packet.h"
+#include "log.h"
+
+/* Frames longer than this are not BPDUs, trim anything else to it */
+#define FILTER_SNAPLEN          0x480
+#define FILTER_MAX_PORTS        4096
+
+enum
+{
+    FILTER_ACCEPTED,
+    FILTER_DROP_UNMANAGED,
+    FILTER_DROP_ADDRESS,
+    FILTER_DROP_LLC,
+    FILTER_DROP_PROTOCOL,
+    FILTER_SUPPRESSED,
+    FILTER_NUM_COUNTERS
+};
+
+/* Value of the ifindex map */
+struct filter_port
+{
+    __u64 hash;      /* of the last BPDU accepted or suppressed */
+    __u64 last_seen; /* CLOCK_MONOTONIC ns of the last suppressed BPDU */
+    __u32 suppress;  /* drop the BPDUs with this hash */
+    __u32 pad;
+};
+
+/* Multiplier of the BPDU hash, sign extended to 64 bits by eBPF */
+#define HASH_MULT   ((__s32)0x9e3779b1)
+
+static int ifmap_fd = -1;
+static int stats_fd = -1;
+static bool suppressing;
+
+/* Classic BPF program, used when the eBPF one can not be loaded:
+ *   dst == 01:80:C2:00:00:00, 3 <= len8023 <= 1500,
+ *   DSAP == SSAP == 0x42, UI frame, protocolIdentifier == 0
+ */
+static struct sock_filter stp_filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0180c200, 0, 15),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0000, 0, 13),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, ETH_DATA_LEN, 11, 0),
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 3, 0, 10),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 14),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x42, 0, 8),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 15),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x42, 0, 6),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 16),
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x03),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x03, 0, 3),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 17),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0000, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, FILTER_SNAPLEN),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int bpf_create_map(enum bpf_map_type type, int key_size,
+                          int value_size, int max_entries)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+/* eBPF program assembler, just enough for the filter below */
+enum
+{
+    L_COUNT,
+    L_OUT,
+    L_PASS,
+    L_WORD,
+    L_BYTES,
+    L_BYTE,
+    L_HASHED,
+    L_CHANGED,
+    L_NUM_LABELS
+};
+
+struct bpf_asm
+{
+    struct bpf_insn insns[128];
+    int n;
+    int labels[L_NUM_LABELS];
+    /* jump instructions which need the offset of a label */
+    struct { int insn, label; } fixups[48];
+    int nfixups;
+};
+
+static void emit(struct bpf_asm *a, __u8 code, __u8 dst, __u8 src,
+                 __s16 off, __s32 imm)
+{
+    struct bpf_insn *insn = &a->insns[a->n++];
+
+    memset(insn, 0, sizeof(*insn));
+    insn->code = code;
+    insn->dst_reg = dst;
+    insn->src_reg = src;
+    insn->off = off;
+    insn->imm = imm;
+}
+
+static void emit_jmp(struct bpf_asm *a, __u8 op, __u8 dst, __s32 imm,
+                     int label)
+{
+    a->fixups[a->nfixups].insn = a->n;
+    a->fixups[a->nfixups++].label = label;
+    emit(a, BPF_JMP | op | BPF_K, dst, 0, 0, imm);
+}
+
+static void emit_jmp_reg(struct bpf_asm *a, __u8 op, __u8 dst, __u8 src,
+                         int label)
+{
+    a->fixups[a->nfixups].insn = a->n;
+    a->fixups[a->nfixups++].label = label;
+    emit(a, BPF_JMP | op | BPF_X, dst, src, 0, 0);
+}
+
+static void emit_ld_map_fd(struct bpf_asm *a, __u8 dst, int fd)
+{
+    emit(a, BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+    emit(a, 0, 0, 0, 0, 0);
+}
+
+static void set_label(struct bpf_asm *a, int label)
+{
+    a->labels[label] = a->n;
+}
+
+static void resolve_labels(struct bpf_asm *a)
+{
+    int i;
+
+    for(i = 0; i < a->nfixups; ++i)
+        a->insns[a->fixups[i].insn].off =
+            a->labels[a->fixups[i].label] - a->fixups[i].insn - 1;
+}
+
+/* Check frame header with LD_ABS (result in r0), on mismatch jump to count */
+#define CHECK(size, offset, op, value) do {                             \
+        emit(&a, BPF_LD | (size) | BPF_ABS, 0, 0, 0, (offset));         \
+        emit_jmp(&a, (op), BPF_REG_0, (value), L_COUNT);                \
+    } while(0)
+
+/* Hash the BPDU into r7 and drop it if the daemon is suppressing its
+ * repeats on this port. Loops need a 5.3+ kernel.
+ */
+static void emit_suppress(struct bpf_asm *a)
+{
+    /* r7 = hash, r8 = offset, r9 = end of the BPDU - 4 */
+    emit(a, BPF_LD | BPF_H | BPF_ABS, 0, 0, 0, 12);
+    emit_jmp(a, BPF_JGT, BPF_REG_0, ETH_DATA_LEN, L_PASS);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_9, BPF_REG_0, 0, 0);
+    emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_9, 0, 0, ETH_HLEN - 4);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_8, 0, 0, ETH_HLEN + 3);
+
+    set_label(a, L_WORD);
+    emit_jmp_reg(a, BPF_JGT, BPF_REG_8, BPF_REG_9, L_BYTES);
+    emit(a, BPF_LD | BPF_W | BPF_IND, 0, BPF_REG_8, 0, 0);
+    emit(a, BPF_ALU64 | BPF_XOR | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0);
+    emit(a, BPF_ALU64 | BPF_MUL | BPF_K, BPF_REG_7, 0, 0, HASH_MULT);
+    emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_8, 0, 0, 4);
+    emit_jmp(a, BPF_JA, 0, 0, L_WORD);
+
+    set_label(a, L_BYTES);
+    emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_9, 0, 0, 4);
+    set_label(a, L_BYTE);
+    emit_jmp_reg(a, BPF_JGE, BPF_REG_8, BPF_REG_9, L_HASHED);
+    emit(a, BPF_LD | BPF_B | BPF_IND, 0, BPF_REG_8, 0, 0);
+    emit(a, BPF_ALU64 | BPF_XOR | BPF_X, BPF_REG_7, BPF_REG_0, 0, 0);
+    emit(a, BPF_ALU64 | BPF_MUL | BPF_K, BPF_REG_7, 0, 0, HASH_MULT);
+    emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_8, 0, 0, 1);
+    emit_jmp(a, BPF_JA, 0, 0, L_BYTE);
+
+    /* The key is still on the stack from the first lookup */
+    set_label(a, L_HASHED);
+    emit_ld_map_fd(a, BPF_REG_1, ifmap_fd);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+    emit(a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4);
+    emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+    emit_jmp(a, BPF_JEQ, BPF_REG_0, 0, L_PASS);
+    emit(a, BPF_LDX | BPF_MEM | BPF_DW, BPF_REG_1, BPF_REG_0,
+         offsetof(struct filter_port, hash), 0);
+    emit(a, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_0, BPF_REG_7,
+         offsetof(struct filter_port, hash), 0);
+    emit_jmp_reg(a, BPF_JNE, BPF_REG_1, BPF_REG_7, L_CHANGED);
+    emit(a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_0,
+         offsetof(struct filter_port, suppress), 0);
+    emit_jmp(a, BPF_JEQ, BPF_REG_1, 0, L_PASS);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_9, BPF_REG_0, 0, 0);
+    emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_ktime_get_ns);
+    emit(a, BPF_STX | BPF_MEM | BPF_DW, BPF_REG_9, BPF_REG_0,
+         offsetof(struct filter_port, last_seen), 0);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, FILTER_SUPPRESSED);
+    emit(a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_8, 0, 0, 0);
+    emit_jmp(a, BPF_JA, 0, 0, L_COUNT);
+
+    /* A different BPDU, the daemon has to see it */
+    set_label(a, L_CHANGED);
+    emit(a, BPF_ST | BPF_MEM | BPF_W, BPF_REG_0, 0,
+         offsetof(struct filter_port, suppress), 0);
+}
+
+static int load_ebpf_filter(bool suppress)
+{
+    struct bpf_asm a;
+    union bpf_attr attr;
+    char bpf_log[4096];
+    int fd;
+
+    memset(&a, 0, sizeof(a));
+
+    /* r6 = ctx (needed by LD_ABS), r7 = counter index, r8 = return value */
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_8, 0, 0, 0);
+
+    /* Is skb->ifindex one of our ports? */
+    emit(&a, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6,
+         offsetof(struct __sk_buff, ifindex), 0);
+    emit(&a, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_2, -4, 0);
+    emit_ld_map_fd(&a, BPF_REG_1, ifmap_fd);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+    emit(&a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4);
+    emit(&a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0,
+         FILTER_DROP_UNMANAGED);
+    emit_jmp(&a, BPF_JEQ, BPF_REG_0, 0, L_COUNT);
+
+    /* Bridge group address */
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, FILTER_DROP_ADDRESS);
+    CHECK(BPF_W, 0, BPF_JNE, 0x0180c200);
+    CHECK(BPF_H, 4, BPF_JNE, 0x0000);
+
+    /* 802.3 length and LLC header */
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, FILTER_DROP_LLC);
+    CHECK(BPF_H, 12, BPF_JGT, ETH_DATA_LEN);
+    emit_jmp(&a, BPF_JLT, BPF_REG_0, 3, L_COUNT);
+    CHECK(BPF_B, 14, BPF_JNE, 0x42);
+    CHECK(BPF_B, 15, BPF_JNE, 0x42);
+    emit(&a, BPF_LD | BPF_B | BPF_ABS, 0, 0, 0, 16);
+    emit(&a, BPF_ALU | BPF_AND | BPF_K, BPF_REG_0, 0, 0, 0x03);
+    emit_jmp(&a, BPF_JNE, BPF_REG_0, 0x03, L_COUNT);
+
+    /* BPDU protocolIdentifier */
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, FILTER_DROP_PROTOCOL);
+    CHECK(BPF_H, 17, BPF_JNE, 0x0000);
+
+    if(suppress)
+        emit_suppress(&a);
+
+    set_label(&a, L_PASS);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_7, 0, 0, FILTER_ACCEPTED);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_8, 0, 0, FILTER_SNAPLEN);
+
+    /* ++stats[r7]; return r8; */
+    set_label(&a, L_COUNT);
+    emit(&a, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_7, -8, 0);
+    emit_ld_map_fd(&a, BPF_REG_1, stats_fd);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+    emit(&a, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -8);
+    emit(&a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+    emit_jmp(&a, BPF_JEQ, BPF_REG_0, 0, L_OUT);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1);
+    emit(&a, BPF_STX | BPF_XADD | BPF_DW, BPF_REG_0, BPF_REG_1, 0, 0);
+    set_label(&a, L_OUT);
+    emit(&a, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_0, BPF_REG_8, 0, 0);
+    emit(&a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+    resolve_labels(&a);
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+    attr.insns = (unsigned long)a.insns;
+    attr.insn_cnt = a.n;
+    attr.license = (unsigned long)"GPL";
+    if(0 <= (fd = sys_bpf(BPF_PROG_LOAD, &attr)))
+        return fd;
+
+    /* Load it again for the verifier log, which could overflow on the
+     * hash loop if always requested */
+    bpf_log[0] = 0;
+    attr.log_buf = (unsigned long)bpf_log;
+    attr.log_size = sizeof(bpf_log);
+    attr.log_level = 1;
+    fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    LOG("eBPF verifier: %s", bpf_log);
+    return fd;
+}
+
+static int attach_ebpf_filter(int sock, bool suppress)
+{
+    int prog_fd;
+
+    ifmap_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(__u32),
+                              sizeof(struct filter_port), FILTER_MAX_PORTS);
+    if(ifmap_fd < 0)
+        goto err;
+    stats_fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(__u32),
+                              sizeof(__u64), FILTER_NUM_COUNTERS);
+    if(stats_fd < 0)
+        goto err;
+
+    if(suppress)
+    {
+        if(0 <= (prog_fd = load_ebpf_filter(true)))
+            suppressing = true;
+        else
+            INFO("eBPF filter can not suppress repeated BPDUs (%m)");
+    }
+    if(!suppressing && ((prog_fd = load_ebpf_filter(false)) < 0))
+        goto err;
+    if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_BPF, &prog_fd, sizeof(prog_fd)))
+    {
+        close(prog_fd);
+        suppressing = false;
+        goto err;
+    }
+    /* The socket holds a reference to the program */
+    close(prog_fd);
+    return 0;
+
+err:
+    INFO("eBPF socket filter unavailable (%m), using classic filter");
+    if(0 <= ifmap_fd)
+        close(ifmap_fd);
+    if(0 <= stats_fd)
+        close(stats_fd);
+    ifmap_fd = stats_fd = -1;
+    return -1;
+}
+
+int packet_filter_attach(int sock, bool suppress)
+{
+    struct sock_fprog prog =
+    {
+        .len = sizeof(stp_filter) / sizeof(stp_filter[0]),
+        .filter = stp_filter,
+    };
+
+    if(0 == attach_ebpf_filter(sock, suppress))
+        return 0;
+
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+void packet_filter_add_if(int ifindex)
+{
+    union bpf_attr attr;
+    __u32 key = ifindex;
+    struct filter_port value;
+
+    if(ifmap_fd < 0)
+        return;
+
+    memset(&value, 0, sizeof(value));
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = ifmap_fd;
+    attr.key = (unsigned long)&key;
+    attr.value = (unsigned long)&value;
+    attr.flags = BPF_ANY;
+    if(sys_bpf(BPF_MAP_UPDATE_ELEM, &attr))
+        ERROR("Couldn't add ifindex %d to the packet filter: %m", ifindex);
+}
+
+void packet_filter_del_if(int ifindex)
+{
+    union bpf_attr attr;
+    __u32 key = ifindex;
+
+    if(ifmap_fd < 0)
+        return;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = ifmap_fd;
+    attr.key = (unsigned long)&key;
+    if(sys_bpf(BPF_MAP_DELETE_ELEM, &attr) && (ENOENT != errno))
+        ERROR("Couldn't remove ifindex %d from the packet filter: %m",
+              ifindex);
+}
+
+int packet_filter_get_stats(packet_filter_stats_t *stats)
+{
+    __u64 *counters[FILTER_NUM_COUNTERS] =
+    {
+        [FILTER_ACCEPTED] = &stats->accepted,
+        [FILTER_DROP_UNMANAGED] = &stats->drop_unmanaged,
+        [FILTER_DROP_ADDRESS] = &stats->drop_address,
+        [FILTER_DROP_LLC] = &stats->drop_llc,
+        [FILTER_DROP_PROTOCOL] = &stats->drop_protocol,
+        [FILTER_SUPPRESSED] = &stats->suppressed,
+    };
+    union bpf_attr attr;
+    __u32 key;
+
+    memset(stats, 0, sizeof(*stats));
+    if(stats_fd < 0)
+        return 0;
+
+    stats->ebpf = true;
+    for(key = 0; key < FILTER_NUM_COUNTERS; ++key)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = stats_fd;
+        attr.key = (unsigned long)&key;
+        attr.value = (unsigned long)counters[key];
+        if(sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr))
+        {
+            ERROR("Couldn't read packet filter counter %u: %m", key);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+bool packet_filter_suppressing(void)
+{
+    return suppressing;
+}
+
+/* Must match the hash computed by emit_suppress(), bpdu points right after
+ * the LLC header and len is the 802.3 length. */
+__u64 packet_filter_hash(const unsigned char *bpdu, unsigned int len)
+{
+    __u64 h = len;
+    unsigned int i;
+
+    len -= 3;
+    for(i = 0; i + 4 <= len; i += 4)
+    {
+        h ^= ((__u32)bpdu[i] << 24) | ((__u32)bpdu[i + 1] << 16)
+             | ((__u32)bpdu[i + 2] << 8) | bpdu[i + 3];
+        h *= (__u64)(__s64)HASH_MULT;
+    }
+    for(; i < len; ++i)
+    {
+        h ^= bpdu[i];
+        h *= (__u64)(__s64)HASH_MULT;
+    }
+    return h;
+}
+
+/* Start dropping the BPDUs with the given hash on the port, or stop it.
+ * Whatever the filter saw since is forgotten: if that was a different
+ * BPDU, it is on its way to the daemon, which will stop suppression. */
+void packet_filter_set_suppress(int ifindex, __u64 hash, bool suppress)
+{
+    union bpf_attr attr;
+    __u32 key = ifindex;
+    struct filter_port value;
+
+    if(!suppressing)
+        return;
+
+    memset(&value, 0, sizeof(value));
+    value.hash = hash;
+    value.suppress = suppress;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = ifmap_fd;
+    attr.key = (unsigned long)&key;
+    attr.value = (unsigned long)&value;
+    attr.flags = BPF_EXIST;
+    if(sys_bpf(BPF_MAP_UPDATE_ELEM, &attr))
+        ERROR("Couldn't set BPDU suppression for ifindex %d: %m", ifindex);
+}
+
+/* Returns -1 if nothing was suppressed on the port, otherwise the time in
+ * milliseconds since the filter last dropped a BPDU. */
+int packet_filter_last_seen(int ifindex, unsigned int *age_ms)
+{
+    union bpf_attr attr;
+    __u32 key = ifindex;
+    struct filter_port value;
+    struct timespec now;
+    __u64 now_ns;
+
+    if(!suppressing)
+        return -1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = ifmap_fd;
+    attr.key = (unsigned long)&key;
+    attr.value = (unsigned long)&value;
+    if(sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr) || !value.last_seen)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ns = (__u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    *age_ms = (now_ns > value.last_seen) ?
+                  (now_ns - value.last_seen) / 1000000 : 0;
+    return 0;
+}
@@ -0,0 +1,330 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "common.h"
+
+/* mstp.c is built in, so the benchmark reaches the static comparisons */
+#include "../mstp.c"
+
+/* Micro-benchmark of betterorsamePriority() and samePriorityAndTimers()
+ * alone. A bridge with many ports and MSTIs receives MST BPDUs from as many
+ * designated bridges, then the comparisons updtRolesTree() makes are run
+ * over the priority vectors of all its trees: each port priority vector
+ * against the designated priority vector of the port, and against the port
+ * priority vector of the next port. This is done once with the comparison
+ * of the big-endian fields one by one, which the keys replaced, and once
+ * with the keys.
+ */
+
+#define NUM_PORTS       1024
+#define NUM_MSTIS       8
+#define NUM_ROUNDS      200
+
+typedef struct
+{
+    port_priority_vector_t *vec1, *vec2;
+    times_t *time1, *time2;
+    port_identifier_t pId1, pId2;
+    bool cist;
+} vector_pair_t;
+
+static vector_pair_t *pairs;
+static int num_pairs;
+
+/* The comparisons before the keys, for reference */
+static bool fieldSamePriorityAndTimers(port_priority_vector_t *vec1,
+                                       port_priority_vector_t *vec2,
+                                       times_t *time1,
+                                       times_t *time2,
+                                       bool cist)
+{
+    if(cist)
+    {
+        if(cmp(time1->Forward_Delay, !=, time2->Forward_Delay))
+            return false;
+        if(cmp(time1->Max_Age, !=, time2->Max_Age))
+            return false;
+        if(cmp(time1->Message_Age, !=, time2->Message_Age))
+            return false;
+        if(cmp(time1->Hello_Time, !=, time2->Hello_Time))
+            return false;
+
+        if(cmp(vec1->RootID, !=, vec2->RootID))
+            return false;
+        if(cmp(vec1->ExtRootPathCost, !=, vec2->ExtRootPathCost))
+            return false;
+    }
+
+    if(cmp(time1->remainingHops, !=, time2->remainingHops))
+        return false;
+
+    if(cmp(vec1->RRootID, !=, vec2->RRootID))
+        return false;
+    if(cmp(vec1->IntRootPathCost, !=, vec2->IntRootPathCost))
+        return false;
+    if(cmp(vec1->DesignatedBridgeID, !=, vec2->DesignatedBridgeID))
+        return false;
+    if(cmp(vec1->DesignatedPortID, !=, vec2->DesignatedPortID))
+        return false;
+
+    return true;
+}
+
+static bool fieldBetterorsamePriority(port_priority_vector_t *vec1,
+                                      port_priority_vector_t *vec2,
+                                      port_identifier_t pId1,
+                                      port_identifier_t pId2,
+                                      bool cist)
+{
+    int result;
+
+    if(cist)
+    {
+        if(0 < (result = _ncmp(vec1->RootID, vec2->RootID)))
+            return false; /* worse */
+        else if(0 > result)
+            return true; /* better */
+        /* The same. Check further. */
+        if(0 < (result = _ncmp(vec1->ExtRootPathCost, vec2->ExtRootPathCost)))
+            return false; /* worse */
+        else if(0 > result)
+            return true; /* better */
+        /* The same. Check further. */
+    }
+
+    if(0 < (result = _ncmp(vec1->RRootID, vec2->RRootID)))
+        return false; /* worse */
+    else if(0 > result)
+        return true; /* better */
+    /* The same. Check further. */
+
+    if(0 < (result = _ncmp(vec1->IntRootPathCost, vec2->IntRootPathCost)))
+        return false; /* worse */
+    else if(0 > result)
+        return true; /* better */
+    /* The same. Check further. */
+
+    if(0 < (result = _ncmp(vec1->DesignatedBridgeID, vec2->DesignatedBridgeID)))
+        return false; /* worse */
+    else if(0 > result)
+        return true; /* better */
+    /* The same. Check further. */
+
+    if(0 < (result = _ncmp(vec1->DesignatedPortID, vec2->DesignatedPortID)))
+        return false; /* worse */
+    else if(0 > result)
+        return true; /* better */
+    /* The same. Check further. */
+
+    /* Port ID is a tie-breaker */
+    return cmp(pId1, <=, pId2);
+}
+
+static double elapsed_ns(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9
+           + (end.tv_nsec - start->tv_nsec);
+}
+
+/* An MST BPDU of the designated bridge on the other end of port, all the
+ * bridges agree on the roots and differ in their costs and identifiers */
+static void make_bpdu(bpdu_t *b, bridge_t *br, int port)
+{
+    msti_configuration_message_t *msg;
+    unsigned int cost = 20000 * (1 + port % 4);
+    int i;
+
+    memset(b, 0, sizeof(*b));
+    b->protocolVersion = protoMSTP;
+    b->bpduType = bpduTypeRST;
+    b->flags = BPDU_FLAGS_ROLE_SET(encodedRoleDesignated)
+               | (1 << offsetLearnig) | (1 << offsetForwarding);
+    b->cistRootID.u = __cpu_to_be64(0x1000000000000001ull);
+    b->cistExtRootPathCost = __cpu_to_be32(cost);
+    b->cistRRootID.u = __cpu_to_be64(0x1000000000000001ull);
+    b->cistPortID = __cpu_to_be16(0x8001 + port % 16);
+    b->MaxAge[0] = 20;
+    b->HelloTime[0] = 2;
+    b->ForwardDelay[0] = 15;
+    assign(b->mstConfigurationIdentifier, br->MstConfigId);
+    b->cistIntRootPathCost = __cpu_to_be32(cost);
+    b->cistBridgeID.u = __cpu_to_be64(0x8000000000001000ull + port / 2);
+    b->cistRemainingHops = 20;
+    for(i = 0; i < NUM_MSTIS; i++)
+    {
+        msg = &b->mstConfiguration[i];
+        msg->flags = BPDU_FLAGS_ROLE_SET(encodedRoleDesignated)
+                     | (1 << offsetLearnig) | (1 << offsetForwarding);
+        msg->mstiRRootID.u = __cpu_to_be64(0x1000000000000001ull
+                                           | ((__u64)(i + 1) << 48));
+        msg->mstiIntRootPathCost = __cpu_to_be32(cost);
+        msg->bridgeIdentifierPriority = 0x80;
+        msg->portIdentifierPriority = 0x80;
+        msg->remainingHops = 20;
+    }
+    b->version3_len = __cpu_to_be16(MST_BPDU_VER3LEN_WO_MSTI_MSGS
+                                    + NUM_MSTIS * sizeof(*msg));
+}
+
+static int prepare_tree(void **state)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+    static port_t *p[NUM_PORTS];
+    static bpdu_t b;
+    per_tree_port_t *ptp, *prev;
+    vector_pair_t *pair;
+    bridge_t *br;
+    tree_t *tree;
+    int i;
+
+    if(prepare_test(state))
+        return -1;
+    assert_int_equal(alloc_bridge_ports(state, &br, "br0", 0x200000000001,
+                                        &p, NUM_PORTS), 0);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br, &cfg), 0);
+    for(i = 1; i <= NUM_MSTIS; i++)
+    {
+        assert_true(MSTP_IN_create_msti(br, i));
+        assert_true(MSTP_IN_set_fid2mstid(br, i, i));
+        assert_true(MSTP_IN_set_vid2fid(br, i, i));
+    }
+    MSTP_IN_set_bridge_enable(br, true);
+    for(i = 0; i < NUM_PORTS; i++)
+    {
+        set_port_state(p[i], true, 1000, true);
+        make_bpdu(&b, br, i);
+        port_rx_bpdu(p[i], &b, sizeof(b));
+    }
+
+    pairs = calloc(2 * NUM_PORTS * (NUM_MSTIS + 1), sizeof(*pairs));
+    assert_non_null(pairs);
+    num_pairs = 0;
+    FOREACH_TREE_IN_BRIDGE(tree, br)
+    {
+        prev = NULL;
+        FOREACH_PTP_IN_TREE(ptp, tree)
+        {
+            pair = &pairs[num_pairs++];
+            pair->vec1 = &ptp->designatedPriority;
+            pair->vec2 = &ptp->portPriority;
+            pair->time1 = &ptp->designatedTimes;
+            pair->time2 = &ptp->portTimes;
+            pair->pId1 = pair->pId2 = ptp->portId;
+            pair->cist = (0 == ptp->MSTID);
+
+            if(prev)
+            {
+                pair = &pairs[num_pairs++];
+                pair->vec1 = &prev->portPriority;
+                pair->vec2 = &ptp->portPriority;
+                pair->time1 = &prev->portTimes;
+                pair->time2 = &ptp->portTimes;
+                pair->pId1 = prev->portId;
+                pair->pId2 = ptp->portId;
+                pair->cist = (0 == ptp->MSTID);
+            }
+            prev = ptp;
+        }
+    }
+    return 0;
+}
+
+static int teardown_tree(void **state)
+{
+    free(pairs);
+    pairs = NULL;
+    return teardown_test(state);
+}
+
+static void run_compare(bool keys)
+{
+    struct timespec start;
+    vector_pair_t *pair;
+    unsigned int better = 0, same = 0;
+    int i, j;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_ROUNDS; i++)
+    {
+        for(j = 0; j < num_pairs; j++)
+        {
+            pair = &pairs[j];
+            if(keys)
+            {
+                better += betterorsamePriority(pair->vec1, pair->vec2,
+                                               pair->pId1, pair->pId2,
+                                               pair->cist);
+                same += samePriorityAndTimers(pair->vec1, pair->vec2,
+                                              pair->time1, pair->time2,
+                                              pair->cist);
+            }
+            else
+            {
+                better += fieldBetterorsamePriority(pair->vec1, pair->vec2,
+                                                    pair->pId1, pair->pId2,
+                                                    pair->cist);
+                same += fieldSamePriorityAndTimers(pair->vec1, pair->vec2,
+                                                   pair->time1, pair->time2,
+                                                   pair->cist);
+            }
+        }
+    }
+    printf("# %d vector pairs, %s: %.1f ns per pair (%u better or same, "
+           "%u same)\n", num_pairs, keys ? "keys" : "field-wise",
+           elapsed_ns(&start) / ((double)NUM_ROUNDS * num_pairs),
+           better / NUM_ROUNDS, same / NUM_ROUNDS);
+}
+
+/* Both ways give the same answers */
+static void check_results(void)
+{
+    vector_pair_t *pair;
+    int j;
+
+    for(j = 0; j < num_pairs; j++)
+    {
+        pair = &pairs[j];
+        assert_int_equal(betterorsamePriority(pair->vec1, pair->vec2,
+                                              pair->pId1, pair->pId2,
+                                              pair->cist),
+                         fieldBetterorsamePriority(pair->vec1, pair->vec2,
+                                                   pair->pId1, pair->pId2,
+                                                   pair->cist));
+        assert_int_equal(samePriorityAndTimers(pair->vec1, pair->vec2,
+                                               pair->time1, pair->time2,
+                                               pair->cist),
+                         fieldSamePriorityAndTimers(pair->vec1, pair->vec2,
+                                                    pair->time1, pair->time2,
+                                                    pair->cist));
+    }
+}
+
+/* The tree takes a while to build, so one test does both runs on it */
+static void bench_compare(void **state)
+{
+    check_results();
+    run_compare(false);
+    run_compare(true);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(bench_compare, prepare_tree, teardown_tree),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "common.h"
+
+/* Micro-benchmark of the priority vector comparisons.
+ * MST BPDUs with a message for each of the MSTIs are received again and
+ * again, rcvInfo() compares msgPriority with portPriority for the CIST and
+ * every MSTI of each BPDU. The same is then done with the fast path for
+ * repeated BPDUs, which skips the state machines.
+ */
+
+#define NUM_MSTIS       MAX_IMPLEMENTATION_MSTIS
+#define NUM_REPEATED    100000
+
+static double elapsed_ns(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9
+           + (end.tv_nsec - start->tv_nsec);
+}
+
+static void make_bpdu(bpdu_t *b, bridge_t *br, int port, unsigned int cost)
+{
+    msti_configuration_message_t *msg;
+    int i;
+
+    memset(b, 0, sizeof(*b));
+    b->protocolVersion = protoMSTP;
+    b->bpduType = bpduTypeRST;
+    b->flags = BPDU_FLAGS_ROLE_SET(encodedRoleDesignated)
+               | (1 << offsetLearnig) | (1 << offsetForwarding);
+    b->cistRootID.u = __cpu_to_be64(0x1000000000000001ull);
+    b->cistExtRootPathCost = __cpu_to_be32(cost);
+    b->cistRRootID.u = __cpu_to_be64(0x1000000000000001ull);
+    b->cistPortID = __cpu_to_be16(0x8001);
+    b->MaxAge[0] = 20;
+    b->HelloTime[0] = 2;
+    b->ForwardDelay[0] = 15;
+    assign(b->mstConfigurationIdentifier, br->MstConfigId);
+    b->cistIntRootPathCost = __cpu_to_be32(cost);
+    b->cistBridgeID.u = __cpu_to_be64(0x8000000000001000ull + port);
+    b->cistRemainingHops = 20;
+    for(i = 0; i < NUM_MSTIS; i++)
+    {
+        msg = &b->mstConfiguration[i];
+        msg->flags = BPDU_FLAGS_ROLE_SET(encodedRoleDesignated)
+                     | (1 << offsetLearnig) | (1 << offsetForwarding);
+        msg->mstiRRootID.u = __cpu_to_be64(0x1000000000000001ull
+                                           | ((__u64)(i + 1) << 48));
+        msg->mstiIntRootPathCost = __cpu_to_be32(cost);
+        msg->bridgeIdentifierPriority = 0x80;
+        msg->portIdentifierPriority = 0x80;
+        msg->remainingHops = 20;
+    }
+    b->version3_len = __cpu_to_be16(MST_BPDU_VER3LEN_WO_MSTI_MSGS
+                                    + NUM_MSTIS * sizeof(*msg));
+}
+
+static void alloc_mst_bridge(void **state, bridge_t **br, port_t *(*p)[],
+                             int num_ports, int num_mstis)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+    int i;
+
+    assert_int_equal(alloc_bridge_ports(state, br, "br0", 0x200000000001,
+                                        p, num_ports), 0);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(*br, &cfg), 0);
+    for(i = 1; i <= num_mstis; i++)
+    {
+        assert_true(MSTP_IN_create_msti(*br, i));
+        assert_true(MSTP_IN_set_fid2mstid(*br, i, i));
+        assert_true(MSTP_IN_set_vid2fid(*br, i, i));
+    }
+    MSTP_IN_set_bridge_enable(*br, true);
+    for(i = 0; i < num_ports; i++)
+        set_port_state((*p)[i], true, 1000, true);
+}
+
+static void run_repeated(void **state, bool fast_path)
+{
+    static bpdu_t bpdus[2];
+    port_t *p[2];
+    struct timespec start;
+    bridge_t *br;
+    int i;
+
+    alloc_mst_bridge(state, &br, &p, 2, NUM_MSTIS);
+    br->rx_fast_path = fast_path;
+    for(i = 0; i < 2; i++)
+    {
+        make_bpdu(&bpdus[i], br, i, 20000);
+        port_rx_bpdu(p[i], &bpdus[i], sizeof(bpdus[i]));
+    }
+    assert_true(PRT_FLAG(p[0], rcvdInternal));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_REPEATED; i++)
+        port_rx_bpdu(p[i & 1], &bpdus[i & 1], sizeof(bpdus[i & 1]));
+    printf("# repeated BPDU, %d MSTIs%s: %.0f ns per BPDU\n", NUM_MSTIS,
+           fast_path ? ", fast path" : "",
+           elapsed_ns(&start) / NUM_REPEATED);
+    assert_int_equal(p[0]->num_rx_fast_path > 0, fast_path);
+}
+
+static void bench_repeated(void **state)
+{
+    run_repeated(state, false);
+}
+
+static void bench_repeated_fast_path(void **state)
+{
+    run_repeated(state, true);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(bench_repeated, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(bench_repeated_fast_path, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "common.h"
+
+/* mstp.c is built in, so the benchmark starts timers the way it does */
+#include "../mstp.c"
+
+/* Micro-benchmark of the tick on a large bridge.
+ * All ports of the bridge are up edge ports without neighbours, so they
+ * become Designated and Forwarding at once. Short ticks are timed in this
+ * steady state, where each port runs only its helloWhen timer, and again
+ * with the rbWhile timer of every tree of every port running.
+ */
+
+#define NUM_PORTS       4000
+#define NUM_MSTIS       MAX_IMPLEMENTATION_MSTIS
+#define TICK_MS         10
+#define NUM_TICKS       2000 /* 10 Hello Times */
+
+static double elapsed_ns(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1e9
+           + (end.tv_nsec - start->tv_nsec);
+}
+
+static void time_ticks(bridge_t *br, const char *what)
+{
+    struct timespec start;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < NUM_TICKS; i++)
+        MSTP_IN_tick(br, TICK_MS);
+    printf("# %s, %d ports x %d trees: %.0f us per %d ms tick\n",
+           what, NUM_PORTS, NUM_MSTIS + 1,
+           elapsed_ns(&start) / NUM_TICKS / 1000, TICK_MS);
+}
+
+static void bench_tick(void **state)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+    CIST_PortConfig edge = {
+        .set_admin_edge_port = true,
+        .admin_edge_port = true,
+    };
+    static port_t *p[NUM_PORTS];
+    bridge_t *br;
+    int i, mstid;
+
+    assert_int_equal(alloc_bridge_ports(state, &br, "br0", 0x200000000001,
+                                        &p, NUM_PORTS), 0);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br, &cfg), 0);
+    /* Configure the ports before the MSTIs exist and bring them up before
+     * the bridge, which then starts all of them at once: each of these
+     * steps marks all the state machines of the bridge.
+     */
+    for(i = 0; i < NUM_PORTS; i++)
+    {
+        assert_int_equal(MSTP_IN_set_cist_port_config(p[i], &edge), 0);
+        set_port_state(p[i], true, 1000, true);
+    }
+    for(i = 1; i <= NUM_MSTIS; i++)
+        assert_true(MSTP_IN_create_msti(br, i));
+    MSTP_IN_set_bridge_enable(br, true);
+    for(i = 0; i < 5; i++)
+        MSTP_IN_one_second(br);
+    assert_int_equal(find_ptp(p[0], NUM_MSTIS)->state, BR_STATE_FORWARDING);
+
+    time_ticks(br, "forwarding");
+
+    /* as if all the ports had just left the Backup role in all trees */
+    for(i = 0; i < NUM_PORTS; i++)
+        for(mstid = 0; mstid <= NUM_MSTIS; mstid++)
+            set_ptp_timer(find_ptp(p[i], mstid), rbWhile, 60000);
+
+    time_ticks(br, "rbWhile running");
+    assert_int_equal(PTP_TIMER(find_ptp(p[0], NUM_MSTIS), rbWhile),
+                     60000 - NUM_TICKS * TICK_MS);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(bench_tick, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
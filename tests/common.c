@@ -21,9 +21,20 @@ typedef struct mock_port_s {
     size_t last_tx_bpdu_len;
     int num_tx;
 
+    /* packet filter suppressing repeated BPDUs */
+    bpdu_t last_rx_bpdu;
+    size_t last_rx_bpdu_len;
+    bool rx_suppress;
+    bool rx_suppressed;
+    unsigned int rx_last_seen;
+    unsigned int num_rx_suppressed;
+
     struct mock_port_s *link;
 } mock_port_t;
 
+/* time in ms, advanced by test_one_second() */
+static unsigned int mock_time;
+
 static port_t *alloc_port(bridge_t *br, const char *name)
 {
     mock_port_t *p;
@@ -149,10 +160,40 @@ void test_one_second(void **state)
     struct list_head *bridges = *state;
     bridge_t *br;
 
+    mock_time += 1000;
     list_for_each_entry(br, bridges, list)
         MSTP_IN_one_second(br);
 }
 
+void test_advance_ms(unsigned int msec)
+{
+    mock_time += msec;
+}
+
+void test_tick_ms(void **state, unsigned int msec)
+{
+    struct list_head *bridges = *state;
+    bridge_t *br;
+
+    mock_time += msec;
+    list_for_each_entry(br, bridges, list)
+        MSTP_IN_tick(br, msec);
+}
+
+int port_num_tx_bpdu(port_t *p)
+{
+    mock_port_t *mp = (mock_port_t *)p;
+
+    return mp->num_tx;
+}
+
+unsigned int port_num_rx_suppressed(port_t *p)
+{
+    mock_port_t *mp = (mock_port_t *)p;
+
+    return mp->num_rx_suppressed;
+}
+
 void link_ports(port_t *p1, port_t *p2)
 {
     mock_port_t *mp1 = (mock_port_t *)p1;
@@ -198,13 +239,8 @@ void set_port_state(port_t *port, bool up, int speed, bool duplex)
 
 void port_rx_bpdu(port_t *p, const void *data, size_t len)
 {
-    bpdu_t bpdu;
-
-    assert_true(len <= sizeof(bpdu));
-
-    /* MSTP_IN_rx_bpdu() may modify the BPDU, so we need a copy */
-    memcpy(&bpdu, data, len);
-    MSTP_IN_rx_bpdu(p, &bpdu, len);
+    if(MSTP_IN_rx_bpdu_admit(p))
+        MSTP_IN_rx_bpdu(p, (bpdu_t *)data, len);
 }
 
 int port_last_tx_bpdu(port_t *p, bpdu_t **data, size_t *len)
@@ -278,8 +314,26 @@ void MSTP_OUT_tx_bpdu(port_t *p, bpdu_t *bpdu, int size)
     mp->last_tx_bpdu_len = size;
     mp->num_tx++;
 
-    /* if linked to a port, forward it */
-    if (mp->link)
+    if (!mp->link)
+        return;
+
+    /* the packet filter of the linked port drops the repeats if asked to */
+    if (size == mp->link->last_rx_bpdu_len
+        && !memcmp(bpdu, &mp->link->last_rx_bpdu, size)) {
+        if (mp->link->rx_suppress) {
+            mp->link->rx_suppressed = true;
+            mp->link->rx_last_seen = mock_time;
+            mp->link->num_rx_suppressed++;
+            return;
+        }
+    } else {
+        mp->link->rx_suppress = false;
+        memcpy(&mp->link->last_rx_bpdu, bpdu, size);
+        mp->link->last_rx_bpdu_len = size;
+    }
+
+    /* forward it to the linked port */
+    if(MSTP_IN_rx_bpdu_admit(&mp->link->port))
         MSTP_IN_rx_bpdu(&mp->link->port, bpdu, size);
 }
 
@@ -287,3 +341,26 @@ void MSTP_OUT_shutdown_port(port_t *prt)
 {
     /* nothing to do */
 }
+
+void MSTP_OUT_set_rx_suppress(port_t *prt, bool suppress)
+{
+    mock_port_t *mp = (mock_port_t *)prt;
+
+    mp->rx_suppress = suppress;
+    mp->rx_suppressed = false;
+}
+
+unsigned int MSTP_OUT_get_time_ms(void)
+{
+    return mock_time;
+}
+
+bool MSTP_OUT_get_rx_last_seen(port_t *prt, unsigned int *age_ms)
+{
+    mock_port_t *mp = (mock_port_t *)prt;
+
+    if (!mp->rx_suppressed)
+        return false;
+    *age_ms = mock_time - mp->rx_last_seen;
+    return true;
+}
@@ -53,5 +53,13 @@ int port_last_tx_bpdu(port_t *p, bpdu_t **data, size_t *len);
 void port_reset_last_tx_bpdu(port_t *p);
 /* advances the time of all bridges by one tick (second) */
 void test_one_second(void **state);
+/* advances the clock by msec milliseconds, without a tick */
+void test_advance_ms(unsigned int msec);
+/* advances the time of all bridges by one tick of msec milliseconds */
+void test_tick_ms(void **state, unsigned int msec);
+/* number of BPDUs transmitted from that port */
+int port_num_tx_bpdu(port_t *p);
+/* number of BPDUs the mock packet filter dropped on that port */
+unsigned int port_num_rx_suppressed(port_t *p);
 
 #endif
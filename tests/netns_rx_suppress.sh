@@ -0,0 +1,127 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# End-to-end check of the suppression of repeated BPDUs by the eBPF filter
+# (mstpd -u). Not run by "make check": it needs root, network namespaces,
+# veth and an eBPF capable kernel.
+#
+# Two namespaces each get a bridge br0 and one end of a veth pair, and run
+# their own mstpd -u. The bridge in the second namespace is the root, so
+# the first one receives its hellos on its Root Port. The check passes when
+#   - the "suppressed" counter of "mstpctl showfilter" in the first namespace
+#     rises while the hellos repeat, and
+#   - after the veth end in the second namespace is taken out of its bridge,
+#     the carrier staying up, the Root Port of the first bridge ages its
+#     received information out within 3 x Hello Time.
+#
+# The kernel hands STP of a bridge to user space only in the initial network
+# namespace, elsewhere stp_state 1 means the kernel's own STP. The bridges
+# here run it on another group address, 01:80:c2:00:00:0f: that way the
+# kernel still passes the BPDUs up to mstpd, but neither sends nor handles
+# any on 01:80:c2:00:00:00. mstpd cannot set the port states then, which
+# this check does not look at.
+#
+# Usage, from the build directory:
+#   sudo tests/netns_rx_suppress.sh [<mstpd> [<mstpctl>]]
+# Exits 0 on success, 1 on failure and 77 when it cannot run here.
+
+MSTPD=$(realpath "${1:-./mstpd}")
+MSTPCTL=$(realpath "${2:-./mstpctl}")
+NS_A=mstpd-test-a.$$
+NS_B=mstpd-test-b.$$
+HELLO=2
+
+fail()
+{
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+skip()
+{
+  echo "SKIP: $*" >&2
+  exit 77
+}
+
+cleanup()
+{
+  for ns in "$NS_A" "$NS_B"; do
+    pids=$(ip netns pids "$ns" 2>/dev/null)
+    [ -n "$pids" ] && kill $pids 2>/dev/null
+    ip netns del "$ns" 2>/dev/null
+  done
+}
+
+now_ms()
+{
+  echo $(($(date +%s%N) / 1000000))
+}
+
+# suppressed <namespace>
+suppressed()
+{
+  ip netns exec "$1" "$MSTPCTL" showfilter | awk '$1 == "suppressed" { print $2 }'
+}
+
+# role <namespace> <port>
+role()
+{
+  ip netns exec "$1" "$MSTPCTL" showportparams br0 "$2" role
+}
+
+[ "$(id -u)" -eq 0 ] || skip "must be run as root"
+[ -x "$MSTPD" ] && [ -x "$MSTPCTL" ] || skip "mstpd or mstpctl not found"
+
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+ip netns add "$NS_A" && ip netns add "$NS_B" || skip "no network namespaces"
+ip -n "$NS_A" link add name veth-a type veth peer name veth-b netns "$NS_B" \
+  || skip "no veth"
+
+for side in a b; do
+  [ "$side" = a ] && ns=$NS_A || ns=$NS_B
+  ip -n "$ns" link set lo up
+  ip -n "$ns" link add name br0 type bridge stp_state 1 \
+    group_address 01:80:c2:00:00:0f || skip "no bridge"
+  ip -n "$ns" link set "veth-$side" master br0
+  ip -n "$ns" link set br0 up
+  ip -n "$ns" link set "veth-$side" up
+
+  ip netns exec "$ns" "$MSTPD" -d -u >/dev/null 2>&1 &
+  for i in 1 2 3 4 5 6 7 8 9 10; do
+    ip netns exec "$ns" "$MSTPCTL" showbridge >/dev/null 2>&1 && break
+    sleep 0.5
+  done
+  ip netns exec "$ns" "$MSTPCTL" addbridge br0 || fail "mstpd did not start in $ns"
+  ip netns exec "$ns" "$MSTPCTL" sethello br0 "$HELLO" || fail "sethello in $ns"
+done
+ip netns exec "$NS_B" "$MSTPCTL" settreeprio br0 0 0 || fail "settreeprio"
+
+ip netns exec "$NS_A" "$MSTPCTL" showfilter | grep -q '^eBPF' \
+  || skip "no eBPF filter, no suppression"
+
+# converge, then the repeated hellos are dropped by the filter
+for i in $(seq 20); do
+  [ "$(role "$NS_A" veth-a)" = Root ] && break
+  sleep 1
+done
+[ "$(role "$NS_A" veth-a)" = Root ] || fail "veth-a did not become the Root Port"
+sleep $((3 * HELLO))
+before=$(suppressed "$NS_A")
+sleep $((3 * HELLO))
+after=$(suppressed "$NS_A")
+echo "suppressed BPDUs: $before, then $after $((3 * HELLO)) s later"
+[ "$after" -gt "$before" ] || fail "the suppressed counter did not rise"
+
+# unplug the far end, the link stays up, so only the age of the received
+# information tells that the root is gone
+start=$(now_ms)
+ip -n "$NS_B" link set veth-b nomaster
+limit=$((start + 3 * HELLO * 1000 + 1000))
+while [ "$(role "$NS_A" veth-a)" = Root ]; do
+  [ "$(now_ms)" -le "$limit" ] || fail "veth-a still Root Port after $((limit - start)) ms"
+  sleep 0.1
+done
+echo "veth-a aged out after $(($(now_ms) - start)) ms, Hello Time $HELLO s"
+echo "PASS"
@@ -5,6 +5,13 @@
 #include "mstp.h"
 #include "common.h"
 
+/* RFC 1321 and RFC 2104 test vectors, and Table 13-2 with hmac_md5() and
+ * with hmac_md5_mstp() */
+static void md5_test_suite(void **state)
+{
+    assert_true(MD5TestSuite());
+}
+
 /* Tests based IEEE 802.1Q-2022, Table 13-2: "Example Configuration Digests" */
 
 /* All VIDs map to the CIST, no VID mapped to any MSTI */
@@ -74,6 +81,158 @@ static void all_vid_mst_mod32_digest(void **state)
                         expected_digest, 16);
 }
 
+/* The same mapping set at once, read back, then undone */
+static void all_vid_mst_mod32_at_once(void **state)
+{
+    const __u8 expected_digest[] = {
+        0x9D, 0x14, 0x5C, 0x26, 0x7D, 0xBE, 0x9F, 0xB5, 0xD8, 0x93, 0x44, 0x1B,
+        0xE3, 0xBA, 0x08, 0xCE
+    };
+    const __u8 cist_digest[] = {
+        0xAC, 0x36, 0x17, 0x7F, 0x50, 0x28, 0x3C, 0xD4, 0xB8, 0x38, 0x21, 0xD8,
+        0xAB, 0x26, 0xDE, 0x62
+    };
+    __u16 vids2fids[MAX_VID + 1], fids2mstids[MAX_FID + 1];
+    __u16 vids2fids_get[MAX_VID + 1], fids2mstids_get[MAX_FID + 1];
+    bridge_t *br;
+    int i;
+
+    alloc_bridge_ports(state, &br, "BR_TEST", 0x200000000001, NULL, 0);
+    assert_int_equal(br->vid2fid.room, 0);
+
+    for (i = 1; i <= 32; i++)
+        assert_true(MSTP_IN_create_msti(br, i));
+
+    for (i = 0; i <= MAX_VID; i++)
+        vids2fids[i] = i;
+    fids2mstids[0] = 0;
+    for (i = 1; i <= MAX_FID; i++)
+        fids2mstids[i] = (i % 32) + 1;
+    assert_true(MSTP_IN_set_all_fids2mstids(br, fids2mstids));
+    assert_true(MSTP_IN_set_all_vids2fids(br, vids2fids));
+
+    assert_memory_equal(br->MstConfigId.s.configuration_digest,
+                        expected_digest, 16);
+    MSTP_IN_get_all_vids2fids(br, vids2fids_get);
+    MSTP_IN_get_all_fids2mstids(br, fids2mstids_get);
+    assert_memory_equal(vids2fids_get, vids2fids, sizeof(vids2fids));
+    assert_memory_equal(fids2mstids_get, fids2mstids, sizeof(fids2mstids));
+
+    /* back to the default map, one VID at a time */
+    for (i = MAX_VID; i >= 1; i--)
+        assert_true(MSTP_IN_set_vid2fid(br, i, 0));
+    assert_int_equal(br->vid2fid.num_runs, 1);
+    assert_int_equal(br->vid2fid.room, 0);
+    assert_memory_equal(br->MstConfigId.s.configuration_digest,
+                        cist_digest, 16);
+}
+
+/* Inside a VLAN map transaction the digest and the state machines change
+ * only at the commit, and not at all if the mapping ends up the same */
+static void vlan_map_transaction(void **state)
+{
+    const __u8 expected_digest[] = {
+        0x9D, 0x14, 0x5C, 0x26, 0x7D, 0xBE, 0x9F, 0xB5, 0xD8, 0x93, 0x44, 0x1B,
+        0xE3, 0xBA, 0x08, 0xCE
+    };
+    const __u8 cist_digest[] = {
+        0xAC, 0x36, 0x17, 0x7F, 0x50, 0x28, 0x3C, 0xD4, 0xB8, 0x38, 0x21, 0xD8,
+        0xAB, 0x26, 0xDE, 0x62
+    };
+    per_tree_port_t *cist;
+    port_t *brp[1];
+    bridge_t *br, *br2;
+    int i;
+
+    alloc_bridge_ports(state, &br, "BR_TEST", 0x200000000001, &brp, 1);
+    cist = GET_CIST_PTP_FROM_PORT(brp[0]);
+    for (i = 1; i <= 32; i++)
+        assert_true(MSTP_IN_create_msti(br, i));
+    MSTP_IN_set_bridge_enable(br, true);
+    test_one_second(state);
+    test_one_second(state);
+    assert_int_not_equal(cist->start_time, br->uptime);
+
+    /* changed and changed back: no restart */
+    assert_true(MSTP_IN_begin_vlan_map(br));
+    assert_true(MSTP_IN_set_fid2mstid(br, 1, 1));
+    assert_true(MSTP_IN_set_vid2fid(br, 1, 1));
+    assert_true(MSTP_IN_set_vid2fid(br, 1, 0));
+    MSTP_IN_commit_vlan_map(br);
+    assert_memory_equal(br->MstConfigId.s.configuration_digest,
+                        cist_digest, 16);
+    assert_int_not_equal(cist->start_time, br->uptime);
+
+    /* one VID at a time, the digest changes at the commit */
+    assert_true(MSTP_IN_begin_vlan_map(br));
+    for (i = 1; i <= MAX_VID; i++)
+        assert_true(MSTP_IN_set_vid2fid(br, i, i));
+    for (i = 1; i <= MAX_FID; i++)
+        assert_true(MSTP_IN_set_fid2mstid(br, i, (i % 32) + 1));
+    assert_memory_equal(br->MstConfigId.s.configuration_digest,
+                        cist_digest, 16);
+    MSTP_IN_commit_vlan_map(br);
+    assert_memory_equal(br->MstConfigId.s.configuration_digest,
+                        expected_digest, 16);
+    assert_int_equal(cist->start_time, br->uptime);
+
+    /* a bridge with the same mapping gets the same digest */
+    alloc_bridge_ports(state, &br2, "BR_TEST2", 0x200000000002, NULL, 0);
+    for (i = 1; i <= 32; i++)
+        assert_true(MSTP_IN_create_msti(br2, i));
+    assert_true(MSTP_IN_begin_vlan_map(br2));
+    for (i = 1; i <= MAX_VID; i++)
+        assert_true(MSTP_IN_set_vid2fid(br2, i, i));
+    for (i = 1; i <= MAX_FID; i++)
+        assert_true(MSTP_IN_set_fid2mstid(br2, i, (i % 32) + 1));
+    MSTP_IN_commit_vlan_map(br2);
+    assert_memory_equal(br2->MstConfigId.s.configuration_digest,
+                        expected_digest, 16);
+}
+
+/* A VLAN map transaction does not nest, shows in the bridge status, and
+ * is not committed behind the back of whoever left it open */
+static void vlan_map_transaction_open(void **state)
+{
+    const __u8 cist_digest[] = {
+        0xAC, 0x36, 0x17, 0x7F, 0x50, 0x28, 0x3C, 0xD4, 0xB8, 0x38, 0x21, 0xD8,
+        0xAB, 0x26, 0xDE, 0x62
+    };
+    CIST_BridgeStatus s;
+    bridge_t *br;
+    int i;
+
+    alloc_bridge_ports(state, &br, "BR_TEST", 0x200000000001, NULL, 0);
+    assert_true(MSTP_IN_create_msti(br, 1));
+    MSTP_IN_set_bridge_enable(br, true);
+
+    MSTP_IN_get_cist_bridge_status(br, &s);
+    assert_false(s.vlan_map_txn);
+
+    assert_true(MSTP_IN_begin_vlan_map(br));
+    assert_false(MSTP_IN_begin_vlan_map(br));
+    assert_true(MSTP_IN_set_fid2mstid(br, 1, 1));
+    assert_true(MSTP_IN_set_vid2fid(br, 1, 1));
+
+    for (i = 0; i < 300; i++)
+        test_one_second(state);
+    MSTP_IN_get_cist_bridge_status(br, &s);
+    assert_true(s.vlan_map_txn);
+    assert_int_equal(s.vlan_map_txn_time, 300);
+    assert_memory_equal(br->MstConfigId.s.configuration_digest,
+                        cist_digest, 16);
+
+    MSTP_IN_commit_vlan_map(br);
+    MSTP_IN_get_cist_bridge_status(br, &s);
+    assert_false(s.vlan_map_txn);
+    assert_false(0 == memcmp(br->MstConfigId.s.configuration_digest,
+                             cist_digest, 16));
+
+    /* and a new one can be opened */
+    assert_true(MSTP_IN_begin_vlan_map(br));
+    MSTP_IN_commit_vlan_map(br);
+}
+
 /* Setting a configuration name should set the name as expected */
 static void configuration_name(void **state)
 {
@@ -157,9 +316,13 @@ static void configuration_name_garbage(void **state)
 int main(int argc, char *argv[])
 {
     const struct CMUnitTest tests[] = {
+        cmocka_unit_test(md5_test_suite),
         cmocka_unit_test_setup_teardown(all_vid_cist_digest, prepare_test, teardown_test),
         cmocka_unit_test_setup_teardown(all_vid_mst_1_digest, prepare_test, teardown_test),
         cmocka_unit_test_setup_teardown(all_vid_mst_mod32_digest, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(all_vid_mst_mod32_at_once, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(vlan_map_transaction, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(vlan_map_transaction_open, prepare_test, teardown_test),
         cmocka_unit_test_setup_teardown(configuration_name, prepare_test, teardown_test),
         cmocka_unit_test_setup_teardown(configuration_name_min, prepare_test, teardown_test),
         cmocka_unit_test_setup_teardown(configuration_name_max, prepare_test, teardown_test),
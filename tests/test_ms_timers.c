@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "common.h"
+
+#define STEP_MS 10
+
+/* Tick in STEP_MS steps until the port sends a BPDU, return the time it took */
+static unsigned int until_tx(void **state, port_t *p, unsigned int limit)
+{
+    int tx = port_num_tx_bpdu(p);
+    unsigned int t;
+
+    for (t = 0; t < limit && port_num_tx_bpdu(p) == tx; t += STEP_MS)
+        test_tick_ms(state, STEP_MS);
+    return t;
+}
+
+/* Tick in STEP_MS steps until the port is in that state, return the time
+ * it took */
+static unsigned int until_state(void **state, port_t *p, int port_state,
+                                unsigned int limit)
+{
+    CIST_PortStatus s;
+    unsigned int t;
+
+    for (t = 0; t < limit; t += STEP_MS) {
+        MSTP_IN_get_cist_port_status(p, &s);
+        if (s.state == port_state)
+            break;
+        test_tick_ms(state, STEP_MS);
+    }
+    return t;
+}
+
+/* A sub-second Hello Time of a port sets the tick interval and the period
+ * of its BPDUs, but not the Hello Time it sends */
+void fast_hello(void **state)
+{
+    CIST_PortConfig cfg = {
+        .set_port_hello_time_ms = true,
+        .port_hello_time_ms = 150,
+    };
+    port_t *p[2];
+    bridge_t *br;
+    bpdu_t *bpdu;
+    size_t len;
+    int i;
+
+    alloc_bridge_ports(state, &br, "br0", 0x200000000001, &p, 2);
+    assert_int_equal(MSTP_IN_get_tick_interval(br), 1000);
+    assert_int_equal(MSTP_IN_set_cist_port_config(p[0], &cfg), 0);
+    assert_int_equal(MSTP_IN_get_tick_interval(br), 50);
+
+    MSTP_IN_set_bridge_enable(br, true);
+    set_port_state(p[0], true, 1000, true);
+    set_port_state(p[1], true, 1000, true);
+
+    /* the first hello is due one Hello Time after the BPDUs of the start */
+    until_tx(state, p[0], 2000);
+    for (i = 0; i < 10; i++)
+        assert_int_equal(until_tx(state, p[0], 2000), 150);
+    /* the other port keeps the Hello Time of the bridge */
+    until_tx(state, p[1], 3000);
+    assert_int_equal(until_tx(state, p[1], 3000), 2000);
+
+    assert_int_equal(port_last_tx_bpdu(p[0], &bpdu, &len), 0);
+    assert_int_equal(bpdu->HelloTime[0], 2);
+    assert_int_equal(bpdu->HelloTime[1], 0);
+
+    /* back to the Hello Time of the bridge */
+    cfg.port_hello_time_ms = 0;
+    assert_int_equal(MSTP_IN_set_cist_port_config(p[0], &cfg), 0);
+    assert_int_equal(MSTP_IN_get_tick_interval(br), 1000);
+    until_tx(state, p[0], 3000);
+    assert_int_equal(until_tx(state, p[0], 3000), 2000);
+}
+
+/* A sub-second Forward Delay of the bridge times the Learning state,
+ * the timer expires on the tick it is due */
+void fast_forward_delay(void **state)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoSTP,
+        .set_bridge_forward_delay_ms = true,
+        .bridge_forward_delay_ms = 400,
+    };
+    CIST_BridgeStatus s;
+    port_t *p[1];
+    bridge_t *br;
+
+    alloc_bridge_ports(state, &br, "br0", 0x200000000001, &p, 1);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br, &cfg), 0);
+    assert_int_equal(MSTP_IN_get_tick_interval(br), 200);
+    MSTP_IN_get_cist_bridge_status(br, &s);
+    assert_int_equal(s.bridge_forward_delay_ms, 400);
+
+    MSTP_IN_set_bridge_enable(br, true);
+    set_port_state(p[0], true, 1000, true);
+
+    /* the port leaves Blocking when its fdWhile of Max Age expires */
+    assert_int_equal(until_state(state, p[0], BR_STATE_LEARNING, 30000),
+                     20000);
+    assert_int_equal(until_state(state, p[0], BR_STATE_FORWARDING, 30000),
+                     400);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(fast_hello, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(fast_forward_delay, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,298 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <string.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "common.h"
+
+/* Check the MSTID indexes against the lists they shadow */
+static void assert_index_consistent(bridge_t *br)
+{
+    per_tree_port_t *ptp;
+    tree_t *tree;
+    port_t *prt;
+    int mstid, count = 0;
+
+    list_for_each_entry(tree, &br->trees, bridge_list)
+    {
+        assert_ptr_equal(find_tree(br, __be16_to_cpu(tree->MSTID)), tree);
+        ++count;
+    }
+    for(mstid = 0; mstid <= MAX_MSTID; ++mstid)
+        if(find_tree(br, mstid))
+            --count;
+    assert_int_equal(count, 0);
+
+    list_for_each_entry(prt, &br->ports, br_list)
+        list_for_each_entry(ptp, &prt->trees, port_list)
+            assert_ptr_equal(find_ptp(prt, __be16_to_cpu(ptp->MSTID)), ptp);
+}
+
+void msti_index(void **state)
+{
+    port_t *brp[3];
+    bridge_t *br;
+    int i;
+
+    alloc_bridge_ports(state, &br, "br0", 0x200000000001, &brp, 2);
+    assert_ptr_equal(find_tree(br, 0), GET_CIST_TREE(br));
+    assert_null(find_tree(br, 1));
+    assert_null(find_tree(br, MAX_MSTID + 1));
+    assert_null(find_ptp(brp[0], 1));
+
+    assert_true(MSTP_IN_create_msti(br, 10));
+    assert_true(MSTP_IN_create_msti(br, 5));
+    assert_true(MSTP_IN_create_msti(br, 4094));
+    assert_index_consistent(br);
+    assert_ptr_equal(find_ptp(brp[1], 5)->port, brp[1]);
+    assert_ptr_equal(find_ptp(brp[1], 5)->tree, find_tree(br, 5));
+
+    /* slot of a deleted MSTI is reused */
+    assert_true(MSTP_IN_delete_msti(br, 5));
+    assert_null(find_tree(br, 5));
+    assert_null(find_ptp(brp[0], 5));
+    assert_true(MSTP_IN_create_msti(br, 7));
+    assert_index_consistent(br);
+
+    /* all the slots taken, then half of them freed and taken again */
+    alloc_bridge_ports(state, &br, "br1", 0x200000000002, &brp, 3);
+    for(i = 1; i <= MAX_IMPLEMENTATION_MSTIS; ++i)
+        assert_true(MSTP_IN_create_msti(br, i * 2));
+    assert_false(MSTP_IN_create_msti(br, 1));
+    assert_index_consistent(br);
+    for(i = 1; i <= MAX_IMPLEMENTATION_MSTIS; i += 2)
+        assert_true(MSTP_IN_delete_msti(br, i * 2));
+    for(i = 1; i <= MAX_IMPLEMENTATION_MSTIS / 2; ++i)
+        assert_true(MSTP_IN_create_msti(br, i * 2 + 1));
+    assert_index_consistent(br);
+}
+
+/* The timer rows widen when an MSTI takes a slot past their room, keeping
+ * the running timers */
+void timer_rows_grow(void **state)
+{
+    per_tree_port_t *cist;
+    port_t *brp[3];
+    bridge_t *br;
+    int mstid;
+
+    alloc_bridge_ports(state, &br, "br0", 0x200000000001, &brp, 2);
+    assert_int_equal(br->timer_slots, 4);
+    cist = GET_CIST_PTP_FROM_PORT(brp[1]);
+    PRT_TIMER(brp[0], mdelayWhile) = 1234;
+    PTP_TIMER(cist, rcvdInfoWhile) = 4321;
+    for(mstid = 1; mstid <= 3; ++mstid)
+        assert_true(MSTP_IN_create_msti(br, mstid));
+    PTP_TIMER(find_ptp(brp[1], 3), rbWhile) = 5678;
+    assert_int_equal(br->timer_slots, 4);
+
+    assert_true(MSTP_IN_create_msti(br, 4));
+    assert_int_equal(br->timer_slots, 8);
+    assert_int_equal(PRT_TIMER(brp[0], mdelayWhile), 1234);
+    assert_int_equal(PTP_TIMER(cist, rcvdInfoWhile), 4321);
+    assert_int_equal(PTP_TIMER(find_ptp(brp[1], 3), rbWhile), 5678);
+    assert_int_equal(PTP_TIMER(find_ptp(brp[0], 3), rbWhile), 0);
+}
+
+/* The MSTI messages of a received BPDU reach the MSTIs they are for, and
+ * the ones for MSTIs the bridge does not have are counted */
+void msti_messages_demux(void **state)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+    port_t *br0p[1], *br1p[1];
+    bridge_t *br0, *br1;
+    CIST_PortStatus s;
+    int i;
+
+    alloc_bridge_ports(state, &br0, "br0", 0x200000000001, &br0p, 1);
+    alloc_bridge_ports(state, &br1, "br1", 0x200000000002, &br1p, 1);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br0, &cfg), 0);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br1, &cfg), 0);
+    assert_true(MSTP_IN_create_msti(br0, 1));
+    assert_true(MSTP_IN_create_msti(br0, 2));
+    assert_true(MSTP_IN_create_msti(br0, 3));
+    assert_true(MSTP_IN_create_msti(br1, 1));
+    assert_true(MSTP_IN_create_msti(br1, 3));
+    MSTP_IN_set_mst_config_id(br0, 1, (__u8 *)"region");
+    MSTP_IN_set_mst_config_id(br1, 1, (__u8 *)"region");
+
+    link_ports(br0p[0], br1p[0]);
+    MSTP_IN_set_bridge_enable(br0, true);
+    MSTP_IN_set_bridge_enable(br1, true);
+    set_port_state(br0p[0], true, 1000, true);
+
+    for (i = 0; i < 5; i++)
+        test_one_second(state);
+
+    assert_int_equal(br1p[0]->rcvdBpduNumOfMstis, 3);
+    /* room only for the messages received */
+    assert_int_equal(br1p[0]->rcvdMstiMsgsRoom, 3);
+    assert_int_equal(
+        __be16_to_cpu(find_ptp(br1p[0], 1)->rxMstiMsg->mstiRRootID.s.priority)
+        & 0x0FFF, 1);
+    assert_int_equal(
+        __be16_to_cpu(find_ptp(br1p[0], 3)->rxMstiMsg->mstiRRootID.s.priority)
+        & 0x0FFF, 3);
+    assert_null(GET_CIST_PTP_FROM_PORT(br1p[0])->rxMstiMsg);
+    assert_int_equal(find_ptp(br1p[0], 1)->role, roleRoot);
+    assert_int_equal(find_ptp(br1p[0], 3)->role, roleRoot);
+
+    MSTP_IN_get_cist_port_status(br1p[0], &s);
+    assert_true(s.num_rx_unknown_msti > 0);
+    MSTP_IN_get_cist_port_status(br0p[0], &s);
+    assert_int_equal(s.num_rx_unknown_msti, 0);
+}
+
+/* A lazy bridge gives its ports state in an MSTI only on receipt of an
+ * MSTI message for it, on configuration, or once VLANs are allocated to it
+ */
+void lazy_msti_ports(void **state)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+    MSTI_PortConfig pcfg = {
+        .set_port_priority = true,
+        .port_priority = 4,
+    };
+    port_t *br0p[1], *br1p[3];
+    bridge_t *br0, *br1;
+    MSTI_PortStatus s;
+    tree_t *tree;
+    int i;
+
+    alloc_bridge_ports(state, &br0, "br0", 0x200000000001, &br0p, 1);
+    alloc_bridge_ports(state, &br1, "br1", 0x200000000002, &br1p, 3);
+    br0->sm_cross_check = br1->sm_cross_check = true;
+    br1->lazy_msti_ports = true;
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br0, &cfg), 0);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br1, &cfg), 0);
+    assert_true(MSTP_IN_create_msti(br0, 1));
+    assert_true(MSTP_IN_create_msti(br1, 1));
+    MSTP_IN_set_mst_config_id(br0, 1, (__u8 *)"region");
+    MSTP_IN_set_mst_config_id(br1, 1, (__u8 *)"region");
+
+    tree = find_tree(br1, 1);
+    assert_true(tree->sparse);
+    assert_true(list_empty(&tree->ports));
+    assert_null(find_ptp(br1p[0], 1));
+
+    link_ports(br0p[0], br1p[0]);
+    MSTP_IN_set_bridge_enable(br0, true);
+    MSTP_IN_set_bridge_enable(br1, true);
+    set_port_state(br0p[0], true, 1000, true);
+    set_port_state(br1p[2], true, 1000, true);
+
+    for (i = 0; i < 10; i++)
+        test_one_second(state);
+
+    /* the port of br1 towards br0 got state from the messages of br0 */
+    assert_non_null(find_ptp(br1p[0], 1));
+    assert_int_equal(find_ptp(br1p[0], 1)->role, roleRoot);
+    assert_int_equal(br1p[0]->num_rx_unknown_msti, 0);
+    assert_null(find_ptp(br1p[1], 1));
+    assert_null(find_ptp(br1p[2], 1));
+    MSTP_IN_get_absent_msti_port_status(br1p[2], tree, &s);
+    assert_int_equal(s.role, roleDisabled);
+    assert_int_equal(s.state, BR_STATE_DISABLED);
+    assert_index_consistent(br1);
+
+    /* configuring a port gives it state, in the order of the ports */
+    assert_non_null(MSTP_IN_add_msti_port(br1p[2], tree));
+    assert_int_equal(MSTP_IN_set_msti_port_config(find_ptp(br1p[2], 1),
+                                                  &pcfg), 0);
+    assert_ptr_equal(list_entry(tree->ports.prev, per_tree_port_t,
+                                tree_list)->port, br1p[2]);
+    assert_index_consistent(br1);
+    test_one_second(state);
+    assert_int_equal(find_ptp(br1p[2], 1)->role, roleDesignated);
+
+    /* a VLAN allocated to the MSTI gives state to all the ports */
+    assert_true(MSTP_IN_set_fid2mstid(br0, 1, 1));
+    assert_true(MSTP_IN_set_vid2fid(br0, 10, 1));
+    assert_true(MSTP_IN_set_fid2mstid(br1, 1, 1));
+    assert_true(MSTP_IN_set_vid2fid(br1, 10, 1));
+    assert_false(tree->sparse);
+    for (i = 0; i < 3; i++)
+        assert_non_null(find_ptp(br1p[i], 1));
+    assert_index_consistent(br1);
+
+    for (i = 0; i < 10; i++)
+        test_one_second(state);
+    assert_int_equal(find_ptp(br1p[0], 1)->role, roleRoot);
+    assert_int_equal(find_ptp(br1p[1], 1)->role, roleDisabled);
+    assert_int_equal(find_ptp(br1p[2], 1)->role, roleDesignated);
+    assert_int_equal(br0->sm_cross_check_errors, 0);
+    assert_int_equal(br1->sm_cross_check_errors, 0);
+}
+
+/* An MST BPDU whose version3_len claims more MSTI messages than the frame
+ * carries is handled as an RST BPDU (14.4.d) */
+void short_mst_bpdu(void **state)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+    port_t *br0p[1], *br1p[1];
+    bridge_t *br0, *br1;
+    bpdu_t *tx, bpdu;
+    size_t len;
+    int i;
+
+    alloc_bridge_ports(state, &br0, "br0", 0x200000000001, &br0p, 1);
+    alloc_bridge_ports(state, &br1, "br1", 0x200000000002, &br1p, 1);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br0, &cfg), 0);
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br1, &cfg), 0);
+    for (i = 1; i <= 3; i++) {
+        assert_true(MSTP_IN_create_msti(br0, i));
+        assert_true(MSTP_IN_create_msti(br1, i));
+    }
+    MSTP_IN_set_bridge_enable(br0, true);
+    MSTP_IN_set_bridge_enable(br1, true);
+    set_port_state(br0p[0], true, 1000, true);
+    set_port_state(br1p[0], true, 1000, true);
+    test_one_second(state);
+
+    assert_int_equal(port_last_tx_bpdu(br0p[0], &tx, &len), 0);
+    assert_int_equal(len, MST_BPDU_SIZE_WO_MSTI_MSGS
+                          + 3 * sizeof(msti_configuration_message_t));
+    memcpy(&bpdu, tx, len);
+
+    /* the whole BPDU is an MST one */
+    port_rx_bpdu(br1p[0], &bpdu, len);
+    assert_int_equal(br1p[0]->rcvdBpduData.protocolVersion, protoMSTP);
+    assert_int_equal(br1p[0]->rcvdBpduNumOfMstis, 3);
+
+    /* cut after the first MSTI message, version3_len still claims three */
+    port_rx_bpdu(br1p[0], &bpdu, MST_BPDU_SIZE_WO_MSTI_MSGS
+                                 + sizeof(msti_configuration_message_t));
+    assert_int_equal(br1p[0]->rcvdBpduData.protocolVersion, protoRSTP);
+    assert_int_equal(br1p[0]->rcvdBpduNumOfMstis, 0);
+
+    /* only the MSTI-less part of an MST BPDU */
+    port_rx_bpdu(br1p[0], &bpdu, MST_BPDU_SIZE_WO_MSTI_MSGS);
+    assert_int_equal(br1p[0]->rcvdBpduData.protocolVersion, protoRSTP);
+    assert_int_equal(br1p[0]->rcvdBpduNumOfMstis, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(msti_index, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(timer_rows_grow, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(msti_messages_demux, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(lazy_msti_ports, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(short_mst_bpdu, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <stdlib.h>
+
+#include <cmocka.h>
+
+#include <sys/socket.h>
+
+struct mmsghdr;
+int mock_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags);
+
+/* The packet layer is built in, so the tests reach its queues and ring, and
+ * sendmmsg() is replaced by a recording mock */
+#define sendmmsg mock_sendmmsg
+#include "../packet.c"
+#undef sendmmsg
+
+#define MAX_CALLS 8
+
+static struct
+{
+    int calls;
+    int flags[MAX_CALLS];
+    unsigned int vlen[MAX_CALLS];
+    int ifindex[MAX_CALLS][PACKET_TX_BATCH];
+    bool would_block;
+} tx;
+
+static struct
+{
+    int batches_begun, batches_ended;
+    int frames;
+    int ifindex[4];
+    unsigned int len[4];
+    unsigned char *ring_start, *ring_end;
+    bool blocks_held; /* all the blocks were still the daemon's at the end */
+} rx;
+
+static struct
+{
+    int deferred, coalesced, dropped;
+    bool want_output;
+} backlog;
+
+int mock_sendmmsg(int fd, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+    struct sockaddr_ll *sl;
+    unsigned int i;
+
+    if (tx.would_block) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    assert_true(tx.calls < MAX_CALLS);
+    tx.flags[tx.calls] = flags;
+    tx.vlen[tx.calls] = vlen;
+    for (i = 0; i < vlen; ++i) {
+        sl = msgs[i].msg_hdr.msg_name;
+        tx.ifindex[tx.calls][i] = sl->sll_ifindex;
+        msgs[i].msg_len = msgs[i].msg_hdr.msg_iov[0].iov_len;
+    }
+    ++tx.calls;
+    return vlen;
+}
+
+/* functions called by packet.c */
+
+void bridge_bpdu_rcv(int ifindex, const unsigned char *data, int len)
+{
+    int i;
+
+    /* the frame right in the ring */
+    assert_true(data >= rx.ring_start && data + len <= rx.ring_end);
+    for (i = 0; i < len; ++i)
+        assert_int_equal(data[i], 0x42);
+    rx.ifindex[rx.frames] = ifindex;
+    rx.len[rx.frames] = len;
+    ++rx.frames;
+}
+
+void bridge_bpdu_rcv_batch_begin(void)
+{
+    ++rx.batches_begun;
+}
+
+void bridge_bpdu_rcv_batch_end(void)
+{
+    struct tpacket_block_desc *bd;
+
+    ++rx.batches_ended;
+    if (rx.ring_start) {
+        bd = (struct tpacket_block_desc *)rx.ring_start;
+        rx.blocks_held = (bd->hdr.bh1.block_status & TP_STATUS_USER);
+        bd = (struct tpacket_block_desc *)(rx.ring_start + RING_RX_BLOCK_SIZE);
+        rx.blocks_held &= (bd->hdr.bh1.block_status & TP_STATUS_USER);
+    }
+}
+
+void bridge_bpdu_tx_error(int ifindex, int err, int sent, int len)
+{
+    /* the mock send never fails */
+    fail();
+}
+
+void bridge_bpdu_tx_backlog(int ifindex, bpdu_tx_backlog_t ev)
+{
+    switch (ev) {
+        case BPDU_TX_DEFERRED:
+            ++backlog.deferred;
+            break;
+        case BPDU_TX_COALESCED:
+            ++backlog.coalesced;
+            break;
+        case BPDU_TX_DROPPED:
+            ++backlog.dropped;
+            break;
+    }
+}
+
+int epoll_want_output(struct epoll_event_handler *h, bool want)
+{
+    backlog.want_output = want;
+    return 0;
+}
+
+int add_epoll(struct epoll_event_handler *h)
+{
+    return 0;
+}
+
+void add_epoll_idle(struct epoll_idle_handler *h)
+{
+}
+
+int packet_filter_attach(int sock, bool suppress)
+{
+    return 0;
+}
+
+void Dprintf(int level, const char *fmt, ...)
+{
+}
+
+void _ctl_err_log(char *fmt, ...)
+{
+}
+
+int log_level = 0;
+int ctl_in_handler = 0;
+
+static int reset(void **state)
+{
+    memset(&tx, 0, sizeof(tx));
+    memset(&rx, 0, sizeof(rx));
+    memset(&backlog, 0, sizeof(backlog));
+    tx_queue_len = 0;
+    tx_deferred_len = 0;
+    tx_want_output = false;
+    return 0;
+}
+
+static void send_bpdu(int ifindex)
+{
+    unsigned char frame[60] = { 0x01, 0x80, 0xc2, 0x00, 0x00, 0x00 };
+    struct iovec iov = { .iov_base = frame, .iov_len = sizeof(frame) };
+
+    frame[ETH_ALEN] = ifindex;
+    packet_send(ifindex, &iov, 1, sizeof(frame));
+}
+
+/* Put a frame of len bytes (of 0x42) for ifindex at offset off of the block,
+ * return the offset of the next frame */
+static unsigned int put_frame(unsigned char *block, unsigned int off,
+                              int ifindex, unsigned int len)
+{
+    const unsigned int mac = 128;
+    struct tpacket3_hdr *ph = (struct tpacket3_hdr *)(block + off);
+    struct sockaddr_ll *sl;
+
+    sl = (struct sockaddr_ll *)((unsigned char *)ph
+                                + TPACKET_ALIGN(sizeof(*ph)));
+    sl->sll_ifindex = ifindex;
+    ph->tp_mac = mac;
+    ph->tp_snaplen = len;
+    ph->tp_len = len;
+    memset(block + off + mac, 0x42, len);
+    ph->tp_next_offset = TPACKET_ALIGN(mac + len);
+    return off + ph->tp_next_offset;
+}
+
+/* The frames of the filled ring blocks are handed on in place in one batch,
+ * and the blocks go back to the kernel after it */
+void ring_frames_in_place(void **state)
+{
+    struct tpacket_block_desc *bd;
+    unsigned int off;
+
+    rx_ring.block_size = RING_RX_BLOCK_SIZE;
+    rx_ring.nr = 3;
+    rx_ring.idx = 0;
+    rx_ring.map_size = RING_RX_BLOCK_SIZE * rx_ring.nr;
+    rx_ring.map = malloc(rx_ring.map_size);
+    assert_non_null(rx_ring.map);
+    memset(rx_ring.map, 0xff, rx_ring.map_size);
+    rx.ring_start = rx_ring.map;
+    rx.ring_end = rx_ring.map + rx_ring.map_size;
+
+    bd = (struct tpacket_block_desc *)rx_ring.map;
+    bd->hdr.bh1.block_status = TP_STATUS_USER;
+    bd->hdr.bh1.num_pkts = 2;
+    off = bd->hdr.bh1.offset_to_first_pkt = TPACKET_ALIGN(sizeof(*bd));
+    off = put_frame(rx_ring.map, off, 3, 7);
+    put_frame(rx_ring.map, off, 4, 38);
+    bd = (struct tpacket_block_desc *)(rx_ring.map + RING_RX_BLOCK_SIZE);
+    bd->hdr.bh1.block_status = TP_STATUS_USER;
+    bd->hdr.bh1.num_pkts = 1;
+    off = bd->hdr.bh1.offset_to_first_pkt = TPACKET_ALIGN(sizeof(*bd));
+    put_frame((unsigned char *)bd, off, 5, 60);
+    /* the next block is still the kernel's */
+    bd = (struct tpacket_block_desc *)(rx_ring.map + 2 * RING_RX_BLOCK_SIZE);
+    bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+    packet_rcv_ring(EPOLLIN, &packet_event);
+
+    assert_int_equal(rx.batches_begun, 1);
+    assert_int_equal(rx.batches_ended, 1);
+    assert_int_equal(rx.frames, 3);
+    assert_int_equal(rx.ifindex[0], 3);
+    assert_int_equal(rx.len[0], 7);
+    assert_int_equal(rx.ifindex[1], 4);
+    assert_int_equal(rx.len[1], 38);
+    assert_int_equal(rx.ifindex[2], 5);
+    assert_int_equal(rx.len[2], 60);
+    assert_true(rx.blocks_held);
+    bd = (struct tpacket_block_desc *)rx_ring.map;
+    assert_int_equal(bd->hdr.bh1.block_status, TP_STATUS_KERNEL);
+    bd = (struct tpacket_block_desc *)(rx_ring.map + RING_RX_BLOCK_SIZE);
+    assert_int_equal(bd->hdr.bh1.block_status, TP_STATUS_KERNEL);
+    assert_int_equal(rx_ring.idx, 2);
+
+    free(rx_ring.map);
+    rx_ring.map = NULL;
+}
+
+/* The BPDUs of one loop iteration go out in one non-blocking sendmmsg(),
+ * whatever ports they are for */
+void tx_batched_across_ports(void **state)
+{
+    send_bpdu(1);
+    send_bpdu(2);
+    send_bpdu(1);
+    send_bpdu(3);
+    assert_int_equal(tx.calls, 0);
+
+    tx_flush_idle(&tx_flush_handler);
+
+    assert_int_equal(tx.calls, 1);
+    assert_int_equal(tx.vlen[0], 4);
+    assert_true(tx.flags[0] & MSG_DONTWAIT);
+    assert_int_equal(tx.ifindex[0][0], 1);
+    assert_int_equal(tx.ifindex[0][1], 2);
+    assert_int_equal(tx.ifindex[0][2], 1);
+    assert_int_equal(tx.ifindex[0][3], 3);
+    assert_int_equal(tx_queue_len, 0);
+}
+
+/* A full queue is sent right away, before more BPDUs are queued */
+void tx_full_queue(void **state)
+{
+    int i;
+
+    for (i = 0; i < PACKET_TX_BATCH + 1; ++i)
+        send_bpdu(i + 1);
+    assert_int_equal(tx.calls, 1);
+    assert_int_equal(tx.vlen[0], PACKET_TX_BATCH);
+
+    tx_flush_idle(&tx_flush_handler);
+    assert_int_equal(tx.calls, 2);
+    assert_int_equal(tx.vlen[1], 1);
+    assert_int_equal(tx.ifindex[1][0], PACKET_TX_BATCH + 1);
+}
+
+/* When the socket is full, the newest BPDU per port waits for EPOLLOUT */
+void tx_backpressure(void **state)
+{
+    tx.would_block = true;
+    send_bpdu(1);
+    send_bpdu(2);
+    send_bpdu(1);
+    tx_flush_idle(&tx_flush_handler);
+
+    assert_int_equal(tx.calls, 0);
+    assert_int_equal(backlog.deferred, 2);
+    assert_int_equal(backlog.coalesced, 1);
+    assert_int_equal(tx_deferred_len, 2);
+    assert_true(backlog.want_output);
+
+    tx.would_block = false;
+    packet_rcv_ring(EPOLLOUT, &packet_event);
+
+    assert_int_equal(tx.calls, 1);
+    assert_int_equal(tx.vlen[0], 2);
+    assert_int_equal(tx.ifindex[0][0], 1);
+    assert_int_equal(tx.ifindex[0][1], 2);
+    assert_int_equal(tx_deferred_len, 0);
+    assert_false(backlog.want_output);
+    assert_int_equal(rx.batches_begun, 0);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(ring_frames_in_place, reset, NULL),
+        cmocka_unit_test_setup_teardown(tx_batched_across_ports, reset, NULL),
+        cmocka_unit_test_setup_teardown(tx_full_queue, reset, NULL),
+        cmocka_unit_test_setup_teardown(tx_backpressure, reset, NULL),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
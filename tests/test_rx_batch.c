@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "common.h"
+
+static const bpdu_t tcn_bpdu = {
+    .protocolIdentifier = 0x0000,
+    .protocolVersion = protoRSTP,
+    .bpduType = 0x0,
+    .flags = (1 << offsetTc),
+    .MessageAge = { 0x1, 0x0 },
+    .MaxAge = { 0x14, 0x0 },
+    .HelloTime = { 0x2, 0x0 },
+    .ForwardDelay = { 0xf, 0x0 },
+};
+
+/* Ensure that inside of a receive batch the state machines are deferred until
+ * the end of the batch, and that a second BPDU for the same port within one
+ * batch is processed instead of being dropped.
+ */
+void two_bpdus_same_port_in_batch(void **state)
+{
+    port_t *br0p[2], *br1p[2];
+    bridge_t *br0, *br1;
+    CIST_PortStatus port_status;
+    unsigned int num_rx_tcn;
+
+    alloc_bridge_ports(state, &br0, "br0", 0x200000000001, &br0p, 2);
+    alloc_bridge_ports(state, &br1, "br1", 0x200000000002, &br1p, 2);
+
+    link_ports(br0p[0], br1p[0]);
+    link_ports(br0p[1], br1p[1]);
+
+    MSTP_IN_set_bridge_enable(br0, true);
+    MSTP_IN_set_bridge_enable(br1, true);
+
+    set_port_state(br0p[0], true, 1000, true);
+    set_port_state(br0p[1], true, 1000, true);
+
+    for (int i = 0; i < 3; i++)
+        test_one_second(state);
+
+    MSTP_IN_get_cist_port_status(br0p[1], &port_status);
+    assert_false(port_status.rcvdBpdu);
+    num_rx_tcn = port_status.num_rx_tcn;
+
+    MSTP_IN_rx_batch_begin(br0);
+
+    port_rx_bpdu(br0p[1], &tcn_bpdu, RST_BPDU_SIZE);
+    MSTP_IN_get_cist_port_status(br0p[1], &port_status);
+    /* not yet consumed by the Port Receive state machine */
+    assert_true(port_status.rcvdBpdu);
+    assert_uint_equal(port_status.num_rx_tcn, num_rx_tcn + 1);
+
+    port_rx_bpdu(br0p[1], &tcn_bpdu, RST_BPDU_SIZE);
+    MSTP_IN_get_cist_port_status(br0p[1], &port_status);
+    assert_true(port_status.rcvdBpdu);
+    assert_uint_equal(port_status.num_rx_tcn, num_rx_tcn + 2);
+
+    MSTP_IN_rx_batch_end(br0);
+
+    MSTP_IN_get_cist_port_status(br0p[1], &port_status);
+    assert_false(port_status.rcvdBpdu);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(two_bpdus_same_port_in_batch, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "common.h"
+
+/* Bring up a pair of linked bridges and return a BPDU sent by br0 */
+static void setup_pair(void **state, port_t **p0, port_t **p1,
+                       bpdu_t *bpdu, size_t *len)
+{
+    port_t *br0p[1], *br1p[1];
+    bridge_t *br0, *br1;
+    bpdu_t *last;
+    int i;
+
+    alloc_bridge_ports(state, &br0, "br0", 0x200000000001, &br0p, 1);
+    alloc_bridge_ports(state, &br1, "br1", 0x200000000002, &br1p, 1);
+    link_ports(br0p[0], br1p[0]);
+
+    MSTP_IN_set_bridge_enable(br0, true);
+    MSTP_IN_set_bridge_enable(br1, true);
+    set_port_state(br0p[0], true, 1000, true);
+
+    for (i = 0; i < 10; i++)
+        test_one_second(state);
+
+    assert_int_equal(port_last_tx_bpdu(br0p[0], &last, len), 0);
+    memcpy(bpdu, last, *len);
+    *p0 = br0p[0];
+    *p1 = br1p[0];
+}
+
+static void inject(port_t *p, const bpdu_t *bpdu, size_t len, int count)
+{
+    while (count--)
+        port_rx_bpdu(p, bpdu, len);
+}
+
+void rx_rate_drop(void **state)
+{
+    CIST_PortStatus before, after;
+    port_t *p0, *p1;
+    bpdu_t bpdu;
+    size_t len;
+    int i;
+
+    setup_pair(state, &p0, &p1, &bpdu, &len);
+
+    CIST_PortConfig cfg = {
+        .set_bpdu_rx_rate = true,
+        .bpdu_rx_rate = 1,
+        .set_bpdu_rx_burst = true,
+        .bpdu_rx_burst = 3,
+    };
+    assert_int_equal(MSTP_IN_set_cist_port_config(p1, &cfg), 0);
+
+    /* a storm of 10 BPDUs: only the burst gets through */
+    MSTP_IN_get_cist_port_status(p1, &before);
+    inject(p1, &bpdu, len, 10);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 3);
+    assert_int_equal(after.num_rx_rate_limited, 7);
+    assert_false(after.bpdu_rx_rate_error);
+
+    /* the regular hellos stay within the rate once the bucket refills */
+    for (i = 0; i < 10; i++)
+        test_one_second(state);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_rate_limited, 7);
+    assert_int_equal(after.role, roleRoot);
+
+    /* and the burst is available again, once the last hello is paid back */
+    test_advance_ms(1000);
+    MSTP_IN_get_cist_port_status(p1, &before);
+    inject(p1, &bpdu, len, 3);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 3);
+    assert_int_equal(after.num_rx_rate_limited, 7);
+
+    /* no limit */
+    cfg.bpdu_rx_rate = 0;
+    assert_int_equal(MSTP_IN_set_cist_port_config(p1, &cfg), 0);
+    MSTP_IN_get_cist_port_status(p1, &before);
+    inject(p1, &bpdu, len, 100);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 100);
+    assert_int_equal(after.num_rx_rate_limited, 7);
+}
+
+/* The bucket refills with the time between the BPDUs, not once per tick */
+void rx_rate_refill_between_ticks(void **state)
+{
+    CIST_PortStatus before, after;
+    port_t *p0, *p1;
+    bpdu_t bpdu;
+    size_t len;
+
+    setup_pair(state, &p0, &p1, &bpdu, &len);
+
+    CIST_PortConfig cfg = {
+        .set_bpdu_rx_rate = true,
+        .bpdu_rx_rate = 10,
+        .set_bpdu_rx_burst = true,
+        .bpdu_rx_burst = 1,
+    };
+    assert_int_equal(MSTP_IN_set_cist_port_config(p1, &cfg), 0);
+
+    MSTP_IN_get_cist_port_status(p1, &before);
+    inject(p1, &bpdu, len, 2);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 1);
+    assert_int_equal(after.num_rx_rate_limited, 1);
+
+    /* 1/10 s later one more token is there, 1/20 s is not enough */
+    test_advance_ms(50);
+    inject(p1, &bpdu, len, 1);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 1);
+    assert_int_equal(after.num_rx_rate_limited, 2);
+    test_advance_ms(50);
+    inject(p1, &bpdu, len, 1);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 2);
+    assert_int_equal(after.num_rx_rate_limited, 2);
+}
+
+void rx_rate_policies(void **state)
+{
+    CIST_PortStatus before, after;
+    port_t *p0, *p1;
+    bpdu_t bpdu;
+    size_t len;
+
+    setup_pair(state, &p0, &p1, &bpdu, &len);
+
+    CIST_PortConfig cfg = {
+        .set_bpdu_rx_rate = true,
+        .bpdu_rx_rate = 2,
+        .set_bpdu_rx_policy = true,
+        .bpdu_rx_policy = rxLimitAlert,
+    };
+    assert_int_equal(MSTP_IN_set_cist_port_config(p1, &cfg), 0);
+
+    /* alert: everything is processed, the excess is counted */
+    MSTP_IN_get_cist_port_status(p1, &before);
+    inject(p1, &bpdu, len, 5);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 5);
+    assert_int_equal(after.num_rx_rate_limited, 3);
+    assert_false(after.bpdu_rx_rate_error);
+
+    /* errdisable: the port is put into error state on the first excess */
+    cfg.bpdu_rx_policy = rxLimitErrdisable;
+    assert_int_equal(MSTP_IN_set_cist_port_config(p1, &cfg), 0);
+    MSTP_IN_get_cist_port_status(p1, &before);
+    inject(p1, &bpdu, len, 5);
+    MSTP_IN_get_cist_port_status(p1, &after);
+    assert_int_equal(after.num_rx_bpdu - before.num_rx_bpdu, 2);
+    assert_int_equal(after.num_rx_rate_limited, 6);
+    assert_true(after.bpdu_rx_rate_error);
+    assert_int_equal(after.bpdu_rx_policy, rxLimitErrdisable);
+
+    /* out of range values are refused */
+    cfg.bpdu_rx_rate = MAX_BPDU_RX_RATE + 1;
+    assert_int_not_equal(MSTP_IN_set_cist_port_config(p1, &cfg), 0);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(rx_rate_drop, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(rx_rate_refill_between_ticks, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(rx_rate_policies, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
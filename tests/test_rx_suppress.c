@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "common.h"
+
+static void assert_same_port_status(port_t *p1, port_t *p2)
+{
+    CIST_PortStatus s1, s2;
+
+    MSTP_IN_get_cist_port_status(p1, &s1);
+    MSTP_IN_get_cist_port_status(p2, &s2);
+    assert_int_equal(s1.role, s2.role);
+    assert_int_equal(s1.state, s2.state);
+    assert_int_equal(s1.oper_edge_port, s2.oper_edge_port);
+    assert_int_equal(s1.designated_root.u, s2.designated_root.u);
+}
+
+/* Run two identical pairs of bridges, one of them with suppression of the
+ * repeated BPDUs, and ensure they behave the same both while the BPDUs are
+ * suppressed and when the neighbour goes silent and its information has to
+ * age out.
+ */
+void suppressed_repeats_equivalent(void **state)
+{
+    port_t *a0p[1], *a1p[1], *b0p[1], *b1p[1];
+    bridge_t *a0, *a1, *b0, *b1;
+    CIST_PortStatus sa, sb;
+    int i;
+
+    alloc_bridge_ports(state, &a0, "a0", 0x200000000001, &a0p, 1);
+    alloc_bridge_ports(state, &a1, "a1", 0x200000000002, &a1p, 1);
+    alloc_bridge_ports(state, &b0, "b0", 0x200000000001, &b0p, 1);
+    alloc_bridge_ports(state, &b1, "b1", 0x200000000002, &b1p, 1);
+    a0->rx_suppress = a1->rx_suppress = true;
+    /* the refreshed timers must be seen by the scheduler like any other */
+    a0->sm_cross_check = a1->sm_cross_check = true;
+
+    link_ports(a0p[0], a1p[0]);
+    link_ports(b0p[0], b1p[0]);
+
+    MSTP_IN_set_bridge_enable(a0, true);
+    MSTP_IN_set_bridge_enable(a1, true);
+    MSTP_IN_set_bridge_enable(b0, true);
+    MSTP_IN_set_bridge_enable(b1, true);
+
+    set_port_state(a0p[0], true, 1000, true);
+    set_port_state(b0p[0], true, 1000, true);
+
+    for (i = 0; i < 60; i++) {
+        test_one_second(state);
+        assert_same_port_status(a0p[0], b0p[0]);
+        assert_same_port_status(a1p[0], b1p[0]);
+    }
+
+    MSTP_IN_get_cist_port_status(a1p[0], &sa);
+    MSTP_IN_get_cist_port_status(b1p[0], &sb);
+    assert_int_equal(sa.role, roleRoot);
+    assert_true(port_num_rx_suppressed(a1p[0]) > 0);
+    assert_true(sa.num_rx_bpdu < sb.num_rx_bpdu);
+
+    /* neighbour goes silent, its information must age out at the same time */
+    unlink_ports(a0p[0], a1p[0]);
+    unlink_ports(b0p[0], b1p[0]);
+
+    for (i = 0; i < 10; i++) {
+        test_one_second(state);
+        assert_same_port_status(a0p[0], b0p[0]);
+        assert_same_port_status(a1p[0], b1p[0]);
+    }
+
+    MSTP_IN_get_cist_port_status(a1p[0], &sa);
+    assert_int_equal(sa.role, roleDesignated);
+    assert_int_equal(a0->sm_cross_check_errors, 0);
+    assert_int_equal(a1->sm_cross_check_errors, 0);
+}
+
+/* A different BPDU must reach the state machines even while suppressing */
+void changed_bpdu_not_suppressed(void **state)
+{
+    port_t *br0p[1], *br1p[1];
+    bridge_t *br0, *br1;
+    CIST_PortStatus s;
+    int i;
+
+    alloc_bridge_ports(state, &br0, "br0", 0x200000000001, &br0p, 1);
+    alloc_bridge_ports(state, &br1, "br1", 0x200000000002, &br1p, 1);
+    br0->rx_suppress = br1->rx_suppress = true;
+
+    link_ports(br0p[0], br1p[0]);
+
+    MSTP_IN_set_bridge_enable(br0, true);
+    MSTP_IN_set_bridge_enable(br1, true);
+    set_port_state(br0p[0], true, 1000, true);
+
+    for (i = 0; i < 60; i++)
+        test_one_second(state);
+
+    assert_true(br1p[0]->rxSuppress);
+    MSTP_IN_get_cist_port_status(br1p[0], &s);
+    assert_int_equal(s.role, roleRoot);
+
+    /* br1 becomes the root bridge, br0 must learn it from the new BPDU */
+    MSTP_IN_set_msti_bridge_config(GET_CIST_TREE(br1), 0);
+    for (i = 0; i < 3; i++)
+        test_one_second(state);
+
+    MSTP_IN_get_cist_port_status(br0p[0], &s);
+    assert_int_equal(s.role, roleRoot);
+    MSTP_IN_get_cist_port_status(br1p[0], &s);
+    assert_int_equal(s.role, roleDesignated);
+}
+
+static void assert_same_port_timers(port_t *p1, port_t *p2)
+{
+    per_tree_port_t *ptp1, *ptp2;
+
+    assert_int_equal(PRT_TIMER(p1, edgeDelayWhile),
+                     PRT_TIMER(p2, edgeDelayWhile));
+    assert_int_equal(PRT_TIMER(p1, brAssuRcvdInfoWhile),
+                     PRT_TIMER(p2, brAssuRcvdInfoWhile));
+    assert_int_equal(p1->num_rx_bpdu, p2->num_rx_bpdu);
+    assert_int_equal(p1->num_tx_bpdu, p2->num_tx_bpdu);
+
+    ptp2 = list_entry(p2->trees.next, per_tree_port_t, port_list);
+    list_for_each_entry(ptp1, &p1->trees, port_list) {
+        assert_int_equal(ptp1->MSTID, ptp2->MSTID);
+        assert_int_equal(ptp1->role, ptp2->role);
+        assert_int_equal(ptp1->state, ptp2->state);
+        assert_int_equal(ptp1->infoIs, ptp2->infoIs);
+        assert_int_equal(PTP_TIMER(ptp1, rcvdInfoWhile),
+                         PTP_TIMER(ptp2, rcvdInfoWhile));
+        assert_memory_equal(&ptp1->portPriority, &ptp2->portPriority,
+                            sizeof(ptp1->portPriority));
+        ptp2 = list_entry(ptp2->port_list.next, per_tree_port_t, port_list);
+    }
+}
+
+static void setup_region(bridge_t *br)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+
+    assert_int_equal(MSTP_IN_set_cist_bridge_config(br, &cfg), 0);
+    assert_true(MSTP_IN_create_msti(br, 1));
+    assert_true(MSTP_IN_set_fid2mstid(br, 1, 1));
+    assert_true(MSTP_IN_set_vid2fid(br, 10, 1));
+    MSTP_IN_set_mst_config_id(br, 1, (__u8 *)"region");
+}
+
+/* Run two identical pairs of bridges in a region, one of them processing
+ * every repeated BPDU with the state machines, and ensure the fast path of
+ * the other one leaves it in the same state, with the same timers, in the
+ * steady state, on a change and when the information ages out.
+ */
+void fast_path_repeats_equivalent(void **state)
+{
+    port_t *a0p[1], *a1p[1], *b0p[1], *b1p[1];
+    bridge_t *a0, *a1, *b0, *b1;
+    int i;
+
+    alloc_bridge_ports(state, &a0, "a0", 0x200000000001, &a0p, 1);
+    alloc_bridge_ports(state, &a1, "a1", 0x200000000002, &a1p, 1);
+    alloc_bridge_ports(state, &b0, "b0", 0x200000000001, &b0p, 1);
+    alloc_bridge_ports(state, &b1, "b1", 0x200000000002, &b1p, 1);
+    assert_true(a0->rx_fast_path && a1->rx_fast_path);
+    b0->rx_fast_path = b1->rx_fast_path = false;
+    setup_region(a0);
+    setup_region(a1);
+    setup_region(b0);
+    setup_region(b1);
+
+    link_ports(a0p[0], a1p[0]);
+    link_ports(b0p[0], b1p[0]);
+
+    MSTP_IN_set_bridge_enable(a0, true);
+    MSTP_IN_set_bridge_enable(a1, true);
+    MSTP_IN_set_bridge_enable(b0, true);
+    MSTP_IN_set_bridge_enable(b1, true);
+
+    set_port_state(a0p[0], true, 1000, true);
+    set_port_state(b0p[0], true, 1000, true);
+
+    for (i = 0; i < 60; i++) {
+        test_one_second(state);
+        assert_same_port_timers(a0p[0], b0p[0]);
+        assert_same_port_timers(a1p[0], b1p[0]);
+    }
+    assert_true(a1p[0]->num_rx_fast_path > 0);
+    assert_int_equal(b1p[0]->num_rx_fast_path, 0);
+    assert_int_equal(GET_CIST_PTP_FROM_PORT(a1p[0])->role, roleRoot);
+
+    /* a1 becomes the regional root of the MSTI, the new BPDUs must reach
+     * the state machines of both */
+    MSTP_IN_set_msti_bridge_config(find_tree(a1, 1), 0);
+    MSTP_IN_set_msti_bridge_config(find_tree(b1, 1), 0);
+    for (i = 0; i < 30; i++) {
+        test_one_second(state);
+        assert_same_port_timers(a0p[0], b0p[0]);
+        assert_same_port_timers(a1p[0], b1p[0]);
+    }
+    assert_int_equal(find_ptp(a0p[0], 1)->role, roleRoot);
+
+    /* neighbour goes silent, its information must age out at the same time */
+    unlink_ports(a0p[0], a1p[0]);
+    unlink_ports(b0p[0], b1p[0]);
+    for (i = 0; i < 10; i++) {
+        test_one_second(state);
+        assert_same_port_timers(a0p[0], b0p[0]);
+        assert_same_port_timers(a1p[0], b1p[0]);
+    }
+    assert_int_equal(GET_CIST_PTP_FROM_PORT(a1p[0])->role, roleDesignated);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(suppressed_repeats_equivalent, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(changed_bpdu_not_suppressed, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(fast_path_repeats_equivalent, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
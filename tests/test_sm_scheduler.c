@@ -0,0 +1,319 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <stdio.h>
+#include <string.h>
+#include <linux/if_ether.h>
+#include <linux/if_bridge.h>
+#include <asm/byteorder.h>
+
+#include "mstp.h"
+#include "common.h"
+
+/* Two identical networks are built, one of them runs the original full
+ * sweep of all state machines, the full scan in the role selection and the
+ * hand-coded state machines for every received BPDU, the other one the
+ * work-list scheduler, the incremental role selection, the fast path for
+ * repeated BPDUs and the transition tables, which are also
+ * cross-checked with the hand-coded ones on each evaluation.
+ * Both get the same events and must be in the same state after each of them.
+ */
+
+#define NUM_BRIDGES 4
+#define NUM_PORTS   3 /* 0 and 1 make a ring, 2 is an edge port */
+#define NUM_MSTIS   3
+
+typedef struct
+{
+    bridge_t *br[NUM_BRIDGES];
+    port_t *p[NUM_BRIDGES][NUM_PORTS];
+} net_t;
+
+static void build_net(void **state, net_t *net, const char *prefix,
+                      bool legacy, bool region)
+{
+    CIST_BridgeConfig cfg = {
+        .set_protocol_version = true,
+        .protocol_version = protoMSTP,
+    };
+    char name[IFNAMSIZ];
+    port_t *p[NUM_PORTS];
+    int i, j;
+
+    for(i = 0; i < NUM_BRIDGES; i++)
+    {
+        snprintf(name, sizeof(name), "%s%d", prefix, i);
+        assert_int_equal(alloc_bridge_ports(state, &net->br[i], name,
+                                            0x200000000001 + i, &p,
+                                            NUM_PORTS), 0);
+        for(j = 0; j < NUM_PORTS; j++)
+            net->p[i][j] = p[j];
+        net->br[i]->sm_full_sweep = legacy;
+        net->br[i]->roles_full_scan = legacy;
+        net->br[i]->sm_ref_dispatch = legacy;
+        net->br[i]->sm_cross_check = !legacy;
+        net->br[i]->rx_fast_path = !legacy;
+        assert_int_equal(MSTP_IN_set_cist_bridge_config(net->br[i], &cfg), 0);
+
+        for(j = 1; j <= NUM_MSTIS; j++)
+        {
+            assert_true(MSTP_IN_create_msti(net->br[i], j));
+            assert_true(MSTP_IN_set_fid2mstid(net->br[i], j, j));
+            assert_true(MSTP_IN_set_vid2fid(net->br[i], j * 10, j));
+        }
+        if(region)
+            MSTP_IN_set_mst_config_id(net->br[i], 1, (__u8 *)"region");
+    }
+
+    for(i = 0; i < NUM_BRIDGES; i++)
+        link_ports(net->p[i][0], net->p[(i + 1) % NUM_BRIDGES][1]);
+
+    for(i = 0; i < NUM_BRIDGES; i++)
+        MSTP_IN_set_bridge_enable(net->br[i], true);
+    for(i = 0; i < NUM_BRIDGES; i++)
+    {
+        set_port_state(net->p[i][0], true, 1000, true);
+        set_port_state(net->p[i][2], true, 100, true);
+    }
+}
+
+static void assert_same_ptp(per_tree_port_t *a, per_tree_port_t *b)
+{
+    assert_int_equal(a->MSTID, b->MSTID);
+    assert_int_equal(a->state, b->state);
+    assert_int_equal(a->role, b->role);
+    assert_int_equal(a->selectedRole, b->selectedRole);
+    assert_int_equal(a->infoIs, b->infoIs);
+    assert_int_equal(a->PISM_state, b->PISM_state);
+    assert_int_equal(a->PRTSM_state, b->PRTSM_state);
+    assert_int_equal(a->PSTSM_state, b->PSTSM_state);
+    assert_int_equal(a->TCSM_state, b->TCSM_state);
+    assert_int_equal(PTP_TIMER(a, fdWhile), PTP_TIMER(b, fdWhile));
+    assert_int_equal(PTP_TIMER(a, rrWhile), PTP_TIMER(b, rrWhile));
+    assert_int_equal(PTP_TIMER(a, rbWhile), PTP_TIMER(b, rbWhile));
+    assert_int_equal(PTP_TIMER(a, tcWhile), PTP_TIMER(b, tcWhile));
+    assert_int_equal(PTP_TIMER(a, rcvdInfoWhile), PTP_TIMER(b, rcvdInfoWhile));
+    assert_int_equal(PTP_FLAG(a, agreed), PTP_FLAG(b, agreed));
+    assert_int_equal(PTP_FLAG(a, proposing), PTP_FLAG(b, proposing));
+    assert_int_equal(PTP_FLAG(a, synced), PTP_FLAG(b, synced));
+    assert_memory_equal(&a->portPriority, &b->portPriority,
+                        sizeof(a->portPriority));
+    assert_memory_equal(&a->designatedPriority, &b->designatedPriority,
+                        sizeof(a->designatedPriority));
+}
+
+static void assert_same_port(port_t *a, port_t *b)
+{
+    per_tree_port_t *pa, *pb;
+    bpdu_t *ba, *bb;
+    size_t la, lb;
+    int ra, rb;
+
+    assert_int_equal(a->PRSM_state, b->PRSM_state);
+    assert_int_equal(a->PPMSM_state, b->PPMSM_state);
+    assert_int_equal(a->BDSM_state, b->BDSM_state);
+    assert_int_equal(a->PTSM_state, b->PTSM_state);
+    assert_int_equal(PRT_FLAG(a, operEdge), PRT_FLAG(b, operEdge));
+    assert_int_equal(PRT_FLAG(a, sendRSTP), PRT_FLAG(b, sendRSTP));
+    assert_int_equal(PRT_FLAG(a, rcvdBpdu), PRT_FLAG(b, rcvdBpdu));
+    assert_int_equal(a->BaInconsistent, b->BaInconsistent);
+    assert_int_equal(PRT_TIMER(a, helloWhen), PRT_TIMER(b, helloWhen));
+    assert_int_equal(a->txCount, b->txCount);
+    assert_int_equal(a->num_tx_bpdu, b->num_tx_bpdu);
+    assert_int_equal(a->num_rx_bpdu, b->num_rx_bpdu);
+    assert_int_equal(a->num_trans_fwd, b->num_trans_fwd);
+    assert_int_equal(a->num_trans_blk, b->num_trans_blk);
+
+    ra = port_last_tx_bpdu(a, &ba, &la);
+    rb = port_last_tx_bpdu(b, &bb, &lb);
+    assert_int_equal(ra, rb);
+    if(0 == ra)
+    {
+        assert_int_equal(la, lb);
+        assert_memory_equal(ba, bb, la);
+    }
+
+    pb = list_entry(b->trees.next, per_tree_port_t, port_list);
+    list_for_each_entry(pa, &a->trees, port_list)
+    {
+        assert_true(&pb->port_list != &b->trees);
+        assert_same_ptp(pa, pb);
+        pb = list_entry(pb->port_list.next, per_tree_port_t, port_list);
+    }
+}
+
+/* The bitmaps of ports used by allSynced must follow the flags and roles */
+static void assert_port_bits(tree_t *tree)
+{
+    per_tree_port_t *ptp;
+    unsigned int row, word, bit, bits = 8 * sizeof(unsigned long);
+    bool unsettled, unsynced;
+
+    list_for_each_entry(ptp, &tree->ports, tree_list)
+    {
+        row = ptp->port->timer_row;
+        word = row / bits;
+        bit = row % bits;
+        assert_true(word < tree->port_bitmap_words);
+        unsettled = !PTP_FLAG(ptp, selected) || PTP_FLAG(ptp, updtInfo)
+                    || (ptp->role != ptp->selectedRole);
+        unsynced = !PTP_FLAG(ptp, synced);
+        assert_int_equal(unsettled, (tree->unsettled_ports[word] >> bit) & 1);
+        assert_int_equal(unsynced, (tree->unsynced_ports[word] >> bit) & 1);
+    }
+}
+
+static void assert_same_net(net_t *a, net_t *b)
+{
+    tree_t *ta, *tb;
+    int i, j;
+
+    for(i = 0; i < NUM_BRIDGES; i++)
+    {
+        assert_int_equal(b->br[i]->sm_cross_check_errors, 0);
+        tb = list_entry(b->br[i]->trees.next, tree_t, bridge_list);
+        list_for_each_entry(ta, &a->br[i]->trees, bridge_list)
+        {
+            assert_int_equal(ta->PRSSM_state, tb->PRSSM_state);
+            assert_int_equal(ta->rootPortId, tb->rootPortId);
+            assert_memory_equal(&ta->rootPriority, &tb->rootPriority,
+                                sizeof(ta->rootPriority));
+            assert_int_equal(ta->topology_change_count,
+                             tb->topology_change_count);
+            assert_port_bits(ta);
+            assert_port_bits(tb);
+            tb = list_entry(tb->bridge_list.next, tree_t, bridge_list);
+        }
+        for(j = 0; j < NUM_PORTS; j++)
+            assert_same_port(a->p[i][j], b->p[i][j]);
+    }
+}
+
+static void run_seconds(void **state, net_t *a, net_t *b, int seconds)
+{
+    while(seconds--)
+    {
+        test_one_second(state);
+        assert_same_net(a, b);
+    }
+}
+
+/* Apply the same change to both networks and compare them */
+#define BOTH(a, b, expr) do {     \
+        net_t *net = (a);         \
+        expr;                     \
+        net = (b);                \
+        expr;                     \
+        assert_same_net(a, b);    \
+    } while(0)
+
+static void scheduler_equivalent(void **state, bool region)
+{
+    static const bpdu_t tcn_bpdu = {
+        .protocolIdentifier = 0x0000,
+        .protocolVersion = protoRSTP,
+        .bpduType = 0x0,
+        .flags = (1 << offsetTc),
+        .MessageAge = { 0x1, 0x0 },
+        .MaxAge = { 0x14, 0x0 },
+        .HelloTime = { 0x2, 0x0 },
+        .ForwardDelay = { 0xf, 0x0 },
+    };
+    CIST_BridgeConfig bcfg;
+    CIST_PortConfig pcfg;
+    net_t a, b;
+
+    build_net(state, &a, "a", true, region);
+    build_net(state, &b, "b", false, region);
+    assert_same_net(&a, &b);
+
+    run_seconds(state, &a, &b, 40);
+    assert_int_equal(PRT_FLAG(b.p[1][1], rcvdInternal), region);
+
+    /* new CIST root and new MSTI regional root */
+    BOTH(&a, &b, MSTP_IN_set_msti_bridge_config(
+                     GET_CIST_TREE(net->br[2]), 1));
+    BOTH(&a, &b, MSTP_IN_set_msti_bridge_config(
+                     find_tree(net->br[3], 2), 0));
+    run_seconds(state, &a, &b, 40);
+
+    /* link failure with and without loss of carrier */
+    BOTH(&a, &b, set_port_state(net->p[1][0], false, 1000, true));
+    run_seconds(state, &a, &b, 10);
+    BOTH(&a, &b, unlink_ports(net->p[3][0], net->p[0][1]));
+    run_seconds(state, &a, &b, 25);
+    BOTH(&a, &b, link_ports(net->p[3][0], net->p[0][1]));
+    BOTH(&a, &b, set_port_state(net->p[1][0], true, 1000, true));
+    run_seconds(state, &a, &b, 40);
+
+    /* topology change from the edge, then from outside */
+    memset(&pcfg, 0, sizeof(pcfg));
+    pcfg.set_admin_edge_port = true;
+    pcfg.admin_edge_port = false;
+    pcfg.set_auto_edge_port = true;
+    pcfg.auto_edge_port = false;
+    BOTH(&a, &b, MSTP_IN_set_cist_port_config(net->p[0][2], &pcfg));
+    BOTH(&a, &b, set_port_state(net->p[0][2], false, 100, true));
+    BOTH(&a, &b, set_port_state(net->p[0][2], true, 100, true));
+    run_seconds(state, &a, &b, 5);
+    BOTH(&a, &b, port_rx_bpdu(net->p[0][2], &tcn_bpdu, RST_BPDU_SIZE));
+    run_seconds(state, &a, &b, 40);
+
+    /* MSTI port cost change, migration check, STP compatibility */
+    MSTI_PortConfig mcfg = {
+        .set_admin_internal_port_path_cost = true,
+        .admin_internal_port_path_cost = 100000,
+    };
+    BOTH(&a, &b, MSTP_IN_set_msti_port_config(
+                     find_ptp(net->p[2][1], 1), &mcfg));
+    BOTH(&a, &b, MSTP_IN_port_mcheck(net->p[1][1]));
+    run_seconds(state, &a, &b, 10);
+    memset(&bcfg, 0, sizeof(bcfg));
+    bcfg.set_protocol_version = true;
+    bcfg.protocol_version = protoSTP;
+    BOTH(&a, &b, MSTP_IN_set_cist_bridge_config(net->br[1], &bcfg));
+    run_seconds(state, &a, &b, 60);
+    bcfg.protocol_version = protoMSTP;
+    BOTH(&a, &b, MSTP_IN_set_cist_bridge_config(net->br[1], &bcfg));
+    BOTH(&a, &b, MSTP_IN_port_mcheck(net->p[0][0]));
+    BOTH(&a, &b, MSTP_IN_port_mcheck(net->p[2][1]));
+    run_seconds(state, &a, &b, 60);
+
+    /* bridge assurance on one of the links */
+    memset(&pcfg, 0, sizeof(pcfg));
+    pcfg.set_network_port = true;
+    pcfg.network_port = true;
+    BOTH(&a, &b, MSTP_IN_set_cist_port_config(net->p[2][0], &pcfg));
+    run_seconds(state, &a, &b, 10);
+    BOTH(&a, &b, unlink_ports(net->p[2][0], net->p[3][1]));
+    run_seconds(state, &a, &b, 20);
+    BOTH(&a, &b, link_ports(net->p[2][0], net->p[3][1]));
+    run_seconds(state, &a, &b, 20);
+
+    /* MSTI deleted and created again */
+    BOTH(&a, &b, assert_true(MSTP_IN_set_fid2mstid(net->br[0], 3, 0)));
+    BOTH(&a, &b, assert_true(MSTP_IN_delete_msti(net->br[0], 3)));
+    run_seconds(state, &a, &b, 10);
+    BOTH(&a, &b, assert_true(MSTP_IN_create_msti(net->br[0], 3)));
+    BOTH(&a, &b, assert_true(MSTP_IN_set_fid2mstid(net->br[0], 3, 3)));
+    run_seconds(state, &a, &b, 60);
+}
+
+void scheduler_equivalent_region(void **state)
+{
+    scheduler_equivalent(state, true);
+}
+
+void scheduler_equivalent_boundaries(void **state)
+{
+    scheduler_equivalent(state, false);
+}
+
+int main(int argc, char *argv[])
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(scheduler_equivalent_region, prepare_test, teardown_test),
+        cmocka_unit_test_setup_teardown(scheduler_equivalent_boundaries, prepare_test, teardown_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}